@@ -1,51 +1,227 @@
 #pragma once
+#include "event_stream.hpp"
 #include "request.hpp"
 #include "router.hpp"
 #include "server.hpp"
+#include "static_files.hpp"
+#include <memory>
 
 class Application
 {
   public:
     Application(int port) : server(port, router)
     {
+        // Routes registered before run() go out as a single table
+        router.begin_batch();
+        server.watch(hub.watch_fd(), [this]() { hub.handle_wakeup(); });
+        server.at_fork([this]() { hub.reopen(); });
     }
-    
+
     void run()
     {
+        router.end_batch();
         server.run();
     }
 
-    inline void GET(const std::string& route, const RouteHandler& handler)
+    // Serve from worker processes forked by run(), each with its own event loop, see PreforkOptions.
+    // Call before run().
+    inline bool prefork(const PreforkOptions& options = {})
+    {
+        return server.enable_prefork(options);
+    }
+
+    // Counters of every prefork worker, readable from any of them. nullptr without prefork.
+    inline const SharedStats* worker_stats() const
+    {
+        return server.worker_stats();
+    }
+
+    // Drain on SIGTERM and hand the listener to the next process on deploys, see RestartOptions. Call before run().
+    inline void graceful_restart(const RestartOptions& options)
     {
-        router.add_route(Method::GET, route, handler);
+        server.configure_restart(options);
     }
 
-    inline void POST(const std::string& route, const RouteHandler& handler)
+    // Phase timestamps for a sample of requests, see TraceOptions. Call before run().
+    inline void trace(const TraceOptions& options = {})
     {
-        router.add_route(Method::POST, route, handler);
+        server.enable_tracing(options);
+    }
+
+    // The sampled requests as Chrome trace JSON, for a handler to serve
+    inline void write_trace(JsonWriter& json) const
+    {
+        server.write_trace(json);
+    }
+
+    // Backlog, dual-stack and socket tuning for the listener, call before run()
+    inline void listen(const ListenerOptions& options)
+    {
+        server.configure_listener(options);
+    }
+
+    // Answer requests that sat in the event loop's queue too long with a 503 instead of letting latency
+    // grow without bound. RouteOptions::priority decides which routes go first.
+    inline void shed_load(const OverloadOptions& options = {})
+    {
+        server.enable_load_shedding(options);
+    }
+
+    // Low-latency event loop, see ReactorOptions. Call before run().
+    inline void reactor(const ReactorOptions& options)
+    {
+        server.configure_reactor(options);
+    }
+
+    // Event loop counters, read them from handlers (they run on the loop's thread)
+    inline const ReactorStats& reactor_stats() const
+    {
+        return server.stats();
+    }
+
+    // Serve HTTPS instead of plain HTTP, call before run()
+    inline bool enable_tls(const TlsOptions& options)
+    {
+        return server.enable_tls(options);
+    }
+
+    // Request line, header and body size limits, see RequestLimits. Call before run().
+    inline void limit_requests(const RequestLimits& limits)
+    {
+        server.set_request_limits(limits);
+    }
+
+    // Per-client token buckets in front of every route, clients over the rate get a 429
+    inline void rate_limit(const RateLimitOptions& options)
+    {
+        server.enable_rate_limit(options);
+    }
+
+    inline void GET(const std::string& route, RouteHandler handler, RouteOptions options = {})
+    {
+        router.add_route(Method::GET, route, std::move(handler), options);
+    }
+
+    inline void POST(const std::string& route, RouteHandler handler, RouteOptions options = {})
+    {
+        router.add_route(Method::POST, route, std::move(handler), options);
     }
     
-    inline void PUT(const std::string& route, const RouteHandler& handler)
+    inline void PUT(const std::string& route, RouteHandler handler, RouteOptions options = {})
     {
-        router.add_route(Method::PUT, route, handler);
+        router.add_route(Method::PUT, route, std::move(handler), options);
     }
     
-    inline void DELETE(const std::string& route, const RouteHandler& handler)
+    inline void DELETE(const std::string& route, RouteHandler handler, RouteOptions options = {})
     {
-        router.add_route(Method::DELETE, route, handler);
+        router.add_route(Method::DELETE, route, std::move(handler), options);
     }
     
-    inline void PATCH(const std::string& route, const RouteHandler& handler)
+    inline void PATCH(const std::string& route, RouteHandler handler, RouteOptions options = {})
     {
-        router.add_route(Method::PATCH, route, handler);
+        router.add_route(Method::PATCH, route, std::move(handler), options);
     }
     
-    inline void OPTIONS(const std::string& route, const RouteHandler& handler)
+    inline void OPTIONS(const std::string& route, RouteHandler handler, RouteOptions options = {})
+    {
+        router.add_route(Method::OPTIONS, route, std::move(handler), options);
+    }
+
+    // WebSocket endpoint, plain GETs on the route are told to upgrade
+    inline void WS(const std::string& route, WebSocketHandler handler)
+    {
+        RouteOptions options;
+        options.websocket = std::make_shared<const WebSocketHandler>(std::move(handler));
+        router.add_route(Method::GET, route, [](Request&) {
+            auto response = Response::with_status(426, "Upgrade Required");
+            response.header("Upgrade", "websocket");
+            return response;
+        }, std::move(options));
+    }
+
+    // Server-Sent Events endpoint, on_subscribe picks the topics for each new subscriber:
+    //
+    //   app.SSE("/live/:topic", [](Request& req, EventSubscriber& s) { s.subscribe(req.params().at("topic")); });
+    //   app.events().publish("prices", payload);
+    inline void SSE(const std::string& route, InplaceFunction<void(Request&, EventSubscriber&)> on_subscribe,
+                    EventStreamOptions options = {})
+    {
+        RouteOptions route_options;
+        route_options.events = std::make_shared<const EventStreamRoute>(&hub, std::move(on_subscribe), options);
+        router.add_route(Method::GET, route, [](Request& request) {
+            // Event streams only exist on HTTP/1.x connections
+            if (request.header("Accept").find("text/event-stream") != std::string_view::npos)
+            {
+                return Response::with_status(505, "Event streams need HTTP/1.1");
+            }
+            return Response::with_status(406, "Not Acceptable");
+        }, std::move(route_options));
+    }
+
+    // Streaming POST and PUT bodies, multipart and urlencoded ones parsed on the way, see UploadHandler.
+    // Only HTTP/1.x clients stream, HTTP/2 streams on the route get a 505.
+    //
+    //   app.upload("/files", {.on_part = ..., .on_data = ..., .on_end = ...}, {.check_upload = ...});
+    inline void upload(const std::string& route, UploadHandler handler, RouteOptions options = {})
+    {
+        options.upload = std::make_shared<const UploadHandler>(std::move(handler));
+        for (Method method : {Method::POST, Method::PUT})
+        {
+            router.add_route(method, route, [](Request&) { return Response::with_status(505, "Uploads need HTTP/1.1"); },
+                             options);
+        }
+    }
+
+    // Reverse proxy, requests under route are forwarded to the upstreams with pooled keep-alive connections.
+    // Only HTTP/1.x clients are proxied, HTTP/2 streams on the route get a 502.
+    //
+    //   app.proxy("/api/*", {"10.0.0.1:8080", "10.0.0.2:8080"}, {.balance = BalancePolicy::LEAST_CONNECTIONS});
+    inline bool proxy(const std::string& route, const std::vector<std::string>& upstreams, ProxyOptions options = {})
+    {
+        auto proxy_route = std::make_shared<ProxyRoute>(upstreams, std::move(options));
+        if (!proxy_route->valid()) { return false; }
+        server.add_proxy(proxy_route);
+
+        RouteOptions route_options;
+        route_options.proxy = proxy_route;
+        for (Method method : {Method::GET, Method::POST, Method::PUT, Method::DELETE, Method::PATCH, Method::OPTIONS})
+        {
+            // Proxying only happens on HTTP/1.x connections
+            router.add_route(method, route, [](Request&) { return Response::with_status(502, "Proxy routes need HTTP/1.1"); },
+                             route_options);
+        }
+        return true;
+    }
+
+    // Topics for SSE routes, publish() works from any thread
+    inline EventHub& events()
+    {
+        return hub;
+    }
+
+    // Serves files under directory at prefix/*, e.g. static_dir("/assets", "/srv/assets")
+    inline void static_dir(const std::string& prefix, const std::string& directory)
+    {
+        auto files = std::make_shared<StaticFiles>(directory);
+        if (files->watch_fd() != -1)
+        {
+            server.watch(files->watch_fd(), [files]() { files->handle_changes(); });
+            server.at_fork([files]() { files->reopen(); });
+        }
+
+        std::string route = prefix;
+        while (!route.empty() && route.back() == '/') { route.pop_back(); }
+        router.add_route(Method::GET, route + "/*", [files](Request& request) { return files->serve(request); });
+    }
+
+    // Safe to call while the server is running, lookups never wait for route updates
+    inline bool remove_route(Method method, const std::string& route)
     {
-        router.add_route(Method::OPTIONS, route, handler);
+        return router.remove_route(method, route);
     }
 
   private:
     Server server;
     Router router;
+    EventHub hub;
 };
\ No newline at end of file
@@ -1,7 +1,9 @@
 #pragma once
 
-#include <functional>
+#include "handler.hpp"
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 enum class Method
@@ -22,4 +24,74 @@ class Request;
 class Response;
 
 using RouteParams = std::unordered_map<std::string, std::string>;
-using RouteHandler = std::function<Response(Request&)>;
+using RouteHandler = InplaceFunction<Response(Request&)>;
+// Looks at a request's headers before its body is read, returning a response refuses the upload
+using UploadCheck = InplaceFunction<std::optional<Response>(const Request&)>;
+
+// ASCII case-insensitive comparison, header names and most header tokens are case-insensitive
+inline bool iequals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x += 'a' - 'A';
+        if (y >= 'A' && y <= 'Z') y += 'a' - 'A';
+        if (x != y) return false;
+    }
+    return true;
+}
+
+// A field name is a non-empty token (RFC 9110 section 5.1): no whitespace, colon, CTLs or separators
+inline bool is_field_name(std::string_view name)
+{
+    if (name.empty()) return false;
+    for (unsigned char c : name)
+    {
+        if (c <= ' ' || c >= 0x7f) return false;
+        if (std::string_view("\"(),/:;<=>?@[\\]{}").find(static_cast<char>(c)) != std::string_view::npos) return false;
+    }
+    return true;
+}
+
+// CR, LF and NUL are what would end a field line early or start another one
+inline bool is_field_value(std::string_view value)
+{
+    return value.find_first_of(std::string_view("\r\n\0", 3)) == std::string_view::npos;
+}
+
+// Case-insensitive search for token inside a comma separated header value
+inline bool contains_token(std::string_view value, std::string_view token)
+{
+    while (!value.empty())
+    {
+        size_t comma = value.find(',');
+        auto item = value.substr(0, comma);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+        if (iequals(item, token)) return true;
+        if (comma == std::string_view::npos) break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// If-None-Match uses the weak comparison, a W/ prefix on either side doesn't matter
+inline bool etag_matches(std::string_view header, std::string_view etag)
+{
+    if (etag.starts_with("W/")) { etag.remove_prefix(2); }
+
+    while (!header.empty())
+    {
+        size_t comma = header.find(',');
+        auto item = header.substr(0, comma);
+        header = comma == std::string_view::npos ? std::string_view() : header.substr(comma + 1);
+
+        while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+        while (!item.empty() && item.back() == ' ') item.remove_suffix(1);
+        if (item.starts_with("W/")) { item.remove_prefix(2); }
+
+        if (item == "*" || (!etag.empty() && item == etag)) { return true; }
+    }
+    return false;
+}
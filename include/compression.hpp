@@ -0,0 +1,31 @@
+#pragma once
+
+#include "request.hpp"
+#include "response.hpp"
+#include <cstddef>
+#include <string_view>
+
+// Bodies smaller than this usually grow or barely shrink once compressed
+constexpr size_t default_compression_threshold = 1024;
+// Upper bound for the shared cache of compressed bodies, counting the source body each entry keeps to verify hits
+constexpr size_t compression_cache_budget = 32 * 1024 * 1024;
+
+enum class ContentEncoding
+{
+    IDENTITY,
+    GZIP,
+    DEFLATE
+};
+
+// Response body compression negotiated from Accept-Encoding. Every reactor thread reuses its own
+// zlib streams, and compressed bodies are cached by content (hash, then a full compare) so identical responses are only
+// compressed once and then sent straight from the shared cached buffer.
+class Compression
+{
+  public:
+    // Best coding the client accepts, gzip preferred over deflate
+    static ContentEncoding negotiate(std::string_view accept_encoding);
+
+    // Replaces the body with a compressed one when the client, the content type and the size allow it
+    static void apply(const Request& request, Response& response, size_t threshold = default_compression_threshold);
+};
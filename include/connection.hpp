@@ -1,10 +1,23 @@
 #pragma once
 
+#include "event_stream.hpp"
+#include "form.hpp"
+#include "framing.hpp"
+#include "http2.hpp"
+#include "output.hpp"
 #include "request.hpp"
+#include "request_limits.hpp"
+#include "response.hpp"
+#include "tls.hpp"
+#include "trace.hpp"
+#include "websocket.hpp"
+#include <memory>
+#include <cstdint>
+#include <netinet/in.h>
 #include <optional>
 #include <vector>
 
-constexpr size_t max_buffer_size = 1024 * 4;
+constexpr size_t max_buffer_size = 1024 * 16;
 
 class Connection
 {
@@ -12,11 +25,93 @@ class Connection
 
   public:
     Connection();
-    std::optional<Request> handle_request();
+
+    enum class ReceiveResult
+    {
+        // Read until the socket had nothing more
+        DRAINED,
+        // Stopped at the budget, the socket may still hold data
+        BUDGET_SPENT,
+        // The peer closed or the socket failed
+        CLOSED
+    };
+
+    // Reads what the socket has, up to budget bytes. Closes once more than limit bytes would be buffered.
+    ReceiveResult receive(size_t budget, size_t limit);
+
+    // Pops the next complete request (headers plus a Content-Length or chunked body) off the received bytes,
+    // anything after it stays buffered for the next call so pipelined requests work. Chunked bodies are
+    // decoded, the request's body is the data without the framing.
+    // A request over one of the limits leaves its error response in rejection.
+    std::optional<Request> next_request(const RequestLimits& limits);
+
+    // The headers of a request whose body is still being received, parsed on their own
+    Request request_head() const;
 
   private:
+    void reset();
+
+    // Drops buffers an idle connection doesn't need
+    void trim();
+
     int handle = -1;
-    std::vector<char> buffer;
+    // IPv4 peers as mapped addresses
+    in6_addr peer_address = {};
+    // Set on TLS listeners, reads and writes go through it until kTLS takes over sending
+    std::unique_ptr<TlsSession> tls;
     std::vector<char> request_data;
-    bool request_in_progress = false;
-};
\ No newline at end of file
+    // How far we've already searched for the end of the headers
+    size_t header_scan_offset = 0;
+    // Header block and Content-Length of the request being received once its headers are complete, 0 before
+    size_t head_size = 0;
+    size_t body_size = 0;
+    // The body being received is chunked, decoded into request_data right after the head as it comes in
+    bool chunked = false;
+    ChunkedDecoder chunks;
+    // Lower body limit of the route the head was checked against, 0 for RequestLimits::max_body_size
+    size_t body_limit = 0;
+    // The request's headers already went through the route's upload checks
+    bool head_checked = false;
+    // Preserialized error for a request next_request refused
+    std::string_view rejection;
+    // Streaming upload in progress, the body goes to it instead of request_data
+    std::unique_ptr<Upload> upload;
+
+    // Serialized responses waiting for the socket to become writable
+    OutputQueue output;
+    bool close_after_flush = false;
+
+    // Streaming response in progress, requests pipelined behind it wait until it's done
+    std::shared_ptr<StreamProducer> stream;
+    bool stream_chunked = true;
+
+    // Set once the connection speaks HTTP/2, by prior knowledge or after Upgrade: h2c
+    std::unique_ptr<Http2Session> h2;
+    std::unique_ptr<WebSocket> ws;
+    // Set once the connection is a text/event-stream, whatever else the client sends is ignored
+    std::unique_ptr<EventSubscriber> sse;
+    // The request being received was already charged to the rate limiter
+    bool admitted = false;
+    // Upstream connection descriptor while a proxied response is in progress, -1 otherwise
+    int upstream = -1;
+    // Already queued for flushing at the end of the event batch
+    bool woken = false;
+    // Input left for a later turn: unread bytes in the socket, pipelined requests beyond the request budget
+    bool input_pending = false;
+    bool requests_pending = false;
+    // Kept from reading by its own backed up output or response in progress
+    bool stalled = false;
+    // Monotonic microseconds since the input being served has been waiting, for load shedding
+    uint64_t readable_at = 0;
+    // Already on the server's ready list
+    bool ready = false;
+
+    // Phases of the request being received and of the last traced response still being sent, see RequestTracer
+    PhaseTrace trace;
+    PhaseTrace sending;
+    // trace_ticks() at accept while tracing, taken by the connection's first request
+    uint64_t accepted_at = 0;
+
+    // Server tick of the last activity, used to close idle keep-alive connections
+    uint64_t last_active = 0;
+};
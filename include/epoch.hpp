@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+constexpr size_t max_epoch_readers = 64;
+
+// Quiescent-state based reclamation. Readers (reactor threads) register once, announce themselves
+// online when they wake up and offline before they block. Objects retired by writers are freed once
+// every online reader has announced an epoch newer than the one the object was retired in, so readers
+// never take a lock or touch a reference count on the lookup path.
+class EpochDomain
+{
+  public:
+    using Reader = size_t;
+    static constexpr Reader invalid_reader = SIZE_MAX;
+
+    EpochDomain() = default;
+    ~EpochDomain();
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    Reader register_reader();
+    void unregister_reader(Reader reader);
+
+    inline void online(Reader reader)
+    {
+        if (reader == invalid_reader) { return; }
+        slots[reader].epoch.store(global_epoch.load());
+    }
+
+    inline void offline(Reader reader)
+    {
+        if (reader == invalid_reader) { return; }
+        slots[reader].epoch.store(0, std::memory_order_release);
+    }
+
+    // Queue ptr to be passed to deleter once no online reader can still observe it
+    void retire(void* ptr, void (*deleter)(void*));
+
+    // Free whatever is safe to free now, returns false if another thread was already collecting
+    bool collect();
+
+    [[nodiscard]] inline bool has_retired() const
+    {
+        return retired_count.load(std::memory_order_relaxed) != 0;
+    }
+
+  private:
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> epoch = 0;
+        std::atomic<bool> in_use = false;
+    };
+
+    struct Retired
+    {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    std::atomic<uint64_t> global_epoch = 1;
+    std::array<Slot, max_epoch_readers> slots;
+
+    std::mutex retired_mutex;
+    std::vector<Retired> retired;
+    std::atomic<size_t> retired_count = 0;
+};
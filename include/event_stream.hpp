@@ -0,0 +1,152 @@
+#pragma once
+
+#include "common.hpp"
+#include "handler.hpp"
+#include "output.hpp"
+#include "request.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Subscribers with more than this waiting for the socket count as slow
+constexpr size_t event_stream_max_queued_bytes = 1024 * 1024;
+// Seconds without an event before a subscriber gets a comment line, so proxies don't time it out
+constexpr uint64_t event_stream_keep_alive = 15;
+
+enum class SlowSubscriberPolicy
+{
+    // Skip events for the subscriber until it catches up
+    DROP,
+    // Close the subscriber's connection, the browser reconnects with Last-Event-ID
+    DISCONNECT
+};
+
+struct EventStreamOptions
+{
+    SlowSubscriberPolicy slow_policy = SlowSubscriberPolicy::DROP;
+    size_t max_queued_bytes = event_stream_max_queued_bytes;
+    // Reconnection delay sent to the client, 0 keeps the browser default
+    uint32_t retry_ms = 0;
+};
+
+class EventHub;
+class EventSubscriber;
+
+// What Application::SSE attaches to a route
+struct EventStreamRoute
+{
+    EventHub* hub = nullptr;
+    InplaceFunction<void(Request&, EventSubscriber&)> on_subscribe = {};
+    EventStreamOptions options = {};
+};
+
+// One text/event-stream connection. Subscribers live as long as their connection and leave
+// all of their topics when it closes.
+class EventSubscriber
+{
+    friend class Server;
+    friend class EventHub;
+
+  public:
+    using Wake = InplaceFunction<void()>;
+
+    ~EventSubscriber();
+
+    EventSubscriber(const EventSubscriber&) = delete;
+    EventSubscriber& operator=(const EventSubscriber&) = delete;
+
+    void subscribe(std::string_view topic);
+    void unsubscribe(std::string_view topic);
+
+    // Sends an event to this subscriber only, same slow subscriber rules as published ones
+    bool send(std::string_view data, std::string_view event = {}, std::string_view id = {});
+
+    [[nodiscard]] inline const RouteParams& params() const
+    {
+        return _params;
+    }
+
+    // Events skipped because the client wasn't keeping up
+    [[nodiscard]] inline uint64_t dropped() const
+    {
+        return _dropped;
+    }
+
+  private:
+    EventSubscriber(OutputQueue& out, std::shared_ptr<const EventStreamRoute> route, RouteParams params, Wake wake);
+
+    // Queues a formatted event without copying it, false when it was dropped
+    bool deliver(const std::shared_ptr<const std::string>& event);
+
+    // Sends the keep-alive comment, false once the subscriber should be disconnected
+    bool tick(uint64_t now);
+
+    OutputQueue& out;
+    std::shared_ptr<const EventStreamRoute> route;
+    RouteParams _params;
+    Wake wake;
+
+    // Topics and our position in each topic's subscriber list
+    std::vector<std::pair<std::string, size_t>> topics;
+
+    uint64_t last_sent = 0;
+    // Something went out since the last tick
+    bool sent = false;
+    uint64_t _dropped = 0;
+    // Fell too far behind under SlowSubscriberPolicy::DISCONNECT
+    bool overrun = false;
+};
+
+// Topic channels for Server-Sent Events. A published event is formatted once into an immutable
+// buffer that every subscriber's output queue references, so fan-out costs one queue entry per
+// subscriber no matter how large the event is.
+class EventHub
+{
+    friend class EventSubscriber;
+
+  public:
+    EventHub();
+    ~EventHub();
+
+    EventHub(const EventHub&) = delete;
+    EventHub& operator=(const EventHub&) = delete;
+
+    // Safe from any thread, delivery happens on the event loop
+    void publish(std::string_view topic, std::string_view data, std::string_view event = {}, std::string_view id = {});
+
+    // Event loop only
+    [[nodiscard]] size_t subscribers(std::string_view topic) const;
+
+    // Readable when published events are waiting to be delivered
+    [[nodiscard]] inline int watch_fd() const
+    {
+        return event_fd;
+    }
+
+    void handle_wakeup();
+
+    // Fresh eventfd under the same descriptor number, for a forked worker. Processes sharing
+    // one would consume each other's wakeups.
+    void reopen();
+
+    // Wire format of one event, multi-line data becomes several data: fields
+    static std::shared_ptr<const std::string> format(std::string_view data, std::string_view event = {},
+                                                     std::string_view id = {});
+
+  private:
+    size_t add(const std::string& topic, EventSubscriber* subscriber);
+    void remove(const std::string& topic, size_t index);
+
+    int event_fd = -1;
+
+    std::mutex mutex;
+    std::vector<std::pair<std::string, std::shared_ptr<const std::string>>> pending;
+
+    std::unordered_map<std::string, std::vector<EventSubscriber*>> topics;
+};
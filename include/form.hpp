@@ -0,0 +1,187 @@
+#pragma once
+
+#include "common.hpp"
+#include "handler.hpp"
+#include "request.hpp"
+#include "response.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Largest header block of a single multipart part, bigger ones fail the parse
+constexpr size_t max_part_header_size = 16 * 1024;
+
+// One multipart/form-data part or urlencoded field, reported before its body
+struct FormPart
+{
+    // From Content-Disposition (or the urlencoded field name)
+    std::string name;
+    // Set for file fields
+    std::string filename;
+    std::string content_type;
+    // Every header field of a multipart part, as sent
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    // Empty when the part doesn't have the field
+    [[nodiscard]] std::string_view header(std::string_view field) const;
+};
+
+// What the body parsers report, in order: a part, its body in any number of pieces, the next part and so on.
+// Either callback returning false stops the parse.
+struct FormEvents
+{
+    InplaceFunction<bool(const FormPart&)> on_part = {};
+    InplaceFunction<bool(std::string_view data)> on_data = {};
+};
+
+// Boyer-Moore-Horspool search for one fixed pattern, the skip table is built once
+class PatternSearch
+{
+  public:
+    explicit PatternSearch(std::string pattern);
+
+    // Offset of the first match in text, npos when there is none
+    [[nodiscard]] size_t find(std::string_view text) const;
+
+    [[nodiscard]] inline const std::string& pattern() const
+    {
+        return _pattern;
+    }
+
+  private:
+    std::string _pattern;
+    std::array<uint8_t, 256> skip;
+};
+
+// Incremental multipart/form-data parser. The body can come in chunks of any size, part bodies are
+// passed on as they arrive and only a delimiter's worth of bytes (or a part's headers) is ever held back.
+class MultipartParser
+{
+  public:
+    explicit MultipartParser(std::string_view boundary);
+
+    // Parses the next chunk of the body, false once it's malformed or a callback stopped it
+    bool feed(std::string_view chunk, const FormEvents& events);
+
+    // The closing delimiter went by, anything after it is ignored
+    [[nodiscard]] inline bool complete() const
+    {
+        return state == State::DONE;
+    }
+
+  private:
+    enum class State
+    {
+        PREAMBLE,
+        // Between a delimiter and its line break, "--" here closes the body
+        DELIMITER_LINE,
+        HEADERS,
+        BODY,
+        DONE,
+        FAILED
+    };
+
+    // Finds the next delimiter in carry and chunk, passing the bytes before it on when emit is set.
+    // True when a delimiter was consumed.
+    bool scan(std::string_view& chunk, bool emit, const FormEvents& events);
+    bool parse_headers(std::string_view& chunk, const FormEvents& events);
+
+    State state = State::PREAMBLE;
+    // "\r\n--boundary"
+    PatternSearch delimiter;
+    // Tail of the previous chunk that may be the start of a delimiter, or a part's unfinished header block
+    std::string carry;
+    // Dashes seen on the delimiter line
+    int dashes = 0;
+};
+
+// Incremental application/x-www-form-urlencoded parser. Each field is reported as a part named after
+// it with its decoded value as the body, values are passed on as they arrive.
+class UrlencodedParser
+{
+  public:
+    bool feed(std::string_view chunk, const FormEvents& events);
+
+    // Reports a final field without a value, false when the body ended inside a field name or an escape
+    bool finish(const FormEvents& events);
+
+  private:
+    bool end_name(const FormEvents& events);
+
+    bool in_value = false;
+    bool failed = false;
+    std::string name;
+    // Percent escape in progress: digits seen so far and their value
+    int escape_digits = -1;
+    uint8_t escape_value = 0;
+};
+
+// Parameter of a header value like multipart/form-data; boundary="xyz", without quotes. Empty when missing.
+std::string_view header_parameter(std::string_view value, std::string_view parameter);
+
+class Upload;
+
+// Callbacks for a streaming upload route, the body is handed over as it arrives instead of being buffered:
+//
+//   app.upload("/files", {.on_part = [](Upload& upload, const FormPart& part) { ... open a file ... },
+//                         .on_data = [](Upload& upload, std::string_view data) { ... write ... },
+//                         .on_end = [](Upload&) { return Response::ok("Stored"); }});
+//
+// multipart/form-data bodies come part by part, urlencoded ones field by field and anything else as one
+// part without a name. All of them run on the reactor thread.
+struct UploadHandler
+{
+    // Next part, false refuses the upload with a 400
+    InplaceFunction<bool(Upload&, const FormPart&)> on_part = {};
+    // Next piece of the current part's body, false refuses the upload with a 400
+    InplaceFunction<bool(Upload&, std::string_view data)> on_data = {};
+    // The whole body went through, the response to send
+    InplaceFunction<Response(Upload&)> on_end = {};
+    // The upload ended early: the client went away, the body was malformed or a callback refused it.
+    // Partially written files get cleaned up here.
+    InplaceFunction<void(Upload&)> on_abort = {};
+};
+
+// Streaming request body in progress on a connection
+class Upload
+{
+    friend class Server;
+
+  public:
+    Upload(Request&& request, std::shared_ptr<const UploadHandler> handler);
+    Upload(const Upload&) = delete;
+    Upload& operator=(const Upload&) = delete;
+
+    // The request's headers and route params, its body is what the callbacks get
+    [[nodiscard]] inline const Request& request() const
+    {
+        return _request;
+    }
+
+    // Handler owned per-upload state
+    std::shared_ptr<void> user_data;
+
+  private:
+    // Hands the next body bytes to the parser, false once the upload failed
+    bool feed(std::string_view data);
+    // Whole body received: the handler's response, a 400 when the body was incomplete
+    Response finish();
+    // Tells the handler the upload won't finish, once
+    void abort();
+
+    Request _request;
+    std::shared_ptr<const UploadHandler> handler;
+    FormEvents events;
+    std::optional<MultipartParser> multipart;
+    std::optional<UrlencodedParser> urlencoded;
+    // Body bytes still to come
+    size_t remaining = 0;
+    bool failed = false;
+    bool aborted = false;
+};
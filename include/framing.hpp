@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// How an HTTP/1.x request's body is delimited, read off its header block (RFC 9112 section 6). Anything
+// two parties could disagree on is refused, so a proxy in front can't be made to see different request
+// boundaries than we do.
+struct RequestFraming
+{
+    size_t content_length = 0;
+    bool chunked = false;
+    // Preserialized error response when the framing is refused: 400 for Content-Length together with
+    // Transfer-Encoding, repeated or malformed Content-Length, or chunked not the final coding, 501 for
+    // codings other than chunked, 413 for a Content-Length that doesn't fit
+    std::string_view rejection = {};
+};
+
+RequestFraming request_framing(std::string_view head);
+
+// Decodes a chunked body in place: the data of each chunk is moved down to right after the body decoded
+// so far, so buffer ends up holding the head, the decoded body, then whatever followed the request.
+class ChunkedDecoder
+{
+  public:
+    enum class Result
+    {
+        INCOMPLETE,
+        DONE,
+        INVALID,
+        TOO_LARGE
+    };
+
+    // Decodes what buffer holds from the last call on, body_start is where the body begins (the head's
+    // size). More than limit bytes of decoded body is TOO_LARGE.
+    Result decode(std::vector<char>& buffer, size_t body_start, size_t limit);
+
+    // Decoded bytes so far, they sit at [body_start, body_start + decoded())
+    [[nodiscard]] inline size_t decoded() const
+    {
+        return body_size;
+    }
+
+    // Where the undecoded input starts, after DONE the end of the request
+    [[nodiscard]] inline size_t input_end() const
+    {
+        return offset;
+    }
+
+    void reset();
+
+  private:
+    enum class State
+    {
+        SIZE,
+        DATA,
+        DATA_END,
+        TRAILER
+    };
+
+    State state = State::SIZE;
+    size_t body_size = 0;
+    // 0 until the first call, relative to the start of buffer afterwards
+    size_t offset = 0;
+    uint64_t remaining = 0;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature, size_t Capacity = 48>
+class InplaceFunction;
+
+// Move-only callable with inline storage for small captures. Unlike std::function it never
+// copies the target, and a call is a single indirect jump through the invoker pointer.
+// Targets bigger than Capacity fall back to one heap allocation made at construction time.
+template <typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity>
+{
+  public:
+    InplaceFunction() = default;
+
+    template <typename F>
+        requires(!std::is_same_v<std::decay_t<F>, InplaceFunction> && std::is_invocable_r_v<R, std::decay_t<F>&, Args...>)
+    InplaceFunction(F&& f)
+    {
+        using T = std::decay_t<F>;
+
+        if constexpr (fits_inline<T>)
+        {
+            new (storage) T(std::forward<F>(f));
+            invoker = [](void* target, Args&&... args) -> R {
+                return (*static_cast<T*>(target))(std::forward<Args>(args)...);
+            };
+            manager = [](Operation op, void* dst, void* src) {
+                if (op == Operation::MOVE) { new (dst) T(std::move(*static_cast<T*>(src))); }
+                static_cast<T*>(src)->~T();
+            };
+        }
+        else
+        {
+            *reinterpret_cast<T**>(storage) = new T(std::forward<F>(f));
+            invoker = [](void* target, Args&&... args) -> R {
+                return (**static_cast<T**>(target))(std::forward<Args>(args)...);
+            };
+            manager = [](Operation op, void* dst, void* src) {
+                if (op == Operation::MOVE) { *static_cast<T**>(dst) = *static_cast<T**>(src); }
+                else { delete *static_cast<T**>(src); }
+            };
+        }
+    }
+
+    InplaceFunction(InplaceFunction&& other) noexcept
+    {
+        move_from(other);
+    }
+
+    InplaceFunction& operator=(InplaceFunction&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+
+    InplaceFunction(const InplaceFunction&) = delete;
+    InplaceFunction& operator=(const InplaceFunction&) = delete;
+
+    ~InplaceFunction()
+    {
+        reset();
+    }
+
+    R operator()(Args... args) const
+    {
+        return invoker(storage, std::forward<Args>(args)...);
+    }
+
+    [[nodiscard]] inline explicit operator bool() const
+    {
+        return invoker != nullptr;
+    }
+
+  private:
+    enum class Operation
+    {
+        MOVE,
+        DESTROY
+    };
+
+    template <typename T>
+    static constexpr bool fits_inline = sizeof(T) <= Capacity && alignof(T) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible_v<T>;
+
+    void move_from(InplaceFunction& other)
+    {
+        if (!other.invoker) { return; }
+        other.manager(Operation::MOVE, storage, other.storage);
+        invoker = other.invoker;
+        manager = other.manager;
+        other.invoker = nullptr;
+        other.manager = nullptr;
+    }
+
+    void reset()
+    {
+        if (manager) { manager(Operation::DESTROY, nullptr, storage); }
+        invoker = nullptr;
+        manager = nullptr;
+    }
+
+    static_assert(Capacity >= sizeof(void*), "InplaceFunction needs room for at least a pointer");
+
+    R (*invoker)(void*, Args&&...) = nullptr;
+    void (*manager)(Operation, void*, void*) = nullptr;
+    alignas(std::max_align_t) mutable std::byte storage[Capacity];
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// XXH64, fast non-cryptographic hash for content addressing (compression cache, ETags)
+namespace xxh64_detail
+{
+
+constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t rotl(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t read64(const char* ptr)
+{
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+inline uint32_t read32(const char* ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t value)
+{
+    acc ^= round(0, value);
+    return acc * prime1 + prime4;
+}
+
+} // namespace xxh64_detail
+
+inline uint64_t xxh64(std::string_view data, uint64_t seed = 0)
+{
+    using namespace xxh64_detail;
+
+    const char* ptr = data.data();
+    const char* end = ptr + data.size();
+    uint64_t hash;
+
+    if (data.size() >= 32)
+    {
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+
+        const char* limit = end - 32;
+        do
+        {
+            v1 = round(v1, read64(ptr));
+            v2 = round(v2, read64(ptr + 8));
+            v3 = round(v3, read64(ptr + 16));
+            v4 = round(v4, read64(ptr + 24));
+            ptr += 32;
+        } while (ptr <= limit);
+
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        hash = merge_round(hash, v1);
+        hash = merge_round(hash, v2);
+        hash = merge_round(hash, v3);
+        hash = merge_round(hash, v4);
+    }
+    else { hash = seed + prime5; }
+
+    hash += data.size();
+
+    while (ptr + 8 <= end)
+    {
+        hash ^= round(0, read64(ptr));
+        hash = rotl(hash, 27) * prime1 + prime4;
+        ptr += 8;
+    }
+
+    if (ptr + 4 <= end)
+    {
+        hash ^= static_cast<uint64_t>(read32(ptr)) * prime1;
+        hash = rotl(hash, 23) * prime2 + prime3;
+        ptr += 4;
+    }
+
+    while (ptr < end)
+    {
+        hash ^= static_cast<uint64_t>(static_cast<unsigned char>(*ptr)) * prime5;
+        hash = rotl(hash, 11) * prime1;
+        ptr++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
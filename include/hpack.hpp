@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// HPACK (RFC 7541) header compression for HTTP/2
+
+constexpr size_t hpack_default_table_size = 4096;
+
+struct HeaderField
+{
+    std::string name;
+    std::string value;
+};
+
+using HeaderList = std::vector<HeaderField>;
+
+namespace huffman
+{
+
+// Canonical HPACK Huffman code, the encoder only uses it when the result is shorter
+size_t encoded_length(std::string_view input);
+void encode(std::string_view input, std::string& out);
+
+// Returns false for invalid padding or an encoded EOS symbol
+bool decode(std::string_view input, std::string& out);
+
+} // namespace huffman
+
+// The table shared by an encoder/decoder pair, newest entry first. Every entry costs its name and
+// value length plus 32 bytes of accounting overhead, the oldest ones are evicted past max_size.
+class HpackTable
+{
+  public:
+    void add(std::string_view name, std::string_view value);
+    void set_max_size(size_t size);
+
+    // 1-based combined index space, 1..61 is the static table and the dynamic table follows
+    [[nodiscard]] const HeaderField* get(size_t index) const;
+
+    // Best index for name/value, 0 when nothing matches; value_match tells whether the value matched too
+    [[nodiscard]] size_t find(std::string_view name, std::string_view value, bool& value_match) const;
+
+    [[nodiscard]] inline size_t max_size() const
+    {
+        return _max_size;
+    }
+
+  private:
+    void evict();
+
+    std::deque<HeaderField> entries;
+    size_t size = 0;
+    size_t _max_size = hpack_default_table_size;
+};
+
+class HpackDecoder
+{
+  public:
+    enum class Result
+    {
+        OK,
+        // COMPRESSION_ERROR, the connection has to go
+        INVALID,
+        // Decoded fields would pass the header list limit, decoding stopped so the table is out of sync too
+        TOO_LARGE
+    };
+
+    // Decodes a complete header block. Every field counts its name and value length plus 32 bytes against
+    // max_header_list_size, checked before it's copied: one indexed byte can stand for a whole table entry.
+    Result decode(std::string_view block, HeaderList& headers);
+
+    // Our SETTINGS_MAX_HEADER_LIST_SIZE
+    inline void set_max_header_list_size(size_t size)
+    {
+        max_header_list_size = size;
+    }
+
+    // Upper bound the peer's table size updates have to respect (our SETTINGS_HEADER_TABLE_SIZE)
+    inline void set_max_allowed_size(size_t size)
+    {
+        max_allowed_size = size;
+    }
+
+  private:
+    HpackTable table;
+    size_t max_allowed_size = hpack_default_table_size;
+    size_t max_header_list_size = SIZE_MAX;
+};
+
+class HpackEncoder
+{
+  public:
+    // Appends one field to a header block being built in out
+    void encode(std::string_view name, std::string_view value, std::string& out);
+
+    // Applies the peer's SETTINGS_HEADER_TABLE_SIZE, announced at the start of the next block
+    void set_max_table_size(size_t size);
+
+    // Must open every header block, it emits pending table size updates
+    void begin_block(std::string& out);
+
+  private:
+    HpackTable table;
+    size_t pending_table_size = SIZE_MAX;
+};
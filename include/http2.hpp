@@ -0,0 +1,118 @@
+#pragma once
+
+#include "handler.hpp"
+#include "hpack.hpp"
+#include "output.hpp"
+#include "request.hpp"
+#include "response.hpp"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Client connection preface, sent before its first frame
+constexpr std::string_view http2_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+constexpr uint32_t http2_max_concurrent_streams = 256;
+constexpr uint32_t http2_default_window = 65535;
+constexpr uint32_t http2_default_max_frame_size = 16384;
+constexpr size_t http2_max_body_size = 4 * 1024 * 1024;
+// Decoded header fields of one request (advertised as SETTINGS_MAX_HEADER_LIST_SIZE) and the HPACK block
+// carrying them across HEADERS and CONTINUATION frames. Past either the connection gets ENHANCE_YOUR_CALM.
+constexpr size_t http2_max_header_list_size = 64 * 1024;
+constexpr size_t http2_max_header_block_size = 64 * 1024;
+
+// Server side of an HTTP/2 cleartext connection (h2c, RFC 9113): frame parsing, HPACK, flow control and
+// stream multiplexing. Every complete request stream is dispatched like an HTTP/1.x request, responses
+// are framed into the connection's OutputQueue and interleaved across streams as the peer's windows allow.
+class Http2Session
+{
+  public:
+    // Runs a request through the router, returns a cached response or fills response
+    using Dispatch = InplaceFunction<std::shared_ptr<const Response>(Request&, Response&)>;
+
+    Http2Session(OutputQueue& out, Dispatch dispatch);
+
+    // Connection started with the client preface (prior knowledge)
+    void start();
+
+    // Connection upgraded from HTTP/1.1, request becomes stream 1 and settings is the HTTP2-Settings header
+    bool start_upgraded(Request& request, std::string_view settings);
+
+    // Consumes complete frames in data, false once the connection has failed and should close. Each
+    // request dispatched takes one from budget, once it's spent the remaining frames are left in data.
+    bool receive(std::vector<char>& data, size_t& budget);
+
+    // Frames pending response bodies while windows allow and output stays under high_water,
+    // returns true when anything was written
+    bool pump(size_t high_water);
+
+    // Peer sent GOAWAY or we did, and nothing is left in flight
+    [[nodiscard]] bool finished() const;
+
+    // GOAWAY without an error, streams already open are answered and new ones refused
+    void shutdown();
+
+  private:
+    struct Stream
+    {
+        HeaderList headers;
+        std::vector<char> body;
+        bool request_complete = false;
+        bool response_started = false;
+        bool response_complete = false;
+        int64_t send_window = 0;
+
+        // Response body not framed yet, producers refill it on demand
+        OutputQueue pending;
+        std::shared_ptr<StreamProducer> producer;
+    };
+
+    bool handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+    bool handle_headers(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    bool handle_header_block(uint32_t stream_id, bool end_stream);
+    bool handle_data(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    bool handle_settings(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    bool handle_window_update(uint32_t stream_id, std::string_view payload);
+
+    bool apply_settings(std::string_view payload);
+    void dispatch_stream(uint32_t stream_id, Stream& stream);
+    void respond(uint32_t stream_id, Stream& stream, Request& request);
+    void send_response(uint32_t stream_id, Stream& stream, const Response& response);
+    bool pump_stream(uint32_t stream_id, Stream& stream);
+
+    void write_frame_header(size_t length, uint8_t type, uint8_t flags, uint32_t stream_id);
+    void send_settings();
+    void send_window_update(uint32_t stream_id, uint32_t increment);
+    void send_rst_stream(uint32_t stream_id, uint32_t error);
+    bool connection_error(uint32_t error);
+
+    OutputQueue& out;
+    Dispatch dispatch;
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+
+    std::map<uint32_t, Stream> streams;
+    uint32_t last_stream_id = 0;
+    // Requests dispatched by the current receive() call
+    size_t dispatched = 0;
+
+    bool preface_received = false;
+    bool settings_received = false;
+    bool going_away = false;
+    bool failed = false;
+
+    // Header block split over HEADERS and CONTINUATION frames
+    std::string header_block;
+    uint32_t continuation_stream = 0;
+    bool continuation_end_stream = false;
+
+    int64_t connection_send_window = http2_default_window;
+    uint32_t peer_initial_window = http2_default_window;
+    uint32_t peer_max_frame_size = http2_default_max_frame_size;
+
+    // Where the next pump() round starts, so one busy stream can't starve the others
+    uint32_t next_stream = 0;
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <ctime>
+#include <string_view>
+
+// Length of an RFC 7231 IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+constexpr size_t http_date_length = 29;
+
+// Each reactor thread keeps a preserialized "Server: ...\r\nDate: ...\r\n" block that its
+// timer tick refreshes once per second, so responses only ever memcpy the Date header.
+class HttpDate
+{
+  public:
+    // Re-render the calling thread's cached block if the second changed
+    static void refresh();
+
+    // Server and Date header lines for the calling thread
+    static std::string_view common_headers();
+
+    // Writes exactly http_date_length characters, without going through strftime/locales
+    static void format(time_t time, char* out);
+
+    // Parses an IMF-fixdate, the only format we ever send, so conditional requests echoing it work
+    static bool parse(std::string_view text, time_t& out);
+};
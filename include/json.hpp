@@ -0,0 +1,151 @@
+#pragma once
+
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Streaming JSON serializer writing straight into an output buffer, see Response::json:
+//
+//   writer.begin_object().field("id", 42).key("tags").begin_array().value("a").value("b").end_array().end_object();
+//
+// Commas are placed automatically. Strings are escaped, numbers are formatted with to_chars and
+// non-finite doubles come out as null. The writer doesn't check that objects alternate keys and values.
+class JsonWriter
+{
+  public:
+    explicit JsonWriter(std::vector<char>& out) : out(out), start(out.size()), used(out.size())
+    {
+    }
+
+    // The buffer is grown ahead of the writes, this trims it to what was written
+    ~JsonWriter()
+    {
+        out.resize(used);
+    }
+
+    JsonWriter(const JsonWriter&) = delete;
+    JsonWriter& operator=(const JsonWriter&) = delete;
+
+    inline JsonWriter& begin_object()
+    {
+        separate();
+        put('{');
+        return *this;
+    }
+
+    inline JsonWriter& end_object()
+    {
+        put('}');
+        return *this;
+    }
+
+    inline JsonWriter& begin_array()
+    {
+        separate();
+        put('[');
+        return *this;
+    }
+
+    inline JsonWriter& end_array()
+    {
+        put(']');
+        return *this;
+    }
+
+    // Member name, the next call writes its value
+    inline JsonWriter& key(std::string_view name)
+    {
+        separate();
+        write_string(name);
+        put(':');
+        return *this;
+    }
+
+    inline JsonWriter& value(std::string_view text)
+    {
+        separate();
+        write_string(text);
+        return *this;
+    }
+
+    inline JsonWriter& value(const char* text)
+    {
+        return value(std::string_view(text));
+    }
+
+    inline JsonWriter& value(bool flag)
+    {
+        return raw(flag ? "true" : "false");
+    }
+
+    inline JsonWriter& value(std::nullptr_t)
+    {
+        return raw("null");
+    }
+
+    JsonWriter& value(double number);
+
+    template <std::integral T>
+        requires(!std::same_as<T, bool>)
+    JsonWriter& value(T number)
+    {
+        separate();
+        char* at = reserve(24);
+        used = std::to_chars(at, at + 24, number).ptr - out.data();
+        return *this;
+    }
+
+    // Already serialized JSON, written as is
+    inline JsonWriter& raw(std::string_view json)
+    {
+        separate();
+        memcpy(reserve(json.size()), json.data(), json.size());
+        used += json.size();
+        return *this;
+    }
+
+    template <typename T>
+    inline JsonWriter& field(std::string_view name, const T& member)
+    {
+        return key(name).value(member);
+    }
+
+    // Bytes written so far
+    [[nodiscard]] inline size_t size() const
+    {
+        return used - start;
+    }
+
+  private:
+    // Comma in front of anything that isn't the first element of its container or a member's value
+    inline void separate()
+    {
+        if (used == start) { return; }
+        char last = out[used - 1];
+        if (last != '[' && last != '{' && last != ':') { put(','); }
+    }
+
+    // Room for length more bytes at the write position
+    inline char* reserve(size_t length)
+    {
+        if (out.size() - used < length) { grow(length); }
+        return out.data() + used;
+    }
+
+    inline void put(char c)
+    {
+        *reserve(1) = c;
+        used++;
+    }
+
+    void grow(size_t length);
+    void write_string(std::string_view text);
+
+    std::vector<char>& out;
+    size_t start;
+    // End of what's been written, out is sized past it
+    size_t used;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+
+// Listening socket setup, set through Application::listen before run():
+//
+//   app.listen({.defer_accept = 1, .fastopen = 256});
+//
+// Everything that accepted sockets inherit from the listener (TCP_NODELAY, buffer sizes, busy polling)
+// is set once here, accept4() hands out sockets that need no further syscalls.
+struct ListenerOptions
+{
+    int backlog = SOMAXCONN;
+
+    // Accept IPv4 and IPv6 on one [::] socket, IPv4 peers show up as ::ffff:a.b.c.d.
+    // Falls back to IPv4 only when the host has no IPv6.
+    bool dual_stack = true;
+
+    // SO_REUSEPORT, several sockets bound to the same port share its connections (see PreforkOptions)
+    bool reuse_port = false;
+
+    bool tcp_nodelay = true;
+    // Seconds the kernel holds a connection until its first data arrives, 0 wakes us on the handshake
+    int defer_accept = 0;
+    // Queue length for TCP Fast Open, requests arrive with the SYN from clients that have a cookie. 0 disables it.
+    int fastopen = 0;
+
+    // SO_RCVBUF/SO_SNDBUF in bytes, 0 leaves the kernel's autotuning alone
+    int receive_buffer = 0;
+    int send_buffer = 0;
+
+    // Microseconds a blocking read may busy poll the device queue (SO_BUSY_POLL), 0 disables it
+    int busy_poll = 0;
+    // SO_PREFER_BUSY_POLL, also turned on by ReactorOptions::prefer_busy_poll
+    bool prefer_busy_poll = false;
+};
+
+// Bound, listening, non-blocking socket on port, -1 on failure with the reason printed
+int open_listener(int port, const ListenerOptions& options);
+
+// Address of an accepted peer, IPv4 as a mapped IPv6 address so there's one representation
+in6_addr peer_address(const sockaddr_storage& address);
+
+// Dotted IPv4 for mapped addresses, RFC 5952 text otherwise
+std::string format_address(const in6_addr& address);
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "request.hpp"
+#include "response.hpp"
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// Middleware layers are plain objects callable as `Response layer(Request& request, Next& next)`.
+// chain() nests them into a single concrete type, so every layer's call to next() is a direct
+// (inlinable) call and the whole stack costs one indirect call through RouteHandler.
+//
+//   app.GET("/admin", middleware::chain(middleware::Cors("*"), middleware::BearerAuth("secret"), handler));
+namespace middleware
+{
+
+template <typename Layer, typename Next>
+struct Chain
+{
+    Layer layer;
+    Next next;
+
+    Response operator()(Request& request)
+    {
+        return layer(request, next);
+    }
+};
+
+template <typename Handler>
+auto chain(Handler&& handler)
+{
+    return std::forward<Handler>(handler);
+}
+
+template <typename Layer, typename Next, typename... Rest>
+auto chain(Layer&& layer, Next&& next, Rest&&... rest)
+{
+    auto inner = chain(std::forward<Next>(next), std::forward<Rest>(rest)...);
+    return Chain<std::decay_t<Layer>, decltype(inner)>{std::forward<Layer>(layer), std::move(inner)};
+}
+
+// Measures the time spent in the rest of the chain and reports it to sink(request, duration)
+template <typename Sink>
+struct Timing
+{
+    Sink sink;
+
+    template <typename Next>
+    Response operator()(Request& request, Next& next)
+    {
+        auto start = std::chrono::steady_clock::now();
+        Response response = next(request);
+        sink(request, std::chrono::steady_clock::now() - start);
+        return response;
+    }
+};
+
+template <typename Sink>
+Timing(Sink) -> Timing<Sink>;
+
+// Rejects requests whose Authorization header is not "Bearer <token>"
+class BearerAuth
+{
+  public:
+    explicit BearerAuth(std::string token) : token(std::move(token))
+    {
+    }
+
+    template <typename Next>
+    Response operator()(Request& request, Next& next)
+    {
+        static constexpr std::string_view scheme = "Bearer ";
+
+        auto it = request.headers().find("Authorization");
+        if (it == request.headers().end() || !it->second.starts_with(scheme) ||
+            it->second.substr(scheme.size()) != token)
+        {
+            return Response::with_status(401, "Unauthorized");
+        }
+
+        return next(request);
+    }
+
+  private:
+    std::string token;
+};
+
+// Adds CORS headers to responses and answers preflight requests, so it needs to wrap
+// the OPTIONS route for a path as well as the actual method
+class Cors
+{
+  public:
+    explicit Cors(std::string origin, std::string methods = "GET, POST, PUT, PATCH, DELETE, OPTIONS",
+                  std::string allowed_headers = "Content-Type, Authorization")
+        : origin(std::move(origin)), methods(std::move(methods)), allowed_headers(std::move(allowed_headers))
+    {
+    }
+
+    template <typename Next>
+    Response operator()(Request& request, Next& next)
+    {
+        if (request.method() == Method::OPTIONS)
+        {
+            Response response;
+            response.status(204)
+                .header("Access-Control-Allow-Origin", origin)
+                .header("Access-Control-Allow-Methods", methods)
+                .header("Access-Control-Allow-Headers", allowed_headers);
+            return response;
+        }
+
+        Response response = next(request);
+        response.header("Access-Control-Allow-Origin", origin);
+        return response;
+    }
+
+  private:
+    std::string origin;
+    std::string methods;
+    std::string allowed_headers;
+};
+
+} // namespace middleware
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <sys/types.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A pending piece of a connection's output. Small writes are copied into BUFFER segments,
+// large immutable bodies are referenced by VIEW segments and kept alive through owner,
+// FILE segments are sent with sendfile() straight from the page cache.
+struct OutputSegment
+{
+    enum class Kind
+    {
+        BUFFER,
+        VIEW,
+        FILE
+    };
+
+    Kind kind = Kind::BUFFER;
+    std::vector<char> bytes;
+    std::string_view view;
+    std::shared_ptr<const void> owner;
+    size_t sent = 0;
+
+    int file_fd = -1;
+    off_t file_offset = 0;
+    size_t file_length = 0;
+
+    [[nodiscard]] inline std::string_view data() const
+    {
+        return kind == Kind::BUFFER ? std::string_view(bytes.data(), bytes.size()) : view;
+    }
+
+    [[nodiscard]] inline size_t size() const
+    {
+        return kind == Kind::FILE ? file_length : data().size();
+    }
+};
+
+// Per-connection output: everything a response serializes goes here and is written
+// to the socket with one sendmsg() over an iovec list of all pending segments.
+class OutputQueue
+{
+  public:
+    enum class FlushResult
+    {
+        DONE,
+        BLOCKED,
+        ERROR
+    };
+
+    // Copy bytes into the tail buffer
+    void append(std::string_view bytes);
+
+    // Queue bytes without copying them, owner keeps them alive until they are sent
+    void append_view(std::string_view bytes, std::shared_ptr<const void> owner);
+
+    // Queue length bytes of fd starting at offset, owner keeps the descriptor open
+    void append_file(int fd, off_t offset, size_t length, std::shared_ptr<const void> owner);
+
+    // Tail buffer for serializers that write in place, they report how much they added with commit()
+    std::vector<char>& writable_tail();
+    inline void commit(size_t length)
+    {
+        pending += length;
+    }
+
+    // Write as much as the socket accepts without blocking
+    FlushResult flush(int fd);
+
+    // Move all pending bytes into out, used to capture serialized messages
+    void drain_into(std::string& out);
+
+    // Copy up to length bytes from the front without consuming them, file segments are read with pread()
+    size_t peek(char* buffer, size_t length) const;
+
+    // Drop bytes from the front once they have been written some other way
+    void consume(size_t length);
+
+    // Move up to max_bytes from the front into another queue, views and files stay zero-copy
+    size_t move_into(OutputQueue& dest, size_t max_bytes);
+
+    void clear();
+
+    // Frees the recycled buffers, for connections that went idle
+    void release_buffers();
+
+    [[nodiscard]] inline bool empty() const
+    {
+        return pending == 0;
+    }
+
+    [[nodiscard]] inline size_t pending_bytes() const
+    {
+        return pending;
+    }
+
+  private:
+    std::vector<char>& tail_buffer();
+
+    std::deque<OutputSegment> segments;
+    // Flushed buffers are kept around so steady state serialization doesn't allocate
+    std::vector<std::vector<char>> spare_buffers;
+    size_t pending = 0;
+};
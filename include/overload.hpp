@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Sent as is to shed requests, the connection closes after it
+constexpr std::string_view service_unavailable_response = "HTTP/1.1 503 Service Unavailable\r\n"
+                                                          "Server: au_web\r\n"
+                                                          "Retry-After: 1\r\n"
+                                                          "Connection: close\r\n"
+                                                          "Content-Type: text/plain\r\n"
+                                                          "Content-Length: 19\r\n"
+                                                          "\r\n"
+                                                          "Service Unavailable";
+
+// What gets shed first once requests queue up, set per route in RouteOptions
+enum class RoutePriority
+{
+    // Never shed: health checks, control endpoints
+    CRITICAL,
+    // Shed while the server is overloaded, queueing delay above target for a whole interval
+    NORMAL,
+    // Shed as soon as a request waited longer than the target
+    SHEDDABLE
+};
+
+struct OverloadOptions
+{
+    // Time a request may spend between its connection becoming readable and its dispatch
+    uint32_t target_microseconds = 5000;
+    // How long the delay has to stay above target before NORMAL requests are shed too
+    uint32_t interval_microseconds = 100000;
+};
+
+// CoDel-style admission control on queueing delay. A single slow request doesn't trip it, a standing
+// queue does: overload starts once every request for a whole interval waited longer than the target
+// and ends with the first one that didn't.
+class OverloadController
+{
+  public:
+    explicit OverloadController(const OverloadOptions& options);
+
+    // Whether a request that waited delay microseconds, now being the current time, should run
+    bool admit(uint64_t delay, RoutePriority priority, uint64_t now);
+
+    [[nodiscard]] inline bool overloaded() const
+    {
+        return dropping;
+    }
+
+  private:
+    OverloadOptions options;
+    // When the delay went above target, 0 while it's below
+    uint64_t first_above = 0;
+    bool dropping = false;
+};
+
+// CLOCK_MONOTONIC in microseconds
+uint64_t monotonic_microseconds();
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "common.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+// Latency histogram buckets: bucket 0 is under a microsecond, bucket n covers [2^(n-1), 2^n) microseconds
+// and the last one takes everything slower
+constexpr size_t latency_buckets = 24;
+// A worker that exits sooner than this after being forked doubles the wait before the next respawn
+constexpr uint32_t respawn_min_uptime_ms = 1000;
+constexpr uint32_t respawn_max_delay_ms = 10000;
+
+// Multi-process mode, set through Application::prefork before run():
+//
+//   app.prefork({.workers = 8});
+//
+// run() forks the workers and supervises them, each worker runs its own single-threaded event loop, so
+// handlers don't need to be thread-safe. Everything set up before run() (routes, options, caches) is
+// copied into every worker, state created afterwards is per worker.
+struct PreforkOptions
+{
+    // Worker processes, 0 for one per online core
+    unsigned workers = 0;
+
+    // Every worker binds its own SO_REUSEPORT listener and the kernel spreads connections between them.
+    // Otherwise the workers share the master's socket and wake one at a time (EPOLLEXCLUSIVE).
+    bool reuse_port = true;
+};
+
+// One worker's counters, readable from every process. Only the worker writes them while it runs,
+// the master only between one worker exiting and the next being forked.
+struct alignas(64) WorkerStats
+{
+    // 0 while the worker is down
+    std::atomic<pid_t> pid = 0;
+    // Times the slot's worker was started again after exiting
+    std::atomic<uint64_t> respawns = 0;
+
+    std::atomic<uint64_t> requests = 0;
+    std::atomic<uint64_t> accepted_connections = 0;
+    std::atomic<uint64_t> open_connections = 0;
+    std::atomic<uint64_t> shed_requests = 0;
+    // Microseconds from dispatch to the response being ready, see latency_buckets
+    std::atomic<uint64_t> latency[latency_buckets] = {};
+
+    // Single writer, a plain load and store instead of a locked read-modify-write
+    static inline void add(std::atomic<uint64_t>& counter, uint64_t amount = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    inline void record_latency(uint64_t microseconds)
+    {
+        add(latency[std::min<size_t>(std::bit_width(microseconds), latency_buckets - 1)]);
+    }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<pid_t>::is_always_lock_free,
+              "counters in shared memory have to be lock-free");
+
+// Counters read out of one or more workers
+struct StatsSnapshot
+{
+    size_t workers_up = 0;
+    uint64_t respawns = 0;
+    uint64_t requests = 0;
+    uint64_t accepted_connections = 0;
+    uint64_t open_connections = 0;
+    uint64_t shed_requests = 0;
+    uint64_t latency[latency_buckets] = {};
+
+    void add(const WorkerStats& stats);
+
+    // Upper bound in microseconds of the bucket holding the given fraction of requests, e.g. 0.99
+    [[nodiscard]] uint64_t latency_percentile(double fraction) const;
+};
+
+// Anonymous shared mapping with one WorkerStats per worker. Created before the workers are forked, so
+// every process sees the same pages and any of them can aggregate.
+class SharedStats
+{
+  public:
+    explicit SharedStats(size_t workers);
+    ~SharedStats();
+
+    SharedStats(const SharedStats&) = delete;
+    SharedStats& operator=(const SharedStats&) = delete;
+
+    [[nodiscard]] inline bool valid() const
+    {
+        return slots != nullptr;
+    }
+
+    [[nodiscard]] inline size_t workers() const
+    {
+        return count;
+    }
+
+    [[nodiscard]] inline WorkerStats& worker(size_t index) const
+    {
+        return slots[index];
+    }
+
+    [[nodiscard]] StatsSnapshot snapshot(size_t index) const;
+    // Summed over every worker
+    [[nodiscard]] StatsSnapshot total() const;
+
+  private:
+    WorkerStats* slots = nullptr;
+    size_t count = 0;
+};
+
+// Forks one process per stats slot and calls run_worker(index) in each, the worker exits when it returns.
+// Workers that exit are started again with backoff. SIGUSR1 prints the aggregated stats. SIGTERM or SIGINT,
+// or poll (called about every 100ms) returning false, passes SIGTERM on to the workers and returns once
+// they all exited. Another signal meanwhile is passed on too.
+void supervise(SharedStats& stats, InplaceFunction<void(size_t index)> run_worker, InplaceFunction<bool()> poll = {});
+
+// Worker count for options, resolving 0 to the online cores
+size_t prefork_workers(const PreforkOptions& options);
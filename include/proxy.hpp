@@ -0,0 +1,206 @@
+#pragma once
+
+#include "output.hpp"
+#include "request.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <netinet/in.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Keep-alive sockets parked per upstream between requests
+constexpr size_t proxy_max_idle_connections = 32;
+// Seconds between active health checks of every upstream
+constexpr uint64_t proxy_health_check_interval = 5;
+// Seconds an upstream may go without sending anything before the exchange fails with 504
+constexpr uint64_t proxy_response_timeout = 30;
+// Upstream status line plus headers, anything bigger is a bad gateway
+constexpr size_t proxy_max_head_size = 64 * 1024;
+
+enum class BalancePolicy
+{
+    ROUND_ROBIN,
+    LEAST_CONNECTIONS
+};
+
+struct ProxyOptions
+{
+    BalancePolicy balance = BalancePolicy::ROUND_ROBIN;
+
+    // Requested from every upstream each health_check_interval seconds, a 5xx or no answer marks it down
+    // until a later check passes. 0 leaves only passive checks, failed connects mark the upstream down.
+    std::string health_check_path = "/";
+    uint64_t health_check_interval = proxy_health_check_interval;
+
+    uint64_t response_timeout = proxy_response_timeout;
+    size_t max_idle_connections = proxy_max_idle_connections;
+};
+
+// One backend from the list given to Application::proxy
+struct Upstream
+{
+    std::string name;
+    // First address the name resolved to, IPv4 or IPv6
+    sockaddr_storage address = {};
+    socklen_t address_length = 0;
+
+    bool healthy = true;
+    bool checking = false;
+    // Exchanges in flight, for LEAST_CONNECTIONS
+    size_t active = 0;
+    // Keep-alive sockets waiting for the next request
+    std::vector<int> idle;
+};
+
+// Backends behind a proxy route. The addresses and options are fixed once the route is added,
+// the balancing state, health and idle pools belong to the reactor serving the route.
+class ProxyRoute
+{
+  public:
+    // upstreams are "host:port", hosts are resolved once here
+    ProxyRoute(const std::vector<std::string>& upstreams, ProxyOptions options);
+
+    [[nodiscard]] inline bool valid() const
+    {
+        return !upstreams.empty();
+    }
+
+    // Next healthy upstream by the route's policy, nullptr when all of them are down
+    Upstream* pick();
+
+    std::vector<Upstream> upstreams;
+    ProxyOptions options;
+    uint64_t next_health_check = 0;
+
+  private:
+    size_t cursor = 0;
+};
+
+// Finds the end of a chunked body without decoding it, so it can be passed through unchanged
+class ChunkedScanner
+{
+  public:
+    // How many bytes of data belong to the body, less than data.size() only once the body is done
+    size_t scan(std::string_view data);
+
+    [[nodiscard]] inline bool done() const
+    {
+        return state == State::DONE;
+    }
+
+    [[nodiscard]] inline bool failed() const
+    {
+        return state == State::FAILED;
+    }
+
+  private:
+    enum class State
+    {
+        SIZE,
+        EXTENSION,
+        SIZE_LF,
+        DATA,
+        DATA_CR,
+        DATA_LF,
+        TRAILER,
+        TRAILER_LF,
+        TRAILER_LINE,
+        DONE,
+        FAILED
+    };
+
+    State state = State::SIZE;
+    uint64_t remaining = 0;
+    bool size_digits = false;
+};
+
+// Status line and the headers that matter for framing the upstream response
+struct UpstreamResponseHead
+{
+    int status = 0;
+    int version_minor = 1;
+    // Bytes up to and including the blank line
+    size_t size = 0;
+    bool chunked = false;
+    bool has_length = false;
+    uint64_t content_length = 0;
+    bool keep_alive = true;
+};
+
+// Parses the response head at the start of data, false while it's incomplete, malformed sets head.status to -1
+bool parse_upstream_head(std::string_view data, UpstreamResponseHead& head);
+
+// Request for the upstream: hop-by-hop headers dropped and X-Forwarded-For/-Proto added. The body isn't
+// part of the result, it is sent straight from the request.
+std::shared_ptr<const std::string> upstream_request_head(const Request& request, std::string_view client_address,
+                                                         bool tls);
+
+// Response head for the client, the upstream's own Connection handling replaced by ours
+void write_client_head(OutputQueue& out, std::string_view head, bool keep_alive);
+
+// A socket to an upstream, either serving one client exchange, running a health check or parked idle
+struct UpstreamConnection
+{
+    enum class State
+    {
+        CONNECTING,
+        WRITING,
+        HEAD,
+        BODY,
+        IDLE
+    };
+
+    enum class Framing
+    {
+        NONE,
+        LENGTH,
+        CHUNKED,
+        CLOSE
+    };
+
+    UpstreamConnection() = default;
+    ~UpstreamConnection();
+
+    UpstreamConnection(const UpstreamConnection&) = delete;
+    UpstreamConnection& operator=(const UpstreamConnection&) = delete;
+
+    int fd = -1;
+    ProxyRoute* route = nullptr;
+    Upstream* upstream = nullptr;
+    // Client connection descriptor, -1 for health checks
+    int client = -1;
+    State state = State::CONNECTING;
+
+    // What gets sent, the request stays alive so a stale keep-alive socket can be retried on a fresh one
+    OutputQueue out;
+    std::shared_ptr<const std::string> request_head;
+    std::shared_ptr<const Request> request;
+    bool client_keep_alive = true;
+
+    // Response bytes read but not yet forwarded
+    std::vector<char> buffer;
+    Framing framing = Framing::NONE;
+    uint64_t remaining = 0;
+    ChunkedScanner chunks;
+
+    // Active health check instead of a client exchange
+    bool health_check = false;
+    bool reused = false;
+    // The exchange already moved here from a failed socket, it doesn't move again
+    bool retried = false;
+    bool received = false;
+    bool head_sent = false;
+    bool reusable = true;
+    // Set outside the client's flush, the next pump answers the client with fail_status
+    bool failed = false;
+    int fail_status = 502;
+
+    // Pipe for splicing bodies from the upstream socket to the client's, created on first use
+    int pipe_fds[2] = {-1, -1};
+    size_t piped = 0;
+
+    // Server tick after which the exchange times out
+    uint64_t deadline = 0;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <netinet/in.h>
+#include <string>
+#include <string_view>
+
+// Clients tracked at once, past that the least recently seen client in the same shard is forgotten
+constexpr size_t default_rate_limit_clients = 64 * 1024;
+constexpr size_t rate_limit_shard_slots = 4;
+
+// Sent as is to rejected clients, the connection closes after it
+constexpr std::string_view too_many_requests_response = "HTTP/1.1 429 Too Many Requests\r\n"
+                                                        "Server: au_web\r\n"
+                                                        "Retry-After: 1\r\n"
+                                                        "Connection: close\r\n"
+                                                        "Content-Type: text/plain\r\n"
+                                                        "Content-Length: 17\r\n"
+                                                        "\r\n"
+                                                        "Too Many Requests";
+
+struct RateLimitOptions
+{
+    // Sustained requests per second per client and how many may arrive at once on top of that
+    double requests_per_second = 10;
+    double burst = 20;
+
+    // Clients are told apart by this request header (e.g. X-Forwarded-For behind a load balancer)
+    // instead of the peer address, requests without it fall back to the address
+    std::string key_header = {};
+
+    size_t max_clients = default_rate_limit_clients;
+};
+
+// Token bucket per client in a fixed-size table. Buckets refill lazily when their client shows up
+// again, a client maps to one cache-line sized shard and replaces its least recently seen slot when
+// the shard is full. Only the event loop touches it, there is no locking.
+class RateLimiter
+{
+  public:
+    explicit RateLimiter(const RateLimitOptions& options);
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Takes a token for the client, false when its bucket is empty
+    bool allow(uint64_t key);
+
+    // Whether allow() would pass, without taking anything
+    [[nodiscard]] bool admits(uint64_t key);
+
+    [[nodiscard]] inline const RateLimitOptions& options() const
+    {
+        return _options;
+    }
+
+    static uint64_t key(const in6_addr& address);
+    static uint64_t key(std::string_view header_value);
+
+  private:
+    struct Slot
+    {
+        uint64_t key = 0;
+        float tokens = 0;
+        // Milliseconds on the limiter's clock, differences survive the wrap after 49 days
+        uint32_t seen = 0;
+    };
+
+    struct alignas(64) Shard
+    {
+        std::array<Slot, rate_limit_shard_slots> slots;
+    };
+
+    // The client's slot, refilled up to now
+    Slot& find(uint64_t key);
+
+    RateLimitOptions _options;
+    float tokens_per_ms;
+    std::unique_ptr<Shard[]> shards;
+    size_t shard_mask;
+};
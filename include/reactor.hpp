@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+// Latency mode for the event loop, set through Application::reactor before run():
+//
+//   app.reactor({.spin_microseconds = 50, .busy_poll_microseconds = 50});
+//
+// Both trade a busy core for skipping the wakeup and context switch of a blocking epoll_wait.
+struct ReactorOptions
+{
+    // Keep polling epoll without blocking for this long after the last event before going to sleep, 0 always blocks
+    uint32_t spin_microseconds = 0;
+
+    // Kernel busy polling of the NIC queues from epoll_wait (EPIOCSPARAMS, Linux 6.9+), 0 leaves it off.
+    // Pair with ListenerOptions::busy_poll so the sockets are polled too.
+    uint32_t busy_poll_microseconds = 0;
+    uint16_t busy_poll_budget = 8;
+    // Keep device interrupts off while the application is polling (SO_PREFER_BUSY_POLL)
+    bool prefer_busy_poll = false;
+};
+
+// Event loop counters. For tuning spin_microseconds: a low hit ratio means the budget mostly burns CPU.
+struct ReactorStats
+{
+    // Non-blocking polls while spinning
+    uint64_t spin_polls = 0;
+    // Spins that found events before the budget ran out
+    uint64_t spin_hits = 0;
+    // Spins that ran out and went to a blocking wait
+    uint64_t spin_misses = 0;
+    // Wakeups from a blocking wait
+    uint64_t blocking_wakeups = 0;
+
+    // Requests answered with 503 by load shedding
+    uint64_t shed_requests = 0;
+    // Times accepting paused near max_connections
+    uint64_t accept_pauses = 0;
+
+    [[nodiscard]] inline double spin_hit_ratio() const
+    {
+        uint64_t spins = spin_hits + spin_misses;
+        return spins == 0 ? 0.0 : static_cast<double>(spin_hits) / static_cast<double>(spins);
+    }
+};
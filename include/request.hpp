@@ -7,6 +7,7 @@
 #include <string_view>
 #include <vector>
 #include <unordered_map>
+#include <utility>
 
 typedef std::unordered_map<std::string_view, std::string_view> Headers;
 
@@ -17,6 +18,11 @@ class Request
 public:
     static Request from_content(std::vector<char>&& content, size_t header_size);
 
+    // HTTP/2 streams, the fields are laid out in HTTP/1.1 form so the same parser and accessors apply
+    static Request from_fields(std::string_view method, std::string_view target,
+                               std::span<const std::pair<std::string_view, std::string_view>> fields,
+                               std::vector<char>&& body);
+
     void print() const;
 
     [[nodiscard]] inline const std::vector<char>& content() const { return _content; }
@@ -26,6 +32,13 @@ public:
     [[nodiscard]] inline Method method() const { return _method; }
     [[nodiscard]] inline bool is_complete() const { return _is_complete; }
     [[nodiscard]] inline const RouteParams& params() const { return _params; }
+    [[nodiscard]] inline int version_minor() const { return _version_minor; }
+
+    // Case-insensitive header lookup, empty when the header is missing
+    [[nodiscard]] std::string_view header(std::string_view name) const;
+
+    // HTTP/1.1 defaults to persistent connections, HTTP/1.0 has to ask for them
+    [[nodiscard]] bool keep_alive() const;
     [[nodiscard]] inline RouteParams& params() { return _params; }
 
 private:
@@ -38,6 +51,7 @@ private:
     Path _path;
     Method _method = Method::UNKNOWN;
     size_t _header_size = 0;
+    int _version_minor = 1;
     std::span<char> _body;
     bool _is_complete = false;
     RouteParams _params;
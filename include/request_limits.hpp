@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// Size limits for HTTP/1.x requests, set through Application::limit_requests before run():
+//
+//   app.limit_requests({.max_body_size = 64 * 1024 * 1024});
+//
+// Each one is checked as soon as the bytes it covers are in, a request over a limit is answered and
+// its connection closed without buffering the rest of it.
+struct RequestLimits
+{
+    // Method, target and version, a longer request line gets a 414
+    size_t max_request_line = 8 * 1024;
+    // Header fields, and bytes of the whole header block including the request line. More gets a 431.
+    size_t max_header_count = 100;
+    size_t max_header_bytes = 32 * 1024;
+    // A larger Content-Length gets a 413 before any of the body is read, a chunked body as soon as it grows past it.
+    // RouteOptions::max_body_size lowers it per route.
+    size_t max_body_size = 4 * 1024 * 1024;
+};
+
+// Interim response telling an Expect: 100-continue client to send its body
+constexpr std::string_view continue_response = "HTTP/1.1 100 Continue\r\n\r\n";
+
+// Sent as is for requests over a limit, the connection closes after them
+constexpr std::string_view content_too_large_response = "HTTP/1.1 413 Content Too Large\r\n"
+                                                        "Server: au_web\r\n"
+                                                        "Connection: close\r\n"
+                                                        "Content-Type: text/plain\r\n"
+                                                        "Content-Length: 17\r\n"
+                                                        "\r\n"
+                                                        "Content Too Large";
+
+constexpr std::string_view uri_too_long_response = "HTTP/1.1 414 URI Too Long\r\n"
+                                                   "Server: au_web\r\n"
+                                                   "Connection: close\r\n"
+                                                   "Content-Type: text/plain\r\n"
+                                                   "Content-Length: 12\r\n"
+                                                   "\r\n"
+                                                   "URI Too Long";
+
+constexpr std::string_view expectation_failed_response = "HTTP/1.1 417 Expectation Failed\r\n"
+                                                         "Server: au_web\r\n"
+                                                         "Connection: close\r\n"
+                                                         "Content-Type: text/plain\r\n"
+                                                         "Content-Length: 18\r\n"
+                                                         "\r\n"
+                                                         "Expectation Failed";
+
+constexpr std::string_view header_fields_too_large_response = "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                                                              "Server: au_web\r\n"
+                                                              "Connection: close\r\n"
+                                                              "Content-Type: text/plain\r\n"
+                                                              "Content-Length: 31\r\n"
+                                                              "\r\n"
+                                                              "Request Header Fields Too Large";
+
+constexpr std::string_view bad_request_response = "HTTP/1.1 400 Bad Request\r\n"
+                                                  "Server: au_web\r\n"
+                                                  "Connection: close\r\n"
+                                                  "Content-Type: text/plain\r\n"
+                                                  "Content-Length: 11\r\n"
+                                                  "\r\n"
+                                                  "Bad Request";
+
+constexpr std::string_view not_implemented_response = "HTTP/1.1 501 Not Implemented\r\n"
+                                                      "Server: au_web\r\n"
+                                                      "Connection: close\r\n"
+                                                      "Content-Type: text/plain\r\n"
+                                                      "Content-Length: 15\r\n"
+                                                      "\r\n"
+                                                      "Not Implemented";
@@ -1,24 +1,218 @@
 #pragma once
-#include "server.hpp"
+#include "handler.hpp"
+#include "json.hpp"
+#include "output.hpp"
+#include <memory>
+#include <span>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
+
+enum class ContentType
+{
+    NONE,
+    TEXT,
+    HTML,
+    JSON,
+    CSS,
+    JAVASCRIPT,
+    OCTET_STREAM
+};
+
+// Handed to stream producers, frames everything written as HTTP/1.1 chunks (HTTP/2 puts it in DATA frames)
+class ChunkWriter
+{
+    friend class Server;
+    friend class Http2Session;
+
+  public:
+    // Copies data into the connection's output as one chunk
+    void write(std::string_view data);
+
+    // Queues a shared immutable buffer as one chunk without copying it
+    void write(std::shared_ptr<const std::string> data);
+
+    [[nodiscard]] inline size_t written() const
+    {
+        return _written;
+    }
+
+  private:
+    ChunkWriter(OutputQueue& out, bool chunked) : _out(out), _chunked(chunked)
+    {
+    }
+
+    void write_size(size_t size);
+    void finish();
+
+    OutputQueue& _out;
+    bool _chunked;
+    size_t _written = 0;
+};
+
+// Called whenever the connection can take more data. Each call writes at least one chunk
+// and returns true, or returns false once the body is complete.
+using StreamProducer = InplaceFunction<bool(ChunkWriter&)>;
+
+// Writes a JSON body, see Response::json
+using JsonProducer = InplaceFunction<void(JsonWriter&)>;
 
 class Response
 {
     friend class Server;
+    friend class ResponseCache;
+    friend class Http2Session;
+
   public:
     Response() = default;
 
-    static Response ok(const std::string& content)
+    static Response ok(std::string content)
+    {
+        Response response;
+        response.body(std::move(content));
+        return response;
+    }
+
+    static Response with_status(int status_code, std::string content)
+    {
+        Response response;
+        response._status_code = status_code;
+        response.body(std::move(content));
+        return response;
+    }
+
+    // JSON body serialized straight into the connection's output when the response is sent, with no string
+    // in between. The writer runs after the handler returned, so it has to own what it captures:
+    //
+    //   return Response::json([users = std::move(users)](JsonWriter& json) {
+    //       json.begin_array();
+    //       for (const auto& user : users) { json.begin_object().field("id", user.id).field("name", user.name).end_object(); }
+    //       json.end_array();
+    //   });
+    static Response json(JsonProducer writer, int status_code = 200)
     {
         Response response;
-        response._content = content;
-        response._status_code = 200;
+        response._status_code = status_code;
+        response._content_type = ContentType::JSON;
+        response._json = std::make_shared<const JsonProducer>(std::move(writer));
         return response;
     }
 
-    [[nodiscard]] inline const std::string& content() const
+    // Serializes everything but the Date and Connection lines once, sending it afterwards only copies memory
+    static Response prebuilt(int status_code, std::string_view content, ContentType type = ContentType::TEXT);
+
+    inline Response& status(int status_code)
+    {
+        _status_code = status_code;
+        return *this;
+    }
+
+    inline Response& content_type(ContentType type)
     {
-        return _content;
+        _content_type = type;
+        return *this;
+    }
+
+    // Custom content types go out as a regular header
+    inline Response& content_type(std::string_view type)
+    {
+        _content_type = ContentType::NONE;
+        return header("Content-Type", type);
+    }
+
+    // A name that isn't a token or a value with CR, LF or NUL in it is dropped
+    Response& header(std::string_view name, std::string_view value);
+
+    // Value of a header added with header(), empty when there is none
+    [[nodiscard]] std::string_view header(std::string_view name) const;
+
+    // Owned body
+    inline Response& body(std::string content)
+    {
+        _body_kind = BodyKind::OWNED;
+        _content = std::move(content);
+        _body_owner.reset();
+        return *this;
+    }
+
+    // Borrowed body, copied when the response is serialized right after the handler returns (request data, literals)
+    inline Response& body(std::string_view content)
+    {
+        _body_kind = BodyKind::VIEW;
+        _body_view = content;
+        _body_owner.reset();
+        return *this;
+    }
+
+    // Borrowed body sent without copying, owner keeps the bytes alive until they are written
+    inline Response& body(std::string_view content, std::shared_ptr<const void> owner)
+    {
+        _body_kind = owner ? BodyKind::SHARED : BodyKind::VIEW;
+        _body_view = content;
+        _body_owner = std::move(owner);
+        return *this;
+    }
+
+    inline Response& body(const char* content)
+    {
+        return body(std::string_view(content));
+    }
+
+    inline Response& body(std::span<const char> content)
+    {
+        return body(std::string_view(content.data(), content.size()));
+    }
+
+    // Shared immutable body, sent straight from the shared buffer without copying
+    inline Response& body(std::shared_ptr<const std::string> content)
+    {
+        _body_kind = BodyKind::SHARED;
+        _body_view = *content;
+        _body_owner = std::move(content);
+        return *this;
+    }
+
+    // File body, written with sendfile(); owner keeps fd open until the bytes are sent
+    inline Response& file(int fd, off_t offset, size_t length, std::shared_ptr<const void> owner)
+    {
+        _body_kind = BodyKind::FILE;
+        _file_fd = fd;
+        _file_offset = offset;
+        _file_length = length;
+        _body_owner = std::move(owner);
+        return *this;
+    }
+
+    // Body produced incrementally and sent with Transfer-Encoding: chunked. The producer only runs
+    // while the connection's output is below the high water mark, so memory stays bounded
+    inline Response& stream(StreamProducer producer)
+    {
+        _stream = std::make_shared<StreamProducer>(std::move(producer));
+        return *this;
+    }
+
+    [[nodiscard]] inline bool is_stream() const
+    {
+        return _stream != nullptr;
+    }
+
+    // Runs a JSON writer into an owned body, for what has to see the bytes (compression, ETags, caching, HTTP/2)
+    void render();
+
+    // Empty for file and stream bodies, they are never held in memory, and for JSON bodies until render()
+    [[nodiscard]] inline std::string_view content() const
+    {
+        return _body_kind == BodyKind::OWNED ? std::string_view(_content) : _body_view;
+    }
+
+    [[nodiscard]] inline bool has_file_body() const
+    {
+        return _body_kind == BodyKind::FILE;
+    }
+
+    [[nodiscard]] inline size_t content_length() const
+    {
+        return _body_kind == BodyKind::FILE ? _file_length : content().size();
     }
 
     [[nodiscard]] inline int status_code() const
@@ -26,9 +220,66 @@ class Response
         return _status_code;
     }
 
+    [[nodiscard]] inline ContentType type() const
+    {
+        return _content_type;
+    }
+
+    // Custom headers, already serialized as "Name: value\r\n" lines
+    [[nodiscard]] inline std::string_view headers() const
+    {
+        return _headers;
+    }
+
+    static std::string_view status_line(int status_code);
+    static std::string_view reason_phrase(int status_code);
+    static std::string_view content_type_name(ContentType type);
+
   private:
-    std::string to_http_response() const;
+    enum class BodyKind
+    {
+        OWNED,
+        VIEW,
+        SHARED,
+        FILE
+    };
+
+    // Status line, the cached Server/Date block, the Connection header, then the entity
+    void to_http_response(OutputQueue& out, bool keep_alive) const&;
+    // Same, but a large owned body is handed to the queue instead of copied
+    void to_http_response(OutputQueue& out, bool keep_alive) &&;
+    // Moves a large owned body into a shared buffer the output queue can hold on to
+    void share_body();
+    void write_entity(OutputQueue& out) const;
+    // Content-Length and the body of a JSON writer response, written in place
+    void write_json(OutputQueue& out) const;
+    // Just the body, for framings that carry headers separately
+    void write_body(OutputQueue& out) const;
+
+    // Serializes the entity into _prebuilt, the body then points into it
+    static Response frozen(Response response);
+
+    // 304 for a response the client already has, keeping its validators and Vary
+    static Response not_modified(const Response& response);
 
-    std::string _content;
     int _status_code = 200;
+    ContentType _content_type = ContentType::TEXT;
+    std::string _headers;
+
+    BodyKind _body_kind = BodyKind::OWNED;
+    std::string _content;
+    std::string_view _body_view;
+    std::shared_ptr<const void> _body_owner;
+
+    int _file_fd = -1;
+    off_t _file_offset = 0;
+    size_t _file_length = 0;
+
+    std::shared_ptr<StreamProducer> _stream;
+    std::shared_ptr<const JsonProducer> _json;
+    // HTTP/1.0 peers don't understand chunks, their streams end when the connection closes
+    bool _chunked = true;
+
+    // Set for prebuilt responses, the serialized headers and body that follow the Connection line
+    std::shared_ptr<const std::string> _prebuilt;
 };
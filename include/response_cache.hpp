@@ -0,0 +1,63 @@
+#pragma once
+
+#include "handler.hpp"
+#include "request.hpp"
+#include "response.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+struct RouteOptions;
+
+// Upper bound for all cached responses together
+constexpr size_t response_cache_budget = 64 * 1024 * 1024;
+
+// Micro-cache for deterministic GET handlers. Entries hold the response already serialized up to
+// the Date and Connection lines, so a hit costs one hash lookup and a memcpy. Each event loop owns its
+// cache and only that thread may touch it, there is no locking. A miss runs the handler inline and
+// inserts, nothing ever waits.
+class ResponseCache
+{
+  public:
+    using Producer = InplaceFunction<Response()>;
+
+    explicit ResponseCache(size_t budget = response_cache_budget);
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    // Method, path, sorted query parameters and the route's Vary inputs
+    static std::string key(const Request& request, std::string_view path, const RouteOptions& options);
+
+    // The cached response for key, running produce on a miss. Returns nullptr when the fresh
+    // response can't be cached (streams, files, cookies, Cache-Control private or no-store, uncacheable
+    // status), it's left in uncached.
+    std::shared_ptr<const Response> fetch(const std::string& key, uint32_t ttl_seconds, const Producer& produce,
+                                          Response& uncached);
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        std::shared_ptr<const Response> response;
+        Clock::time_point expires;
+        size_t size = 0;
+        std::list<std::string>::iterator position;
+    };
+
+    static bool is_cacheable(const Response& response);
+    void insert(const std::string& key, std::shared_ptr<const Response> response, uint32_t ttl_seconds);
+    void remove(std::unordered_map<std::string, Entry>::iterator it);
+
+    size_t budget;
+    std::unordered_map<std::string, Entry> entries;
+    // Most recently used first
+    std::list<std::string> lru;
+    size_t bytes = 0;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Seconds a draining server gives in-flight requests before closing whatever is left
+constexpr uint32_t default_drain_timeout = 30;
+
+// Deploys without refused connections, set through Application::graceful_restart before run():
+//
+//   app.graceful_restart({.control_socket = "/run/au_web.sock"});
+//
+// SIGTERM or SIGINT drains the server: it stops accepting, finishes the requests in flight, answers them with
+// Connection: close and exits once every connection is gone (a second signal exits right away). On startup the
+// listening socket is taken from systemd socket activation when there is one, otherwise from the process
+// already serving on control_socket: it passes its listener over with SCM_RIGHTS and starts draining once the
+// new process is up. Connections waiting in the backlog meanwhile are accepted by the new process.
+struct RestartOptions
+{
+    // Unix socket path old and new process meet on, empty turns binary upgrades off
+    std::string control_socket = {};
+    // Use the listener passed by systemd (LISTEN_PID/LISTEN_FDS) when socket activated
+    bool systemd = true;
+    uint32_t drain_timeout = default_drain_timeout;
+};
+
+// Listening socket passed by systemd, -1 when the process wasn't socket activated
+int systemd_listener();
+
+// Asks the process serving on path for its listener. The connection to it is left in control for
+// confirm_handoff, -1 when nothing is serving there.
+int request_listener(const std::string& path, int& control);
+
+// New side, we're serving on the listener: the old process starts draining
+void confirm_handoff(int control);
+
+// Old side, a new process connected to the control socket: sends it the listener
+bool send_listener(int connection, int listener);
+
+// Bound, listening, non-blocking control socket at path, taking the path over from an earlier process
+int open_control_socket(const std::string& path);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common.hpp"
+#include "compression.hpp"
+#include "event_stream.hpp"
+#include "form.hpp"
+#include "overload.hpp"
+#include "proxy.hpp"
+#include "websocket.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Per-route behaviour the server applies around the handler, set when the route is added:
+//
+//   app.GET("/api/report", handler, {.compress = true});
+struct RouteOptions
+{
+    // gzip/deflate the response body when the client accepts it
+    bool compress = false;
+    size_t compress_min_size = default_compression_threshold;
+
+    // Strong ETag hashed from the body, a matching If-None-Match gets a bodiless 304
+    bool etag = false;
+
+    // Seconds to serve GET responses from the micro-cache without running the handler, 0 disables it.
+    // Only for handlers whose output depends on nothing but the path, query and cache_vary headers.
+    uint32_t cache_ttl = 0;
+    // Request headers that select between cached variants
+    std::vector<std::string> cache_vary = {};
+
+    // Lower body limit than RequestLimits::max_body_size for this route, 0 keeps the global one
+    size_t max_body_size = 0;
+    // Runs on the headers of requests with a body, before the body is received when it isn't in yet.
+    // This is what answers Expect: 100-continue, a response here tells the client not to send the body.
+    std::shared_ptr<const UploadCheck> check_upload = {};
+
+    // Which requests load shedding drops first, see Application::shed_load
+    RoutePriority priority = RoutePriority::NORMAL;
+
+    // Set by Application::WS, upgrade requests on the route become WebSocket connections
+    std::shared_ptr<const WebSocketHandler> websocket = {};
+    // Set by Application::SSE, GETs accepting text/event-stream become subscribers
+    std::shared_ptr<const EventStreamRoute> events = {};
+    // Set by Application::upload, request bodies are parsed and handed over as they arrive instead of being buffered
+    std::shared_ptr<const UploadHandler> upload = {};
+    // Set by Application::proxy, requests are forwarded to the route's upstreams instead of running the handler
+    std::shared_ptr<ProxyRoute> proxy = {};
+};
@@ -1,8 +1,14 @@
 #pragma once
 
 #include "common.hpp"
+#include "epoch.hpp"
+#include "route_options.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <regex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -26,16 +32,48 @@ struct Node
     Node* wildcard_child = nullptr;
     Node* param_child = nullptr;
     Node* regex_child = nullptr;
-    RouteHandler handler;
+    // Only set on leaves; shared with the route definition so snapshots don't copy handlers
+    std::shared_ptr<const RouteHandler> handler;
+    RouteOptions options;
 
-    Node(bool is_leaf, NodeType type, const std::string& path, const RouteHandler& handler);
+    Node(bool is_leaf, NodeType type, const std::string& path);
     inline void add_child(Node* child);
-    [[nodiscard]] inline Node* get_child(const std::string& path, RouteParams& params);
+    [[nodiscard]] inline const Node* get_child(const std::string& path, RouteParams& params) const;
 
     ~Node();
-    void print(int depth = 0);
+    void print(int depth = 0) const;
 };
 
+// Immutable routing tree, readers only ever see fully built tables
+struct RouteTable
+{
+    Node* get_root = nullptr;
+    Node* post_root = nullptr;
+    Node* put_root = nullptr;
+    Node* delete_root = nullptr;
+    Node* options_root = nullptr;
+    Node* patch_root = nullptr;
+
+    RouteTable();
+    ~RouteTable();
+
+    RouteTable(const RouteTable&) = delete;
+    RouteTable& operator=(const RouteTable&) = delete;
+};
+
+struct RouteDefinition
+{
+    Method method;
+    std::string path;
+    std::shared_ptr<const RouteHandler> handler;
+    RouteOptions options;
+};
+
+// Routes can be added and removed at any time, including while serving. Every change builds a new
+// RouteTable from the route definitions and publishes it with a single atomic store; lookups load the
+// current table and never block. Changes made inside a batch are published together as one table.
+// Replaced tables are reclaimed through the EpochDomain once every reactor thread has passed a
+// quiescent point.
 class Router
 {
   public:
@@ -43,21 +81,61 @@ class Router
 
     ~Router();
 
-    void add_route(Method method, const std::string& path, const RouteHandler& handler);
+    void add_route(Method method, const std::string& path, RouteHandler handler, RouteOptions options = {});
+    bool remove_route(Method method, const std::string& path);
+
+    // Adds and removes until the matching end_batch only update the definitions, end_batch publishes
+    // one table with all of them. Batches nest, lookups keep seeing the table from before the batch.
+    void begin_batch();
+    void end_batch();
+
+    // The returned node stays valid until the calling reader's next quiescent point. A trailing
+    // wildcard matches the rest of the path, which ends up in params["*"].
+    const Node* find_route(Method method, std::string_view path, RouteParams& params) const;
+
+    // Reactor threads register as readers and announce when they can't hold any Node pointers
+    [[nodiscard]] inline EpochDomain::Reader register_reader()
+    {
+        return epochs.register_reader();
+    }
+
+    inline void unregister_reader(EpochDomain::Reader reader)
+    {
+        epochs.unregister_reader(reader);
+    }
+
+    inline void online(EpochDomain::Reader reader)
+    {
+        epochs.online(reader);
+    }
+
+    inline void offline(EpochDomain::Reader reader)
+    {
+        epochs.offline(reader);
+    }
 
-    Node* find_route(Method method, const std::string& path, RouteParams& params);
+    inline void quiescent(EpochDomain::Reader reader)
+    {
+        epochs.online(reader);
+        if (epochs.has_retired()) { epochs.collect(); }
+    }
 
-    void print();
+    void print() const;
 
   private:
-    Node* get_root = nullptr;
-    Node* post_root = nullptr;
-    Node* put_root = nullptr;
-    Node* delete_root = nullptr;
-    Node* options_root = nullptr;
-    Node* patch_root = nullptr;
+    std::atomic<RouteTable*> table;
+    EpochDomain epochs;
+
+    // Writers serialize on this, readers never touch it
+    std::mutex write_mutex;
+    std::vector<RouteDefinition> definitions;
+    uint32_t batch_depth = 0;
+    // Definitions changed since the last published table
+    bool unpublished = false;
 
-    std::vector<std::string> get_segments(const std::string& path);
-    NodeType get_node_type(const std::string& segment);
-    Node* get_root_node(Method method);
+    void publish();
+    static void insert_route(RouteTable& table, const RouteDefinition& definition);
+    static std::vector<std::string> get_segments(std::string_view path);
+    static NodeType get_node_type(const std::string& segment);
+    static Node* get_root_node(const RouteTable& table, Method method);
 };
\ No newline at end of file
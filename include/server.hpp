@@ -1,25 +1,246 @@
 #pragma once
-#include <array>
+#include <cstdint>
+#include <memory>
+#include <sys/epoll.h>
 #include <unordered_map>
+#include <vector>
 
 #include "connection.hpp"
+#include "handler.hpp"
+#include "listener.hpp"
+#include "overload.hpp"
+#include "prefork.hpp"
+#include "proxy.hpp"
+#include "rate_limit.hpp"
+#include "reactor.hpp"
+#include "restart.hpp"
+#include "response_cache.hpp"
 #include "router.hpp"
+#include "trace.hpp"
 
-constexpr size_t max_connections = 1024;
+constexpr size_t max_connections = 65536;
+// Accepting pauses with this many connections open and resumes once enough of them closed
+constexpr size_t accept_pause_connections = max_connections - max_connections / 16;
+constexpr size_t accept_resume_connections = max_connections - max_connections / 8;
+// Seconds a keep-alive connection may sit idle before we close it
+constexpr uint64_t keep_alive_timeout = 10;
+// Stream producers only run while less than this much output is waiting for the socket
+constexpr size_t stream_high_water = 64 * 1024;
+// Bytes read from and pipelined requests answered on one connection per turn, so a fast uploader
+// or a deep pipeline can't hold up every other ready connection
+constexpr size_t read_budget = 64 * 1024;
+constexpr size_t request_budget = 16;
 
 class Server
 {
   public:
+    using WatchHandler = InplaceFunction<void()>;
+    using ForkHandler = InplaceFunction<void()>;
+
     explicit Server(int port, Router& router);
     void run();
 
+    // Makes the listener speak TLS, false when the certificate or key couldn't be loaded
+    bool enable_tls(const TlsOptions& options);
+
+    // Socket options for the listener, call before run()
+    void configure_listener(const ListenerOptions& options);
+
+    // 503 for requests that queued longer than the target while overloaded, call before run()
+    void enable_load_shedding(const OverloadOptions& options);
+
+    // Spinning and kernel busy polling instead of blocking in epoll_wait, call before run()
+    void configure_reactor(const ReactorOptions& options);
+
+    [[nodiscard]] inline const ReactorStats& stats() const
+    {
+        return reactor_stats;
+    }
+
+    // Request line, header and body limits for HTTP/1.x, call before run()
+    void set_request_limits(const RequestLimits& limits);
+
+    // Answers clients over their request rate with 429, call before run()
+    void enable_rate_limit(const RateLimitOptions& options);
+
+    // run() forks worker processes and supervises them instead of serving itself, call before run().
+    // False when the shared stats segment couldn't be mapped.
+    bool enable_prefork(const PreforkOptions& options);
+
+    // Counters of every worker, nullptr unless prefork is enabled
+    [[nodiscard]] inline const SharedStats* worker_stats() const
+    {
+        return shared_stats.get();
+    }
+
+    // Runs in each worker right after it was forked, before its event loop starts. For descriptors
+    // that every process needs its own of, like the eventfd and inotify ones passed to watch().
+    void at_fork(ForkHandler handler);
+
+    // Draining on SIGTERM and listener handoff between old and new process, call before run()
+    void configure_restart(const RestartOptions& options);
+
+    // Records phase timestamps for a sample of HTTP/1.x requests, call before run()
+    void enable_tracing(const TraceOptions& options);
+
+    // The recorded requests as Chrome trace events, an empty trace when tracing is off. Event loop only.
+    void write_trace(JsonWriter& json) const;
+
+    // Sends requests on route's paths to its upstreams, set up by Application::proxy
+    void add_proxy(std::shared_ptr<ProxyRoute> route);
+
+    // Calls handler from the event loop whenever fd is readable, for auxiliary
+    // descriptors like inotify or eventfd that belong to other components
+    void watch(int fd, WatchHandler handler);
+
   private:
+    // The event loop, opens the listener unless the master already did
+    void serve();
+    // Listener from socket activation or the process we're replacing, false when there is none
+    bool acquire_listener();
+    // Serving on the listener now: tells the process we replaced and opens the control socket for the next one
+    void take_over();
+    // Stops accepting, closes idle connections and lets the rest finish their current request
+    void start_drain();
+    void handle_signal();
+    // Old side of a handoff: a new process connected to the control socket, then confirmed it took over.
+    // The prefork master waits for the confirmation in place, false once it handed the listener over.
+    void accept_successor();
+    void finish_handoff();
+    bool master_handoff();
+    [[nodiscard]] ListenerOptions socket_options() const;
+    // Worker stats for one dispatched request, started is when dispatch began
+    void record_request(uint64_t started);
+    // epoll_wait, spinning first when the reactor is configured to
+    int wait_for_events(epoll_event* events, int max_events);
+    void handle_readable(Connection& connection);
+    // One turn of reading and answering requests, within the budgets
+    void serve_input(Connection& connection);
+    void process_requests(Connection& connection);
+    // Queues a preserialized error response and closes the connection after it
+    void reject(Connection& connection, std::string_view response);
+    void reject(Connection& connection, const Response& response);
+    // Route limits and upload checks on a request's headers, false when the request was refused
+    bool check_upload(Connection& connection, Request& request, const Node* node, size_t body_size);
+    // Headers complete, body still on its way: refuse it now or tell an Expect: 100-continue client to go ahead
+    void check_request_head(Connection& connection);
+    // Streaming uploads: the body is passed to the route's UploadHandler as it's received.
+    // False while the connection can't go on to its next request.
+    void start_upload(Connection& connection, Request&& head, std::shared_ptr<const UploadHandler> handler);
+    bool receive_upload(Connection& connection);
+    bool finish_upload(Connection& connection);
+    // Load shedding decision for a routed request
+    bool shed(const Connection& connection, const Node* node);
+    void pause_accepting();
+    void resume_accepting();
+    bool upgrade_to_http2(Connection& connection, Request& request);
+    bool upgrade_to_websocket(Connection& connection, Request& request);
+    void process_websocket(Connection& connection);
+    bool start_event_stream(Connection& connection, Request& request);
+    void process_http2(Connection& connection, size_t budget);
+    std::unique_ptr<Http2Session> make_http2_session(Connection& connection);
+
+    // Finds the route for a request and fills in its params, nullptr when nothing matches
+    const Node* route(Request& request);
+    // Runs the route's handler with everything around it, returns the cached
+    // response when there is one, otherwise the response is left in response
+    std::shared_ptr<const Response> dispatch(Request& request, const Node* node, Response& response,
+                                             PhaseTrace* trace = nullptr);
+    Response run_handler(const Node& node, Request& request);
+    void flush_connection(Connection& connection);
+    bool pump_stream(Connection& connection);
+    void close_connection(Connection& connection);
+    void handle_tick();
+
+    // Reverse proxy: the client connection waits on an upstream connection until the response is through.
+    // False when the request was answered locally because no upstream could take it.
+    bool start_proxy(Connection& connection, Request&& request, ProxyRoute& route, bool keep_alive);
+    UpstreamConnection* acquire_upstream(ProxyRoute& route, Upstream& upstream, bool fresh);
+    void send_upstream_request(Connection& connection, UpstreamConnection& upstream_connection);
+    void advance_upstream(UpstreamConnection& upstream_connection, uint32_t events);
+    void handle_upstream_event(UpstreamConnection& upstream_connection, uint32_t events);
+    bool pump_upstream(Connection& connection);
+    void start_upstream_response(Connection& connection, UpstreamConnection& upstream_connection,
+                                 const UpstreamResponseHead& head);
+    void forward_upstream_body(Connection& connection, UpstreamConnection& upstream_connection, std::string_view data);
+    int splice_upstream_body(Connection& connection, UpstreamConnection& upstream_connection);
+    void finish_exchange(Connection& connection, UpstreamConnection& upstream_connection);
+    bool fail_exchange(Connection& connection, UpstreamConnection& upstream_connection);
+    void detach_upstream(UpstreamConnection& upstream_connection);
+    void close_upstream(UpstreamConnection& upstream_connection);
+    void check_upstreams();
+    void read_health_check(UpstreamConnection& upstream_connection);
+
+    // Request tracing: the sampling decision when a request's first bytes are looked at, the hand-over
+    // to sending once its response is queued and the commit to the ring once that's on the wire
+    void begin_trace(Connection& connection);
+    void trace_serialized(Connection& connection, PhaseTrace& trace, const Request& request, int status);
+    void trace_sent(Connection& connection);
+
+    // Connections written to from outside their own events (WebSocket sends, published events) get flushed once
+    // the current batch of events is done
+    void wake(int fd);
+    void flush_woken();
+
+    // Connections that stopped at their budget get another turn after everyone else's
+    bool can_read(const Connection& connection) const;
+    void mark_ready(Connection& connection);
+    void run_ready();
+
     int port;
+    ListenerOptions listener_options;
+    RequestLimits request_limits;
+    ReactorOptions reactor_options;
+    ReactorStats reactor_stats;
     int server_socket;
+    // EPOLLEXCLUSIVE added when prefork workers share one listener
+    uint32_t listener_events = EPOLLIN | EPOLLET;
+    // Prefork workers bind their own SO_REUSEPORT listeners
+    bool worker_listeners = false;
     int epoll_fd;
+    int timer_fd = -1;
+    // Seconds since run() started, advanced by the timer
+    uint64_t ticks = 0;
 
     Router& router;
+    ResponseCache response_cache;
+    std::unique_ptr<TlsContext> tls_context;
+    std::unique_ptr<RateLimiter> rate_limiter;
+    std::unique_ptr<OverloadController> overload;
+    std::unique_ptr<RequestTracer> tracer;
+    // Monotonic microseconds when the current batch of events came in, kept while load shedding is on
+    uint64_t batch_time = 0;
+    RestartOptions restart_options;
+    int signal_fd = -1;
+    // Listening control socket for the next process, our connection to the previous one while taking over
+    // and the next one's connection while it takes over from us
+    int control_fd = -1;
+    int predecessor_fd = -1;
+    int successor_fd = -1;
+    // Set by the first SIGTERM/SIGINT or a handoff, the loop ends when the last connection is gone,
+    // the drain timeout passed or a second signal came
+    bool draining = false;
+    bool stopping = false;
+    uint64_t drain_deadline = 0;
+
+    PreforkOptions prefork_options;
+    std::unique_ptr<SharedStats> shared_stats;
+    // This worker's slot in shared_stats, nullptr in the master and without prefork
+    WorkerStats* stats_slot = nullptr;
+    std::vector<ForkHandler> fork_handlers;
+
+    // False while the listener is out of epoll because we're near max_connections
+    bool accepting = true;
+
+    // Indexed by socket descriptor, slots are created on first use and reused afterwards
+    std::vector<std::unique_ptr<Connection>> connections;
+    size_t open_connections = 0;
+    std::vector<int> woken_connections;
+    std::vector<int> ready_connections;
+    std::vector<int> ready_turn;
+    std::unordered_map<int, WatchHandler> watchers;
 
-    std::array<Connection, max_connections> connections;
-    std::unordered_map<int, size_t> socket_to_connection;
+    // Upstream sockets, indexed by descriptor like connections
+    std::vector<std::unique_ptr<UpstreamConnection>> upstream_connections;
+    std::vector<std::shared_ptr<ProxyRoute>> proxy_routes;
 };
\ No newline at end of file
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "http_date.hpp"
+#include "request.hpp"
+#include "response.hpp"
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+constexpr size_t default_max_open_files = 1024;
+
+// A descriptor shared by the cache and in-flight responses, closed along with the last reference
+struct OpenFile
+{
+    int fd = -1;
+
+    explicit OpenFile(int fd) : fd(fd)
+    {
+    }
+
+    ~OpenFile();
+
+    OpenFile(const OpenFile&) = delete;
+    OpenFile& operator=(const OpenFile&) = delete;
+};
+
+// Serves a directory tree behind a trailing wildcard route. Open descriptors and stat results live in
+// an LRU cache that inotify keeps fresh, bodies are sent with sendfile(), conditional and Range requests
+// are answered from the cached metadata and precompressed .br/.gz siblings win when the client accepts them.
+class StaticFiles
+{
+  public:
+    explicit StaticFiles(std::string root, size_t max_open_files = default_max_open_files);
+    ~StaticFiles();
+
+    StaticFiles(const StaticFiles&) = delete;
+    StaticFiles& operator=(const StaticFiles&) = delete;
+
+    // Route handler, the path relative to root comes from params["*"]
+    Response serve(Request& request);
+
+    // Readable whenever something under a directory we have cached files from changed
+    [[nodiscard]] inline int watch_fd() const
+    {
+        return inotify_fd;
+    }
+
+    // Drops cache entries for files that changed on disk
+    void handle_changes();
+
+    // Fresh inotify instance under the same descriptor number and an empty cache, for a forked worker
+    void reopen();
+
+  private:
+    struct Entry
+    {
+        std::string path;
+        std::shared_ptr<OpenFile> file;
+        size_t size = 0;
+        time_t mtime = 0;
+        std::string etag;
+        char last_modified[http_date_length] = {};
+        bool is_directory = false;
+        bool has_gzip = false;
+        bool has_brotli = false;
+        // Counted in its directory's watch, see DirectoryWatch
+        bool watched = false;
+    };
+
+    // Kept as long as an entry from the directory is cached, evicting the last one drops the watch
+    // so they don't pile up against fs.inotify.max_user_watches
+    struct DirectoryWatch
+    {
+        int wd = -1;
+        size_t entries = 0;
+    };
+
+    using LruList = std::list<Entry>;
+
+    // Must be called with mutex held, returns nullptr when the file doesn't exist
+    Entry* lookup(const std::string& path);
+    bool load(const std::string& path, Entry& entry);
+    bool watch_directory(const std::string& directory);
+    void unwatch_directory(const std::string& directory);
+    void invalidate(const std::string& path);
+    // Drops an entry from the cache and its directory watch
+    LruList::iterator remove(LruList::iterator entry);
+
+    std::string root;
+    size_t max_open_files;
+    int inotify_fd = -1;
+
+    std::mutex mutex;
+    // Most recently used first
+    LruList lru;
+    std::unordered_map<std::string, LruList::iterator> entries;
+    std::unordered_map<int, std::string> watched_directories;
+    std::unordered_map<std::string, DirectoryWatch> directory_watches;
+};
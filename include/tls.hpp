@@ -0,0 +1,97 @@
+#pragma once
+
+#include "output.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+
+// Sessions the server remembers for TLS 1.2 session ID resumption, TLS 1.3 clients resume from tickets
+constexpr size_t default_tls_session_cache_size = 20 * 1024;
+
+struct TlsOptions
+{
+    std::string certificate_file;
+    std::string private_key_file;
+    // Let the kernel encrypt after the handshake so send() and sendfile() keep working unchanged
+    bool ktls = true;
+    // Offer h2 in ALPN, http/1.1 is always offered
+    bool http2 = true;
+    size_t session_cache_size = default_tls_session_cache_size;
+};
+
+class TlsSession;
+
+// Certificate, key and session state shared by every connection on a TLS listener
+class TlsContext
+{
+  public:
+    explicit TlsContext(const TlsOptions& options);
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    // False when the certificate or key couldn't be loaded, the reason has been printed
+    [[nodiscard]] inline bool valid() const
+    {
+        return ctx != nullptr;
+    }
+
+    // Server side session on an accepted non-blocking socket
+    std::unique_ptr<TlsSession> accept(int fd);
+
+  private:
+    SSL_CTX* ctx = nullptr;
+};
+
+// One TLS connection driven by the event loop. OpenSSL reads and writes the non-blocking socket itself,
+// would-block conditions come back as EAGAIN and BLOCKED like they do for plain sockets.
+class TlsSession
+{
+  public:
+    explicit TlsSession(SSL* ssl);
+    ~TlsSession();
+
+    TlsSession(const TlsSession&) = delete;
+    TlsSession& operator=(const TlsSession&) = delete;
+
+    // recv() semantics on the decrypted stream, drives the handshake until it's done
+    ssize_t read(char* buffer, size_t length);
+
+    // Encrypts and writes as much of out as the socket accepts
+    OutputQueue::FlushResult flush(OutputQueue& out);
+
+    // Sends close_notify, best effort
+    void shutdown();
+
+    // The last read stopped because the handshake couldn't write, retry it once the socket is writable
+    [[nodiscard]] inline bool read_wants_write() const
+    {
+        return _read_wants_write;
+    }
+
+    // kTLS took over encryption, plain writes to the socket are now TLS records
+    [[nodiscard]] inline bool kernel_send() const
+    {
+        return _kernel_send;
+    }
+
+    [[nodiscard]] inline bool established() const
+    {
+        return _established;
+    }
+
+    // Protocol picked in ALPN, empty when the client didn't ask
+    [[nodiscard]] std::string_view alpn() const;
+
+  private:
+    SSL* ssl;
+    bool _established = false;
+    bool _kernel_send = false;
+    bool _read_wants_write = false;
+};
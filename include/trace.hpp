@@ -0,0 +1,124 @@
+#pragma once
+
+#include "common.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+class JsonWriter;
+
+// Requests kept by default, the oldest are overwritten
+constexpr size_t default_trace_capacity = 4096;
+
+// Points in a request's life, in order. Phases a request didn't go through (accept for every request but
+// the first on a connection, the last byte of one that never got fully sent) stay 0.
+enum class TracePhase
+{
+    ACCEPT,
+    FIRST_BYTE,
+    HEADERS_COMPLETE,
+    // Request::parse done, for requests with a body that's also when the body was complete
+    PARSED,
+    ROUTED,
+    HANDLER_START,
+    HANDLER_END,
+    // Response queued on the connection
+    SERIALIZED,
+    // Output queue drained to the socket
+    LAST_BYTE
+};
+
+constexpr size_t trace_phases = 9;
+
+// Cycle counter where there is one (invariant TSC on x86), monotonic nanoseconds elsewhere.
+// Converted to time only when traces are written out.
+inline uint64_t trace_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + static_cast<uint64_t>(now.tv_nsec);
+#endif
+}
+
+// Phase timestamps of one request, only filled in for sampled ones
+struct PhaseTrace
+{
+    uint64_t at[trace_phases] = {};
+    // "GET /path", cut to fit
+    char name[64] = {};
+    int status = 0;
+    // Picked by the sampler, everything else about an unsampled request stays untouched
+    bool sampled = false;
+    // The sampler already looked at this request
+    bool decided = false;
+
+    inline void stamp(TracePhase phase)
+    {
+        if (sampled) { at[static_cast<size_t>(phase)] = trace_ticks(); }
+    }
+
+    void set_name(Method method, std::string_view path);
+};
+
+// Turned on through Application::trace before run():
+//
+//   app.trace({.sample_every = 100});
+//   app.GET("/debug/trace", [&app](Request&) { return Response::json([&app](JsonWriter& json) { app.write_trace(json); }); });
+struct TraceOptions
+{
+    // One request in this many is traced
+    uint32_t sample_every = 100;
+    size_t capacity = default_trace_capacity;
+};
+
+// Ring of sampled request traces belonging to one event loop, so only that loop's thread touches it.
+// Written out as Chrome trace events: one track per connection with a span for the whole request
+// and one for each phase, pipelined and keep-alive requests line up behind each other.
+class RequestTracer
+{
+  public:
+    explicit RequestTracer(const TraceOptions& options);
+
+    // Whether the next request gets traced
+    inline bool sample()
+    {
+        return ++seen % options.sample_every == 0;
+    }
+
+    // A finished (or abandoned) request, connection is its track
+    void commit(const PhaseTrace& trace, int connection);
+
+    // {"traceEvents":[...]} for chrome://tracing and Perfetto, oldest request first
+    void write(JsonWriter& json) const;
+
+    [[nodiscard]] inline size_t recorded() const
+    {
+        return count;
+    }
+
+  private:
+    struct Record
+    {
+        PhaseTrace trace;
+        int connection;
+    };
+
+    TraceOptions options;
+    uint64_t seen = 0;
+    std::vector<Record> ring;
+    // Where the next record goes and how many are valid
+    size_t next = 0;
+    size_t count = 0;
+    // Tick and monotonic nanosecond readings at startup, ticks are calibrated against them on write
+    uint64_t start_ticks;
+    uint64_t start_nanoseconds;
+};
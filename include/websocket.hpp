@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common.hpp"
+#include "handler.hpp"
+#include "output.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Largest message we reassemble, bigger ones close the connection with 1009
+constexpr size_t websocket_max_message_size = 1024 * 1024;
+// Sends fail once this much is queued for a slow client instead of growing without bound
+constexpr size_t websocket_max_queued_bytes = 4 * 1024 * 1024;
+// Seconds of silence before we ping, and how long the pong (or the peer's close) may take
+constexpr uint64_t websocket_ping_interval = 30;
+constexpr uint64_t websocket_pong_timeout = 10;
+
+class WebSocket;
+
+// Callbacks for a WebSocket route, all of them run on the reactor thread:
+//
+//   app.WS("/echo", {.on_message = [](WebSocket& ws, std::string_view message, bool binary) {
+//       binary ? ws.send_binary(message) : ws.send_text(message);
+//   }});
+struct WebSocketHandler
+{
+    InplaceFunction<void(WebSocket&)> on_open = {};
+    InplaceFunction<void(WebSocket&, std::string_view message, bool binary)> on_message = {};
+    // Last call for this socket, drop any references to it here
+    InplaceFunction<void(WebSocket&, uint16_t code)> on_close = {};
+};
+
+// Server side of an RFC 6455 connection after the upgrade. Frames are parsed incrementally from the
+// received bytes, fragmented messages are reassembled and sends go through the connection's output queue.
+class WebSocket
+{
+    friend class Server;
+
+  public:
+    using Wake = InplaceFunction<void()>;
+
+    // False when the message was dropped because the client isn't keeping up or the socket is closing
+    bool send_text(std::string_view message);
+    bool send_binary(std::string_view message);
+
+    // Zero-copy send of a shared buffer, for fanning the same message out to many sockets
+    bool send(std::shared_ptr<const std::string> message, bool binary = false);
+
+    // Starts the closing handshake
+    void close(uint16_t code = 1000, std::string_view reason = {});
+
+    [[nodiscard]] inline bool is_open() const
+    {
+        return !close_sent;
+    }
+
+    [[nodiscard]] inline const RouteParams& params() const
+    {
+        return _params;
+    }
+
+    // Handler owned per-socket state
+    std::shared_ptr<void> user_data;
+
+  private:
+    WebSocket(OutputQueue& out, std::shared_ptr<const WebSocketHandler> handler, RouteParams params, Wake wake);
+
+    // Consumes every complete frame in data, false once the socket should be closed after flushing
+    bool receive(std::vector<char>& data, uint64_t now);
+
+    // Pings idle peers, false when the peer stopped answering
+    bool tick(uint64_t now);
+
+    // The socket is gone, tell the handler if it doesn't know yet
+    void closed(uint16_t code);
+
+    void write_header(uint8_t opcode, size_t length);
+    void write_frame(uint8_t opcode, std::string_view payload);
+    bool send_message(uint8_t opcode, std::string_view payload, std::shared_ptr<const std::string> owner);
+    bool fail(uint16_t code);
+
+    OutputQueue& out;
+    std::shared_ptr<const WebSocketHandler> handler;
+    RouteParams _params;
+    Wake wake;
+
+    // Fragmented message being reassembled
+    std::string message;
+    uint8_t message_opcode = 0;
+
+    uint64_t last_received = 0;
+    uint64_t ping_sent = 0;
+    uint64_t closing_ticks = 0;
+    bool ping_outstanding = false;
+    bool close_sent = false;
+    bool close_notified = false;
+};
+
+// Sec-WebSocket-Accept for a Sec-WebSocket-Key
+std::string websocket_accept_key(std::string_view key);
+
+// XORs data with the 4 byte masking key, offset is the position of data[0] in the payload
+void websocket_unmask(char* data, size_t length, const uint8_t mask[4], size_t offset = 0);
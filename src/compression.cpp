@@ -0,0 +1,224 @@
+#include "compression.hpp"
+#include "common.hpp"
+#include "hash.hpp"
+
+#include <charconv>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <zlib.h>
+
+constexpr int compression_level = 6;
+
+struct CompressedKey
+{
+    uint64_t hash;
+    size_t size;
+    ContentEncoding encoding;
+
+    bool operator==(const CompressedKey&) const = default;
+};
+
+struct CompressedKeyHash
+{
+    size_t operator()(const CompressedKey& key) const
+    {
+        uint64_t mixed = key.hash ^ (key.size * 0x9E3779B97F4A7C15ull) ^ (static_cast<uint64_t>(key.encoding) << 56);
+        return static_cast<size_t>(mixed ^ (mixed >> 29));
+    }
+};
+
+// Compressed bodies by content hash, shared by all threads and bounded by compression_cache_budget.
+// XXH64 isn't collision resistant, so every entry keeps its source and a hit has to match it byte for byte:
+// a collision must never hand one response's body to another.
+class CompressedCache
+{
+  public:
+    std::shared_ptr<const std::string> get(const CompressedKey& key, std::string_view source)
+    {
+        std::lock_guard lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end() || it->second->source != source) { return nullptr; }
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->compressed;
+    }
+
+    void put(const CompressedKey& key, std::string_view source, std::shared_ptr<const std::string> compressed)
+    {
+        std::lock_guard lock(mutex);
+        // A colliding body keeps the slot it's in, the newcomer just isn't cached
+        if (index.contains(key)) { return; }
+
+        bytes += source.size() + compressed->size();
+        lru.push_front({key, std::string(source), std::move(compressed)});
+        index[key] = lru.begin();
+
+        while (bytes > compression_cache_budget && !lru.empty())
+        {
+            bytes -= lru.back().source.size() + lru.back().compressed->size();
+            index.erase(lru.back().key);
+            lru.pop_back();
+        }
+    }
+
+  private:
+    struct Entry
+    {
+        CompressedKey key;
+        std::string source;
+        std::shared_ptr<const std::string> compressed;
+    };
+
+    std::mutex mutex;
+    std::list<Entry> lru;
+    std::unordered_map<CompressedKey, std::list<Entry>::iterator, CompressedKeyHash> index;
+    size_t bytes = 0;
+};
+
+static CompressedCache compressed_cache;
+
+// One gzip and one zlib stream per thread, reset between bodies instead of reallocated
+class Compressor
+{
+  public:
+    Compressor()
+    {
+        gzip_ready = deflateInit2(&gzip, compression_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        deflate_ready = deflateInit2(&zlib, compression_level, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+
+    ~Compressor()
+    {
+        if (gzip_ready) { deflateEnd(&gzip); }
+        if (deflate_ready) { deflateEnd(&zlib); }
+    }
+
+    std::shared_ptr<const std::string> compress(std::string_view input, ContentEncoding encoding)
+    {
+        z_stream& stream = encoding == ContentEncoding::GZIP ? gzip : zlib;
+        if (!(encoding == ContentEncoding::GZIP ? gzip_ready : deflate_ready)) { return nullptr; }
+
+        deflateReset(&stream);
+
+        auto output = std::make_shared<std::string>();
+        output->resize(deflateBound(&stream, input.size()));
+
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        stream.next_out = reinterpret_cast<Bytef*>(output->data());
+        stream.avail_out = static_cast<uInt>(output->size());
+
+        if (deflate(&stream, Z_FINISH) != Z_STREAM_END) { return nullptr; }
+
+        output->resize(stream.total_out);
+        return output;
+    }
+
+  private:
+    z_stream gzip = {};
+    z_stream zlib = {};
+    bool gzip_ready = false;
+    bool deflate_ready = false;
+};
+
+static thread_local Compressor compressor;
+
+// Parses the q parameter of an Accept-Encoding item, 1.0 when there is none
+static double quality(std::string_view parameters)
+{
+    size_t q = parameters.find("q=");
+    if (q == std::string_view::npos) { return 1.0; }
+
+    auto value = parameters.substr(q + 2);
+    double result = 1.0;
+    std::from_chars(value.data(), value.data() + value.size(), result);
+    return result;
+}
+
+ContentEncoding Compression::negotiate(std::string_view accept_encoding)
+{
+    double gzip_q = -1.0, deflate_q = -1.0, any_q = -1.0;
+
+    while (!accept_encoding.empty())
+    {
+        size_t comma = accept_encoding.find(',');
+        auto item = accept_encoding.substr(0, comma);
+        accept_encoding = comma == std::string_view::npos ? std::string_view() : accept_encoding.substr(comma + 1);
+
+        size_t semicolon = item.find(';');
+        auto name = item.substr(0, semicolon);
+        while (!name.empty() && name.front() == ' ') name.remove_prefix(1);
+        while (!name.empty() && name.back() == ' ') name.remove_suffix(1);
+        double q = semicolon == std::string_view::npos ? 1.0 : quality(item.substr(semicolon + 1));
+
+        if (iequals(name, "gzip") || iequals(name, "x-gzip")) { gzip_q = q; }
+        else if (iequals(name, "deflate")) { deflate_q = q; }
+        else if (name == "*") { any_q = q; }
+    }
+
+    if (gzip_q < 0) { gzip_q = any_q; }
+    if (deflate_q < 0) { deflate_q = any_q; }
+
+    if (gzip_q > 0 && gzip_q >= deflate_q) { return ContentEncoding::GZIP; }
+    if (deflate_q > 0) { return ContentEncoding::DEFLATE; }
+    return ContentEncoding::IDENTITY;
+}
+
+static bool is_compressible(const Response& response)
+{
+    switch (response.type())
+    {
+        case ContentType::TEXT:
+        case ContentType::HTML:
+        case ContentType::JSON:
+        case ContentType::CSS:
+        case ContentType::JAVASCRIPT: return true;
+        case ContentType::OCTET_STREAM: return false;
+        default: break;
+    }
+
+    // Custom content type, it's one of the serialized header lines
+    auto headers = response.headers();
+    size_t start = headers.find("Content-Type: ");
+    if (start == std::string_view::npos) { return false; }
+    auto type = headers.substr(start + 14, headers.find("\r\n", start) - start - 14);
+
+    return type.starts_with("text/") || type.find("json") != std::string_view::npos ||
+           type.find("xml") != std::string_view::npos || type.find("javascript") != std::string_view::npos;
+}
+
+void Compression::apply(const Request& request, Response& response, size_t threshold)
+{
+    int status = response.status_code();
+    if (status < 200 || status == 204 || status == 206 || status == 304) { return; }
+    if (response.has_file_body() || !is_compressible(response)) { return; }
+
+    // Already encoded by the handler
+    if (response.headers().find("Content-Encoding: ") != std::string_view::npos) { return; }
+
+    // The representation depends on Accept-Encoding whether or not we end up compressing this one
+    response.header("Vary", "Accept-Encoding");
+
+    auto body = response.content();
+    if (body.size() < threshold) { return; }
+
+    ContentEncoding encoding = negotiate(request.header("Accept-Encoding"));
+    if (encoding == ContentEncoding::IDENTITY) { return; }
+
+    CompressedKey key = {xxh64(body), body.size(), encoding};
+    auto compressed = compressed_cache.get(key, body);
+    if (!compressed)
+    {
+        compressed = compressor.compress(body, encoding);
+        if (!compressed) { return; }
+        compressed_cache.put(key, body, compressed);
+    }
+
+    // Incompressible content, not worth the Content-Encoding
+    if (compressed->size() >= body.size()) { return; }
+
+    response.header("Content-Encoding", encoding == ContentEncoding::GZIP ? "gzip" : "deflate");
+    response.body(std::move(compressed));
+}
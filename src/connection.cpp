@@ -1,79 +1,210 @@
 #include "connection.hpp"
+#include "common.hpp"
 #include "request.hpp"
 
 #include <algorithm>
+#include <cerrno>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <optional>
+#include <string_view>
 #include <sys/socket.h>
 
-constexpr size_t max_request_size = 4 * 1024 * 1024;
+Connection::Connection()
+{
+}
 
-Connection::Connection() : buffer(max_buffer_size)
+void Connection::reset()
 {
+    request_data.clear();
+    header_scan_offset = 0;
+    head_size = 0;
+    body_size = 0;
+    chunked = false;
+    chunks.reset();
+    body_limit = 0;
+    head_checked = false;
+    rejection = {};
+    close_after_flush = false;
+    output.clear();
+    stream.reset();
+    h2.reset();
+    ws.reset();
+    sse.reset();
+    upload.reset();
+    tls.reset();
+    upstream = -1;
+    admitted = false;
+    input_pending = false;
+    requests_pending = false;
+    stalled = false;
+    readable_at = 0;
+    ready = false;
+    woken = false;
+    trace = {};
+    sending = {};
+    accepted_at = 0;
 }
 
-std::optional<Request> Connection::handle_request()
+void Connection::trim()
 {
-    if (!request_in_progress)
-    {
-        request_data.clear();
-        request_data.reserve(max_buffer_size);
-        request_in_progress = true;
-    }
+    if (request_data.empty()) { request_data.shrink_to_fit(); }
+    output.release_buffers();
+}
 
-    size_t current_request_size = request_data.size();
+Connection::ReceiveResult Connection::receive(size_t budget, size_t limit)
+{
+    // One scratch buffer for the whole reactor instead of one per connection
+    static thread_local std::vector<char> buffer(max_buffer_size);
 
+    size_t received = 0;
     while (true)
     {
+        // Everyone else's turn, the server comes back for the rest
+        if (received >= budget) { return ReceiveResult::BUDGET_SPENT; }
+
         // Get a chunk of the request
-        int bytes_read = recv(handle, buffer.data(), buffer.size(), 0);
+        int bytes_read = tls ? tls->read(buffer.data(), buffer.size()) : recv(handle, buffer.data(), buffer.size(), 0);
 
         if (bytes_read <= 0)
         {
             if (bytes_read == 0)
             {
                 // Connection closed by client
-                return std::nullopt;
+                return ReceiveResult::CLOSED;
             }
             else if (errno == EAGAIN || errno == EWOULDBLOCK) { break; }
+            else if (errno == EINTR) { continue; }
             else
             {
                 // Error
                 std::cerr << "Error reading from socket: " << strerror(errno) << std::endl;
-                return std::nullopt;
+                return ReceiveResult::CLOSED;
             }
         }
 
-        current_request_size += bytes_read;
-        // Check if the request is too large
-        if (current_request_size > max_request_size)
+        // Requests over a limit are refused as soon as their headers are in, this only stops runaway buffering
+        if (request_data.size() + bytes_read > limit)
         {
             std::cerr << "Request too large" << std::endl;
-            return std::nullopt;
+            return ReceiveResult::CLOSED;
         }
 
         // Append data to request buffer
         request_data.insert(request_data.end(), buffer.data(), buffer.data() + bytes_read);
+        received += bytes_read;
     }
 
+    return ReceiveResult::DRAINED;
+}
+
+std::optional<Request> Connection::next_request(const RequestLimits& limits)
+{
     static const char pattern[] = "\r\n\r\n";
-    auto it = std::search(request_data.begin(), request_data.end(), pattern, pattern + 4);
-    bool is_complete_request = false;
-    if ((it != request_data.end())) { is_complete_request = true; }
 
-    // Only process complete requests
-    if (is_complete_request)
+    if (head_size == 0)
+    {
+        // The request line has to end within the limit, however much else has arrived
+        std::string_view received(request_data.data(), request_data.size());
+        auto request_line = received.substr(0, limits.max_request_line + 2);
+        if (request_line.size() == limits.max_request_line + 2 && request_line.find("\r\n") == std::string_view::npos)
+        {
+            rejection = uri_too_long_response;
+            return std::nullopt;
+        }
+
+        // Only look at bytes we haven't searched yet (minus a partial terminator)
+        auto search_start = request_data.begin() + std::min(header_scan_offset, request_data.size());
+        auto it = std::search(search_start, request_data.end(), pattern, pattern + 4);
+
+        if (it == request_data.end())
+        {
+            if (request_data.size() > limits.max_header_bytes) { rejection = header_fields_too_large_response; }
+            header_scan_offset = request_data.size() >= 3 ? request_data.size() - 3 : 0;
+            return std::nullopt;
+        }
+
+        size_t header_size = it + 4 - request_data.begin();
+        // One line feed per field plus the request line's and the blank line's
+        size_t header_count = std::count(request_data.begin(), it + 4, '\n') - 2;
+        if (header_size > limits.max_header_bytes || header_count > limits.max_header_count)
+        {
+            rejection = header_fields_too_large_response;
+            return std::nullopt;
+        }
+
+        // Refused before the body is read, not after
+        auto framing = request_framing(std::string_view(request_data.data(), header_size));
+        if (framing.rejection.empty() && framing.content_length > limits.max_body_size)
+        {
+            framing.rejection = content_too_large_response;
+        }
+        if (!framing.rejection.empty())
+        {
+            rejection = framing.rejection;
+            return std::nullopt;
+        }
+
+        head_size = header_size;
+        body_size = framing.content_length;
+        chunked = framing.chunked;
+        trace.stamp(TracePhase::HEADERS_COMPLETE);
+    }
+
+    if (chunked)
     {
-        auto header_end = it + 4;
-        size_t header_size = header_end - request_data.begin();
-        Request request = Request::from_content(std::move(request_data), header_size);
-        request.parse();
-        request_in_progress = false;
-        return request;
+        // Its length only shows as it arrives, so the limits are checked on every piece
+        size_t limit = body_limit > 0 ? std::min(body_limit, limits.max_body_size) : limits.max_body_size;
+        auto result = chunks.decode(request_data, head_size, limit);
+        body_size = chunks.decoded();
+        if (result == ChunkedDecoder::Result::INCOMPLETE) { return std::nullopt; }
+        if (result != ChunkedDecoder::Result::DONE)
+        {
+            rejection = result == ChunkedDecoder::Result::TOO_LARGE ? content_too_large_response : bad_request_response;
+            return std::nullopt;
+        }
+
+        // The framing goes, the decoded body now runs right up to what follows the request
+        request_data.erase(request_data.begin() + head_size + body_size, request_data.begin() + chunks.input_end());
+        chunked = false;
+        chunks.reset();
     }
-    else { std::cout << "Request not completed" << std::endl; }
 
-    return std::nullopt;
-}
\ No newline at end of file
+    // Wait for the rest of the body
+    size_t header_size = head_size;
+    size_t request_size = head_size + body_size;
+    if (request_data.size() < request_size) { return std::nullopt; }
+
+    header_scan_offset = 0;
+    head_size = 0;
+    body_size = 0;
+    body_limit = 0;
+
+    std::vector<char> content;
+    if (request_data.size() == request_size)
+    {
+        content = std::move(request_data);
+        request_data.clear();
+    }
+    else
+    {
+        // Pipelined request behind this one, keep its bytes
+        content.assign(request_data.begin(), request_data.begin() + request_size);
+        request_data.erase(request_data.begin(), request_data.begin() + request_size);
+    }
+
+    Request request = Request::from_content(std::move(content), header_size);
+    request.parse();
+    trace.stamp(TracePhase::PARSED);
+    return request;
+}
+
+Request Connection::request_head() const
+{
+    std::vector<char> content(request_data.begin(), request_data.begin() + head_size);
+    Request request = Request::from_content(std::move(content), head_size);
+    request.parse();
+    return request;
+}
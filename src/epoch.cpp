@@ -0,0 +1,64 @@
+#include "epoch.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+EpochDomain::~EpochDomain()
+{
+    // Nobody can be reading anymore, free everything
+    for (auto& entry : retired) { entry.deleter(entry.ptr); }
+}
+
+EpochDomain::Reader EpochDomain::register_reader()
+{
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        bool expected = false;
+        if (slots[i].in_use.compare_exchange_strong(expected, true))
+        {
+            slots[i].epoch.store(0);
+            return i;
+        }
+    }
+
+    std::cerr << "Error: too many epoch readers" << std::endl;
+    return invalid_reader;
+}
+
+void EpochDomain::unregister_reader(Reader reader)
+{
+    if (reader == invalid_reader) { return; }
+    slots[reader].epoch.store(0);
+    slots[reader].in_use.store(false);
+}
+
+void EpochDomain::retire(void* ptr, void (*deleter)(void*))
+{
+    // Readers that announce an epoch after this increment are guaranteed to see the new
+    // version, so ptr is only reachable by readers whose announced epoch is <= retired_epoch
+    uint64_t retired_epoch = global_epoch.fetch_add(1);
+
+    std::lock_guard lock(retired_mutex);
+    retired.push_back({ptr, deleter, retired_epoch});
+    retired_count.store(retired.size(), std::memory_order_relaxed);
+}
+
+bool EpochDomain::collect()
+{
+    std::unique_lock lock(retired_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) { return false; }
+
+    uint64_t oldest = UINT64_MAX;
+    for (auto& slot : slots)
+    {
+        uint64_t epoch = slot.epoch.load();
+        if (epoch != 0) { oldest = std::min(oldest, epoch); }
+    }
+
+    auto it = std::partition(retired.begin(), retired.end(), [&](const Retired& entry) { return entry.epoch >= oldest; });
+    for (auto free_it = it; free_it != retired.end(); ++free_it) { free_it->deleter(free_it->ptr); }
+    retired.erase(it, retired.end());
+    retired_count.store(retired.size(), std::memory_order_relaxed);
+
+    return true;
+}
@@ -0,0 +1,231 @@
+#include "event_stream.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+EventSubscriber::EventSubscriber(OutputQueue& out, std::shared_ptr<const EventStreamRoute> route, RouteParams params,
+                                 Wake wake)
+    : out(out), route(std::move(route)), _params(std::move(params)), wake(std::move(wake))
+{
+}
+
+EventSubscriber::~EventSubscriber()
+{
+    while (!topics.empty()) { unsubscribe(topics.back().first); }
+}
+
+void EventSubscriber::subscribe(std::string_view topic)
+{
+    for (auto& [name, index] : topics)
+    {
+        if (name == topic) { return; }
+    }
+
+    std::string name(topic);
+    size_t index = route->hub->add(name, this);
+    topics.emplace_back(std::move(name), index);
+}
+
+void EventSubscriber::unsubscribe(std::string_view topic)
+{
+    for (size_t i = 0; i < topics.size(); i++)
+    {
+        if (topics[i].first != topic) { continue; }
+
+        route->hub->remove(topics[i].first, topics[i].second);
+        if (i + 1 != topics.size()) { topics[i] = std::move(topics.back()); }
+        topics.pop_back();
+        return;
+    }
+}
+
+bool EventSubscriber::send(std::string_view data, std::string_view event, std::string_view id)
+{
+    return deliver(EventHub::format(data, event, id));
+}
+
+bool EventSubscriber::deliver(const std::shared_ptr<const std::string>& event)
+{
+    if (overrun) { return false; }
+
+    if (out.pending_bytes() + event->size() > route->options.max_queued_bytes)
+    {
+        _dropped++;
+        if (route->options.slow_policy == SlowSubscriberPolicy::DISCONNECT)
+        {
+            // The server closes us once the current batch of events is done
+            overrun = true;
+            wake();
+        }
+        return false;
+    }
+
+    out.append_view(*event, event);
+    sent = true;
+    wake();
+    return true;
+}
+
+bool EventSubscriber::tick(uint64_t now)
+{
+    if (overrun) { return false; }
+
+    if (sent)
+    {
+        sent = false;
+        last_sent = now;
+        return true;
+    }
+
+    if (now - last_sent >= event_stream_keep_alive && out.empty())
+    {
+        out.append(":\n\n");
+        last_sent = now;
+        wake();
+    }
+    return true;
+}
+
+EventHub::EventHub()
+{
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd == -1) { std::cerr << "Error creating event hub eventfd: " << strerror(errno) << std::endl; }
+}
+
+EventHub::~EventHub()
+{
+    if (event_fd != -1) { close(event_fd); }
+}
+
+void EventHub::reopen()
+{
+    if (event_fd == -1) { return; }
+
+    int fresh = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fresh == -1 || dup3(fresh, event_fd, O_CLOEXEC) == -1)
+    {
+        std::cerr << "Error reopening event hub eventfd: " << strerror(errno) << std::endl;
+    }
+    if (fresh != -1) { close(fresh); }
+}
+
+std::shared_ptr<const std::string> EventHub::format(std::string_view data, std::string_view event,
+                                                    std::string_view id)
+{
+    // Field values end at the first line break, the protocol has no escaping
+    auto single_line = [](std::string_view value) { return value.substr(0, value.find_first_of("\r\n")); };
+
+    auto out = std::make_shared<std::string>();
+    out->reserve(data.size() + event.size() + id.size() + 32);
+
+    if (!id.empty())
+    {
+        out->append("id: ");
+        out->append(single_line(id));
+        out->push_back('\n');
+    }
+    if (!event.empty())
+    {
+        out->append("event: ");
+        out->append(single_line(event));
+        out->push_back('\n');
+    }
+
+    // Every line of the data gets its own field, CRLF, LF and CR all end a line
+    while (true)
+    {
+        size_t end = data.find_first_of("\r\n");
+        out->append("data: ");
+        out->append(data.substr(0, end));
+        out->push_back('\n');
+        if (end == std::string_view::npos) { break; }
+
+        size_t next = end + 1;
+        if (data[end] == '\r' && next < data.size() && data[next] == '\n') { next++; }
+        data.remove_prefix(next);
+    }
+
+    out->push_back('\n');
+    return out;
+}
+
+void EventHub::publish(std::string_view topic, std::string_view data, std::string_view event, std::string_view id)
+{
+    auto formatted = format(data, event, id);
+
+    bool signal;
+    {
+        std::lock_guard lock(mutex);
+        signal = pending.empty();
+        pending.emplace_back(std::string(topic), std::move(formatted));
+    }
+
+    // One wakeup per batch, the event loop drains everything that was queued before it ran
+    if (signal)
+    {
+        uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        {
+            std::cerr << "Error signalling event hub: " << strerror(errno) << std::endl;
+        }
+    }
+}
+
+void EventHub::handle_wakeup()
+{
+    uint64_t count;
+    while (read(event_fd, &count, sizeof(count)) > 0) {}
+
+    std::vector<std::pair<std::string, std::shared_ptr<const std::string>>> batch;
+    {
+        std::lock_guard lock(mutex);
+        batch.swap(pending);
+    }
+
+    // Subscribers only ever mark themselves for disconnection here, the lists don't change under us
+    for (auto& [topic, event] : batch)
+    {
+        auto it = topics.find(topic);
+        if (it == topics.end()) { continue; }
+        for (EventSubscriber* subscriber : it->second) { subscriber->deliver(event); }
+    }
+}
+
+size_t EventHub::subscribers(std::string_view topic) const
+{
+    auto it = topics.find(std::string(topic));
+    return it == topics.end() ? 0 : it->second.size();
+}
+
+size_t EventHub::add(const std::string& topic, EventSubscriber* subscriber)
+{
+    auto& list = topics[topic];
+    list.push_back(subscriber);
+    return list.size() - 1;
+}
+
+void EventHub::remove(const std::string& topic, size_t index)
+{
+    auto it = topics.find(topic);
+    if (it == topics.end()) { return; }
+    auto& list = it->second;
+
+    // Swap with the last subscriber and fix up its recorded position
+    EventSubscriber* moved = list.back();
+    list[index] = moved;
+    list.pop_back();
+
+    if (index < list.size())
+    {
+        for (auto& [name, position] : moved->topics)
+        {
+            if (name == topic) { position = index; }
+        }
+    }
+
+    if (list.empty()) { topics.erase(it); }
+}
@@ -0,0 +1,363 @@
+#include "form.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static std::string_view trim(std::string_view value)
+{
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) { value.remove_prefix(1); }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) { value.remove_suffix(1); }
+    return value;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+    return -1;
+}
+
+std::string_view FormPart::header(std::string_view field) const
+{
+    for (const auto& [name, value] : headers)
+    {
+        if (iequals(name, field)) { return value; }
+    }
+    return {};
+}
+
+std::string_view header_parameter(std::string_view value, std::string_view parameter)
+{
+    size_t start = value.find(';');
+    while (start != std::string_view::npos)
+    {
+        size_t end = value.find(';', start + 1);
+        auto item = trim(value.substr(start + 1, end == std::string_view::npos ? std::string_view::npos : end - start - 1));
+        start = end;
+
+        size_t equals = item.find('=');
+        if (equals == std::string_view::npos || !iequals(trim(item.substr(0, equals)), parameter)) { continue; }
+
+        auto result = trim(item.substr(equals + 1));
+        if (result.size() >= 2 && result.front() == '"' && result.back() == '"') { result = result.substr(1, result.size() - 2); }
+        return result;
+    }
+    return {};
+}
+
+PatternSearch::PatternSearch(std::string pattern) : _pattern(std::move(pattern))
+{
+    // How far the window may move when its last byte is c, capped so the table stays small
+    size_t length = _pattern.size();
+    skip.fill(static_cast<uint8_t>(std::min<size_t>(length, 255)));
+    for (size_t i = 0; i + 1 < length; i++)
+    {
+        skip[static_cast<uint8_t>(_pattern[i])] = static_cast<uint8_t>(std::min<size_t>(length - 1 - i, 255));
+    }
+}
+
+size_t PatternSearch::find(std::string_view text) const
+{
+    size_t length = _pattern.size();
+    if (length == 0 || text.size() < length) { return std::string_view::npos; }
+
+    const char last = _pattern.back();
+    for (size_t i = 0; i <= text.size() - length;)
+    {
+        char c = text[i + length - 1];
+        if (c == last && memcmp(text.data() + i, _pattern.data(), length - 1) == 0) { return i; }
+        i += skip[static_cast<uint8_t>(c)];
+    }
+    return std::string_view::npos;
+}
+
+MultipartParser::MultipartParser(std::string_view boundary) : delimiter("\r\n--" + std::string(boundary))
+{
+    // The first delimiter may open the body without a line break in front of it
+    carry = "\r\n";
+}
+
+bool MultipartParser::feed(std::string_view chunk, const FormEvents& events)
+{
+    while (!chunk.empty() && state != State::FAILED && state != State::DONE)
+    {
+        switch (state)
+        {
+            case State::PREAMBLE:
+            case State::BODY:
+                if (scan(chunk, state == State::BODY, events) && state != State::FAILED)
+                {
+                    state = State::DELIMITER_LINE;
+                    dashes = 0;
+                }
+                break;
+
+            case State::DELIMITER_LINE:
+            {
+                char c = chunk.front();
+                chunk.remove_prefix(1);
+                if (c == '-')
+                {
+                    if (++dashes == 2) { state = State::DONE; }
+                }
+                else if (dashes > 0) { state = State::FAILED; }
+                else if (c == '\n')
+                {
+                    // Leading line break so a part without headers ends its header block right away
+                    carry = "\r\n";
+                    state = State::HEADERS;
+                }
+                // Transport padding and the \r
+                else if (c != ' ' && c != '\t' && c != '\r') { state = State::FAILED; }
+                break;
+            }
+
+            case State::HEADERS: parse_headers(chunk, events); break;
+
+            case State::DONE:
+            case State::FAILED: break;
+        }
+    }
+
+    return state != State::FAILED;
+}
+
+bool MultipartParser::scan(std::string_view& chunk, bool emit, const FormEvents& events)
+{
+    size_t length = delimiter.pattern().size();
+    auto pass_on = [&](std::string_view data) {
+        if (emit && !data.empty() && !events.on_data(data)) { state = State::FAILED; }
+    };
+
+    if (!carry.empty())
+    {
+        // A delimiter may straddle the chunks, look at the held back bytes with enough of the new ones to finish it
+        size_t held = carry.size();
+        size_t take = std::min(chunk.size(), length);
+        carry.append(chunk.data(), take);
+
+        size_t at = delimiter.find(carry);
+        if (at != std::string_view::npos)
+        {
+            pass_on(std::string_view(carry).substr(0, at));
+            chunk.remove_prefix(at + length - held);
+            carry.clear();
+            return true;
+        }
+
+        if (take < length)
+        {
+            // Still too short to rule a delimiter out, keep only what might start one
+            chunk = {};
+            if (carry.size() >= length)
+            {
+                size_t safe = carry.size() - (length - 1);
+                pass_on(std::string_view(carry).substr(0, safe));
+                carry.erase(0, safe);
+            }
+            return false;
+        }
+
+        // No delimiter starts in the held back bytes, the chunk is searched on its own below
+        pass_on(std::string_view(carry).substr(0, held));
+        carry.clear();
+        if (state == State::FAILED) { return false; }
+    }
+
+    size_t at = delimiter.find(chunk);
+    if (at != std::string_view::npos)
+    {
+        pass_on(chunk.substr(0, at));
+        chunk.remove_prefix(at + length);
+        return true;
+    }
+
+    size_t keep = std::min(chunk.size(), length - 1);
+    pass_on(chunk.substr(0, chunk.size() - keep));
+    carry.assign(chunk.substr(chunk.size() - keep));
+    chunk = {};
+    return false;
+}
+
+bool MultipartParser::parse_headers(std::string_view& chunk, const FormEvents& events)
+{
+    size_t held = carry.size();
+    size_t room = max_part_header_size + 2 > held ? max_part_header_size + 2 - held : 0;
+    auto appended = chunk.substr(0, room);
+    carry.append(appended);
+
+    size_t end = carry.find("\r\n\r\n", held >= 3 ? held - 3 : 0);
+    if (end == std::string::npos)
+    {
+        if (carry.size() >= max_part_header_size + 2) { state = State::FAILED; }
+        chunk.remove_prefix(appended.size());
+        return false;
+    }
+    chunk.remove_prefix(end + 4 - held);
+
+    FormPart part;
+    // Between the leading line break and the blank line
+    std::string_view block = end > 2 ? std::string_view(carry).substr(2, end - 2) : std::string_view();
+    while (!block.empty())
+    {
+        size_t line_end = block.find("\r\n");
+        auto line = block.substr(0, line_end);
+        block.remove_prefix(line_end == std::string_view::npos ? block.size() : line_end + 2);
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+        {
+            state = State::FAILED;
+            return false;
+        }
+        part.headers.emplace_back(trim(line.substr(0, colon)), trim(line.substr(colon + 1)));
+    }
+
+    auto disposition = part.header("content-disposition");
+    part.name = header_parameter(disposition, "name");
+    part.filename = header_parameter(disposition, "filename");
+    part.content_type = part.header("content-type");
+
+    carry.clear();
+    state = events.on_part(part) ? State::BODY : State::FAILED;
+    return state == State::BODY;
+}
+
+bool UrlencodedParser::feed(std::string_view chunk, const FormEvents& events)
+{
+    // Decoded value bytes of this chunk, passed on at the end of the field or the chunk
+    static thread_local std::string value;
+    value.clear();
+
+    auto flush_value = [&]() {
+        if (!value.empty() && !events.on_data(value)) { failed = true; }
+        value.clear();
+        return !failed;
+    };
+
+    if (failed) { return false; }
+
+    for (char c : chunk)
+    {
+        char decoded;
+        if (escape_digits >= 0)
+        {
+            int digit = hex_value(c);
+            if (digit < 0)
+            {
+                failed = true;
+                return false;
+            }
+            escape_value = static_cast<uint8_t>(escape_value * 16 + digit);
+            if (++escape_digits < 2) { continue; }
+            escape_digits = -1;
+            decoded = static_cast<char>(escape_value);
+        }
+        else if (c == '%')
+        {
+            escape_digits = 0;
+            escape_value = 0;
+            continue;
+        }
+        else if (c == '&')
+        {
+            if (in_value)
+            {
+                if (!flush_value()) { return false; }
+                in_value = false;
+            }
+            // A field without '=' still counts, empty ones between two '&' don't
+            else if (!name.empty() && !end_name(events)) { return false; }
+            continue;
+        }
+        else if (c == '=' && !in_value)
+        {
+            if (!end_name(events)) { return false; }
+            in_value = true;
+            continue;
+        }
+        else { decoded = c == '+' ? ' ' : c; }
+
+        if (in_value) { value += decoded; }
+        else if (name.size() < max_part_header_size) { name += decoded; }
+        else
+        {
+            failed = true;
+            return false;
+        }
+    }
+
+    return flush_value();
+}
+
+bool UrlencodedParser::finish(const FormEvents& events)
+{
+    if (failed || escape_digits >= 0) { return false; }
+    if (!in_value && !name.empty()) { return end_name(events); }
+    return true;
+}
+
+bool UrlencodedParser::end_name(const FormEvents& events)
+{
+    FormPart part;
+    part.name = std::move(name);
+    name.clear();
+    if (!events.on_part(part)) { failed = true; }
+    return !failed;
+}
+
+Upload::Upload(Request&& request, std::shared_ptr<const UploadHandler> handler)
+    : _request(std::move(request)), handler(std::move(handler))
+{
+    events.on_part = [this](const FormPart& part) { return !this->handler->on_part || this->handler->on_part(*this, part); };
+    events.on_data = [this](std::string_view data) { return !this->handler->on_data || this->handler->on_data(*this, data); };
+
+    auto content_type = _request.header("content-type");
+    auto media_type = trim(content_type.substr(0, content_type.find(';')));
+    if (iequals(media_type, "multipart/form-data"))
+    {
+        // RFC 2046 boundaries are 1 to 70 characters
+        auto boundary = header_parameter(content_type, "boundary");
+        if (boundary.empty() || boundary.size() > 70) { failed = true; }
+        else { multipart.emplace(boundary); }
+    }
+    else if (iequals(media_type, "application/x-www-form-urlencoded")) { urlencoded.emplace(); }
+    else
+    {
+        // Any other body is a single part
+        FormPart part;
+        part.content_type = content_type;
+        failed = !events.on_part(part);
+    }
+}
+
+bool Upload::feed(std::string_view data)
+{
+    if (failed) { return false; }
+
+    if (multipart) { failed = !multipart->feed(data, events); }
+    else if (urlencoded) { failed = !urlencoded->feed(data, events); }
+    else { failed = !events.on_data(data); }
+    return !failed;
+}
+
+Response Upload::finish()
+{
+    if (!failed && urlencoded) { failed = !urlencoded->finish(events); }
+    if (!failed && multipart && !multipart->complete()) { failed = true; }
+
+    if (failed)
+    {
+        abort();
+        return Response::with_status(400, "Bad Request");
+    }
+    return handler->on_end ? handler->on_end(*this) : Response::with_status(200, "OK");
+}
+
+void Upload::abort()
+{
+    if (aborted) { return; }
+    aborted = true;
+    if (handler->on_abort) { handler->on_abort(*this); }
+}
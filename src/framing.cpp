@@ -0,0 +1,168 @@
+#include "framing.hpp"
+#include "common.hpp"
+#include "request_limits.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+// Longest chunk size line (extensions included) or trailer field we wait for
+constexpr size_t max_chunk_line = 4 * 1024;
+
+static std::string_view trim(std::string_view value)
+{
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+    return value;
+}
+
+RequestFraming request_framing(std::string_view head)
+{
+    RequestFraming framing;
+
+    size_t line_end = head.find("\r\n");
+    if (line_end == std::string_view::npos) { return framing; }
+    bool http10 = head.substr(0, line_end).ends_with("HTTP/1.0");
+
+    bool has_length = false;
+    bool has_encoding = false;
+    size_t codings = 0;
+    size_t chunked_codings = 0;
+    bool chunked_last = false;
+
+    size_t start = line_end + 2;
+    while (start < head.size())
+    {
+        size_t end = head.find("\r\n", start);
+        if (end == std::string_view::npos) { end = head.size(); }
+        auto line = head.substr(start, end - start);
+        start = end + 2;
+        if (line.empty()) { break; }
+
+        // Line folding and whitespace before the colon are how one field is hidden from another parser
+        size_t colon = line.find(':');
+        auto name = line.substr(0, colon);
+        if (colon == std::string_view::npos || name.empty() || line.front() == ' ' || line.front() == '\t' ||
+            name.find_first_of(" \t") != std::string_view::npos)
+        {
+            framing.rejection = bad_request_response;
+            return framing;
+        }
+        auto value = trim(line.substr(colon + 1));
+
+        if (iequals(name, "Content-Length"))
+        {
+            // Even a repeat of the same value, a comma list included
+            if (has_length || value.empty() || value.find_first_not_of("0123456789") != std::string_view::npos)
+            {
+                framing.rejection = bad_request_response;
+                return framing;
+            }
+            has_length = true;
+
+            auto result = std::from_chars(value.data(), value.data() + value.size(), framing.content_length);
+            if (result.ec == std::errc::result_out_of_range) { framing.content_length = SIZE_MAX; }
+        }
+        else if (iequals(name, "Transfer-Encoding"))
+        {
+            has_encoding = true;
+            while (!value.empty())
+            {
+                size_t comma = value.find(',');
+                auto coding = trim(value.substr(0, comma));
+                value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+                if (coding.empty()) { continue; }
+
+                codings++;
+                chunked_last = iequals(coding, "chunked");
+                if (chunked_last) { chunked_codings++; }
+            }
+        }
+    }
+
+    if (has_encoding)
+    {
+        // Either could be the one another hop believes, HTTP/1.0 never had Transfer-Encoding
+        if (has_length || http10 || !chunked_last || chunked_codings > 1) { framing.rejection = bad_request_response; }
+        // gzip, chunked and the like: we only undo chunked
+        else if (codings > 1) { framing.rejection = not_implemented_response; }
+        framing.chunked = framing.rejection.empty();
+        framing.content_length = 0;
+        return framing;
+    }
+
+    if (framing.content_length == SIZE_MAX) { framing.rejection = content_too_large_response; }
+    return framing;
+}
+
+void ChunkedDecoder::reset()
+{
+    state = State::SIZE;
+    body_size = 0;
+    offset = 0;
+    remaining = 0;
+}
+
+ChunkedDecoder::Result ChunkedDecoder::decode(std::vector<char>& buffer, size_t body_start, size_t limit)
+{
+    if (offset == 0) { offset = body_start; }
+
+    while (true)
+    {
+        std::string_view input(buffer.data() + offset, buffer.size() - offset);
+
+        if (state == State::DATA)
+        {
+            size_t take = static_cast<size_t>(std::min<uint64_t>(remaining, input.size()));
+            size_t to = body_start + body_size;
+            if (take > 0 && to != offset) { memmove(buffer.data() + to, buffer.data() + offset, take); }
+            body_size += take;
+            offset += take;
+            remaining -= take;
+            if (remaining > 0) { return Result::INCOMPLETE; }
+            state = State::DATA_END;
+            continue;
+        }
+
+        if (state == State::DATA_END)
+        {
+            if (input.size() < 2) { return Result::INCOMPLETE; }
+            if (input[0] != '\r' || input[1] != '\n') { return Result::INVALID; }
+            offset += 2;
+            state = State::SIZE;
+            continue;
+        }
+
+        size_t end = input.find("\r\n");
+        if (end == std::string_view::npos) { return input.size() > max_chunk_line ? Result::INVALID : Result::INCOMPLETE; }
+        if (end > max_chunk_line) { return Result::INVALID; }
+        auto line = input.substr(0, end);
+        offset += end + 2;
+
+        if (state == State::TRAILER)
+        {
+            // Trailer fields are dropped, the empty line ends the request
+            if (line.empty()) { return Result::DONE; }
+            continue;
+        }
+
+        uint64_t size = 0;
+        auto [digits_end, ec] = std::from_chars(line.data(), line.data() + line.size(), size, 16);
+        if (digits_end == line.data()) { return Result::INVALID; }
+        if (ec == std::errc::result_out_of_range) { return Result::TOO_LARGE; }
+
+        // Chunk extensions are ignored, anything else after the size isn't allowed
+        auto rest = trim(std::string_view(digits_end, line.data() + line.size() - digits_end));
+        if (!rest.empty() && rest.front() != ';') { return Result::INVALID; }
+
+        if (size == 0)
+        {
+            state = State::TRAILER;
+            continue;
+        }
+        if (size > limit - std::min(limit, body_size)) { return Result::TOO_LARGE; }
+
+        remaining = size;
+        state = State::DATA;
+    }
+}
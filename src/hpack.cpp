@@ -0,0 +1,505 @@
+#include "hpack.hpp"
+
+#include <array>
+
+struct StaticEntry
+{
+    std::string_view name;
+    std::string_view value;
+};
+
+static constexpr StaticEntry static_table[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+constexpr size_t static_table_size = sizeof(static_table) / sizeof(static_table[0]);
+constexpr size_t entry_overhead = 32;
+
+struct HuffmanCode
+{
+    uint32_t code;
+    uint8_t bits;
+};
+
+// RFC 7541 Appendix B, symbol 256 is EOS
+static constexpr HuffmanCode huffman_codes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+namespace huffman
+{
+
+struct DecodeNode
+{
+    int16_t children[2] = {-1, -1};
+    int16_t symbol = -1;
+};
+
+// Binary tree over huffman_codes, built on first use
+static const std::vector<DecodeNode>& decode_tree()
+{
+    static const std::vector<DecodeNode> tree = [] {
+        std::vector<DecodeNode> nodes(1);
+        for (int symbol = 0; symbol < 257; symbol++)
+        {
+            size_t node = 0;
+            for (int bit = huffman_codes[symbol].bits - 1; bit >= 0; bit--)
+            {
+                int branch = (huffman_codes[symbol].code >> bit) & 1;
+                if (nodes[node].children[branch] == -1)
+                {
+                    nodes[node].children[branch] = static_cast<int16_t>(nodes.size());
+                    nodes.emplace_back();
+                }
+                node = nodes[node].children[branch];
+            }
+            nodes[node].symbol = static_cast<int16_t>(symbol);
+        }
+        return nodes;
+    }();
+    return tree;
+}
+
+size_t encoded_length(std::string_view input)
+{
+    size_t bits = 0;
+    for (unsigned char c : input) { bits += huffman_codes[c].bits; }
+    return (bits + 7) / 8;
+}
+
+void encode(std::string_view input, std::string& out)
+{
+    uint64_t accumulator = 0;
+    int pending = 0;
+
+    for (unsigned char c : input)
+    {
+        accumulator = (accumulator << huffman_codes[c].bits) | huffman_codes[c].code;
+        pending += huffman_codes[c].bits;
+        while (pending >= 8)
+        {
+            pending -= 8;
+            out.push_back(static_cast<char>(accumulator >> pending));
+        }
+    }
+
+    // Pad with the most significant bits of EOS, all ones
+    if (pending > 0) { out.push_back(static_cast<char>((accumulator << (8 - pending)) | (0xff >> pending))); }
+}
+
+bool decode(std::string_view input, std::string& out)
+{
+    const auto& tree = decode_tree();
+    size_t node = 0;
+    int depth = 0;
+    bool all_ones = true;
+
+    for (unsigned char byte : input)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            int branch = (byte >> bit) & 1;
+            int16_t next = tree[node].children[branch];
+            if (next == -1) { return false; }
+            node = next;
+            depth++;
+            all_ones = all_ones && branch == 1;
+
+            if (tree[node].symbol != -1)
+            {
+                if (tree[node].symbol == 256) { return false; }
+                out.push_back(static_cast<char>(tree[node].symbol));
+                node = 0;
+                depth = 0;
+                all_ones = true;
+            }
+        }
+    }
+
+    // Anything left over must be a short prefix of EOS
+    return depth < 8 && all_ones;
+}
+
+} // namespace huffman
+
+void HpackTable::add(std::string_view name, std::string_view value)
+{
+    size_t entry_size = name.size() + value.size() + entry_overhead;
+
+    // An entry larger than the whole table just empties it
+    if (entry_size > _max_size)
+    {
+        entries.clear();
+        size = 0;
+        return;
+    }
+
+    entries.push_front({std::string(name), std::string(value)});
+    size += entry_size;
+    evict();
+}
+
+void HpackTable::set_max_size(size_t max_size)
+{
+    _max_size = max_size;
+    evict();
+}
+
+void HpackTable::evict()
+{
+    while (size > _max_size && !entries.empty())
+    {
+        size -= entries.back().name.size() + entries.back().value.size() + entry_overhead;
+        entries.pop_back();
+    }
+}
+
+const HeaderField* HpackTable::get(size_t index) const
+{
+    if (index == 0) { return nullptr; }
+    if (index <= static_table_size)
+    {
+        // Static entries are materialized once so callers get a HeaderField like for dynamic ones
+        static const std::vector<HeaderField> fields = [] {
+            std::vector<HeaderField> result;
+            for (const auto& entry : static_table) { result.push_back({std::string(entry.name), std::string(entry.value)}); }
+            return result;
+        }();
+        return &fields[index - 1];
+    }
+
+    index -= static_table_size + 1;
+    return index < entries.size() ? &entries[index] : nullptr;
+}
+
+size_t HpackTable::find(std::string_view name, std::string_view value, bool& value_match) const
+{
+    size_t name_index = 0;
+    value_match = false;
+
+    for (size_t i = 0; i < static_table_size; i++)
+    {
+        if (static_table[i].name != name) { continue; }
+        if (static_table[i].value == value)
+        {
+            value_match = true;
+            return i + 1;
+        }
+        if (name_index == 0) { name_index = i + 1; }
+    }
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (entries[i].name != name) { continue; }
+        if (entries[i].value == value)
+        {
+            value_match = true;
+            return static_table_size + i + 1;
+        }
+        if (name_index == 0) { name_index = static_table_size + i + 1; }
+    }
+
+    return name_index;
+}
+
+static void encode_integer(uint64_t value, int prefix_bits, uint8_t flags, std::string& out)
+{
+    uint64_t limit = (1u << prefix_bits) - 1;
+    if (value < limit)
+    {
+        out.push_back(static_cast<char>(flags | value));
+        return;
+    }
+
+    out.push_back(static_cast<char>(flags | limit));
+    value -= limit;
+    while (value >= 128)
+    {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static bool decode_integer(std::string_view block, size_t& position, int prefix_bits, uint64_t& value)
+{
+    if (position >= block.size()) { return false; }
+
+    uint64_t limit = (1u << prefix_bits) - 1;
+    value = static_cast<unsigned char>(block[position++]) & limit;
+    if (value < limit) { return true; }
+
+    for (int shift = 0; shift <= 56; shift += 7)
+    {
+        if (position >= block.size()) { return false; }
+        unsigned char byte = block[position++];
+        value += static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) { return true; }
+    }
+
+    // Longer than any sane length or index
+    return false;
+}
+
+static void encode_string(std::string_view value, std::string& out)
+{
+    size_t huffman_length = huffman::encoded_length(value);
+    if (huffman_length < value.size())
+    {
+        encode_integer(huffman_length, 7, 0x80, out);
+        huffman::encode(value, out);
+    }
+    else
+    {
+        encode_integer(value.size(), 7, 0, out);
+        out.append(value);
+    }
+}
+
+static bool decode_string(std::string_view block, size_t& position, std::string& out)
+{
+    if (position >= block.size()) { return false; }
+    bool is_huffman = static_cast<unsigned char>(block[position]) & 0x80;
+
+    uint64_t length = 0;
+    if (!decode_integer(block, position, 7, length) || length > block.size() - position) { return false; }
+
+    auto bytes = block.substr(position, length);
+    position += length;
+
+    out.clear();
+    if (is_huffman) { return huffman::decode(bytes, out); }
+    out.assign(bytes);
+    return true;
+}
+
+HpackDecoder::Result HpackDecoder::decode(std::string_view block, HeaderList& headers)
+{
+    // RFC 9113 section 6.5.2: uncompressed name and value lengths plus 32 for each field
+    static constexpr size_t field_overhead = 32;
+
+    size_t position = 0;
+    bool seen_field = false;
+    size_t list_size = 0;
+    auto fits = [&](size_t name, size_t value) {
+        size_t field = name + value + field_overhead;
+        if (field > max_header_list_size - std::min(list_size, max_header_list_size)) { return false; }
+        list_size += field;
+        return true;
+    };
+
+    while (position < block.size())
+    {
+        unsigned char first = block[position];
+        uint64_t index = 0;
+
+        if (first & 0x80)
+        {
+            // Indexed field
+            if (!decode_integer(block, position, 7, index)) { return Result::INVALID; }
+            auto field = table.get(index);
+            if (!field) { return Result::INVALID; }
+            if (!fits(field->name.size(), field->value.size())) { return Result::TOO_LARGE; }
+            headers.push_back(*field);
+            seen_field = true;
+            continue;
+        }
+
+        if ((first & 0xe0) == 0x20)
+        {
+            // Table size updates are only allowed before the first field of a block
+            if (seen_field || !decode_integer(block, position, 5, index) || index > max_allowed_size) { return Result::INVALID; }
+            table.set_max_size(index);
+            continue;
+        }
+
+        bool incremental = (first & 0xc0) == 0x40;
+        if (!decode_integer(block, position, incremental ? 6 : 4, index)) { return Result::INVALID; }
+
+        HeaderField field;
+        if (index != 0)
+        {
+            auto name = table.get(index);
+            if (!name) { return Result::INVALID; }
+            field.name = name->name;
+        }
+        else if (!decode_string(block, position, field.name)) { return Result::INVALID; }
+
+        if (!decode_string(block, position, field.value)) { return Result::INVALID; }
+
+        if (!fits(field.name.size(), field.value.size())) { return Result::TOO_LARGE; }
+        if (incremental) { table.add(field.name, field.value); }
+        headers.push_back(std::move(field));
+        seen_field = true;
+    }
+
+    return Result::OK;
+}
+
+void HpackEncoder::set_max_table_size(size_t size)
+{
+    // Never grow past the default, a bigger table only costs us memory
+    pending_table_size = std::min(size, hpack_default_table_size);
+}
+
+void HpackEncoder::begin_block(std::string& out)
+{
+    if (pending_table_size == SIZE_MAX) { return; }
+
+    table.set_max_size(pending_table_size);
+    encode_integer(pending_table_size, 5, 0x20, out);
+    pending_table_size = SIZE_MAX;
+}
+
+// Values that change with every response would only churn the dynamic table
+static bool is_indexable(std::string_view name)
+{
+    return name != "content-length" && name != "etag" && name != "last-modified" && name != "content-range" &&
+           name != "location" && name != "set-cookie";
+}
+
+void HpackEncoder::encode(std::string_view name, std::string_view value, std::string& out)
+{
+    bool value_match = false;
+    size_t index = table.find(name, value, value_match);
+
+    if (value_match)
+    {
+        encode_integer(index, 7, 0x80, out);
+        return;
+    }
+
+    bool indexable = is_indexable(name);
+    if (indexable) { encode_integer(index, 6, 0x40, out); }
+    // Cookies are marked never-indexed so intermediaries don't put them in their tables either
+    else { encode_integer(index, 4, name == "set-cookie" ? 0x10 : 0x00, out); }
+
+    if (index == 0) { encode_string(name, out); }
+    encode_string(value, out);
+
+    if (indexable) { table.add(name, value); }
+}
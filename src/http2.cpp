@@ -0,0 +1,762 @@
+#include "http2.hpp"
+#include "common.hpp"
+#include "http_date.hpp"
+
+#include <algorithm>
+#include <charconv>
+
+enum FrameType : uint8_t
+{
+    FRAME_DATA = 0x0,
+    FRAME_HEADERS = 0x1,
+    FRAME_PRIORITY = 0x2,
+    FRAME_RST_STREAM = 0x3,
+    FRAME_SETTINGS = 0x4,
+    FRAME_PUSH_PROMISE = 0x5,
+    FRAME_PING = 0x6,
+    FRAME_GOAWAY = 0x7,
+    FRAME_WINDOW_UPDATE = 0x8,
+    FRAME_CONTINUATION = 0x9
+};
+
+enum FrameFlag : uint8_t
+{
+    FLAG_END_STREAM = 0x1,
+    FLAG_ACK = 0x1,
+    FLAG_END_HEADERS = 0x4,
+    FLAG_PADDED = 0x8,
+    FLAG_PRIORITY = 0x20
+};
+
+enum ErrorCode : uint32_t
+{
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    CANCEL = 0x8,
+    COMPRESSION_ERROR = 0x9,
+    ENHANCE_YOUR_CALM = 0xb
+};
+
+enum SettingId : uint16_t
+{
+    SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    SETTINGS_ENABLE_PUSH = 0x2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    SETTINGS_MAX_FRAME_SIZE = 0x5,
+    SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+};
+
+constexpr size_t frame_header_size = 9;
+constexpr int64_t max_window = 0x7fffffff;
+
+static uint32_t read_u32(std::string_view bytes)
+{
+    return (static_cast<uint32_t>(static_cast<unsigned char>(bytes[0])) << 24) |
+           (static_cast<uint32_t>(static_cast<unsigned char>(bytes[1])) << 16) |
+           (static_cast<uint32_t>(static_cast<unsigned char>(bytes[2])) << 8) |
+           static_cast<uint32_t>(static_cast<unsigned char>(bytes[3]));
+}
+
+static void write_u32(char* out, uint32_t value)
+{
+    out[0] = static_cast<char>(value >> 24);
+    out[1] = static_cast<char>(value >> 16);
+    out[2] = static_cast<char>(value >> 8);
+    out[3] = static_cast<char>(value);
+}
+
+// HTTP2-Settings is the SETTINGS payload in base64url without padding
+static bool decode_base64url(std::string_view input, std::string& out)
+{
+    uint32_t accumulator = 0;
+    int bits = 0;
+
+    for (char c : input)
+    {
+        int value;
+        if (c >= 'A' && c <= 'Z') { value = c - 'A'; }
+        else if (c >= 'a' && c <= 'z') { value = c - 'a' + 26; }
+        else if (c >= '0' && c <= '9') { value = c - '0' + 52; }
+        else if (c == '-' || c == '+') { value = 62; }
+        else if (c == '_' || c == '/') { value = 63; }
+        else if (c == '=') { break; }
+        else { return false; }
+
+        accumulator = (accumulator << 6) | value;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back(static_cast<char>(accumulator >> bits));
+        }
+    }
+    return true;
+}
+
+// Hop-by-hop headers are meaningless in HTTP/2 and make the message malformed
+static bool is_connection_specific(std::string_view name)
+{
+    return iequals(name, "connection") || iequals(name, "keep-alive") || iequals(name, "transfer-encoding") ||
+           iequals(name, "upgrade") || iequals(name, "proxy-connection");
+}
+
+// Malformed requests (RFC 9113 section 8.2.1, 8.3.1) are refused before they are turned into HTTP/1.1
+// text: a line break in a value or a space in :path would add header lines or end the head early
+static bool is_valid_request(const HeaderList& headers)
+{
+    bool regular_seen = false;
+    bool has_method = false, has_scheme = false, has_path = false, has_authority = false;
+    std::string_view method, path;
+
+    for (const auto& header : headers)
+    {
+        if (!is_field_value(header.value)) { return false; }
+
+        if (header.name.starts_with(':'))
+        {
+            if (regular_seen) { return false; }
+
+            bool* seen = nullptr;
+            if (header.name == ":method")
+            {
+                seen = &has_method;
+                method = header.value;
+            }
+            else if (header.name == ":path")
+            {
+                seen = &has_path;
+                path = header.value;
+            }
+            else if (header.name == ":scheme") { seen = &has_scheme; }
+            else if (header.name == ":authority") { seen = &has_authority; }
+
+            if (!seen || *seen) { return false; }
+            *seen = true;
+            continue;
+        }
+
+        regular_seen = true;
+        if (!is_field_name(header.name)) { return false; }
+        for (char c : header.name)
+        {
+            if (c >= 'A' && c <= 'Z') { return false; }
+        }
+    }
+
+    if (!has_scheme || !is_field_name(method)) { return false; }
+    if (!path.starts_with('/') && !(path == "*" && method == "OPTIONS")) { return false; }
+    for (unsigned char c : path)
+    {
+        if (c <= ' ' || c == 0x7f) { return false; }
+    }
+    return true;
+}
+
+// Encodes serialized "Name: value\r\n" lines, HTTP/2 field names are lowercase
+static void encode_header_lines(HpackEncoder& encoder, std::string_view lines, std::string& block)
+{
+    std::string name;
+    while (!lines.empty())
+    {
+        size_t end = lines.find("\r\n");
+        auto line = lines.substr(0, end);
+        lines.remove_prefix(end == std::string_view::npos ? lines.size() : end + 2);
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || is_connection_specific(line.substr(0, colon))) { continue; }
+
+        name.assign(line.substr(0, colon));
+        for (auto& c : name)
+        {
+            if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        }
+
+        auto value = line.substr(colon + 1);
+        while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+        encoder.encode(name, value, block);
+    }
+}
+
+Http2Session::Http2Session(OutputQueue& out, Dispatch dispatch) : out(out), dispatch(std::move(dispatch))
+{
+    decoder.set_max_header_list_size(http2_max_header_list_size);
+}
+
+void Http2Session::start()
+{
+    send_settings();
+}
+
+bool Http2Session::start_upgraded(Request& request, std::string_view settings)
+{
+    std::string payload;
+    if (!decode_base64url(settings, payload) || payload.size() % 6 != 0) { return false; }
+
+    send_settings();
+    if (!apply_settings(payload)) { return false; }
+
+    // The upgrade request is stream 1, half-closed on the client side already
+    last_stream_id = 1;
+    Stream& stream = streams[1];
+    stream.request_complete = true;
+    stream.send_window = peer_initial_window;
+    respond(1, stream, request);
+    return true;
+}
+
+bool Http2Session::receive(std::vector<char>& data, size_t& budget)
+{
+    if (failed) { return false; }
+    dispatched = 0;
+
+    size_t position = 0;
+    std::string_view bytes(data.data(), data.size());
+
+    if (!preface_received)
+    {
+        size_t compared = std::min(bytes.size(), http2_preface.size());
+        if (bytes.substr(0, compared) != http2_preface.substr(0, compared)) { return connection_error(PROTOCOL_ERROR); }
+        if (compared < http2_preface.size()) { return true; }
+
+        preface_received = true;
+        position = http2_preface.size();
+    }
+
+    // A frame completes at most one request, so stopping between frames keeps to the budget
+    while (dispatched < budget && bytes.size() - position >= frame_header_size)
+    {
+        auto header = bytes.substr(position, frame_header_size);
+        size_t length = (static_cast<size_t>(static_cast<unsigned char>(header[0])) << 16) |
+                        (static_cast<size_t>(static_cast<unsigned char>(header[1])) << 8) |
+                        static_cast<size_t>(static_cast<unsigned char>(header[2]));
+
+        // We never raise SETTINGS_MAX_FRAME_SIZE
+        if (length > http2_default_max_frame_size) { return connection_error(FRAME_SIZE_ERROR); }
+        if (bytes.size() - position < frame_header_size + length) { break; }
+
+        uint8_t type = header[3];
+        uint8_t flags = header[4];
+        uint32_t stream_id = read_u32(header.substr(5)) & 0x7fffffff;
+
+        // The client preface ends with a SETTINGS frame
+        if (!settings_received && type != FRAME_SETTINGS) { return connection_error(PROTOCOL_ERROR); }
+
+        if (!handle_frame(type, flags, stream_id, bytes.substr(position + frame_header_size, length)))
+        {
+            data.clear();
+            return false;
+        }
+        position += frame_header_size + length;
+    }
+
+    budget -= dispatched;
+    data.erase(data.begin(), data.begin() + position);
+    return true;
+}
+
+bool Http2Session::handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    // A header block has to be finished before anything else may be sent on the connection
+    if (continuation_stream != 0 && (type != FRAME_CONTINUATION || stream_id != continuation_stream))
+    {
+        return connection_error(PROTOCOL_ERROR);
+    }
+
+    switch (type)
+    {
+        case FRAME_DATA: return handle_data(flags, stream_id, payload);
+        case FRAME_HEADERS: return handle_headers(flags, stream_id, payload);
+        case FRAME_SETTINGS: return handle_settings(flags, stream_id, payload);
+        case FRAME_WINDOW_UPDATE: return handle_window_update(stream_id, payload);
+
+        case FRAME_PRIORITY:
+            // Prioritization is deprecated by RFC 9113, streams are served round robin
+            if (stream_id == 0) { return connection_error(PROTOCOL_ERROR); }
+            if (payload.size() != 5) { return connection_error(FRAME_SIZE_ERROR); }
+            return true;
+
+        case FRAME_RST_STREAM:
+            if (stream_id == 0 || stream_id > last_stream_id) { return connection_error(PROTOCOL_ERROR); }
+            if (payload.size() != 4) { return connection_error(FRAME_SIZE_ERROR); }
+            streams.erase(stream_id);
+            return true;
+
+        case FRAME_PING:
+            if (stream_id != 0) { return connection_error(PROTOCOL_ERROR); }
+            if (payload.size() != 8) { return connection_error(FRAME_SIZE_ERROR); }
+            if (!(flags & FLAG_ACK))
+            {
+                write_frame_header(8, FRAME_PING, FLAG_ACK, 0);
+                out.append(payload);
+            }
+            return true;
+
+        case FRAME_GOAWAY:
+            if (stream_id != 0) { return connection_error(PROTOCOL_ERROR); }
+            // Finish what's in flight, then close
+            going_away = true;
+            return true;
+
+        case FRAME_CONTINUATION:
+            if (continuation_stream == 0) { return connection_error(PROTOCOL_ERROR); }
+            if (header_block.size() + payload.size() > http2_max_header_block_size) { return connection_error(ENHANCE_YOUR_CALM); }
+            header_block.append(payload);
+            if (flags & FLAG_END_HEADERS) { return handle_header_block(stream_id, continuation_end_stream); }
+            return true;
+
+        // Clients can't push
+        case FRAME_PUSH_PROMISE: return connection_error(PROTOCOL_ERROR);
+
+        // Unknown frame types must be ignored
+        default: return true;
+    }
+}
+
+bool Http2Session::handle_headers(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (stream_id == 0) { return connection_error(PROTOCOL_ERROR); }
+
+    if (flags & FLAG_PADDED)
+    {
+        if (payload.empty()) { return connection_error(PROTOCOL_ERROR); }
+        size_t padding = static_cast<unsigned char>(payload[0]);
+        payload.remove_prefix(1);
+        if (padding > payload.size()) { return connection_error(PROTOCOL_ERROR); }
+        payload.remove_suffix(padding);
+    }
+
+    if (flags & FLAG_PRIORITY)
+    {
+        if (payload.size() < 5) { return connection_error(FRAME_SIZE_ERROR); }
+        payload.remove_prefix(5);
+    }
+
+    header_block.assign(payload);
+    continuation_stream = stream_id;
+    continuation_end_stream = flags & FLAG_END_STREAM;
+
+    if (flags & FLAG_END_HEADERS) { return handle_header_block(stream_id, continuation_end_stream); }
+    return true;
+}
+
+bool Http2Session::handle_header_block(uint32_t stream_id, bool end_stream)
+{
+    continuation_stream = 0;
+
+    // Decoded even for streams we refuse, the HPACK state is shared by the whole connection
+    HeaderList headers;
+    auto decoded = decoder.decode(header_block, headers);
+    header_block.clear();
+    if (decoded == HpackDecoder::Result::TOO_LARGE) { return connection_error(ENHANCE_YOUR_CALM); }
+    if (decoded != HpackDecoder::Result::OK) { return connection_error(COMPRESSION_ERROR); }
+
+    auto it = streams.find(stream_id);
+    if (it != streams.end())
+    {
+        // Trailers, they have to end the request and we ignore their content
+        Stream& stream = it->second;
+        if (stream.request_complete)
+        {
+            send_rst_stream(stream_id, STREAM_CLOSED);
+            streams.erase(it);
+            return true;
+        }
+        if (!end_stream) { return connection_error(PROTOCOL_ERROR); }
+
+        stream.request_complete = true;
+        dispatch_stream(stream_id, stream);
+        return true;
+    }
+
+    // Client streams are odd and increasing, anything else reopens a closed stream
+    if (stream_id % 2 == 0 || stream_id <= last_stream_id) { return connection_error(PROTOCOL_ERROR); }
+    last_stream_id = stream_id;
+
+    if (going_away || streams.size() >= http2_max_concurrent_streams)
+    {
+        send_rst_stream(stream_id, REFUSED_STREAM);
+        return true;
+    }
+
+    if (!is_valid_request(headers))
+    {
+        send_rst_stream(stream_id, PROTOCOL_ERROR);
+        return true;
+    }
+
+    Stream& stream = streams[stream_id];
+    stream.headers = std::move(headers);
+    stream.send_window = peer_initial_window;
+
+    if (end_stream)
+    {
+        stream.request_complete = true;
+        dispatch_stream(stream_id, stream);
+    }
+    return true;
+}
+
+bool Http2Session::handle_data(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (stream_id == 0 || stream_id > last_stream_id) { return connection_error(PROTOCOL_ERROR); }
+
+    // Padding counts against flow control too
+    uint32_t flow_length = static_cast<uint32_t>(payload.size());
+    if (flags & FLAG_PADDED)
+    {
+        if (payload.empty()) { return connection_error(PROTOCOL_ERROR); }
+        size_t padding = static_cast<unsigned char>(payload[0]);
+        payload.remove_prefix(1);
+        if (padding > payload.size()) { return connection_error(PROTOCOL_ERROR); }
+        payload.remove_suffix(padding);
+    }
+
+    // Bodies are buffered whole, so the window is handed straight back
+    if (flow_length > 0) { send_window_update(0, flow_length); }
+
+    auto it = streams.find(stream_id);
+    if (it == streams.end() || it->second.request_complete)
+    {
+        send_rst_stream(stream_id, STREAM_CLOSED);
+        return true;
+    }
+
+    Stream& stream = it->second;
+    if (stream.body.size() + payload.size() > http2_max_body_size)
+    {
+        send_rst_stream(stream_id, ENHANCE_YOUR_CALM);
+        streams.erase(it);
+        return true;
+    }
+
+    stream.body.insert(stream.body.end(), payload.begin(), payload.end());
+
+    if (flags & FLAG_END_STREAM)
+    {
+        stream.request_complete = true;
+        dispatch_stream(stream_id, stream);
+    }
+    else if (flow_length > 0) { send_window_update(stream_id, flow_length); }
+
+    return true;
+}
+
+bool Http2Session::handle_settings(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (stream_id != 0) { return connection_error(PROTOCOL_ERROR); }
+
+    if (flags & FLAG_ACK)
+    {
+        if (!payload.empty()) { return connection_error(FRAME_SIZE_ERROR); }
+        return true;
+    }
+
+    if (payload.size() % 6 != 0) { return connection_error(FRAME_SIZE_ERROR); }
+    if (!apply_settings(payload)) { return false; }
+
+    settings_received = true;
+    write_frame_header(0, FRAME_SETTINGS, FLAG_ACK, 0);
+    return true;
+}
+
+bool Http2Session::apply_settings(std::string_view payload)
+{
+    for (size_t i = 0; i + 6 <= payload.size(); i += 6)
+    {
+        uint16_t id = (static_cast<uint16_t>(static_cast<unsigned char>(payload[i])) << 8) |
+                      static_cast<unsigned char>(payload[i + 1]);
+        uint32_t value = read_u32(payload.substr(i + 2));
+
+        switch (id)
+        {
+            case SETTINGS_HEADER_TABLE_SIZE: encoder.set_max_table_size(value); break;
+
+            case SETTINGS_ENABLE_PUSH:
+                if (value > 1) { return connection_error(PROTOCOL_ERROR); }
+                break;
+
+            case SETTINGS_INITIAL_WINDOW_SIZE:
+            {
+                if (value > max_window) { return connection_error(FLOW_CONTROL_ERROR); }
+
+                // Applies retroactively to every open stream
+                int64_t delta = static_cast<int64_t>(value) - peer_initial_window;
+                for (auto& [id, stream] : streams)
+                {
+                    stream.send_window += delta;
+                    if (stream.send_window > max_window) { return connection_error(FLOW_CONTROL_ERROR); }
+                }
+                peer_initial_window = value;
+                break;
+            }
+
+            case SETTINGS_MAX_FRAME_SIZE:
+                if (value < http2_default_max_frame_size || value > 0xffffff) { return connection_error(PROTOCOL_ERROR); }
+                peer_max_frame_size = value;
+                break;
+
+            default: break;
+        }
+    }
+    return true;
+}
+
+bool Http2Session::handle_window_update(uint32_t stream_id, std::string_view payload)
+{
+    if (payload.size() != 4) { return connection_error(FRAME_SIZE_ERROR); }
+    uint32_t increment = read_u32(payload) & 0x7fffffff;
+
+    if (stream_id == 0)
+    {
+        if (increment == 0) { return connection_error(PROTOCOL_ERROR); }
+        connection_send_window += increment;
+        if (connection_send_window > max_window) { return connection_error(FLOW_CONTROL_ERROR); }
+        return true;
+    }
+
+    auto it = streams.find(stream_id);
+    if (it == streams.end()) { return true; }
+
+    it->second.send_window += increment;
+    if (increment == 0 || it->second.send_window > max_window)
+    {
+        send_rst_stream(stream_id, increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+        streams.erase(it);
+    }
+    return true;
+}
+
+void Http2Session::dispatch_stream(uint32_t stream_id, Stream& stream)
+{
+    std::string_view method, path, authority;
+    std::vector<std::pair<std::string_view, std::string_view>> fields;
+    fields.reserve(stream.headers.size());
+
+    for (const auto& header : stream.headers)
+    {
+        if (header.name.starts_with(':'))
+        {
+            if (header.name == ":method") { method = header.value; }
+            else if (header.name == ":path") { path = header.value; }
+            else if (header.name == ":authority") { authority = header.value; }
+        }
+        else if (!is_connection_specific(header.name)) { fields.emplace_back(header.name, header.value); }
+    }
+
+    if (method.empty() || path.empty())
+    {
+        send_rst_stream(stream_id, PROTOCOL_ERROR);
+        stream.response_started = stream.response_complete = true;
+        return;
+    }
+
+    // Handlers look for Host like they do on HTTP/1.1
+    if (!authority.empty()) { fields.emplace_back("host", authority); }
+
+    Request request = Request::from_fields(method, path, fields, std::move(stream.body));
+    stream.headers.clear();
+    dispatched++;
+    respond(stream_id, stream, request);
+}
+
+void Http2Session::respond(uint32_t stream_id, Stream& stream, Request& request)
+{
+    Response fresh;
+    auto cached = dispatch(request, fresh);
+    // DATA frames are cut from a finished body
+    fresh.render();
+    fresh.share_body();
+    send_response(stream_id, stream, cached ? *cached : fresh);
+}
+
+void Http2Session::send_response(uint32_t stream_id, Stream& stream, const Response& response)
+{
+    int status = response.status_code();
+    bool bodyless = status < 200 || status == 204 || status == 304;
+
+    std::string block;
+    encoder.begin_block(block);
+
+    char status_text[8];
+    auto [end, ec] = std::to_chars(status_text, status_text + sizeof(status_text), status);
+    (void)ec;
+    encoder.encode(":status", std::string_view(status_text, end - status_text), block);
+
+    encode_header_lines(encoder, HttpDate::common_headers(), block);
+    if (response.type() != ContentType::NONE) { encoder.encode("content-type", Response::content_type_name(response.type()), block); }
+    encode_header_lines(encoder, response.headers(), block);
+
+    if (!bodyless && !response._stream)
+    {
+        char length[24];
+        auto [length_end, length_ec] = std::to_chars(length, length + sizeof(length), response.content_length());
+        (void)length_ec;
+        encoder.encode("content-length", std::string_view(length, length_end - length), block);
+    }
+
+    // Queue the body before framing the headers so we know whether HEADERS ends the stream
+    if (!bodyless)
+    {
+        if (response._stream) { stream.producer = response._stream; }
+        else { response.write_body(stream.pending); }
+    }
+
+    bool has_body = stream.producer || !stream.pending.empty();
+    std::string_view remaining = block;
+    bool first = true;
+
+    do
+    {
+        auto fragment = remaining.substr(0, peer_max_frame_size);
+        remaining.remove_prefix(fragment.size());
+
+        uint8_t flags = remaining.empty() ? FLAG_END_HEADERS : 0;
+        if (first && !has_body) { flags |= FLAG_END_STREAM; }
+
+        write_frame_header(fragment.size(), first ? FRAME_HEADERS : FRAME_CONTINUATION, flags, stream_id);
+        out.append(fragment);
+        first = false;
+    } while (!remaining.empty());
+
+    stream.response_started = true;
+    stream.response_complete = !has_body;
+}
+
+bool Http2Session::pump(size_t high_water)
+{
+    bool wrote = false;
+    bool progress = true;
+
+    // One DATA frame per stream per round so concurrent responses interleave
+    while (progress && out.pending_bytes() < high_water && connection_send_window > 0)
+    {
+        progress = false;
+        auto it = streams.lower_bound(next_stream);
+
+        for (size_t i = 0, count = streams.size(); i < count; i++, ++it)
+        {
+            if (it == streams.end()) { it = streams.begin(); }
+
+            Stream& stream = it->second;
+            if (!stream.response_started || stream.response_complete) { continue; }
+
+            if (pump_stream(it->first, stream))
+            {
+                progress = wrote = true;
+                next_stream = it->first + 1;
+            }
+            if (out.pending_bytes() >= high_water || connection_send_window <= 0) { break; }
+        }
+    }
+
+    std::erase_if(streams, [](const auto& entry) {
+        return entry.second.request_complete && entry.second.response_complete;
+    });
+
+    return wrote;
+}
+
+bool Http2Session::pump_stream(uint32_t stream_id, Stream& stream)
+{
+    if (stream.pending.empty() && stream.producer)
+    {
+        ChunkWriter writer(stream.pending, false);
+        if (!(*stream.producer)(writer)) { stream.producer.reset(); }
+        // The producer broke its contract, don't spin on it
+        else if (writer.written() == 0) { return false; }
+    }
+
+    size_t available = stream.pending.pending_bytes();
+    available = std::min<size_t>(available, std::max<int64_t>(connection_send_window, 0));
+    available = std::min<size_t>(available, std::max<int64_t>(stream.send_window, 0));
+    available = std::min<size_t>(available, peer_max_frame_size);
+
+    bool last = !stream.producer && available == stream.pending.pending_bytes();
+    if (available == 0 && !last) { return false; }
+
+    write_frame_header(available, FRAME_DATA, last ? FLAG_END_STREAM : 0, stream_id);
+    stream.pending.move_into(out, available);
+
+    connection_send_window -= available;
+    stream.send_window -= available;
+    if (last) { stream.response_complete = true; }
+    return true;
+}
+
+bool Http2Session::finished() const
+{
+    return failed || (going_away && streams.empty());
+}
+
+void Http2Session::write_frame_header(size_t length, uint8_t type, uint8_t flags, uint32_t stream_id)
+{
+    char header[frame_header_size];
+    header[0] = static_cast<char>(length >> 16);
+    header[1] = static_cast<char>(length >> 8);
+    header[2] = static_cast<char>(length);
+    header[3] = static_cast<char>(type);
+    header[4] = static_cast<char>(flags);
+    write_u32(header + 5, stream_id);
+    out.append(std::string_view(header, sizeof(header)));
+}
+
+void Http2Session::send_settings()
+{
+    char payload[12];
+    payload[0] = 0;
+    payload[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    write_u32(payload + 2, http2_max_concurrent_streams);
+    payload[6] = 0;
+    payload[7] = SETTINGS_MAX_HEADER_LIST_SIZE;
+    write_u32(payload + 8, http2_max_header_list_size);
+
+    write_frame_header(sizeof(payload), FRAME_SETTINGS, 0, 0);
+    out.append(std::string_view(payload, sizeof(payload)));
+}
+
+void Http2Session::send_window_update(uint32_t stream_id, uint32_t increment)
+{
+    char payload[4];
+    write_u32(payload, increment);
+    write_frame_header(sizeof(payload), FRAME_WINDOW_UPDATE, 0, stream_id);
+    out.append(std::string_view(payload, sizeof(payload)));
+}
+
+void Http2Session::send_rst_stream(uint32_t stream_id, uint32_t error)
+{
+    char payload[4];
+    write_u32(payload, error);
+    write_frame_header(sizeof(payload), FRAME_RST_STREAM, 0, stream_id);
+    out.append(std::string_view(payload, sizeof(payload)));
+}
+
+void Http2Session::shutdown()
+{
+    if (going_away) { return; }
+
+    char payload[8];
+    write_u32(payload, last_stream_id);
+    write_u32(payload + 4, NO_ERROR);
+    write_frame_header(sizeof(payload), FRAME_GOAWAY, 0, 0);
+    out.append(std::string_view(payload, sizeof(payload)));
+    going_away = true;
+}
+
+bool Http2Session::connection_error(uint32_t error)
+{
+    char payload[8];
+    write_u32(payload, last_stream_id);
+    write_u32(payload + 4, error);
+    write_frame_header(sizeof(payload), FRAME_GOAWAY, 0, 0);
+    out.append(std::string_view(payload, sizeof(payload)));
+
+    going_away = true;
+    failed = true;
+    return false;
+}
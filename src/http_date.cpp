@@ -0,0 +1,110 @@
+#include "http_date.hpp"
+
+#include <cstring>
+
+static constexpr std::string_view server_line = "Server: au_web\r\n";
+static constexpr std::string_view date_prefix = "Date: ";
+static constexpr size_t common_headers_length = server_line.size() + date_prefix.size() + http_date_length + 2;
+
+struct CommonHeaders
+{
+    char data[common_headers_length];
+    time_t rendered_at = -1;
+};
+
+static thread_local CommonHeaders common;
+
+static void write_two_digits(char* out, int value)
+{
+    out[0] = static_cast<char>('0' + value / 10);
+    out[1] = static_cast<char>('0' + value % 10);
+}
+
+void HttpDate::format(time_t time, char* out)
+{
+    static constexpr char days[7][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static constexpr char months[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                           "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    tm parts = {};
+    gmtime_r(&time, &parts);
+
+    memcpy(out, days[parts.tm_wday], 3);
+    out[3] = ',';
+    out[4] = ' ';
+    write_two_digits(out + 5, parts.tm_mday);
+    out[7] = ' ';
+    memcpy(out + 8, months[parts.tm_mon], 3);
+    out[11] = ' ';
+    int year = parts.tm_year + 1900;
+    write_two_digits(out + 12, year / 100);
+    write_two_digits(out + 14, year % 100);
+    out[16] = ' ';
+    write_two_digits(out + 17, parts.tm_hour);
+    out[19] = ':';
+    write_two_digits(out + 20, parts.tm_min);
+    out[22] = ':';
+    write_two_digits(out + 23, parts.tm_sec);
+    memcpy(out + 25, " GMT", 4);
+}
+
+static bool read_digits(std::string_view text, size_t offset, size_t count, int& out)
+{
+    out = 0;
+    for (size_t i = offset; i < offset + count; i++)
+    {
+        if (text[i] < '0' || text[i] > '9') { return false; }
+        out = out * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+bool HttpDate::parse(std::string_view text, time_t& out)
+{
+    static constexpr std::string_view months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    // "Sun, 06 Nov 1994 08:49:37 GMT"
+    if (text.size() != http_date_length || text[3] != ',' || text.substr(25) != " GMT") { return false; }
+
+    size_t month = months.find(text.substr(8, 3));
+    if (month == std::string_view::npos || month % 3 != 0) { return false; }
+
+    tm parts = {};
+    int year = 0;
+    if (!read_digits(text, 5, 2, parts.tm_mday) || !read_digits(text, 12, 4, year) ||
+        !read_digits(text, 17, 2, parts.tm_hour) || !read_digits(text, 20, 2, parts.tm_min) ||
+        !read_digits(text, 23, 2, parts.tm_sec))
+    {
+        return false;
+    }
+
+    parts.tm_mon = static_cast<int>(month / 3);
+    parts.tm_year = year - 1900;
+    out = timegm(&parts);
+    return out != -1;
+}
+
+void HttpDate::refresh()
+{
+    time_t now = time(nullptr);
+    if (now == common.rendered_at) { return; }
+
+    char* out = common.data;
+    memcpy(out, server_line.data(), server_line.size());
+    out += server_line.size();
+    memcpy(out, date_prefix.data(), date_prefix.size());
+    out += date_prefix.size();
+    format(now, out);
+    out += http_date_length;
+    out[0] = '\r';
+    out[1] = '\n';
+
+    common.rendered_at = now;
+}
+
+std::string_view HttpDate::common_headers()
+{
+    // Threads without a timer tick (tests, helpers) render on first use
+    if (common.rendered_at == -1) { refresh(); }
+    return std::string_view(common.data, common_headers_length);
+}
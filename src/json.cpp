@@ -0,0 +1,96 @@
+#include "json.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void JsonWriter::grow(size_t length)
+{
+    out.resize(std::max(out.size() * 2, used + length + 256));
+}
+
+JsonWriter& JsonWriter::value(double number)
+{
+    if (!std::isfinite(number)) { return raw("null"); }
+
+    separate();
+    char* at = reserve(32);
+    used = std::to_chars(at, at + 32, number).ptr - out.data();
+    return *this;
+}
+
+static inline bool needs_escape(char c)
+{
+    return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+}
+
+void JsonWriter::write_string(std::string_view text)
+{
+    static constexpr char hex[] = "0123456789abcdef";
+
+    // Worst case every byte becomes \u00XX, one check for the whole string
+    char* dest = reserve(text.size() * 6 + 2);
+    *dest++ = '"';
+
+    const char* data = text.data();
+    size_t length = text.size();
+    size_t copied = 0;
+    size_t i = 0;
+    while (i < length)
+    {
+        // Skip over the run that needs no escaping, 16 bytes per step
+#ifdef __SSE2__
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1f);
+        for (; i + 16 <= length; i += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            // Unsigned byte <= 0x1f exactly when max(byte, 0x1f) is 0x1f
+            __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+                                           _mm_cmpeq_epi8(_mm_max_epu8(block, control), control));
+            int mask = _mm_movemask_epi8(special);
+            if (mask != 0)
+            {
+                i += __builtin_ctz(mask);
+                break;
+            }
+        }
+#endif
+        while (i < length && !needs_escape(data[i])) { i++; }
+
+        memcpy(dest, data + copied, i - copied);
+        dest += i - copied;
+        if (i == length) { break; }
+
+        char c = data[i++];
+        copied = i;
+        *dest++ = '\\';
+        switch (c)
+        {
+            case '"': *dest++ = '"'; break;
+            case '\\': *dest++ = '\\'; break;
+            case '\b': *dest++ = 'b'; break;
+            case '\f': *dest++ = 'f'; break;
+            case '\n': *dest++ = 'n'; break;
+            case '\r': *dest++ = 'r'; break;
+            case '\t': *dest++ = 't'; break;
+            default:
+            {
+                auto byte = static_cast<uint8_t>(c);
+                *dest++ = 'u';
+                *dest++ = '0';
+                *dest++ = '0';
+                *dest++ = hex[byte >> 4];
+                *dest++ = hex[byte & 0xf];
+            }
+        }
+    }
+
+    *dest++ = '"';
+    used = dest - out.data();
+}
@@ -0,0 +1,103 @@
+#include "listener.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+static void set_option(int fd, int level, int name, int value, const char* what)
+{
+    if (setsockopt(fd, level, name, &value, sizeof(value)) == -1)
+    {
+        std::cerr << "Error setting " << what << ": " << strerror(errno) << std::endl;
+    }
+}
+
+int open_listener(int port, const ListenerOptions& options)
+{
+    int family = options.dual_stack ? AF_INET6 : AF_INET;
+    int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1 && family == AF_INET6 && errno == EAFNOSUPPORT)
+    {
+        family = AF_INET;
+        fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    }
+    if (fd == -1)
+    {
+        std::cerr << "Error creating server socket: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    set_option(fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR");
+    if (options.reuse_port) { set_option(fd, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT"); }
+    if (family == AF_INET6) { set_option(fd, IPPROTO_IPV6, IPV6_V6ONLY, 0, "IPV6_V6ONLY"); }
+
+    // Inherited by accepted sockets. Buffer sizes have to be set before listen() to affect the window scale.
+    if (options.tcp_nodelay) { set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY"); }
+    if (options.receive_buffer > 0) { set_option(fd, SOL_SOCKET, SO_RCVBUF, options.receive_buffer, "SO_RCVBUF"); }
+    if (options.send_buffer > 0) { set_option(fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer, "SO_SNDBUF"); }
+    if (options.busy_poll > 0) { set_option(fd, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll, "SO_BUSY_POLL"); }
+    if (options.prefer_busy_poll) { set_option(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1, "SO_PREFER_BUSY_POLL"); }
+
+    if (options.defer_accept > 0) { set_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, options.defer_accept, "TCP_DEFER_ACCEPT"); }
+    if (options.fastopen > 0) { set_option(fd, IPPROTO_TCP, TCP_FASTOPEN, options.fastopen, "TCP_FASTOPEN"); }
+
+    sockaddr_storage address = {};
+    socklen_t address_length;
+    if (family == AF_INET6)
+    {
+        auto& ipv6 = reinterpret_cast<sockaddr_in6&>(address);
+        ipv6.sin6_family = AF_INET6;
+        ipv6.sin6_port = htons(port);
+        ipv6.sin6_addr = in6addr_any;
+        address_length = sizeof(sockaddr_in6);
+    }
+    else
+    {
+        auto& ipv4 = reinterpret_cast<sockaddr_in&>(address);
+        ipv4.sin_family = AF_INET;
+        ipv4.sin_port = htons(port);
+        ipv4.sin_addr.s_addr = INADDR_ANY;
+        address_length = sizeof(sockaddr_in);
+    }
+
+    if (bind(fd, reinterpret_cast<const sockaddr*>(&address), address_length) == -1)
+    {
+        std::cerr << "Error binding server socket: " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, options.backlog) == -1)
+    {
+        std::cerr << "Error listening to server socket: " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+in6_addr peer_address(const sockaddr_storage& address)
+{
+    if (address.ss_family == AF_INET6) { return reinterpret_cast<const sockaddr_in6&>(address).sin6_addr; }
+
+    in6_addr mapped = {};
+    mapped.s6_addr[10] = 0xff;
+    mapped.s6_addr[11] = 0xff;
+    if (address.ss_family == AF_INET)
+    {
+        memcpy(&mapped.s6_addr[12], &reinterpret_cast<const sockaddr_in&>(address).sin_addr, 4);
+    }
+    return mapped;
+}
+
+std::string format_address(const in6_addr& address)
+{
+    char text[INET6_ADDRSTRLEN] = "";
+    if (IN6_IS_ADDR_V4MAPPED(&address)) { inet_ntop(AF_INET, &address.s6_addr[12], text, sizeof(text)); }
+    else { inet_ntop(AF_INET6, &address, text, sizeof(text)); }
+    return text;
+}
@@ -1,12 +1,26 @@
 #include "application.hpp"
+#include "middleware.hpp"
 #include "request.hpp"
 #include "response.hpp"
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <ranges>
+#include <string_view>
 
 int main()
 {
     Application app = Application(8080);
 
+    // Woken only once a request has arrived, returning clients can send it with the SYN
+    app.listen({.defer_accept = 1, .fastopen = 256});
+
+    // Microseconds to spin before blocking, for latency tests
+    if (const char* spin = std::getenv("SPIN_US"))
+    {
+        app.reactor({.spin_microseconds = static_cast<uint32_t>(std::atoi(spin))});
+    }
+
     // Add routes
     app.GET("/users", [](Request& req)-> Response {
         std::cout << "GET /users" << std::endl;
@@ -38,6 +52,190 @@ int main()
         return Response::ok("/files/" + req.params()["*"]);
     });
     
+    app.GET("/admin/*", middleware::chain(
+                            middleware::Timing{[](Request& req, std::chrono::nanoseconds duration) {
+                                std::cout << req.path().raw() << " took " << duration.count() << "ns" << std::endl;
+                            }},
+                            middleware::BearerAuth("secret"), [](Request& req) -> Response {
+                                std::cout << "GET /admin/*" << std::endl;
+                                (void) req;
+                                return Response::ok("admin");
+                            }));
+
+    app.GET("/report", [](Request& req) -> Response {
+        (void) req;
+        return Response::json([](JsonWriter& json) {
+            json.begin_array();
+            for (int i = 0; i < 1000; i++) { json.begin_object().field("id", i).end_object(); }
+            json.end_array();
+        });
+    }, {.compress = true, .etag = true, .cache_ttl = 5});
+
+    // Written straight into the connection's output
+    app.GET("/users/:id/json", [](Request& req) -> Response {
+        return Response::json([id = req.params()["id"]](JsonWriter& json) {
+            json.begin_object().field("id", id).field("active", true).field("score", 0.5).end_object();
+        });
+    });
+
+    app.GET("/export", [](Request& req) -> Response {
+        (void) req;
+        Response response;
+        response.content_type(ContentType::TEXT);
+        response.stream([row = 0](ChunkWriter& writer) mutable {
+            if (row == 100000) { return false; }
+            std::string batch;
+            for (int end = row + 1000; row < end; row++) { batch += "row " + std::to_string(row) + "\n"; }
+            writer.write(batch);
+            return true;
+        });
+        return response;
+    });
+
+    app.WS("/echo", {.on_message = [](WebSocket& ws, std::string_view message, bool binary) {
+        binary ? ws.send_binary(message) : ws.send_text(message);
+    }});
+
+    app.SSE("/live/:topic", [](Request& req, EventSubscriber& subscriber) {
+        subscriber.subscribe(req.params().at("topic"));
+    });
+
+    app.POST("/live/:topic", [&app](Request& req) -> Response {
+        auto body = req.body();
+        app.events().publish(req.params().at("topic"), std::string_view(body.data(), body.size()));
+        return Response::with_status(202, "Published");
+    });
+
+    // The token is checked on the headers, an Expect: 100-continue client without one never sends the body
+    app.POST("/upload", [](Request& req) -> Response {
+        return Response::ok(std::to_string(req.body().size()) + " bytes\n");
+    }, {.max_body_size = 1024 * 1024, .check_upload = std::make_shared<const UploadCheck>([](const Request& req) -> std::optional<Response> {
+        if (req.header("authorization").empty()) { return Response::with_status(401, "Unauthorized"); }
+        return std::nullopt;
+    })});
+
+    // Form posts and file uploads are measured as they stream in, none of the body is kept
+    using PartSizes = std::vector<std::pair<std::string, size_t>>;
+    app.upload("/forms", {
+        .on_part = [](Upload& upload, const FormPart& part) {
+            if (!upload.user_data) { upload.user_data = std::make_shared<PartSizes>(); }
+            std::static_pointer_cast<PartSizes>(upload.user_data)->emplace_back(part.filename.empty() ? part.name : part.filename, 0);
+            return true;
+        },
+        .on_data = [](Upload& upload, std::string_view data) {
+            std::static_pointer_cast<PartSizes>(upload.user_data)->back().second += data.size();
+            return true;
+        },
+        .on_end = [](Upload& upload) -> Response {
+            std::string summary;
+            if (upload.user_data)
+            {
+                for (const auto& [name, size] : *std::static_pointer_cast<PartSizes>(upload.user_data))
+                {
+                    summary += name + " " + std::to_string(size) + "\n";
+                }
+            }
+            return Response::ok(summary);
+        }});
+
+    app.static_dir("/assets", "public");
+
+    app.GET("/stats/reactor", [&app](Request&) -> Response {
+        const auto& stats = app.reactor_stats();
+        return Response::ok("spin_polls " + std::to_string(stats.spin_polls) + "\nspin_hits " +
+                            std::to_string(stats.spin_hits) + "\nspin_misses " + std::to_string(stats.spin_misses) +
+                            "\nblocking_wakeups " + std::to_string(stats.blocking_wakeups) + "\nspin_hit_ratio " +
+                            std::to_string(stats.spin_hit_ratio()) + "\nshed_requests " +
+                            std::to_string(stats.shed_requests) + "\naccept_pauses " +
+                            std::to_string(stats.accept_pauses) + "\n");
+    }, {.priority = RoutePriority::CRITICAL});
+
+    // Summed over the prefork workers, whichever of them answers
+    app.GET("/stats/workers", [&app](Request&) -> Response {
+        const SharedStats* stats = app.worker_stats();
+        if (!stats) { return Response::with_status(404, "Not running prefork workers"); }
+        return Response::json([stats](JsonWriter& json) {
+            auto write = [&json](const StatsSnapshot& snapshot) {
+                json.field("requests", snapshot.requests).field("accepted_connections", snapshot.accepted_connections);
+                json.field("open_connections", snapshot.open_connections).field("shed_requests", snapshot.shed_requests);
+                json.field("respawns", snapshot.respawns).field("p50_us", snapshot.latency_percentile(0.5));
+                json.field("p99_us", snapshot.latency_percentile(0.99));
+            };
+            auto total = stats->total();
+            json.begin_object().field("workers_up", total.workers_up);
+            write(total);
+            json.key("workers").begin_array();
+            for (size_t i = 0; i < stats->workers(); i++)
+            {
+                json.begin_object().field("pid", stats->worker(i).pid.load(std::memory_order_relaxed));
+                write(stats->snapshot(i));
+                json.end_object();
+            }
+            json.end_array().end_object();
+        });
+    }, {.priority = RoutePriority::CRITICAL});
+
+    // Load it in Perfetto or chrome://tracing, one track per connection
+    app.GET("/debug/trace", [&app](Request&) -> Response {
+        return Response::json([&app](JsonWriter& json) { app.write_trace(json); });
+    }, {.priority = RoutePriority::CRITICAL});
+
+    // Expensive and optional, the first thing to go when requests queue up
+    app.GET("/work", [](Request&) -> Response {
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(2);
+        uint64_t spins = 0;
+        while (std::chrono::steady_clock::now() < until) { spins++; }
+        return Response::ok(std::to_string(spins));
+    }, {.priority = RoutePriority::SHEDDABLE});
+
+    app.shed_load();
+
+    // Requests per second allowed per client address
+    if (const char* rate = std::getenv("RATE_LIMIT"))
+    {
+        double requests_per_second = std::atof(rate);
+        app.rate_limit({.requests_per_second = requests_per_second, .burst = 2 * requests_per_second});
+    }
+
+    // /api/* goes to the comma separated host:port list in UPSTREAMS
+    const char* upstreams = std::getenv("UPSTREAMS");
+    if (upstreams)
+    {
+        std::vector<std::string> list;
+        for (auto part : std::views::split(std::string_view(upstreams), ','))
+        {
+            list.emplace_back(part.begin(), part.end());
+        }
+        app.proxy("/api/*", list, {.balance = BalancePolicy::LEAST_CONNECTIONS});
+    }
+
+    // HTTPS with h2 over ALPN when a certificate is configured, proxied routes need clients to stay on HTTP/1.1
+    const char* certificate = std::getenv("TLS_CERT");
+    const char* private_key = std::getenv("TLS_KEY");
+    if (certificate && private_key &&
+        !app.enable_tls({.certificate_file = certificate, .private_key_file = private_key, .http2 = !upstreams}))
+    {
+        return 1;
+    }
+
+    // Trace one request in this many
+    if (const char* sample = std::getenv("TRACE_SAMPLE"))
+    {
+        app.trace({.sample_every = static_cast<uint32_t>(std::atoi(sample))});
+    }
+
+    // A new process started with the same CONTROL_SOCKET takes the listener over from this one
+    if (const char* control_socket = std::getenv("CONTROL_SOCKET"))
+    {
+        app.graceful_restart({.control_socket = control_socket});
+    }
+
+    // Worker processes to fork, 0 for one per core
+    if (const char* workers = std::getenv("PREFORK"))
+    {
+        app.prefork({.workers = static_cast<unsigned>(std::atoi(workers))});
+    }
+
     app.run();
 
     return 0;
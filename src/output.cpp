@@ -0,0 +1,239 @@
+#include "output.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+constexpr size_t max_output_iovecs = 64;
+constexpr size_t max_spare_buffers = 4;
+constexpr size_t initial_buffer_capacity = 1024 * 4;
+
+std::vector<char>& OutputQueue::tail_buffer()
+{
+    if (segments.empty() || segments.back().kind != OutputSegment::Kind::BUFFER)
+    {
+        OutputSegment segment;
+        if (!spare_buffers.empty())
+        {
+            segment.bytes = std::move(spare_buffers.back());
+            spare_buffers.pop_back();
+        }
+        else { segment.bytes.reserve(initial_buffer_capacity); }
+        segments.push_back(std::move(segment));
+    }
+    return segments.back().bytes;
+}
+
+std::vector<char>& OutputQueue::writable_tail()
+{
+    return tail_buffer();
+}
+
+void OutputQueue::append(std::string_view bytes)
+{
+    if (bytes.empty()) { return; }
+    auto& buffer = tail_buffer();
+    buffer.insert(buffer.end(), bytes.begin(), bytes.end());
+    pending += bytes.size();
+}
+
+void OutputQueue::append_view(std::string_view bytes, std::shared_ptr<const void> owner)
+{
+    if (bytes.empty()) { return; }
+
+    OutputSegment segment;
+    segment.kind = OutputSegment::Kind::VIEW;
+    segment.view = bytes;
+    segment.owner = std::move(owner);
+    segments.push_back(std::move(segment));
+    pending += bytes.size();
+}
+
+void OutputQueue::append_file(int fd, off_t offset, size_t length, std::shared_ptr<const void> owner)
+{
+    if (length == 0) { return; }
+
+    OutputSegment segment;
+    segment.kind = OutputSegment::Kind::FILE;
+    segment.file_fd = fd;
+    segment.file_offset = offset;
+    segment.file_length = length;
+    segment.owner = std::move(owner);
+    segments.push_back(std::move(segment));
+    pending += length;
+}
+
+OutputQueue::FlushResult OutputQueue::flush(int fd)
+{
+    while (!segments.empty())
+    {
+        ssize_t bytes_sent = 0;
+        auto& head = segments.front();
+
+        if (head.kind == OutputSegment::Kind::FILE)
+        {
+            off_t offset = head.file_offset + head.sent;
+            bytes_sent = sendfile(fd, head.file_fd, &offset, head.file_length - head.sent);
+            if (bytes_sent == 0)
+            {
+                // File shrank underneath us, the response can't be completed
+                std::cerr << "Error sending file: unexpected end of file" << std::endl;
+                return FlushResult::ERROR;
+            }
+        }
+        else
+        {
+            iovec iov[max_output_iovecs];
+            size_t iov_count = 0;
+            int flags = MSG_NOSIGNAL;
+
+            for (auto it = segments.begin(); it != segments.end() && iov_count < max_output_iovecs; ++it)
+            {
+                if (it->kind == OutputSegment::Kind::FILE)
+                {
+                    // Headers followed by a file body, let the kernel coalesce them into full packets
+                    flags |= MSG_MORE;
+                    break;
+                }
+
+                auto data = it->data();
+                iov[iov_count].iov_base = const_cast<char*>(data.data() + it->sent);
+                iov[iov_count].iov_len = data.size() - it->sent;
+                iov_count++;
+            }
+
+            msghdr message = {};
+            message.msg_iov = iov;
+            message.msg_iovlen = iov_count;
+
+            bytes_sent = sendmsg(fd, &message, flags);
+        }
+
+        if (bytes_sent == -1)
+        {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { return FlushResult::BLOCKED; }
+            std::cerr << "Error sending response: " << strerror(errno) << std::endl;
+            return FlushResult::ERROR;
+        }
+
+        consume(bytes_sent);
+    }
+
+    return FlushResult::DONE;
+}
+
+size_t OutputQueue::peek(char* buffer, size_t length) const
+{
+    size_t copied = 0;
+    for (auto it = segments.begin(); it != segments.end() && copied < length; ++it)
+    {
+        size_t take = std::min(it->size() - it->sent, length - copied);
+
+        if (it->kind == OutputSegment::Kind::FILE)
+        {
+            ssize_t bytes_read = pread(it->file_fd, buffer + copied, take, it->file_offset + it->sent);
+            // File shrank underneath us, hand out what we have so far
+            if (bytes_read <= 0) { break; }
+            copied += bytes_read;
+            if (static_cast<size_t>(bytes_read) < take) { break; }
+        }
+        else
+        {
+            memcpy(buffer + copied, it->data().data() + it->sent, take);
+            copied += take;
+        }
+    }
+    return copied;
+}
+
+void OutputQueue::consume(size_t length)
+{
+    pending -= length;
+
+    // Drop everything that was fully written
+    while (length > 0)
+    {
+        auto& front = segments.front();
+        size_t left = front.size() - front.sent;
+        if (length < left)
+        {
+            front.sent += length;
+            break;
+        }
+
+        length -= left;
+        if (front.kind == OutputSegment::Kind::BUFFER && spare_buffers.size() < max_spare_buffers)
+        {
+            front.bytes.clear();
+            spare_buffers.push_back(std::move(front.bytes));
+        }
+        segments.pop_front();
+    }
+}
+
+void OutputQueue::drain_into(std::string& out)
+{
+    for (const auto& segment : segments)
+    {
+        if (segment.kind == OutputSegment::Kind::FILE)
+        {
+            size_t start = out.size();
+            out.resize(start + segment.file_length - segment.sent);
+            ssize_t bytes_read = pread(segment.file_fd, out.data() + start, segment.file_length - segment.sent,
+                                       segment.file_offset + segment.sent);
+            out.resize(start + (bytes_read > 0 ? bytes_read : 0));
+        }
+        else { out.append(segment.data().substr(segment.sent)); }
+    }
+    clear();
+}
+
+size_t OutputQueue::move_into(OutputQueue& dest, size_t max_bytes)
+{
+    size_t moved = 0;
+    while (moved < max_bytes && !segments.empty())
+    {
+        auto& front = segments.front();
+        size_t take = std::min(front.size() - front.sent, max_bytes - moved);
+
+        if (front.kind == OutputSegment::Kind::FILE)
+        {
+            dest.append_file(front.file_fd, front.file_offset + front.sent, take, front.owner);
+        }
+        else if (front.kind == OutputSegment::Kind::VIEW) { dest.append_view(front.view.substr(front.sent, take), front.owner); }
+        else { dest.append(front.data().substr(front.sent, take)); }
+
+        front.sent += take;
+        moved += take;
+        pending -= take;
+
+        if (front.sent == front.size())
+        {
+            if (front.kind == OutputSegment::Kind::BUFFER && spare_buffers.size() < max_spare_buffers)
+            {
+                front.bytes.clear();
+                spare_buffers.push_back(std::move(front.bytes));
+            }
+            segments.pop_front();
+        }
+    }
+    return moved;
+}
+
+void OutputQueue::release_buffers()
+{
+    spare_buffers.clear();
+    spare_buffers.shrink_to_fit();
+}
+
+void OutputQueue::clear()
+{
+    segments.clear();
+    pending = 0;
+}
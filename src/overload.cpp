@@ -0,0 +1,35 @@
+#include "overload.hpp"
+
+#include <time.h>
+
+OverloadController::OverloadController(const OverloadOptions& options) : options(options)
+{
+}
+
+bool OverloadController::admit(uint64_t delay, RoutePriority priority, uint64_t now)
+{
+    if (delay < options.target_microseconds)
+    {
+        first_above = 0;
+        dropping = false;
+        return true;
+    }
+
+    if (first_above == 0) { first_above = now; }
+    else if (now - first_above >= options.interval_microseconds) { dropping = true; }
+
+    switch (priority)
+    {
+        case RoutePriority::CRITICAL: return true;
+        case RoutePriority::NORMAL: return !dropping;
+        case RoutePriority::SHEDDABLE: return false;
+    }
+    return true;
+}
+
+uint64_t monotonic_microseconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + static_cast<uint64_t>(now.tv_nsec) / 1000;
+}
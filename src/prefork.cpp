@@ -0,0 +1,248 @@
+#include "prefork.hpp"
+#include "overload.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+void StatsSnapshot::add(const WorkerStats& stats)
+{
+    if (stats.pid.load(std::memory_order_relaxed) != 0) { workers_up++; }
+    respawns += stats.respawns.load(std::memory_order_relaxed);
+    requests += stats.requests.load(std::memory_order_relaxed);
+    accepted_connections += stats.accepted_connections.load(std::memory_order_relaxed);
+    open_connections += stats.open_connections.load(std::memory_order_relaxed);
+    shed_requests += stats.shed_requests.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < latency_buckets; i++) { latency[i] += stats.latency[i].load(std::memory_order_relaxed); }
+}
+
+uint64_t StatsSnapshot::latency_percentile(double fraction) const
+{
+    uint64_t total = 0;
+    for (uint64_t count : latency) { total += count; }
+    if (total == 0) { return 0; }
+
+    // Buckets are read one at a time while workers write, so the sum may be off by a few requests
+    auto rank = static_cast<uint64_t>(fraction * static_cast<double>(total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < latency_buckets; i++)
+    {
+        seen += latency[i];
+        if (seen > rank) { return uint64_t(1) << i; }
+    }
+    return uint64_t(1) << (latency_buckets - 1);
+}
+
+SharedStats::SharedStats(size_t workers)
+{
+    void* memory = mmap(nullptr, workers * sizeof(WorkerStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        std::cerr << "Error mapping worker stats: " << strerror(errno) << std::endl;
+        return;
+    }
+
+    slots = static_cast<WorkerStats*>(memory);
+    count = workers;
+    for (size_t i = 0; i < count; i++) { new (&slots[i]) WorkerStats(); }
+}
+
+SharedStats::~SharedStats()
+{
+    if (slots) { munmap(slots, count * sizeof(WorkerStats)); }
+}
+
+StatsSnapshot SharedStats::snapshot(size_t index) const
+{
+    StatsSnapshot snapshot;
+    snapshot.add(slots[index]);
+    return snapshot;
+}
+
+StatsSnapshot SharedStats::total() const
+{
+    StatsSnapshot snapshot;
+    for (size_t i = 0; i < count; i++) { snapshot.add(slots[i]); }
+    return snapshot;
+}
+
+size_t prefork_workers(const PreforkOptions& options)
+{
+    if (options.workers > 0) { return options.workers; }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? static_cast<size_t>(cores) : 1;
+}
+
+namespace
+{
+
+struct WorkerSlot
+{
+    pid_t pid = 0;
+    // Monotonic milliseconds it was forked at, or when it's due to be forked again while it's down
+    uint64_t started = 0;
+    uint64_t respawn_at = 0;
+    uint32_t delay = 0;
+};
+
+uint64_t monotonic_milliseconds()
+{
+    return monotonic_microseconds() / 1000;
+}
+
+pid_t spawn(SharedStats& stats, size_t index, const sigset_t& original_mask, InplaceFunction<void(size_t)>& run_worker)
+{
+    pid_t master = getpid();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        std::cerr << "Error forking worker " << index << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        // Workers don't outlive the master, a master that already went away before this ran counts too
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != master) { _exit(EXIT_FAILURE); }
+
+        sigprocmask(SIG_SETMASK, &original_mask, nullptr);
+        stats.worker(index).pid.store(getpid(), std::memory_order_relaxed);
+        run_worker(index);
+        std::cout.flush();
+        _exit(EXIT_SUCCESS);
+    }
+
+    return pid;
+}
+
+void print_stats(const SharedStats& stats)
+{
+    StatsSnapshot total = stats.total();
+    std::cout << "Workers " << total.workers_up << "/" << stats.workers() << " up, " << total.respawns << " respawns, "
+              << total.requests << " requests, " << total.accepted_connections << " connections accepted, "
+              << total.open_connections << " open, " << total.shed_requests << " shed, p50 "
+              << total.latency_percentile(0.5) << "us, p99 " << total.latency_percentile(0.99) << "us" << std::endl;
+}
+
+} // namespace
+
+void supervise(SharedStats& stats, InplaceFunction<void(size_t index)> run_worker, InplaceFunction<bool()> poll)
+{
+    // Taken synchronously with sigtimedwait, workers get the original mask back
+    sigset_t signals;
+    sigemptyset(&signals);
+    for (int signal : {SIGCHLD, SIGTERM, SIGINT, SIGUSR1}) { sigaddset(&signals, signal); }
+    sigset_t original_mask;
+    sigprocmask(SIG_BLOCK, &signals, &original_mask);
+
+    std::vector<WorkerSlot> workers(stats.workers());
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].pid = spawn(stats, i, original_mask, run_worker);
+        workers[i].started = monotonic_milliseconds();
+    }
+    std::cout << "Started " << workers.size() << " workers" << std::endl;
+
+    bool stopping = false;
+    while (!stopping)
+    {
+        timespec timeout = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+        int signal = sigtimedwait(&signals, nullptr, &timeout);
+        if (signal == SIGTERM || signal == SIGINT) { stopping = true; }
+        else if (signal == SIGUSR1) { print_stats(stats); }
+        if (poll && !stopping && !poll()) { stopping = true; }
+
+        uint64_t now = monotonic_milliseconds();
+        int status = 0;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            for (size_t i = 0; i < workers.size(); i++)
+            {
+                WorkerSlot& worker = workers[i];
+                if (worker.pid != pid) { continue; }
+
+                if (WIFSIGNALED(status))
+                {
+                    std::cerr << "Worker " << i << " (pid " << pid << ") killed by signal " << WTERMSIG(status) << std::endl;
+                }
+                else { std::cerr << "Worker " << i << " (pid " << pid << ") exited with " << WEXITSTATUS(status) << std::endl; }
+
+                // Crashing right after start again and again, don't fork in a tight loop
+                if (now - worker.started < respawn_min_uptime_ms)
+                {
+                    worker.delay = std::min(std::max<uint32_t>(worker.delay * 2, 100), respawn_max_delay_ms);
+                }
+                else { worker.delay = 0; }
+
+                worker.pid = 0;
+                worker.respawn_at = now + worker.delay;
+                // Its connections died with it
+                stats.worker(i).pid.store(0, std::memory_order_relaxed);
+                stats.worker(i).open_connections.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        if (stopping) { break; }
+
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            WorkerSlot& worker = workers[i];
+            if (worker.pid > 0 || now < worker.respawn_at) { continue; }
+
+            worker.pid = spawn(stats, i, original_mask, run_worker);
+            worker.started = now;
+            // A failed fork is retried like a worker that died right away
+            if (worker.pid == -1)
+            {
+                worker.pid = 0;
+                worker.delay = std::min(std::max<uint32_t>(worker.delay * 2, 100), respawn_max_delay_ms);
+                worker.respawn_at = now + worker.delay;
+                continue;
+            }
+            WorkerStats::add(stats.worker(i).respawns);
+        }
+    }
+
+    // Workers drain on the first SIGTERM and exit right away on the second
+    std::cout << "Stopping workers" << std::endl;
+    auto signal_workers = [&workers]() {
+        for (const WorkerSlot& worker : workers)
+        {
+            if (worker.pid > 0) { kill(worker.pid, SIGTERM); }
+        }
+    };
+    signal_workers();
+
+    size_t running = 0;
+    for (const WorkerSlot& worker : workers) { running += worker.pid > 0; }
+    while (running > 0)
+    {
+        timespec timeout = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+        int signal = sigtimedwait(&signals, nullptr, &timeout);
+        if (signal == SIGTERM || signal == SIGINT) { signal_workers(); }
+
+        pid_t pid;
+        while ((pid = waitpid(-1, nullptr, WNOHANG)) > 0)
+        {
+            for (WorkerSlot& worker : workers)
+            {
+                if (worker.pid != pid) { continue; }
+                worker.pid = 0;
+                running--;
+            }
+        }
+        if (pid == -1 && errno == ECHILD) { break; }
+    }
+    for (size_t i = 0; i < workers.size(); i++) { stats.worker(i).pid.store(0, std::memory_order_relaxed); }
+
+    sigprocmask(SIG_SETMASK, &original_mask, nullptr);
+}
@@ -0,0 +1,308 @@
+#include "proxy.hpp"
+#include "common.hpp"
+
+#include <arpa/inet.h>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <netdb.h>
+#include <unistd.h>
+
+ProxyRoute::ProxyRoute(const std::vector<std::string>& names, ProxyOptions options) : options(std::move(options))
+{
+    for (const auto& name : names)
+    {
+        size_t colon = name.rfind(':');
+        if (colon == std::string::npos)
+        {
+            std::cerr << "Error: upstream " << name << " has no port" << std::endl;
+            continue;
+        }
+
+        std::string host = name.substr(0, colon);
+        std::string port = name.substr(colon + 1);
+        // [::1]:8080
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') { host = host.substr(1, host.size() - 2); }
+
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* result = nullptr;
+        int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+        if (error != 0 || !result)
+        {
+            std::cerr << "Error resolving upstream " << name << ": " << gai_strerror(error) << std::endl;
+            continue;
+        }
+
+        Upstream upstream;
+        upstream.name = name;
+        memcpy(&upstream.address, result->ai_addr, result->ai_addrlen);
+        upstream.address_length = result->ai_addrlen;
+        freeaddrinfo(result);
+        upstreams.push_back(std::move(upstream));
+    }
+}
+
+Upstream* ProxyRoute::pick()
+{
+    Upstream* best = nullptr;
+
+    // Starting from the cursor keeps equally loaded upstreams taking turns
+    for (size_t i = 0; i < upstreams.size(); i++)
+    {
+        Upstream& candidate = upstreams[(cursor + i) % upstreams.size()];
+        if (!candidate.healthy) { continue; }
+
+        if (options.balance == BalancePolicy::ROUND_ROBIN)
+        {
+            best = &candidate;
+            break;
+        }
+        if (!best || candidate.active < best->active) { best = &candidate; }
+    }
+
+    cursor = (cursor + 1) % upstreams.size();
+    return best;
+}
+
+size_t ChunkedScanner::scan(std::string_view data)
+{
+    size_t i = 0;
+    while (i < data.size() && state != State::DONE && state != State::FAILED)
+    {
+        char c = data[i];
+        switch (state)
+        {
+            case State::SIZE:
+                if (std::isxdigit(static_cast<unsigned char>(c)))
+                {
+                    if (remaining >> 60) { state = State::FAILED; break; }
+                    remaining = remaining * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+                    size_digits = true;
+                }
+                else if (!size_digits) { state = State::FAILED; }
+                else if (c == '\r') { state = State::SIZE_LF; }
+                else if (c == ';' || c == ' ' || c == '\t') { state = State::EXTENSION; }
+                else { state = State::FAILED; }
+                i++;
+                break;
+            case State::EXTENSION:
+                if (c == '\r') { state = State::SIZE_LF; }
+                i++;
+                break;
+            case State::SIZE_LF:
+                if (c != '\n') { state = State::FAILED; }
+                else { state = remaining == 0 ? State::TRAILER : State::DATA; }
+                size_digits = false;
+                i++;
+                break;
+            case State::DATA:
+            {
+                size_t take = std::min<uint64_t>(remaining, data.size() - i);
+                remaining -= take;
+                i += take;
+                if (remaining == 0) { state = State::DATA_CR; }
+                break;
+            }
+            case State::DATA_CR:
+                state = c == '\r' ? State::DATA_LF : State::FAILED;
+                i++;
+                break;
+            case State::DATA_LF:
+                state = c == '\n' ? State::SIZE : State::FAILED;
+                i++;
+                break;
+            case State::TRAILER:
+                // Either the blank line that ends the body or a trailer field
+                state = c == '\r' ? State::TRAILER_LF : State::TRAILER_LINE;
+                i++;
+                break;
+            case State::TRAILER_LF:
+                state = c == '\n' ? State::DONE : State::FAILED;
+                i++;
+                break;
+            case State::TRAILER_LINE:
+                if (c == '\n') { state = State::TRAILER; }
+                i++;
+                break;
+            default: break;
+        }
+    }
+    return i;
+}
+
+bool parse_upstream_head(std::string_view data, UpstreamResponseHead& head)
+{
+    size_t end = data.find("\r\n\r\n");
+    if (end == std::string_view::npos) { return false; }
+
+    head = {};
+    head.size = end + 4;
+
+    auto lines = data.substr(0, end + 2);
+    size_t line_end = lines.find("\r\n");
+    auto status_line = lines.substr(0, line_end);
+
+    // HTTP/1.x NNN reason
+    if (status_line.size() < 12 || !status_line.starts_with("HTTP/1.") || status_line[8] != ' ')
+    {
+        head.status = -1;
+        return true;
+    }
+    head.version_minor = status_line[7] - '0';
+    auto [ptr, ec] = std::from_chars(status_line.data() + 9, status_line.data() + 12, head.status);
+    if (ec != std::errc() || head.status < 100 || head.status > 999)
+    {
+        head.status = -1;
+        return true;
+    }
+
+    head.keep_alive = head.version_minor >= 1;
+
+    size_t start = line_end + 2;
+    while (start < lines.size())
+    {
+        size_t next = lines.find("\r\n", start);
+        auto line = lines.substr(start, next - start);
+        start = next + 2;
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos) { continue; }
+        auto name = line.substr(0, colon);
+        auto value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+
+        if (iequals(name, "Content-Length"))
+        {
+            auto [p, e] = std::from_chars(value.data(), value.data() + value.size(), head.content_length);
+            if (e != std::errc() || p != value.data() + value.size())
+            {
+                head.status = -1;
+                return true;
+            }
+            head.has_length = true;
+        }
+        else if (iequals(name, "Transfer-Encoding")) { head.chunked = contains_token(value, "chunked"); }
+        else if (iequals(name, "Connection"))
+        {
+            if (contains_token(value, "close")) { head.keep_alive = false; }
+            else if (contains_token(value, "keep-alive")) { head.keep_alive = true; }
+        }
+    }
+
+    return true;
+}
+
+// Headers that describe one hop and must not be forwarded to the next
+static bool is_hop_by_hop(std::string_view name, std::string_view connection)
+{
+    static constexpr std::string_view hop_by_hop[] = {"Connection", "Keep-Alive",        "Proxy-Connection",
+                                                      "TE",         "Trailer",           "Transfer-Encoding",
+                                                      "Upgrade",    "Proxy-Authorization"};
+    for (auto header : hop_by_hop)
+    {
+        if (iequals(name, header)) { return true; }
+    }
+
+    // Anything the sender listed in its Connection header
+    return !connection.empty() && contains_token(connection, name);
+}
+
+std::shared_ptr<const std::string> upstream_request_head(const Request& request, std::string_view client_address,
+                                                         bool tls)
+{
+    const auto& content = request.content();
+    std::string_view raw(content.data(), content.size());
+    size_t end = raw.find("\r\n\r\n");
+    auto lines = raw.substr(0, end + 2);
+
+    auto connection = request.header("Connection");
+    auto head = std::make_shared<std::string>();
+    head->reserve(lines.size() + 128);
+
+    // Same method and target. HTTP/1.0 clients are forwarded as HTTP/1.0 so the upstream doesn't
+    // answer with a chunked body they couldn't read.
+    size_t line_end = lines.find("\r\n");
+    auto request_line = lines.substr(0, line_end);
+    head->append(request_line.substr(0, request_line.rfind(' ')));
+    head->append(request.version_minor() >= 1 ? " HTTP/1.1\r\n" : " HTTP/1.0\r\n");
+
+    std::string_view forwarded_for;
+
+    size_t start = line_end + 2;
+    while (start < lines.size())
+    {
+        size_t next = lines.find("\r\n", start);
+        auto line = lines.substr(start, next - start);
+        start = next + 2;
+
+        auto name = line.substr(0, line.find(':'));
+        if (is_hop_by_hop(name, connection) || iequals(name, "Content-Length") || iequals(name, "X-Forwarded-Proto"))
+        {
+            continue;
+        }
+        if (iequals(name, "X-Forwarded-For"))
+        {
+            forwarded_for = request.header("X-Forwarded-For");
+            continue;
+        }
+
+        head->append(line);
+        head->append("\r\n");
+    }
+
+    head->append("X-Forwarded-For: ");
+    if (!forwarded_for.empty())
+    {
+        head->append(forwarded_for);
+        head->append(", ");
+    }
+    head->append(client_address);
+    head->append(tls ? "\r\nX-Forwarded-Proto: https\r\n" : "\r\nX-Forwarded-Proto: http\r\n");
+
+    auto body = request.body();
+    if (!body.empty() || request.method() == Method::POST || request.method() == Method::PUT ||
+        request.method() == Method::PATCH)
+    {
+        head->append("Content-Length: ");
+        head->append(std::to_string(body.size()));
+        head->append("\r\n");
+    }
+
+    head->append("Connection: keep-alive\r\n\r\n");
+    return head;
+}
+
+void write_client_head(OutputQueue& out, std::string_view head, bool keep_alive)
+{
+    // Everything but the blank line
+    auto lines = head.substr(0, head.size() - 2);
+
+    size_t line_end = lines.find("\r\n");
+    out.append(lines.substr(0, line_end + 2));
+
+    size_t start = line_end + 2;
+    while (start < lines.size())
+    {
+        size_t next = lines.find("\r\n", start);
+        auto line = lines.substr(start, next - start);
+        start = next + 2;
+
+        auto name = line.substr(0, line.find(':'));
+        if (iequals(name, "Connection") || iequals(name, "Keep-Alive") || iequals(name, "Proxy-Connection")) { continue; }
+
+        out.append(line);
+        out.append("\r\n");
+    }
+
+    out.append(keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+}
+
+UpstreamConnection::~UpstreamConnection()
+{
+    if (pipe_fds[0] != -1) { close(pipe_fds[0]); }
+    if (pipe_fds[1] != -1) { close(pipe_fds[1]); }
+}
@@ -0,0 +1,82 @@
+#include "rate_limit.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <time.h>
+
+static uint32_t now_ms()
+{
+    // vDSO read of the tick-granular clock, no syscall
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return static_cast<uint32_t>(static_cast<uint64_t>(now.tv_sec) * 1000 + static_cast<uint64_t>(now.tv_nsec) / 1000000);
+}
+
+RateLimiter::RateLimiter(const RateLimitOptions& options)
+    : _options(options), tokens_per_ms(static_cast<float>(options.requests_per_second / 1000.0))
+{
+    size_t shard_count = std::bit_ceil(std::max<size_t>(options.max_clients / rate_limit_shard_slots, 1));
+    shards = std::make_unique<Shard[]>(shard_count);
+    shard_mask = shard_count - 1;
+}
+
+uint64_t RateLimiter::key(const in6_addr& address)
+{
+    // The high bit keeps addresses apart from header hashes and from the empty key 0
+    if (IN6_IS_ADDR_V4MAPPED(&address))
+    {
+        uint32_t ipv4;
+        memcpy(&ipv4, &address.s6_addr[12], sizeof(ipv4));
+        return (1ull << 63) | ipv4;
+    }
+
+    // IPv6 clients usually get a whole /64, one bucket for all of it
+    return (1ull << 63) | (1ull << 62) | (xxh64(std::string_view(reinterpret_cast<const char*>(&address), 8)) >> 2);
+}
+
+uint64_t RateLimiter::key(std::string_view header_value)
+{
+    return (xxh64(header_value) & ~(1ull << 63)) | 1;
+}
+
+RateLimiter::Slot& RateLimiter::find(uint64_t key)
+{
+    // Mix the key so neighbouring addresses spread over the shards
+    uint64_t mixed = key * 0x9E3779B97F4A7C15ull;
+    auto& slots = shards[(mixed >> 32) & shard_mask].slots;
+    uint32_t now = now_ms();
+
+    Slot* oldest = &slots[0];
+    for (auto& slot : slots)
+    {
+        if (slot.key == key)
+        {
+            float refill = static_cast<float>(now - slot.seen) * tokens_per_ms;
+            slot.tokens = std::min(slot.tokens + refill, static_cast<float>(_options.burst));
+            slot.seen = now;
+            return slot;
+        }
+        if (slot.key == 0 || (oldest->key != 0 && now - slot.seen > now - oldest->seen)) { oldest = &slot; }
+    }
+
+    // New client, or one we forgot, starts with a full bucket
+    oldest->key = key;
+    oldest->tokens = static_cast<float>(_options.burst);
+    oldest->seen = now;
+    return *oldest;
+}
+
+bool RateLimiter::allow(uint64_t key)
+{
+    Slot& slot = find(key);
+    if (slot.tokens < 1) { return false; }
+    slot.tokens -= 1;
+    return true;
+}
+
+bool RateLimiter::admits(uint64_t key)
+{
+    return find(key).tokens >= 1;
+}
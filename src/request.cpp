@@ -11,11 +11,41 @@ Request Request::from_content(std::vector<char>&& content, size_t header_size)
 {
     Request request;
     request._content = std::move(content);
+    // parse() null-terminates the content, that must not move the body out from under _body
+    request._content.reserve(request._content.size() + 1);
     request._header_size = header_size;
     request._body = std::span<char>(request._content.data() + header_size, request._content.size() - header_size);
     return request;
 }
 
+Request Request::from_fields(std::string_view method, std::string_view target,
+                             std::span<const std::pair<std::string_view, std::string_view>> fields,
+                             std::vector<char>&& body)
+{
+    std::vector<char> content;
+    auto append = [&content](std::string_view bytes) { content.insert(content.end(), bytes.begin(), bytes.end()); };
+
+    append(method);
+    append(" ");
+    append(target);
+    append(" HTTP/1.1\r\n");
+    for (const auto& [name, value] : fields)
+    {
+        append(name);
+        append(": ");
+        append(value);
+        append("\r\n");
+    }
+    append("\r\n");
+
+    size_t header_size = content.size();
+    append(std::string_view(body.data(), body.size()));
+
+    Request request = from_content(std::move(content), header_size);
+    request.parse();
+    return request;
+}
+
 // this takes around (~3us)
 void Request::parse()
 {
@@ -89,6 +119,9 @@ void Request::parse()
             return;
         }
 
+        std::string_view version(path_end + 1, line_end - path_end - 1);
+        if (version == "HTTP/1.0") { _version_minor = 0; }
+
         _path = Path::from_string(std::string_view(path_start, path_end - path_start));
         _path.parse();
 
@@ -136,6 +169,25 @@ void Request::parse()
     }
 }
 
+std::string_view Request::header(std::string_view name) const
+{
+    auto it = _headers.find(name);
+    if (it != _headers.end()) { return it->second; }
+
+    for (const auto& [key, value] : _headers)
+    {
+        if (iequals(key, name)) { return value; }
+    }
+    return {};
+}
+
+bool Request::keep_alive() const
+{
+    auto connection = header("Connection");
+    if (_version_minor == 0) { return contains_token(connection, "keep-alive"); }
+    return !contains_token(connection, "close");
+}
+
 void Request::print() const
 {
     switch (_method)
@@ -1,7 +1,341 @@
 #include "response.hpp"
+#include "common.hpp"
+#include "http_date.hpp"
 
-std::string Response::to_http_response() const
+#include <charconv>
+#include <cstring>
+#include <iostream>
+
+// Responses this small are copied into the connection buffer, bigger ones are queued by reference
+constexpr size_t max_copied_body_size = 1024 * 16;
+
+std::string_view Response::status_line(int status_code)
+{
+    switch (status_code)
+    {
+        case 100: return "HTTP/1.1 100 Continue\r\n";
+        case 101: return "HTTP/1.1 101 Switching Protocols\r\n";
+        case 200: return "HTTP/1.1 200 OK\r\n";
+        case 201: return "HTTP/1.1 201 Created\r\n";
+        case 202: return "HTTP/1.1 202 Accepted\r\n";
+        case 204: return "HTTP/1.1 204 No Content\r\n";
+        case 206: return "HTTP/1.1 206 Partial Content\r\n";
+        case 301: return "HTTP/1.1 301 Moved Permanently\r\n";
+        case 302: return "HTTP/1.1 302 Found\r\n";
+        case 303: return "HTTP/1.1 303 See Other\r\n";
+        case 304: return "HTTP/1.1 304 Not Modified\r\n";
+        case 307: return "HTTP/1.1 307 Temporary Redirect\r\n";
+        case 308: return "HTTP/1.1 308 Permanent Redirect\r\n";
+        case 400: return "HTTP/1.1 400 Bad Request\r\n";
+        case 401: return "HTTP/1.1 401 Unauthorized\r\n";
+        case 403: return "HTTP/1.1 403 Forbidden\r\n";
+        case 404: return "HTTP/1.1 404 Not Found\r\n";
+        case 405: return "HTTP/1.1 405 Method Not Allowed\r\n";
+        case 408: return "HTTP/1.1 408 Request Timeout\r\n";
+        case 409: return "HTTP/1.1 409 Conflict\r\n";
+        case 411: return "HTTP/1.1 411 Length Required\r\n";
+        case 412: return "HTTP/1.1 412 Precondition Failed\r\n";
+        case 413: return "HTTP/1.1 413 Content Too Large\r\n";
+        case 414: return "HTTP/1.1 414 URI Too Long\r\n";
+        case 415: return "HTTP/1.1 415 Unsupported Media Type\r\n";
+        case 416: return "HTTP/1.1 416 Range Not Satisfiable\r\n";
+        case 417: return "HTTP/1.1 417 Expectation Failed\r\n";
+        case 422: return "HTTP/1.1 422 Unprocessable Content\r\n";
+        case 429: return "HTTP/1.1 429 Too Many Requests\r\n";
+        case 431: return "HTTP/1.1 431 Request Header Fields Too Large\r\n";
+        case 500: return "HTTP/1.1 500 Internal Server Error\r\n";
+        case 501: return "HTTP/1.1 501 Not Implemented\r\n";
+        case 502: return "HTTP/1.1 502 Bad Gateway\r\n";
+        case 503: return "HTTP/1.1 503 Service Unavailable\r\n";
+        case 504: return "HTTP/1.1 504 Gateway Timeout\r\n";
+        case 505: return "HTTP/1.1 505 HTTP Version Not Supported\r\n";
+        default: return {};
+    }
+}
+
+std::string_view Response::reason_phrase(int status_code)
+{
+    auto line = status_line(status_code);
+    if (line.empty()) { return {}; }
+    // Skip "HTTP/1.1 XXX " and drop the trailing CRLF
+    return line.substr(13, line.size() - 15);
+}
+
+std::string_view Response::content_type_name(ContentType type)
+{
+    switch (type)
+    {
+        case ContentType::TEXT: return "text/plain";
+        case ContentType::HTML: return "text/html; charset=utf-8";
+        case ContentType::JSON: return "application/json";
+        case ContentType::CSS: return "text/css";
+        case ContentType::JAVASCRIPT: return "text/javascript";
+        case ContentType::OCTET_STREAM: return "application/octet-stream";
+        default: return {};
+    }
+}
+
+static std::string_view content_type_line(ContentType type)
+{
+    switch (type)
+    {
+        case ContentType::TEXT: return "Content-Type: text/plain\r\n";
+        case ContentType::HTML: return "Content-Type: text/html; charset=utf-8\r\n";
+        case ContentType::JSON: return "Content-Type: application/json\r\n";
+        case ContentType::CSS: return "Content-Type: text/css\r\n";
+        case ContentType::JAVASCRIPT: return "Content-Type: text/javascript\r\n";
+        case ContentType::OCTET_STREAM: return "Content-Type: application/octet-stream\r\n";
+        default: return {};
+    }
+}
+
+Response& Response::header(std::string_view name, std::string_view value)
+{
+    // A reflected name or value carrying a line break would split the response, and frozen or cached
+    // responses would replay the split to every client
+    if (!is_field_name(name) || !is_field_value(value))
+    {
+        std::cerr << "Error: dropping invalid response header " << name << std::endl;
+        return *this;
+    }
+
+    _headers.append(name);
+    _headers.append(": ");
+    _headers.append(value);
+    _headers.append("\r\n");
+    return *this;
+}
+
+std::string_view Response::header(std::string_view name) const
+{
+    std::string_view headers = _headers;
+    while (!headers.empty())
+    {
+        size_t end = headers.find("\r\n");
+        auto line = headers.substr(0, end);
+        headers.remove_prefix(end + 2);
+
+        size_t colon = line.find(':');
+        if (colon != std::string_view::npos && iequals(line.substr(0, colon), name))
+        {
+            auto value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+            return value;
+        }
+    }
+    return {};
+}
+
+Response Response::not_modified(const Response& response)
+{
+    Response result;
+    result._status_code = 304;
+    result._content_type = ContentType::NONE;
+    result._headers = response._headers;
+    return result;
+}
+
+Response Response::prebuilt(int status_code, std::string_view content, ContentType type)
+{
+    Response response;
+    response._status_code = status_code;
+    response._content_type = type;
+    response.body(content);
+    return frozen(std::move(response));
+}
+
+Response Response::frozen(Response response)
+{
+    // Everything after the per-thread Date and per-request Connection lines is invariant
+    response.render();
+    OutputQueue out;
+    response.write_entity(out);
+
+    auto entity = std::make_shared<std::string>();
+    entity->reserve(out.pending_bytes());
+    out.drain_into(*entity);
+
+    // The body now lives at the end of the prebuilt entity
+    response._body_view = std::string_view(*entity).substr(entity->size() - response.content().size());
+    response._body_kind = BodyKind::VIEW;
+    response._content.clear();
+    response._body_owner.reset();
+    response._prebuilt = std::move(entity);
+    return response;
+}
+
+void Response::share_body()
+{
+    if (_body_kind != BodyKind::OWNED || _content.size() <= max_copied_body_size) { return; }
+    body(std::make_shared<const std::string>(std::move(_content)));
+    _content.clear();
+}
+
+void Response::to_http_response(OutputQueue& out, bool keep_alive) &&
+{
+    share_body();
+    static_cast<const Response&>(*this).to_http_response(out, keep_alive);
+}
+
+void Response::to_http_response(OutputQueue& out, bool keep_alive) const&
+{
+    static constexpr std::string_view keep_alive_line = "Connection: keep-alive\r\n";
+    static constexpr std::string_view close_line = "Connection: close\r\n";
+
+    auto line = status_line(_status_code);
+    if (!line.empty()) { out.append(line); }
+    else
+    {
+        char status[32] = "HTTP/1.1 ";
+        auto [end, ec] = std::to_chars(status + 9, status + sizeof(status) - 3, _status_code);
+        (void)ec;
+        *end++ = ' ';
+        *end++ = '\r';
+        *end++ = '\n';
+        out.append(std::string_view(status, end - status));
+    }
+
+    out.append(HttpDate::common_headers());
+    out.append(keep_alive ? keep_alive_line : close_line);
+
+    if (_prebuilt)
+    {
+        if (_prebuilt->size() <= max_copied_body_size) { out.append(*_prebuilt); }
+        else { out.append_view(*_prebuilt, _prebuilt); }
+        return;
+    }
+
+    write_entity(out);
+}
+
+void Response::write_entity(OutputQueue& out) const
+{
+    out.append(content_type_line(_content_type));
+    out.append(_headers);
+
+    // 1xx, 204 and 304 never carry a body or a Content-Length
+    if (_status_code < 200 || _status_code == 204 || _status_code == 304)
+    {
+        out.append("\r\n");
+        return;
+    }
+
+    // The body follows as the producer generates it
+    if (_stream)
+    {
+        out.append(_chunked ? "Transfer-Encoding: chunked\r\n\r\n" : "\r\n");
+        return;
+    }
+
+    if (_json)
+    {
+        write_json(out);
+        return;
+    }
+
+    char length[48] = "Content-Length: ";
+    auto [end, ec] = std::to_chars(length + 16, length + sizeof(length) - 4, content_length());
+    (void)ec;
+    *end++ = '\r';
+    *end++ = '\n';
+    *end++ = '\r';
+    *end++ = '\n';
+    out.append(std::string_view(length, end - length));
+
+    write_body(out);
+}
+
+void Response::write_json(OutputQueue& out) const
+{
+    static constexpr std::string_view length_name = "Content-Length: ";
+    static constexpr std::string_view header_end = "\r\n\r\n";
+    // Room for any length, closed up once the body is written and its length known
+    static constexpr size_t length_digits = 20;
+
+    auto& buffer = out.writable_tail();
+    size_t start = buffer.size();
+    buffer.insert(buffer.end(), length_name.begin(), length_name.end());
+    size_t digits = buffer.size();
+    buffer.resize(digits + length_digits);
+    buffer.insert(buffer.end(), header_end.begin(), header_end.end());
+
+    size_t body = buffer.size();
+    {
+        JsonWriter writer(buffer);
+        (*_json)(writer);
+    }
+
+    char* end = std::to_chars(buffer.data() + digits, buffer.data() + digits + length_digits, buffer.size() - body).ptr;
+    size_t unused = buffer.data() + digits + length_digits - end;
+    memmove(end, end + unused, buffer.size() - (digits + length_digits));
+    buffer.resize(buffer.size() - unused);
+
+    out.commit(buffer.size() - start);
+}
+
+void Response::render()
+{
+    if (!_json) { return; }
+
+    std::vector<char> buffer;
+    {
+        JsonWriter writer(buffer);
+        (*_json)(writer);
+    }
+    _json.reset();
+    body(std::string(buffer.data(), buffer.size()));
+}
+
+void Response::write_body(OutputQueue& out) const
+{
+    if (_body_kind == BodyKind::FILE)
+    {
+        out.append_file(_file_fd, _file_offset, _file_length, _body_owner);
+        return;
+    }
+
+    // Anything without an owner to keep it alive is copied, the queue may be flushed long after the handler returned
+    auto body = content();
+    if (body.size() <= max_copied_body_size) { out.append(body); }
+    else if (_prebuilt) { out.append_view(body, _prebuilt); }
+    else if (_body_kind == BodyKind::SHARED) { out.append_view(body, _body_owner); }
+    else { out.append(body); }
+}
+
+void ChunkWriter::write_size(size_t size)
+{
+    char header[24];
+    auto [end, ec] = std::to_chars(header, header + sizeof(header) - 2, size, 16);
+    (void)ec;
+    *end++ = '\r';
+    *end++ = '\n';
+    _out.append(std::string_view(header, end - header));
+}
+
+void ChunkWriter::write(std::string_view data)
+{
+    // An empty chunk would terminate the body
+    if (data.empty()) { return; }
+
+    if (_chunked) { write_size(data.size()); }
+    _out.append(data);
+    if (_chunked) { _out.append("\r\n"); }
+    _written += data.size();
+}
+
+void ChunkWriter::write(std::shared_ptr<const std::string> data)
+{
+    if (!data || data->empty()) { return; }
+
+    std::string_view view = *data;
+    size_t size = view.size();
+    if (_chunked) { write_size(size); }
+    _out.append_view(view, std::move(data));
+    if (_chunked) { _out.append("\r\n"); }
+    _written += size;
+}
+
+void ChunkWriter::finish()
 {
-    return "HTTP/1.1 " + std::to_string(_status_code) + "\r\nContent-Length: " + std::to_string(_content.size()) +
-           "\r\nContent-Type: text/plain\r\n\r\n" + _content;
+    if (_chunked) { _out.append("0\r\n\r\n"); }
 }
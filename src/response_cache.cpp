@@ -0,0 +1,140 @@
+#include "response_cache.hpp"
+#include "common.hpp"
+#include "compression.hpp"
+#include "route_options.hpp"
+
+#include <algorithm>
+#include <vector>
+
+ResponseCache::ResponseCache(size_t budget) : budget(budget)
+{
+}
+
+std::string ResponseCache::key(const Request& request, std::string_view path, const RouteOptions& options)
+{
+    std::string result;
+    result.reserve(request.path().raw().size() + 16);
+    result += static_cast<char>('0' + static_cast<int>(request.method()));
+    result += path;
+
+    // ?b=2&a=1 and ?a=1&b=2 are the same request
+    std::string_view raw = request.path().raw();
+    size_t question = raw.find('?');
+    if (question != std::string_view::npos)
+    {
+        std::vector<std::string_view> parameters;
+        std::string_view query = raw.substr(question + 1);
+        while (!query.empty())
+        {
+            size_t amp = query.find('&');
+            auto parameter = query.substr(0, amp);
+            if (!parameter.empty()) { parameters.push_back(parameter); }
+            query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
+        }
+        std::sort(parameters.begin(), parameters.end());
+
+        char separator = '?';
+        for (auto parameter : parameters)
+        {
+            result += separator;
+            result += parameter;
+            separator = '&';
+        }
+    }
+
+    // Only the coding we'd pick matters, not the exact Accept-Encoding spelling
+    if (options.compress)
+    {
+        result += "\ne";
+        result += static_cast<char>('0' + static_cast<int>(Compression::negotiate(request.header("Accept-Encoding"))));
+    }
+
+    for (const auto& name : options.cache_vary)
+    {
+        result += '\n';
+        result += name;
+        result += ':';
+        result += request.header(name);
+    }
+
+    return result;
+}
+
+bool ResponseCache::is_cacheable(const Response& response)
+{
+    if (response.is_stream() || response.has_file_body()) { return false; }
+    if (!response.header("Set-Cookie").empty()) { return false; }
+
+    auto cache_control = response.header("Cache-Control");
+    if (contains_token(cache_control, "private") || contains_token(cache_control, "no-store")) { return false; }
+
+    // Cacheable by default per RFC 9110, 206 needs the Range in the key so it's left out
+    switch (response.status_code())
+    {
+        case 200:
+        case 203:
+        case 204:
+        case 300:
+        case 301:
+        case 404:
+        case 405:
+        case 410:
+        case 414:
+        case 501: return true;
+        default: return false;
+    }
+}
+
+std::shared_ptr<const Response> ResponseCache::fetch(const std::string& key, uint32_t ttl_seconds,
+                                                     const Producer& produce, Response& uncached)
+{
+    auto it = entries.find(key);
+    if (it != entries.end())
+    {
+        if (Clock::now() < it->second.expires)
+        {
+            lru.splice(lru.begin(), lru, it->second.position);
+            return it->second.response;
+        }
+        remove(it);
+    }
+
+    // A throwing handler leaves nothing behind
+    Response fresh = produce();
+    if (!is_cacheable(fresh))
+    {
+        uncached = std::move(fresh);
+        return nullptr;
+    }
+
+    auto response = std::make_shared<const Response>(Response::frozen(std::move(fresh)));
+    insert(key, response, ttl_seconds);
+    return response;
+}
+
+void ResponseCache::insert(const std::string& key, std::shared_ptr<const Response> response, uint32_t ttl_seconds)
+{
+    // A handler that went through this cache for the same key already put an entry there
+    auto existing = entries.find(key);
+    if (existing != entries.end()) { remove(existing); }
+
+    size_t size = key.size() + response->_prebuilt->size();
+    if (size > budget) { return; }
+
+    lru.push_front(key);
+    Entry& entry = entries[key];
+    entry.response = std::move(response);
+    entry.expires = Clock::now() + std::chrono::seconds(ttl_seconds);
+    entry.size = size;
+    entry.position = lru.begin();
+    bytes += size;
+
+    while (bytes > budget) { remove(entries.find(lru.back())); }
+}
+
+void ResponseCache::remove(std::unordered_map<std::string, Entry>::iterator it)
+{
+    bytes -= it->second.size;
+    lru.erase(it->second.position);
+    entries.erase(it);
+}
@@ -0,0 +1,159 @@
+#include "restart.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// sd_listen_fds(3): passed descriptors start right after stdio
+constexpr int systemd_first_fd = 3;
+// Seconds a new process waits for the old one to hand over its listener
+constexpr int handoff_timeout = 5;
+
+static bool control_address(const std::string& path, sockaddr_un& address)
+{
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Control socket path too long: " << path << std::endl;
+        return false;
+    }
+    memcpy(address.sun_path, path.data(), path.size());
+    return true;
+}
+
+int systemd_listener()
+{
+    const char* pid = std::getenv("LISTEN_PID");
+    const char* fds = std::getenv("LISTEN_FDS");
+    if (!pid || !fds || std::atoi(pid) != getpid() || std::atoi(fds) < 1) { return -1; }
+
+    // Not for children we might start
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    int fd = systemd_first_fd;
+    int listening = 0;
+    socklen_t length = sizeof(listening);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &length) == -1 || !listening)
+    {
+        std::cerr << "Socket activation passed a descriptor that isn't a listening socket" << std::endl;
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+int request_listener(const std::string& path, int& control)
+{
+    sockaddr_un address;
+    if (!control_address(path, address)) { return -1; }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) { return -1; }
+
+    // Nobody listening, or a stale path left by a process that's gone
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    timeval timeout = {.tv_sec = handoff_timeout, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char byte;
+    iovec data = {.iov_base = &byte, .iov_len = 1};
+    alignas(cmsghdr) char buffer[CMSG_SPACE(sizeof(int))];
+    msghdr message = {};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = buffer;
+    message.msg_controllen = sizeof(buffer);
+
+    if (recvmsg(fd, &message, MSG_CMSG_CLOEXEC) != 1)
+    {
+        std::cerr << "Error receiving listener from " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+        header->cmsg_len != CMSG_LEN(sizeof(int)))
+    {
+        std::cerr << "No listener in the handoff from " << path << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    int listener;
+    memcpy(&listener, CMSG_DATA(header), sizeof(int));
+    control = fd;
+    return listener;
+}
+
+void confirm_handoff(int control)
+{
+    char ready = 'R';
+    if (send(control, &ready, 1, MSG_NOSIGNAL) != 1)
+    {
+        std::cerr << "Error confirming handoff: " << strerror(errno) << std::endl;
+    }
+}
+
+bool send_listener(int connection, int listener)
+{
+    char byte = 'L';
+    iovec data = {.iov_base = &byte, .iov_len = 1};
+    alignas(cmsghdr) char buffer[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = buffer;
+    message.msg_controllen = sizeof(buffer);
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &listener, sizeof(int));
+
+    if (sendmsg(connection, &message, MSG_NOSIGNAL) != 1)
+    {
+        std::cerr << "Error sending listener: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int open_control_socket(const std::string& path)
+{
+    sockaddr_un address;
+    if (!control_address(path, address)) { return -1; }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        std::cerr << "Error creating control socket: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    // The previous process keeps its bound socket open until it's done, only the name moves over
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1 || listen(fd, 4) == -1)
+    {
+        std::cerr << "Error binding control socket " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -1,18 +1,19 @@
 #include "router.hpp"
 
+#include <algorithm>
 #include <iostream>
 
-Router::Router()
+RouteTable::RouteTable()
 {
-    get_root = new Node(false, NodeType::ROOT, "", {});
-    post_root = new Node(false, NodeType::ROOT, "", {});
-    put_root = new Node(false, NodeType::ROOT, "", {});
-    delete_root = new Node(false, NodeType::ROOT, "", {});
-    options_root = new Node(false, NodeType::ROOT, "", {});
-    patch_root = new Node(false, NodeType::ROOT, "", {});
+    get_root = new Node(false, NodeType::ROOT, "");
+    post_root = new Node(false, NodeType::ROOT, "");
+    put_root = new Node(false, NodeType::ROOT, "");
+    delete_root = new Node(false, NodeType::ROOT, "");
+    options_root = new Node(false, NodeType::ROOT, "");
+    patch_root = new Node(false, NodeType::ROOT, "");
 }
 
-Router::~Router()
+RouteTable::~RouteTable()
 {
     if (get_root) delete get_root;
     if (post_root) delete post_root;
@@ -22,12 +23,86 @@ Router::~Router()
     if (patch_root) delete patch_root;
 }
 
-void Router::add_route(Method method, const std::string& path, const RouteHandler& handler)
+Router::Router() : table(new RouteTable())
 {
-    auto segments = get_segments(path);
+}
+
+Router::~Router()
+{
+    delete table.load();
+}
+
+void Router::add_route(Method method, const std::string& path, RouteHandler handler, RouteOptions options)
+{
+    if (get_segments(path).empty()) { return; }
+
+    auto shared_handler = std::make_shared<const RouteHandler>(std::move(handler));
+
+    std::lock_guard lock(write_mutex);
+
+    auto it = std::find_if(definitions.begin(), definitions.end(), [&](const RouteDefinition& definition) {
+        return definition.method == method && definition.path == path;
+    });
+
+    if (it != definitions.end())
+    {
+        it->handler = std::move(shared_handler);
+        it->options = options;
+    }
+    else { definitions.push_back({method, path, std::move(shared_handler), options}); }
+
+    publish();
+}
+
+void Router::begin_batch()
+{
+    std::lock_guard lock(write_mutex);
+    batch_depth++;
+}
+
+void Router::end_batch()
+{
+    std::lock_guard lock(write_mutex);
+    if (batch_depth == 0) { return; }
+    batch_depth--;
+    if (batch_depth == 0 && unpublished) { publish(); }
+}
+
+bool Router::remove_route(Method method, const std::string& path)
+{
+    std::lock_guard lock(write_mutex);
+
+    auto it = std::find_if(definitions.begin(), definitions.end(), [&](const RouteDefinition& definition) {
+        return definition.method == method && definition.path == path;
+    });
+
+    if (it == definitions.end()) { return false; }
+
+    definitions.erase(it);
+    publish();
+    return true;
+}
+
+// Must be called with write_mutex held. Inside a batch this only notes that there's something to publish.
+void Router::publish()
+{
+    unpublished = batch_depth > 0;
+    if (unpublished) { return; }
+
+    auto next = new RouteTable();
+    for (const auto& definition : definitions) { insert_route(*next, definition); }
+
+    RouteTable* previous = table.exchange(next);
+    epochs.retire(previous, [](void* ptr) { delete static_cast<RouteTable*>(ptr); });
+    epochs.collect();
+}
+
+void Router::insert_route(RouteTable& table, const RouteDefinition& definition)
+{
+    auto segments = get_segments(definition.path);
     if (segments.empty()) { return; }
 
-    Node* root = get_root_node(method);
+    Node* root = get_root_node(table, definition.method);
     if (!root) { return; }
 
     Node* current = root;
@@ -52,33 +127,50 @@ void Router::add_route(Method method, const std::string& path, const RouteHandle
 
         if (!next)
         {
-            next = new Node(is_leaf, type, segment, handler);
+            next = new Node(is_leaf, type, segment);
             current->add_child(next);
         }
         else if (is_leaf) { next->is_leaf = true; }
 
         current = next;
     }
+
+    current->handler = definition.handler;
+    current->options = definition.options;
 }
 
-Node* Router::find_route(Method method, const std::string& path, RouteParams& params)
+const Node* Router::find_route(Method method, std::string_view path, RouteParams& params) const
 {
     auto segments = get_segments(path);
     if (segments.empty()) { return nullptr; }
 
-    Node* current = get_root_node(method);
+    const Node* current = get_root_node(*table.load(std::memory_order_acquire), method);
     if (!current) { return nullptr; }
 
     for (size_t i = 0; i < segments.size(); ++i)
     {
         current = current->get_child(segments[i], params);
         if (!current) { return nullptr; }
+
+        // A trailing wildcard swallows the remaining segments
+        if (current->type == NodeType::WILDCARD && current->children.empty() && !current->param_child &&
+            !current->regex_child && !current->wildcard_child)
+        {
+            std::string rest = segments[i];
+            for (size_t j = i + 1; j < segments.size(); ++j)
+            {
+                rest += '/';
+                rest += segments[j];
+            }
+            params["*"] = std::move(rest);
+            break;
+        }
     }
 
     return current->is_leaf ? current : nullptr;
 }
 
-std::vector<std::string> Router::get_segments(const std::string& path)
+std::vector<std::string> Router::get_segments(std::string_view path)
 {
     std::vector<std::string> segments;
     std::string current;
@@ -116,43 +208,44 @@ NodeType Router::get_node_type(const std::string& segment)
     return NodeType::STATIC;
 }
 
-Node* Router::get_root_node(Method method)
+Node* Router::get_root_node(const RouteTable& table, Method method)
 {
     switch (method)
     {
-        case Method::GET: return get_root;
-        case Method::POST: return post_root;
-        case Method::PUT: return put_root;
-        case Method::DELETE: return delete_root;
-        case Method::OPTIONS: return options_root;
-        case Method::PATCH: return patch_root;
+        case Method::GET: return table.get_root;
+        case Method::POST: return table.post_root;
+        case Method::PUT: return table.put_root;
+        case Method::DELETE: return table.delete_root;
+        case Method::OPTIONS: return table.options_root;
+        case Method::PATCH: return table.patch_root;
         default: return nullptr;
     }
 }
 
-void Router::print()
+void Router::print() const
 {
+    const RouteTable& current = *table.load(std::memory_order_acquire);
+
     std::cout << "GET Routes:\n";
-    if (get_root != nullptr) { get_root->print(0); }
+    if (current.get_root != nullptr) { current.get_root->print(0); }
 
     std::cout << "\nPOST Routes:\n";
-    if (post_root != nullptr) { post_root->print(0); }
+    if (current.post_root != nullptr) { current.post_root->print(0); }
 
     std::cout << "\nPUT Routes:\n";
-    if (put_root != nullptr) { put_root->print(0); }
+    if (current.put_root != nullptr) { current.put_root->print(0); }
 
     std::cout << "\nDELETE Routes:\n";
-    if (delete_root != nullptr) { delete_root->print(0); }
+    if (current.delete_root != nullptr) { current.delete_root->print(0); }
 
     std::cout << "\nOPTIONS Routes:\n";
-    if (options_root != nullptr) { options_root->print(0); }
+    if (current.options_root != nullptr) { current.options_root->print(0); }
 
     std::cout << "\nPATCH Routes:\n";
-    if (patch_root != nullptr) { patch_root->print(0); }
+    if (current.patch_root != nullptr) { current.patch_root->print(0); }
 }
 
-Node::Node(bool is_leaf, NodeType type, const std::string& path, const RouteHandler& handler)
-    : is_leaf(is_leaf), type(type), path(path), handler(handler)
+Node::Node(bool is_leaf, NodeType type, const std::string& path) : is_leaf(is_leaf), type(type), path(path)
 {
     if (type == NodeType::NAMED_PARAMETER)
     {
@@ -187,7 +280,7 @@ void Node::add_child(Node* child)
     else { children[child->path] = child; }
 }
 
-Node* Node::get_child(const std::string& path, RouteParams& params)
+const Node* Node::get_child(const std::string& path, RouteParams& params) const
 {
     // First try exact match
     auto it = children.find(path);
@@ -227,7 +320,7 @@ Node::~Node()
     if (regex_child) delete regex_child;
 }
 
-void Node::print(int depth)
+void Node::print(int depth) const
 {
     if (type != NodeType::ROOT)
     {
@@ -1,74 +1,538 @@
 #include "server.hpp"
+#include "compression.hpp"
+#include "hash.hpp"
+#include "http2.hpp"
+#include "proxy.hpp"
+#include "rate_limit.hpp"
+#include "request_limits.hpp"
+#include "restart.hpp"
+#include "websocket.hpp"
+#include "json.hpp"
+#include "http_date.hpp"
+#include "listener.hpp"
+#include "overload.hpp"
 #include "request.hpp"
 #include "response.hpp"
 #include "router.hpp"
 
-#include <arpa/inet.h>
 #include <cerrno>
+#include <charconv>
 #include <chrono>
+#include <csignal>
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
+#include <utility>
 
-void set_nonblocking(int fd)
+#ifndef EPIOCSPARAMS
+// linux/eventpoll.h from 6.9, older headers don't have it
+struct epoll_params
 {
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags == -1)
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+Server::Server(int port, Router& router) : port(port), server_socket(-1), epoll_fd(-1), router(router)
+{
+}
+
+void Server::watch(int fd, WatchHandler handler)
+{
+    watchers[fd] = std::move(handler);
+
+    // Before run() the descriptor gets registered together with the listener
+    if (epoll_fd == -1) { return; }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        std::cerr << "Error adding watched descriptor to epoll: " << strerror(errno) << std::endl;
+    }
+}
+
+void Server::at_fork(ForkHandler handler)
+{
+    fork_handlers.push_back(std::move(handler));
+}
+
+bool Server::enable_prefork(const PreforkOptions& options)
+{
+    auto stats = std::make_unique<SharedStats>(prefork_workers(options));
+    if (!stats->valid()) { return false; }
+    prefork_options = options;
+    shared_stats = std::move(stats);
+    return true;
+}
+
+void Server::enable_tracing(const TraceOptions& options)
+{
+    tracer = std::make_unique<RequestTracer>(options);
+}
+
+void Server::write_trace(JsonWriter& json) const
+{
+    if (tracer) { tracer->write(json); }
+    else { json.begin_object().key("traceEvents").begin_array().end_array().end_object(); }
+}
+
+void Server::begin_trace(Connection& connection)
+{
+    connection.trace = {};
+    connection.trace.decided = true;
+    // Only a connection's first request waited for the accept
+    uint64_t accepted = std::exchange(connection.accepted_at, 0);
+    if (!tracer->sample()) { return; }
+
+    connection.trace.sampled = true;
+    connection.trace.at[static_cast<size_t>(TracePhase::ACCEPT)] = accepted;
+    connection.trace.stamp(TracePhase::FIRST_BYTE);
+}
+
+void Server::trace_serialized(Connection& connection, PhaseTrace& trace, const Request& request, int status)
+{
+    trace.stamp(TracePhase::SERIALIZED);
+    trace.set_name(request.method(), request.path().raw());
+    trace.status = status;
+
+    // Pipelined behind another sampled response that's still in the queue, that one goes without its last byte
+    if (connection.sending.sampled) { tracer->commit(connection.sending, connection.handle); }
+    connection.sending = trace;
+    trace.sampled = false;
+}
+
+void Server::trace_sent(Connection& connection)
+{
+    connection.sending.stamp(TracePhase::LAST_BYTE);
+    tracer->commit(connection.sending, connection.handle);
+    connection.sending.sampled = false;
+}
+
+void Server::enable_rate_limit(const RateLimitOptions& options)
+{
+    rate_limiter = std::make_unique<RateLimiter>(options);
+}
+
+void Server::set_request_limits(const RequestLimits& limits)
+{
+    request_limits = limits;
+}
+
+void Server::enable_load_shedding(const OverloadOptions& options)
+{
+    overload = std::make_unique<OverloadController>(options);
+}
+
+void Server::reject(Connection& connection, std::string_view response)
+{
+    // Whatever else the client sent is dropped with the connection
+    connection.request_data.clear();
+    connection.header_scan_offset = 0;
+    connection.head_size = 0;
+    connection.body_size = 0;
+    connection.chunked = false;
+    connection.chunks.reset();
+    connection.body_limit = 0;
+    connection.head_checked = false;
+    connection.rejection = {};
+    connection.requests_pending = false;
+    if (connection.upload)
+    {
+        connection.upload->abort();
+        connection.upload.reset();
+    }
+    connection.output.append_view(response, nullptr);
+    connection.close_after_flush = true;
+}
+
+void Server::reject(Connection& connection, const Response& response)
+{
+    response.to_http_response(connection.output, false);
+    reject(connection, std::string_view());
+}
+
+bool Server::check_upload(Connection& connection, Request& request, const Node* node, size_t body_size)
+{
+    // A chunked body's size isn't known yet, it's held to the route's limit while it's decoded
+    if (!node || (body_size == 0 && !connection.chunked)) { return true; }
+    if (connection.chunked) { connection.body_limit = node->options.max_body_size; }
+
+    if (node->options.max_body_size > 0 && body_size > node->options.max_body_size)
+    {
+        reject(connection, content_too_large_response);
+        return false;
+    }
+
+    if (node->options.check_upload)
+    {
+        if (auto response = (*node->options.check_upload)(request))
+        {
+            reject(connection, *response);
+            return false;
+        }
+    }
+    return true;
+}
+
+void Server::check_request_head(Connection& connection)
+{
+    connection.head_checked = true;
+    Request head = connection.request_head();
+
+    // HTTP/1.0 has no expectations, its clients send the body right away
+    auto expect = head.version_minor() >= 1 ? head.header("expect") : std::string_view();
+    bool expects_continue = iequals(expect, "100-continue");
+    if (!expect.empty() && !expects_continue)
     {
-        std::cerr << "Error getting socket flags: " << strerror(errno) << std::endl;
+        reject(connection, expectation_failed_response);
         return;
     }
-    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+
+    const Node* node = route(head);
+    if (!node && expects_continue)
     {
-        std::cerr << "Error setting socket to non-blocking: " << strerror(errno) << std::endl;
+        Response response;
+        dispatch(head, nullptr, response);
+        reject(connection, response);
+        return;
     }
+
+    if (!check_upload(connection, head, node, connection.body_size)) { return; }
+    if (expects_continue) { connection.output.append_view(continue_response, nullptr); }
+    // Chunked bodies are decoded into the buffer first, the upload gets them once they're complete
+    if (node && node->options.upload && !connection.chunked) { start_upload(connection, std::move(head), node->options.upload); }
 }
 
-Server::Server(int port, Router& router) : port(port), server_socket(-1), epoll_fd(-1), router(router)
+void Server::start_upload(Connection& connection, Request&& head, std::shared_ptr<const UploadHandler> handler)
 {
+    connection.upload = std::make_unique<Upload>(std::move(head), std::move(handler));
+    connection.upload->remaining = connection.body_size;
+
+    // Only the body's bytes go to request_data from now on, until the upload has all of them
+    connection.request_data.erase(connection.request_data.begin(), connection.request_data.begin() + connection.head_size);
+    connection.header_scan_offset = 0;
+    connection.head_size = 0;
+    connection.body_size = 0;
+    connection.head_checked = false;
 }
 
-void Server::run()
+bool Server::receive_upload(Connection& connection)
 {
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket == -1)
+    Upload& upload = *connection.upload;
+    size_t length = std::min(upload.remaining, connection.request_data.size());
+    bool parsed = upload.feed(std::string_view(connection.request_data.data(), length));
+    connection.request_data.erase(connection.request_data.begin(), connection.request_data.begin() + length);
+    upload.remaining -= length;
+
+    if (!parsed)
     {
-        std::cerr << "Error creating server socket: " << strerror(errno) << std::endl;
-        exit(EXIT_FAILURE);
+        reject(connection, Response::with_status(400, "Bad Request"));
+        return false;
+    }
+    return upload.remaining == 0 && finish_upload(connection);
+}
+
+bool Server::finish_upload(Connection& connection)
+{
+    auto upload = std::move(connection.upload);
+    bool keep_alive = upload->request().keep_alive() && !draining;
+    upload->finish().to_http_response(connection.output, keep_alive);
+    if (!keep_alive) { connection.close_after_flush = true; }
+    return keep_alive;
+}
+
+bool Server::shed(const Connection& connection, const Node* node)
+{
+    if (!overload || connection.readable_at == 0) { return false; }
+
+    uint64_t now = monotonic_microseconds();
+    uint64_t delay = now > connection.readable_at ? now - connection.readable_at : 0;
+    if (overload->admit(delay, node ? node->options.priority : RoutePriority::NORMAL, now)) { return false; }
+
+    reactor_stats.shed_requests++;
+    if (stats_slot) { WorkerStats::add(stats_slot->shed_requests); }
+    return true;
+}
+
+void Server::pause_accepting()
+{
+    std::cerr << "Pausing accepts, " << open_connections << " connections open" << std::endl;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_socket, NULL);
+    accepting = false;
+    reactor_stats.accept_pauses++;
+}
+
+void Server::resume_accepting()
+{
+    // Connections that queued up in the backlog meanwhile show up as an event right away
+    epoll_event event = {};
+    event.events = listener_events;
+    event.data.fd = server_socket;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event) == -1)
+    {
+        std::cerr << "Error adding server socket to epoll: " << strerror(errno) << std::endl;
+        return;
     }
+    accepting = true;
+}
+
+void Server::configure_listener(const ListenerOptions& options)
+{
+    listener_options = options;
+}
+
+void Server::configure_reactor(const ReactorOptions& options)
+{
+    reactor_options = options;
+}
+
+bool Server::enable_tls(const TlsOptions& options)
+{
+    auto context = std::make_unique<TlsContext>(options);
+    if (!context->valid()) { return false; }
+    tls_context = std::move(context);
+    return true;
+}
+
+ListenerOptions Server::socket_options() const
+{
+    ListenerOptions options = listener_options;
+    options.prefer_busy_poll |= reactor_options.prefer_busy_poll;
+    options.reuse_port |= worker_listeners;
+    return options;
+}
+
+void Server::configure_restart(const RestartOptions& options)
+{
+    restart_options = options;
+}
 
-    sockaddr_in server_address = {};
-    server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(port);
-    server_address.sin_addr.s_addr = INADDR_ANY;
+bool Server::acquire_listener()
+{
+    if (restart_options.systemd)
+    {
+        server_socket = systemd_listener();
+        if (server_socket != -1) { std::cout << "Using the listener from socket activation" << std::endl; }
+    }
+    if (server_socket == -1 && !restart_options.control_socket.empty())
+    {
+        server_socket = request_listener(restart_options.control_socket, predecessor_fd);
+        if (server_socket != -1) { std::cout << "Took over the listener from the running process" << std::endl; }
+    }
+    return server_socket != -1;
+}
 
-    int reuse = 1;
-    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int)) == -1)
+void Server::take_over()
+{
+    if (predecessor_fd != -1)
     {
-        std::cerr << "Error setting socket options: " << strerror(errno) << std::endl;
+        confirm_handoff(predecessor_fd);
+        close(predecessor_fd);
+        predecessor_fd = -1;
     }
+    if (!restart_options.control_socket.empty()) { control_fd = open_control_socket(restart_options.control_socket); }
+}
 
-    set_nonblocking(server_socket);
+void Server::start_drain()
+{
+    draining = true;
+    drain_deadline = ticks + restart_options.drain_timeout;
+    std::cout << "Draining " << open_connections << " connections" << std::endl;
 
-    if (bind(server_socket, (const sockaddr*)&server_address, sizeof(server_address)) == -1)
+    // Whoever connects from now on is the next process's, or refused when there is none
+    if (control_fd != -1)
+    {
+        close(control_fd);
+        control_fd = -1;
+    }
+    if (server_socket != -1)
     {
-        std::cerr << "Error binding server socket: " << strerror(errno) << std::endl;
+        if (accepting) { epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_socket, NULL); }
         close(server_socket);
-        exit(EXIT_FAILURE);
+        server_socket = -1;
+        accepting = false;
+    }
+
+    for (auto& slot : connections)
+    {
+        if (!slot || slot->handle == -1) { continue; }
+        Connection& connection = *slot;
+
+        if (connection.h2)
+        {
+            connection.h2->shutdown();
+            flush_connection(connection);
+        }
+        else if (connection.ws) { connection.ws->close(1001, "Going away"); }
+        else if (connection.sse) { close_connection(connection); }
+        // Between requests. The rest finish the one they're on and get Connection: close with its response,
+        // so do fresh connections and keep-alive ones whose next request is already in the socket.
+        else if (connection.output.empty() && connection.request_data.empty() && !connection.input_pending &&
+                 !connection.stream && connection.upstream == -1 && !connection.upload)
+        {
+            char next;
+            if (recv(connection.handle, &next, 1, MSG_PEEK | MSG_DONTWAIT) <= 0) { close_connection(connection); }
+        }
+    }
+}
+
+void Server::handle_signal()
+{
+    signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        if (draining) { stopping = true; }
+        else { start_drain(); }
+    }
+}
+
+void Server::accept_successor()
+{
+    int connection = accept4(control_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (connection == -1) { return; }
+
+    // One at a time
+    if (successor_fd != -1 || !send_listener(connection, server_socket))
+    {
+        close(connection);
+        return;
+    }
+
+    successor_fd = connection;
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = successor_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, successor_fd, &event);
+    std::cout << "Handing the listener over to a new process" << std::endl;
+}
+
+void Server::finish_handoff()
+{
+    char ready;
+    ssize_t length = read(successor_fd, &ready, 1);
+    if (length == -1 && errno == EAGAIN) { return; }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, successor_fd, NULL);
+    close(successor_fd);
+    successor_fd = -1;
+
+    if (length == 1) { start_drain(); }
+    else { std::cerr << "New process went away before taking over, still serving" << std::endl; }
+}
+
+bool Server::master_handoff()
+{
+    int connection = accept4(control_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (connection == -1) { return true; }
+
+    // Nothing else for the master to do meanwhile, the workers keep serving
+    std::cout << "Handing the listener over to a new process" << std::endl;
+    timeval timeout = {.tv_sec = restart_options.drain_timeout, .tv_usec = 0};
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char ready;
+    bool handed_over = send_listener(connection, server_socket) && read(connection, &ready, 1) == 1;
+    close(connection);
+    if (!handed_over)
+    {
+        std::cerr << "New process went away before taking over, still serving" << std::endl;
+        return true;
+    }
+
+    close(control_fd);
+    control_fd = -1;
+    return false;
+}
+
+void Server::run()
+{
+    // OpenSSL and splice() write to sockets without MSG_NOSIGNAL, a peer that went away must not kill the process
+    if (tls_context || !proxy_routes.empty()) { signal(SIGPIPE, SIG_IGN); }
+
+    bool inherited = acquire_listener();
+    if (!shared_stats)
+    {
+        serve();
+        return;
     }
 
-    if (listen(server_socket, SOMAXCONN) == -1)
+    // A listener that was passed to us or has to be passed on is one socket the workers share
+    worker_listeners = prefork_options.reuse_port && !inherited && restart_options.control_socket.empty();
+
+    // Bound here either way so a port that's taken fails once instead of in every worker. With SO_REUSEPORT
+    // the workers bind their own sockets, this one would get its share of connections and never accept them.
+    if (!inherited) { server_socket = open_listener(port, socket_options()); }
+    if (server_socket == -1) { exit(EXIT_FAILURE); }
+    if (worker_listeners)
     {
-        std::cerr << "Error listening to server socket: " << strerror(errno) << std::endl;
         close(server_socket);
-        exit(EXIT_FAILURE);
+        server_socket = -1;
+    }
+    else { listener_events |= EPOLLEXCLUSIVE; }
+
+    std::cout << "Listening on port " << port << " with " << shared_stats->workers() << " workers" << std::endl;
+
+    bool took_over = false;
+    supervise(
+        *shared_stats,
+        [this](size_t index) {
+            stats_slot = &shared_stats->worker(index);
+            // Handoffs are the master's
+            for (int* fd : {&control_fd, &predecessor_fd})
+            {
+                if (*fd != -1) { close(*fd); }
+                *fd = -1;
+            }
+            for (auto& handler : fork_handlers) { handler(); }
+            serve();
+        },
+        [this, &took_over]() {
+            // The first workers are up
+            if (!took_over)
+            {
+                take_over();
+                took_over = true;
+            }
+            return control_fd == -1 || master_handoff();
+        });
+
+    if (server_socket != -1) { close(server_socket); }
+    if (control_fd != -1) { close(control_fd); }
+}
+
+void Server::serve()
+{
+    if (server_socket == -1)
+    {
+        server_socket = open_listener(port, socket_options());
+        if (server_socket == -1) { exit(EXIT_FAILURE); }
+        if (!shared_stats) { std::cout << "Listening on port " << port << std::endl; }
     }
 
-    std::cout << "Listening on port " << port << std::endl;
+    // SIGTERM and SIGINT drain instead of killing the process
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1)
+    {
+        std::cerr << "Error creating signalfd: " << strerror(errno) << std::endl;
+        sigprocmask(SIG_UNBLOCK, &signals, nullptr);
+    }
 
     epoll_fd = epoll_create1(0);
     if (epoll_fd == -1)
@@ -78,8 +542,20 @@ void Server::run()
         exit(EXIT_FAILURE);
     }
 
+    if (reactor_options.busy_poll_microseconds > 0)
+    {
+        epoll_params params = {};
+        params.busy_poll_usecs = reactor_options.busy_poll_microseconds;
+        params.busy_poll_budget = reactor_options.busy_poll_budget;
+        params.prefer_busy_poll = reactor_options.prefer_busy_poll;
+        if (ioctl(epoll_fd, EPIOCSPARAMS, &params) == -1)
+        {
+            std::cerr << "Error enabling epoll busy polling: " << strerror(errno) << std::endl;
+        }
+    }
+
     epoll_event event = {};
-    event.events = EPOLLIN | EPOLLET;
+    event.events = listener_events;
     event.data.fd = server_socket;
     if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event) == -1)
     {
@@ -89,12 +565,75 @@ void Server::run()
         exit(EXIT_FAILURE);
     }
 
+    // One second tick for the cached Date header and idle connection timeouts
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1)
+    {
+        std::cerr << "Error creating timer: " << strerror(errno) << std::endl;
+        close(server_socket);
+        close(epoll_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    itimerspec interval = {};
+    interval.it_interval.tv_sec = 1;
+    interval.it_value.tv_sec = 1;
+    timerfd_settime(timer_fd, 0, &interval, nullptr);
+
+    epoll_event timer_event = {};
+    timer_event.events = EPOLLIN;
+    timer_event.data.fd = timer_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &timer_event) == -1)
+    {
+        std::cerr << "Error adding timer to epoll: " << strerror(errno) << std::endl;
+        close(server_socket);
+        close(epoll_fd);
+        close(timer_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    for (auto& [fd, handler] : watchers)
+    {
+        epoll_event watch_event = {};
+        watch_event.events = EPOLLIN;
+        watch_event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &watch_event) == -1)
+        {
+            std::cerr << "Error adding watched descriptor to epoll: " << strerror(errno) << std::endl;
+        }
+    }
+
+    // A prefork master takes over once its workers are up
+    if (!shared_stats) { take_over(); }
+
+    for (int fd : {signal_fd, control_fd})
+    {
+        if (fd == -1) { continue; }
+        epoll_event control_event = {};
+        control_event.events = EPOLLIN;
+        control_event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &control_event) == -1)
+        {
+            std::cerr << "Error adding control descriptor to epoll: " << strerror(errno) << std::endl;
+        }
+    }
+
+    HttpDate::refresh();
+
     constexpr size_t max_events = 1024;
     epoll_event events[max_events];
 
-    while (true)
+    // Route lookups hand out pointers into the current route table, tell the router
+    // when this thread can't be holding any so replaced tables can be freed
+    auto router_reader = router.register_reader();
+
+    while (!stopping)
     {
-        int num_events = epoll_wait(epoll_fd, events, max_events, -1);
+        router.offline(router_reader);
+        int num_events = wait_for_events(events, max_events);
+        router.quiescent(router_reader);
+        if (overload) { batch_time = monotonic_microseconds(); }
+
         if (num_events == -1)
         {
             if (errno == EINTR)
@@ -113,9 +652,11 @@ void Server::run()
                 // Accept new connections
                 while (true)
                 {
-                    sockaddr_in client_addr;
+                    // Non-blocking from the start, everything else is inherited from the listener
+                    sockaddr_storage client_addr;
                     socklen_t client_len = sizeof(client_addr);
-                    int client_socket = accept(server_socket, (sockaddr*)&client_addr, &client_len);
+                    int client_socket = accept4(server_socket, (sockaddr*)&client_addr, &client_len,
+                                                SOCK_NONBLOCK | SOCK_CLOEXEC);
 
                     if (client_socket == -1)
                     {
@@ -128,29 +669,40 @@ void Server::run()
                         continue;
                     }
 
-                    // Find an available connection slot
-                    size_t selected_connection = SIZE_MAX;
-                    for (size_t j = 0; j < connections.size(); j++)
+                    if (open_connections >= max_connections)
                     {
-                        if (connections[j].handle == -1)
+                        if (!tls_context)
                         {
-                            selected_connection = j;
-                            break;
+                            send(client_socket, service_unavailable_response.data(), service_unavailable_response.size(),
+                                 MSG_NOSIGNAL | MSG_DONTWAIT);
                         }
+                        close(client_socket);
+                        continue;
                     }
 
-                    if (selected_connection == SIZE_MAX)
+                    in6_addr client_address = peer_address(client_addr);
+
+                    // A client already out of tokens doesn't get another connection slot
+                    if (rate_limiter && rate_limiter->options().key_header.empty() &&
+                        !rate_limiter->admits(RateLimiter::key(client_address)))
                     {
-                        std::cerr << "Error: too many connections" << std::endl;
+                        if (!tls_context)
+                        {
+                            send(client_socket, too_many_requests_response.data(), too_many_requests_response.size(),
+                                 MSG_NOSIGNAL | MSG_DONTWAIT);
+                        }
                         close(client_socket);
                         continue;
                     }
 
-                    Connection& connection = connections[selected_connection];
-                    set_nonblocking(client_socket);
+                    // Slots are indexed by descriptor and only allocated for descriptors we've seen
+                    if (static_cast<size_t>(client_socket) >= connections.size()) { connections.resize(client_socket + 1); }
+                    if (!connections[client_socket]) { connections[client_socket] = std::make_unique<Connection>(); }
+
+                    Connection& connection = *connections[client_socket];
 
                     epoll_event client_event = {};
-                    client_event.events = EPOLLIN | EPOLLET;
+                    client_event.events = EPOLLIN | EPOLLOUT | EPOLLET;
                     client_event.data.fd = client_socket;
                     if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &client_event) == -1)
                     {
@@ -159,82 +711,1325 @@ void Server::run()
                         continue;
                     }
 
+                    connection.reset();
                     connection.handle = client_socket;
-                    connection.request_in_progress = false;
-                    socket_to_connection[client_socket] = selected_connection;
+                    connection.peer_address = client_address;
+                    connection.last_active = ticks;
+                    if (tracer) { connection.accepted_at = trace_ticks(); }
+                    open_connections++;
+                    if (stats_slot)
+                    {
+                        WorkerStats::add(stats_slot->accepted_connections);
+                        stats_slot->open_connections.store(open_connections, std::memory_order_relaxed);
+                    }
+
+                    if (tls_context)
+                    {
+                        connection.tls = tls_context->accept(client_socket);
+                        if (!connection.tls) { close_connection(connection); }
+                    }
+
+                    // Near capacity, leave the rest in the backlog until connections close
+                    if (open_connections >= accept_pause_connections)
+                    {
+                        pause_accepting();
+                        break;
+                    }
                 }
             }
+            else if (events[i].data.fd == timer_fd) { handle_tick(); }
+            else if (events[i].data.fd == signal_fd) { handle_signal(); }
+            else if (events[i].data.fd == control_fd) { accept_successor(); }
+            else if (events[i].data.fd == successor_fd) { finish_handoff(); }
             else
             {
-                auto start = std::chrono::high_resolution_clock::now();
-
                 int client_socket = events[i].data.fd;
-                auto it = socket_to_connection.find(client_socket);
 
-                if (it == socket_to_connection.end())
+                if (static_cast<size_t>(client_socket) >= connections.size() || !connections[client_socket] ||
+                    connections[client_socket]->handle == -1)
                 {
-                    std::cerr << "Error: socket not found" << std::endl;
+                    if (static_cast<size_t>(client_socket) < upstream_connections.size() &&
+                        upstream_connections[client_socket])
+                    {
+                        handle_upstream_event(*upstream_connections[client_socket], events[i].events);
+                        continue;
+                    }
+
+                    auto watcher = watchers.find(client_socket);
+                    if (watcher != watchers.end()) { watcher->second(); }
+                    // The listener closed by a drain earlier in this batch
+                    else if (!draining) { std::cerr << "Error: socket not found" << std::endl; }
                     continue;
                 }
 
-                size_t connection_index = it->second;
-                Connection& connection = connections[connection_index];
+                Connection& connection = *connections[client_socket];
 
-                bool should_close = false;
+                // A handshake that was waiting to write continues once the socket drains
+                bool tls_retry = connection.tls && connection.tls->read_wants_write() && (events[i].events & EPOLLOUT);
+                if ((events[i].events & EPOLLIN) || tls_retry) { handle_readable(connection); }
+                if ((events[i].events & EPOLLOUT) && connection.handle != -1) { flush_connection(connection); }
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) { close_connection(connection); }
+            }
+        }
 
-                if (events[i].events & EPOLLIN)
-                {
-                    std::optional<Request> request_opt = connection.handle_request();
+        run_ready();
+        flush_woken();
 
-                    if (request_opt.has_value())
-                    {
-                        auto& request = request_opt.value();
+        if (draining && open_connections == 0) { break; }
+    }
 
-                        RouteParams params;
-                        auto node = router.find_route(request.method(), request.path().raw(), params);
+    if (draining) { std::cout << "Drained, " << open_connections << " connections cut off" << std::endl; }
 
-                        if (node && node->handler)
-                        {
-                            request.set_params(params);
-                            Response response = node->handler(request);
-                            auto http_response = response.to_http_response();
-                            if (send(connection.handle, http_response.data(), http_response.size(), 0) == -1)
-                            {
-                                std::cerr << "Error sending response: " << strerror(errno) << std::endl;
-                            }
-                        }
-                        else
-                        {
-                            const char* response = "HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n\r\nNot Found";
-                            if (send(connection.handle, response, strlen(response), 0) == -1)
-                            {
-                                std::cerr << "Error sending response: " << strerror(errno) << std::endl;
-                            }
-                        }
-                    }
+    router.unregister_reader(router_reader);
+    for (int fd : {server_socket, control_fd, successor_fd, signal_fd, epoll_fd, timer_fd})
+    {
+        if (fd != -1) { close(fd); }
+    }
+}
 
-                    // NOTE(sarbaz) right now we always close the connections
-                    should_close = true;
-                }
+int Server::wait_for_events(epoll_event* events, int max_events)
+{
+    // Connections still have input, just pick up whatever else became ready
+    if (!ready_connections.empty()) { return epoll_wait(epoll_fd, events, max_events, 0); }
 
-                if (events[i].events & (EPOLLERR | EPOLLHUP)) { should_close = true; }
+    if (reactor_options.spin_microseconds > 0)
+    {
+        using Clock = std::chrono::steady_clock;
+        auto deadline = Clock::now() + std::chrono::microseconds(reactor_options.spin_microseconds);
+        do
+        {
+            reactor_stats.spin_polls++;
+            int num_events = epoll_wait(epoll_fd, events, max_events, 0);
+            if (num_events != 0)
+            {
+                if (num_events > 0) { reactor_stats.spin_hits++; }
+                return num_events;
+            }
+        } while (Clock::now() < deadline);
 
-                if (should_close)
-                {
-                    close(connection.handle);
-                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.handle, NULL);
-                    socket_to_connection.erase(connection.handle);
-                    connection.handle = -1;
-                }
+        reactor_stats.spin_misses++;
+    }
+
+    int num_events = epoll_wait(epoll_fd, events, max_events, -1);
+    if (num_events > 0) { reactor_stats.blocking_wakeups++; }
+    return num_events;
+}
+
+void Server::handle_readable(Connection& connection)
+{
+    // Queueing delay counts from the first time the connection had input nobody looked at yet
+    if (overload && !connection.input_pending && !connection.requests_pending) { connection.readable_at = batch_time; }
+    connection.input_pending = true;
+    serve_input(connection);
+}
+
+void Server::serve_input(Connection& connection)
+{
+    connection.last_active = ticks;
+
+    // Backpressure, the rest stays in the socket until the client reads what it already asked for
+    if (!can_read(connection))
+    {
+        connection.stalled = true;
+        return;
+    }
+
+    // Waiting on its own responses isn't queueing delay
+    if (connection.stalled)
+    {
+        connection.stalled = false;
+        if (overload) { connection.readable_at = monotonic_microseconds(); }
+    }
+
+    // Requests left over from the last turn go first, reading more would only grow the buffer
+    if (connection.requests_pending) { connection.requests_pending = false; }
+    else if (connection.input_pending)
+    {
+        // Answer whatever was fully received before the peer went away
+        size_t limit = request_limits.max_header_bytes + request_limits.max_body_size + read_budget;
+        auto result = connection.receive(read_budget, limit);
+        connection.input_pending = result == Connection::ReceiveResult::BUDGET_SPENT;
+        if (result == Connection::ReceiveResult::CLOSED) { connection.close_after_flush = true; }
+    }
+
+    process_requests(connection);
+}
+
+void Server::process_requests(Connection& connection)
+{
+    size_t handled = 0;
+    while (!connection.stream && connection.upstream == -1)
+    {
+        // Pipelined requests past the budget wait for the connection's next turn
+        if (handled == request_budget)
+        {
+            connection.requests_pending = !connection.request_data.empty();
+            break;
+        }
+
+        if (connection.h2)
+        {
+            process_http2(connection, request_budget - handled);
+            return;
+        }
+
+        if (connection.ws)
+        {
+            process_websocket(connection);
+            return;
+        }
+
+        if (connection.sse)
+        {
+            connection.request_data.clear();
+            break;
+        }
+
+        if (connection.upload)
+        {
+            if (!receive_upload(connection)) { break; }
+            handled++;
+            continue;
+        }
+
+        // Charged once per request on its first bytes, before any parsing. Keyed by header the
+        // request has to be parsed first, that happens below.
+        if (rate_limiter && !connection.admitted && !connection.request_data.empty() &&
+            rate_limiter->options().key_header.empty())
+        {
+            if (!rate_limiter->allow(RateLimiter::key(connection.peer_address)))
+            {
+                reject(connection, too_many_requests_response);
+                break;
+            }
+            connection.admitted = true;
+        }
+
+        // HTTP/2 with prior knowledge, the preface would otherwise parse as an HTTP/1.x request
+        std::string_view received(connection.request_data.data(), connection.request_data.size());
+        if (!received.empty() && http2_preface.starts_with(received.substr(0, http2_preface.size())))
+        {
+            if (received.size() < http2_preface.size()) { break; }
+
+            connection.h2 = make_http2_session(connection);
+            connection.h2->start();
+            continue;
+        }
+
+        // Sampled when its first bytes are looked at, pipelined requests when the one before them is done
+        if (tracer && !connection.trace.decided && !connection.request_data.empty()) { begin_trace(connection); }
+
+        std::optional<Request> request_opt = connection.next_request(request_limits);
+        if (!request_opt.has_value())
+        {
+            if (!connection.rejection.empty()) { reject(connection, connection.rejection); }
+            else if (connection.head_size != 0 && !connection.head_checked) { check_request_head(connection); }
+            break;
+        }
+
+        auto& request = request_opt.value();
+        bool admitted = connection.admitted;
+        connection.admitted = false;
+        bool checked = connection.head_checked;
+        connection.head_checked = false;
+        // Stamped until the response is queued, the next request gets its own sampling decision
+        PhaseTrace* trace = connection.trace.sampled ? &connection.trace : nullptr;
+        connection.trace.decided = false;
+
+        if (rate_limiter && !admitted)
+        {
+            auto value = request.header(rate_limiter->options().key_header);
+            uint64_t key = value.empty() ? RateLimiter::key(connection.peer_address) : RateLimiter::key(value);
+            if (!rate_limiter->allow(key))
+            {
+                reject(connection, too_many_requests_response);
+                break;
+            }
+        }
+
+        if (upgrade_to_http2(connection, request) || upgrade_to_websocket(connection, request) ||
+            start_event_stream(connection, request))
+        {
+            continue;
+        }
+
+        // Draining, the connection ends with this response
+        bool keep_alive = request.keep_alive() && !draining;
+        const Node* node = route(request);
+        if (trace) { trace->stamp(TracePhase::ROUTED); }
+        handled++;
+
+        if (shed(connection, node))
+        {
+            reject(connection, service_unavailable_response);
+            break;
+        }
+
+        // Requests whose body came along with the headers get the same checks now
+        if (!checked && !check_upload(connection, request, node, request.body().size())) { break; }
+
+        // Everything is here already, the upload handler still gets it through the parser
+        if (node && node->options.upload)
+        {
+            auto body = request.body();
+            connection.upload = std::make_unique<Upload>(std::move(request), node->options.upload);
+            if (!connection.upload->feed(std::string_view(body.data(), body.size())))
+            {
+                reject(connection, Response::with_status(400, "Bad Request"));
+                break;
+            }
+            if (!finish_upload(connection)) { break; }
+            continue;
+        }
+
+        // Answered once the upstream responds, requests pipelined behind it wait until then
+        if (node && node->options.proxy)
+        {
+            if (!start_proxy(connection, std::move(request), *node->options.proxy, keep_alive) && !keep_alive)
+            {
+                connection.close_after_flush = true;
+                break;
+            }
+            continue;
+        }
+
+        Response response;
+        auto cached = dispatch(request, node, response, trace);
+
+        if (cached) { cached->to_http_response(connection.output, keep_alive); }
+        else if (response._stream)
+        {
+            // Without chunked encoding the end of the body is the end of the connection
+            response._chunked = request.version_minor() >= 1;
+            if (!response._chunked) { keep_alive = false; }
+            connection.stream = response._stream;
+            connection.stream_chunked = response._chunked;
+            response.to_http_response(connection.output, keep_alive);
+        }
+        else { std::move(response).to_http_response(connection.output, keep_alive); }
+
+        // Moving the body out leaves the status alone
+        if (trace) { trace_serialized(connection, *trace, request, cached ? cached->status_code() : response.status_code()); }
+
+        if (!keep_alive)
+        {
+            connection.close_after_flush = true;
+            break;
+        }
+    }
+
+    flush_connection(connection);
+}
+
+const Node* Server::route(Request& request)
+{
+    // Route on the path alone, the query string isn't part of it
+    std::string_view path = request.path().raw();
+    path = path.substr(0, path.find('?'));
+
+    RouteParams params;
+    auto node = router.find_route(request.method(), path, params);
+    if (node) { request.set_params(params); }
+    return node;
+}
+
+std::shared_ptr<const Response> Server::dispatch(Request& request, const Node* node, Response& response,
+                                                PhaseTrace* trace)
+{
+    static const Response not_found = Response::prebuilt(404, "Not Found");
+
+    uint64_t started = stats_slot ? monotonic_microseconds() : 0;
+    if (!node || !node->handler)
+    {
+        response = not_found;
+        if (stats_slot) { record_request(started); }
+        return nullptr;
+    }
+
+    std::string_view path = request.path().raw();
+    path = path.substr(0, path.find('?'));
+
+    if (trace) { trace->stamp(TracePhase::HANDLER_START); }
+    std::shared_ptr<const Response> cached;
+    if (node->options.cache_ttl > 0 && request.method() == Method::GET)
+    {
+        auto key = ResponseCache::key(request, path, node->options);
+        cached = response_cache.fetch(
+            key, node->options.cache_ttl, [&]() { return run_handler(*node, request); }, response);
+    }
+    else { response = run_handler(*node, request); }
+
+    // Compared per request, the cached entry keeps its ETag but not the client's validators
+    if (node->options.etag)
+    {
+        const Response& current = cached ? *cached : response;
+        auto if_none_match = request.header("If-None-Match");
+        if (!if_none_match.empty() && etag_matches(if_none_match, current.header("ETag")))
+        {
+            response = Response::not_modified(current);
+            cached.reset();
+        }
+    }
+
+    if (trace) { trace->stamp(TracePhase::HANDLER_END); }
+    if (stats_slot) { record_request(started); }
+    return cached;
+}
+
+void Server::record_request(uint64_t started)
+{
+    WorkerStats::add(stats_slot->requests);
+    stats_slot->record_latency(monotonic_microseconds() - started);
+}
+
+std::unique_ptr<Http2Session> Server::make_http2_session(Connection& connection)
+{
+    return std::make_unique<Http2Session>(connection.output, [this, &connection](Request& request, Response& response) {
+        const Node* node = route(request);
+        if (shed(connection, node))
+        {
+            response = Response::with_status(503, "Service Unavailable");
+            response.header("Retry-After", "1");
+            return std::shared_ptr<const Response>();
+        }
+        return dispatch(request, node, response);
+    });
+}
+
+// Upgrade: h2c (RFC 7540 section 3.2), only for requests without a body
+bool Server::upgrade_to_http2(Connection& connection, Request& request)
+{
+    // h2c is cleartext only, TLS clients get h2 from ALPN and start with the preface
+    if (connection.tls || request.version_minor() < 1 || !request.body().empty()) { return false; }
+    if (!contains_token(request.header("Upgrade"), "h2c")) { return false; }
+
+    auto settings = request.header("HTTP2-Settings");
+    if (settings.empty() || !contains_token(request.header("Connection"), "HTTP2-Settings")) { return false; }
+
+    connection.output.append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    connection.h2 = make_http2_session(connection);
+    if (!connection.h2->start_upgraded(request, settings)) { connection.close_after_flush = true; }
+    return true;
+}
+
+// RFC 6455 opening handshake for routes added with Application::WS
+bool Server::upgrade_to_websocket(Connection& connection, Request& request)
+{
+    if (!contains_token(request.header("Upgrade"), "websocket")) { return false; }
+
+    std::string_view path = request.path().raw();
+    path = path.substr(0, path.find('?'));
+
+    RouteParams params;
+    auto node = router.find_route(Method::GET, path, params);
+    if (!node || !node->options.websocket) { return false; }
+
+    auto key = request.header("Sec-WebSocket-Key");
+    if (request.method() != Method::GET || request.version_minor() < 1 || key.empty() ||
+        request.header("Sec-WebSocket-Version") != "13")
+    {
+        auto response = Response::with_status(400, "Bad WebSocket handshake");
+        response.header("Sec-WebSocket-Version", "13");
+        response.to_http_response(connection.output, false);
+        connection.close_after_flush = true;
+        return true;
+    }
+
+    connection.output.append("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                             "Sec-WebSocket-Accept: ");
+    connection.output.append(websocket_accept_key(key));
+    connection.output.append("\r\n\r\n");
+
+    int fd = connection.handle;
+    connection.ws.reset(new WebSocket(connection.output, node->options.websocket, std::move(params),
+                                      [this, fd]() { wake(fd); }));
+    connection.ws->last_received = ticks;
+
+    if (node->options.websocket->on_open) { node->options.websocket->on_open(*connection.ws); }
+    return true;
+}
+
+// Turns the connection into a Server-Sent Events stream for routes added with Application::SSE
+bool Server::start_event_stream(Connection& connection, Request& request)
+{
+    if (request.method() != Method::GET || request.header("Accept").find("text/event-stream") == std::string_view::npos)
+    {
+        return false;
+    }
+
+    std::string_view path = request.path().raw();
+    path = path.substr(0, path.find('?'));
+
+    RouteParams params;
+    auto node = router.find_route(Method::GET, path, params);
+    if (!node || !node->options.events) { return false; }
+
+    // No framing, the body runs until the connection closes
+    connection.output.append("HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                             "Connection: close\r\n\r\n");
+    auto& route = node->options.events;
+    if (route->options.retry_ms > 0) { connection.output.append("retry: " + std::to_string(route->options.retry_ms) + "\n\n"); }
+
+    request.set_params(params);
+    int fd = connection.handle;
+    connection.sse.reset(new EventSubscriber(connection.output, route, std::move(params), [this, fd]() { wake(fd); }));
+    connection.sse->last_sent = ticks;
+
+    if (route->on_subscribe) { route->on_subscribe(request, *connection.sse); }
+    return true;
+}
+
+void Server::process_websocket(Connection& connection)
+{
+    if (!connection.ws->receive(connection.request_data, ticks)) { connection.close_after_flush = true; }
+    flush_connection(connection);
+}
+
+void Server::process_http2(Connection& connection, size_t budget)
+{
+    if (!connection.h2->receive(connection.request_data, budget)) { connection.close_after_flush = true; }
+    // Streams past the budget wait for the connection's next turn, like pipelined HTTP/1 requests
+    connection.requests_pending = budget == 0 && !connection.request_data.empty();
+    flush_connection(connection);
+}
+
+void Server::add_proxy(std::shared_ptr<ProxyRoute> route)
+{
+    proxy_routes.push_back(std::move(route));
+}
+
+bool Server::start_proxy(Connection& connection, Request&& request, ProxyRoute& route, bool keep_alive)
+{
+    Upstream* upstream = route.pick();
+    UpstreamConnection* upstream_connection = upstream ? acquire_upstream(route, *upstream, false) : nullptr;
+    if (!upstream_connection)
+    {
+        auto response = upstream ? Response::with_status(502, "Bad Gateway")
+                                 : Response::with_status(503, "No healthy upstream");
+        response.to_http_response(connection.output, keep_alive);
+        return false;
+    }
+
+    auto shared = std::make_shared<const Request>(std::move(request));
+    upstream_connection->request_head = upstream_request_head(*shared, format_address(connection.peer_address),
+                                                          connection.tls != nullptr);
+    upstream_connection->request = std::move(shared);
+    upstream_connection->client_keep_alive = keep_alive;
+    send_upstream_request(connection, *upstream_connection);
+    return true;
+}
+
+UpstreamConnection* Server::acquire_upstream(ProxyRoute& route, Upstream& upstream, bool fresh)
+{
+    // Most recently parked first, it's the least likely to have been closed by the upstream
+    if (!fresh && !upstream.idle.empty())
+    {
+        int fd = upstream.idle.back();
+        upstream.idle.pop_back();
+
+        auto& upstream_connection = *upstream_connections[fd];
+        upstream_connection.state = UpstreamConnection::State::WRITING;
+        upstream_connection.reused = true;
+        return &upstream_connection;
+    }
+
+    int fd = socket(upstream.address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        std::cerr << "Error creating upstream socket: " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&upstream.address), upstream.address_length) == -1 &&
+        errno != EINPROGRESS)
+    {
+        std::cerr << "Error connecting to upstream " << upstream.name << ": " << strerror(errno) << std::endl;
+        upstream.healthy = false;
+        close(fd);
+        return nullptr;
+    }
+
+    // Writable once the connect finished, either way
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        std::cerr << "Error adding upstream socket to epoll: " << strerror(errno) << std::endl;
+        close(fd);
+        return nullptr;
+    }
+
+    if (static_cast<size_t>(fd) >= upstream_connections.size()) { upstream_connections.resize(fd + 1); }
+    upstream_connections[fd] = std::make_unique<UpstreamConnection>();
+
+    auto& upstream_connection = *upstream_connections[fd];
+    upstream_connection.fd = fd;
+    upstream_connection.route = &route;
+    upstream_connection.upstream = &upstream;
+    return &upstream_connection;
+}
+
+void Server::send_upstream_request(Connection& connection, UpstreamConnection& upstream_connection)
+{
+    auto& request = *upstream_connection.request;
+    upstream_connection.out.append_view(*upstream_connection.request_head, upstream_connection.request_head);
+    auto body = request.body();
+    if (!body.empty())
+    {
+        upstream_connection.out.append_view(std::string_view(body.data(), body.size()), upstream_connection.request);
+    }
+
+    upstream_connection.client = connection.handle;
+    upstream_connection.deadline = ticks + upstream_connection.route->options.response_timeout;
+    upstream_connection.upstream->active++;
+    connection.upstream = upstream_connection.fd;
+
+    // A parked socket can take the request right away, a new one waits for its connect
+    if (upstream_connection.state == UpstreamConnection::State::WRITING) { advance_upstream(upstream_connection, EPOLLOUT); }
+}
+
+void Server::advance_upstream(UpstreamConnection& upstream_connection, uint32_t events)
+{
+    if (upstream_connection.state == UpstreamConnection::State::CONNECTING)
+    {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) { return; }
+
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(upstream_connection.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0)
+        {
+            // Passive health check, the next active check brings it back
+            if (upstream_connection.upstream->healthy)
+            {
+                std::cerr << "Upstream " << upstream_connection.upstream->name << " is down: " << strerror(error)
+                          << std::endl;
+            }
+            upstream_connection.upstream->healthy = false;
+            upstream_connection.failed = true;
+            return;
+        }
+        upstream_connection.state = UpstreamConnection::State::WRITING;
+    }
+
+    if (upstream_connection.state == UpstreamConnection::State::WRITING)
+    {
+        auto result = upstream_connection.out.flush(upstream_connection.fd);
+        if (result == OutputQueue::FlushResult::ERROR) { upstream_connection.failed = true; }
+        if (result == OutputQueue::FlushResult::DONE) { upstream_connection.state = UpstreamConnection::State::HEAD; }
+    }
+}
+
+void Server::handle_upstream_event(UpstreamConnection& upstream_connection, uint32_t events)
+{
+    // A parked socket has nothing to say, readable means the upstream closed it
+    if (upstream_connection.state == UpstreamConnection::State::IDLE)
+    {
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) { close_upstream(upstream_connection); }
+        return;
+    }
+
+    advance_upstream(upstream_connection, events);
+
+    if (upstream_connection.health_check)
+    {
+        read_health_check(upstream_connection);
+        return;
+    }
+
+    if (upstream_connection.client != -1) { flush_connection(*connections[upstream_connection.client]); }
+}
+
+// Reads and forwards as much of the upstream response as the client's output allows
+bool Server::pump_upstream(Connection& connection)
+{
+    static thread_local std::vector<char> scratch(stream_high_water);
+
+    auto& upstream_connection = *upstream_connections[connection.upstream];
+    if (upstream_connection.failed) { return fail_exchange(connection, upstream_connection); }
+    if (upstream_connection.state != UpstreamConnection::State::HEAD &&
+        upstream_connection.state != UpstreamConnection::State::BODY)
+    {
+        return false;
+    }
 
-                auto end = std::chrono::high_resolution_clock::now();
-                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-                std::cout << "Request took " << duration.count() << "us" << std::endl;
+    connection.last_active = ticks;
+    auto& buffer = upstream_connection.buffer;
+    bool produced = false;
+
+    while (upstream_connection.state == UpstreamConnection::State::HEAD)
+    {
+        UpstreamResponseHead head;
+        if (parse_upstream_head(std::string_view(buffer.data(), buffer.size()), head))
+        {
+            // No protocol switches through the proxy, the Upgrade header isn't forwarded either
+            if (head.status < 0 || head.status == 101)
+            {
+                upstream_connection.failed = true;
+                return fail_exchange(connection, upstream_connection);
             }
+
+            // Interim responses like 100 Continue, the body has been sent already
+            if (head.status < 200)
+            {
+                buffer.erase(buffer.begin(), buffer.begin() + head.size);
+                continue;
+            }
+
+            start_upstream_response(connection, upstream_connection, head);
+            produced = true;
+            break;
+        }
+
+        if (buffer.size() > proxy_max_head_size)
+        {
+            upstream_connection.failed = true;
+            return fail_exchange(connection, upstream_connection);
         }
+
+        ssize_t bytes_read = recv(upstream_connection.fd, scratch.data(), scratch.size(), 0);
+        if (bytes_read > 0)
+        {
+            upstream_connection.received = true;
+            upstream_connection.deadline = ticks + upstream_connection.route->options.response_timeout;
+            buffer.insert(buffer.end(), scratch.data(), scratch.data() + bytes_read);
+            continue;
+        }
+        if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) { return false; }
+        if (bytes_read == -1 && errno == EINTR) { continue; }
+
+        // Closed or reset before a complete head
+        upstream_connection.failed = true;
+        return fail_exchange(connection, upstream_connection);
     }
 
-    // Cleanup (though we never reach here in practice)
-    close(server_socket);
-    close(epoll_fd);
+    using Framing = UpstreamConnection::Framing;
+    bool can_splice = (upstream_connection.framing == Framing::LENGTH || upstream_connection.framing == Framing::CLOSE) &&
+                      (!connection.tls || connection.tls->kernel_send());
+
+    while (true)
+    {
+        bool complete = false;
+        switch (upstream_connection.framing)
+        {
+            case Framing::NONE: complete = true; break;
+            case Framing::LENGTH: complete = upstream_connection.remaining == 0 && upstream_connection.piped == 0; break;
+            case Framing::CHUNKED: complete = upstream_connection.chunks.done(); break;
+            case Framing::CLOSE: complete = upstream_connection.state == UpstreamConnection::State::IDLE; break;
+        }
+
+        if (complete)
+        {
+            finish_exchange(connection, upstream_connection);
+            return true;
+        }
+
+        if (upstream_connection.failed) { return fail_exchange(connection, upstream_connection) || produced; }
+
+        // Body bytes that came in with the head
+        if (!buffer.empty())
+        {
+            forward_upstream_body(connection, upstream_connection, std::string_view(buffer.data(), buffer.size()));
+            buffer.clear();
+            produced = true;
+            continue;
+        }
+
+        if (connection.output.pending_bytes() >= stream_high_water) { return produced; }
+
+        if (can_splice && connection.output.empty())
+        {
+            int result = splice_upstream_body(connection, upstream_connection);
+            if (result > 0)
+            {
+                produced = true;
+                continue;
+            }
+            if (result == 0) { return produced; }
+            // Splicing isn't possible here, copy instead
+            can_splice = false;
+            continue;
+        }
+
+        size_t want = scratch.size();
+        if (upstream_connection.framing == Framing::LENGTH) { want = std::min<uint64_t>(want, upstream_connection.remaining); }
+
+        ssize_t bytes_read = recv(upstream_connection.fd, scratch.data(), want, 0);
+        if (bytes_read > 0)
+        {
+            upstream_connection.deadline = ticks + upstream_connection.route->options.response_timeout;
+            forward_upstream_body(connection, upstream_connection, std::string_view(scratch.data(), bytes_read));
+            produced = true;
+            continue;
+        }
+        if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) { return produced; }
+        if (bytes_read == -1 && errno == EINTR) { continue; }
+
+        // End of a close-delimited body, anything else was cut short
+        if (bytes_read == 0 && upstream_connection.framing == Framing::CLOSE)
+        {
+            upstream_connection.state = UpstreamConnection::State::IDLE;
+            continue;
+        }
+        upstream_connection.failed = true;
+    }
+}
+
+void Server::start_upstream_response(Connection& connection, UpstreamConnection& upstream_connection,
+                                     const UpstreamResponseHead& head)
+{
+    using Framing = UpstreamConnection::Framing;
+
+    if (head.status == 204 || head.status == 304 || upstream_connection.request->method() == Method::HEAD)
+    {
+        upstream_connection.framing = Framing::NONE;
+    }
+    else if (head.chunked) { upstream_connection.framing = Framing::CHUNKED; }
+    else if (head.has_length)
+    {
+        upstream_connection.framing = Framing::LENGTH;
+        upstream_connection.remaining = head.content_length;
+    }
+    else { upstream_connection.framing = Framing::CLOSE; }
+
+    // The client sees the body end when the connection does
+    if (upstream_connection.framing == Framing::CLOSE)
+    {
+        upstream_connection.reusable = false;
+        upstream_connection.client_keep_alive = false;
+    }
+    if (!head.keep_alive) { upstream_connection.reusable = false; }
+
+    auto& buffer = upstream_connection.buffer;
+    write_client_head(connection.output, std::string_view(buffer.data(), head.size), upstream_connection.client_keep_alive);
+    buffer.erase(buffer.begin(), buffer.begin() + head.size);
+
+    upstream_connection.head_sent = true;
+    upstream_connection.state = UpstreamConnection::State::BODY;
+}
+
+void Server::forward_upstream_body(Connection& connection, UpstreamConnection& upstream_connection,
+                                   std::string_view data)
+{
+    using Framing = UpstreamConnection::Framing;
+
+    size_t take = data.size();
+    switch (upstream_connection.framing)
+    {
+        case Framing::NONE: take = 0; break;
+        case Framing::LENGTH:
+            take = std::min<uint64_t>(take, upstream_connection.remaining);
+            upstream_connection.remaining -= take;
+            break;
+        case Framing::CHUNKED:
+            take = upstream_connection.chunks.scan(data);
+            if (upstream_connection.chunks.failed()) { upstream_connection.failed = true; }
+            break;
+        case Framing::CLOSE: break;
+    }
+
+    // Bytes past the end of the response, the socket is out of sync
+    if (take < data.size()) { upstream_connection.reusable = false; }
+
+    connection.output.append(data.substr(0, take));
+}
+
+// Moves body bytes upstream socket -> pipe -> client socket without them entering user space.
+// Returns 1 on progress, 0 when either side would block and -1 when splicing isn't possible.
+int Server::splice_upstream_body(Connection& connection, UpstreamConnection& upstream_connection)
+{
+    if (upstream_connection.pipe_fds[0] == -1 && pipe2(upstream_connection.pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+
+    if (upstream_connection.piped > 0)
+    {
+        ssize_t moved = splice(upstream_connection.pipe_fds[0], nullptr, connection.handle, nullptr,
+                               upstream_connection.piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved > 0)
+        {
+            upstream_connection.piped -= moved;
+            return 1;
+        }
+        if (moved == -1 && (errno == EAGAIN || errno == EINTR)) { return 0; }
+
+        // The client is gone, the rest of the body has nowhere to go
+        upstream_connection.failed = true;
+        return 1;
+    }
+
+    size_t want = stream_high_water;
+    if (upstream_connection.framing == UpstreamConnection::Framing::LENGTH)
+    {
+        want = std::min<uint64_t>(want, upstream_connection.remaining);
+    }
+
+    ssize_t moved = splice(upstream_connection.fd, nullptr, upstream_connection.pipe_fds[1], nullptr, want,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved > 0)
+    {
+        upstream_connection.piped += moved;
+        if (upstream_connection.framing == UpstreamConnection::Framing::LENGTH) { upstream_connection.remaining -= moved; }
+        upstream_connection.deadline = ticks + upstream_connection.route->options.response_timeout;
+        return 1;
+    }
+    if (moved == -1 && (errno == EAGAIN || errno == EINTR)) { return 0; }
+    if (moved == -1 && (errno == EINVAL || errno == ENOSYS)) { return -1; }
+
+    if (moved == 0 && upstream_connection.framing == UpstreamConnection::Framing::CLOSE)
+    {
+        upstream_connection.state = UpstreamConnection::State::IDLE;
+    }
+    else { upstream_connection.failed = true; }
+    return 1;
+}
+
+void Server::finish_exchange(Connection& connection, UpstreamConnection& upstream_connection)
+{
+    bool keep_alive = upstream_connection.client_keep_alive;
+    bool reusable = upstream_connection.reusable &&
+                    upstream_connection.framing != UpstreamConnection::Framing::CLOSE &&
+                    upstream_connection.upstream->idle.size() < upstream_connection.route->options.max_idle_connections;
+
+    detach_upstream(upstream_connection);
+    if (!keep_alive) { connection.close_after_flush = true; }
+
+    if (!reusable)
+    {
+        close_upstream(upstream_connection);
+        return;
+    }
+
+    // Parked for the next request to this upstream
+    upstream_connection.state = UpstreamConnection::State::IDLE;
+    upstream_connection.request.reset();
+    upstream_connection.request_head.reset();
+    upstream_connection.out.clear();
+    upstream_connection.buffer.clear();
+    upstream_connection.framing = UpstreamConnection::Framing::NONE;
+    upstream_connection.remaining = 0;
+    upstream_connection.chunks = {};
+    upstream_connection.received = false;
+    upstream_connection.retried = false;
+    upstream_connection.head_sent = false;
+    upstream_connection.failed = false;
+    upstream_connection.fail_status = 502;
+    upstream_connection.upstream->idle.push_back(upstream_connection.fd);
+}
+
+bool Server::fail_exchange(Connection& connection, UpstreamConnection& upstream_connection)
+{
+    auto method = upstream_connection.request->method();
+    bool idempotent = method == Method::GET || method == Method::HEAD || method == Method::PUT ||
+                      method == Method::DELETE || method == Method::OPTIONS;
+
+    // Try once more when the upstream never saw the request: a refused connect goes to the next healthy
+    // upstream, a parked socket the upstream closed in the meantime gets replaced by a new one
+    bool refused = upstream_connection.state == UpstreamConnection::State::CONNECTING;
+    bool stale = upstream_connection.reused && !upstream_connection.received && idempotent;
+    if (!upstream_connection.retried && upstream_connection.fail_status == 502 && (refused || stale))
+    {
+        auto& route = *upstream_connection.route;
+        auto* upstream = refused ? route.pick() : upstream_connection.upstream;
+        auto request = std::move(upstream_connection.request);
+        auto request_head = std::move(upstream_connection.request_head);
+        bool keep_alive = upstream_connection.client_keep_alive;
+        close_upstream(upstream_connection);
+
+        auto retry = upstream ? acquire_upstream(route, *upstream, stale) : nullptr;
+        if (retry)
+        {
+            retry->request = std::move(request);
+            retry->request_head = std::move(request_head);
+            retry->client_keep_alive = keep_alive;
+            retry->retried = true;
+            send_upstream_request(connection, *retry);
+            return false;
+        }
+
+        Response::with_status(502, "Bad Gateway").to_http_response(connection.output, keep_alive);
+        if (!keep_alive) { connection.close_after_flush = true; }
+        return true;
+    }
+
+    bool head_sent = upstream_connection.head_sent;
+    bool keep_alive = upstream_connection.client_keep_alive;
+    int status = upstream_connection.fail_status;
+    close_upstream(upstream_connection);
+
+    // Part of the response is out already, closing is the only way to tell the client it's incomplete
+    if (head_sent)
+    {
+        connection.close_after_flush = true;
+        return true;
+    }
+
+    Response::with_status(status, status == 504 ? "Gateway Timeout" : "Bad Gateway")
+        .to_http_response(connection.output, keep_alive);
+    if (!keep_alive) { connection.close_after_flush = true; }
+    return true;
+}
+
+void Server::detach_upstream(UpstreamConnection& upstream_connection)
+{
+    if (upstream_connection.client == -1) { return; }
+
+    connections[upstream_connection.client]->upstream = -1;
+    upstream_connection.client = -1;
+    upstream_connection.upstream->active--;
+}
+
+void Server::close_upstream(UpstreamConnection& upstream_connection)
+{
+    int fd = upstream_connection.fd;
+
+    if (upstream_connection.state == UpstreamConnection::State::IDLE)
+    {
+        auto& idle = upstream_connection.upstream->idle;
+        auto it = std::find(idle.begin(), idle.end(), fd);
+        if (it != idle.end()) { idle.erase(it); }
+    }
+    if (upstream_connection.health_check) { upstream_connection.upstream->checking = false; }
+    detach_upstream(upstream_connection);
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    upstream_connections[fd].reset();
+}
+
+void Server::check_upstreams()
+{
+    // Timeouts, by index since failing an exchange can open new upstream connections
+    for (size_t fd = 0; fd < upstream_connections.size(); fd++)
+    {
+        auto* upstream_connection = upstream_connections[fd].get();
+        if (!upstream_connection || upstream_connection->state == UpstreamConnection::State::IDLE ||
+            ticks < upstream_connection->deadline)
+        {
+            continue;
+        }
+
+        if (upstream_connection->health_check)
+        {
+            upstream_connection->failed = true;
+            read_health_check(*upstream_connection);
+            continue;
+        }
+
+        upstream_connection->failed = true;
+        upstream_connection->fail_status = 504;
+        if (upstream_connection->client != -1) { flush_connection(*connections[upstream_connection->client]); }
+    }
+
+    for (auto& route : proxy_routes)
+    {
+        if (route->options.health_check_interval == 0 || ticks < route->next_health_check) { continue; }
+        route->next_health_check = ticks + route->options.health_check_interval;
+
+        for (auto& upstream : route->upstreams)
+        {
+            if (upstream.checking) { continue; }
+
+            auto upstream_connection = acquire_upstream(*route, upstream, true);
+            if (!upstream_connection) { continue; }
+
+            upstream.checking = true;
+            upstream_connection->health_check = true;
+            upstream_connection->deadline = ticks + route->options.response_timeout;
+            upstream_connection->out.append("GET " + route->options.health_check_path + " HTTP/1.1\r\nHost: " +
+                                            upstream.name + "\r\nConnection: close\r\n\r\n");
+        }
+    }
+}
+
+void Server::read_health_check(UpstreamConnection& upstream_connection)
+{
+    auto& upstream = *upstream_connection.upstream;
+    auto& buffer = upstream_connection.buffer;
+    UpstreamResponseHead head;
+    bool answered = false;
+
+    while (!upstream_connection.failed && upstream_connection.state == UpstreamConnection::State::HEAD)
+    {
+        if (parse_upstream_head(std::string_view(buffer.data(), buffer.size()), head))
+        {
+            answered = true;
+            break;
+        }
+
+        char chunk[4096];
+        ssize_t bytes_read = recv(upstream_connection.fd, chunk, sizeof(chunk), 0);
+        if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) { return; }
+        if (bytes_read == -1 && errno == EINTR) { continue; }
+        if (bytes_read <= 0 || buffer.size() > proxy_max_head_size) { break; }
+        buffer.insert(buffer.end(), chunk, chunk + bytes_read);
+    }
+
+    // Still connecting or sending
+    if (!answered && !upstream_connection.failed && upstream_connection.state != UpstreamConnection::State::HEAD)
+    {
+        return;
+    }
+
+    bool healthy = answered && head.status >= 100 && head.status < 500;
+    if (healthy != upstream.healthy)
+    {
+        std::cerr << "Upstream " << upstream.name << (healthy ? " is up" : " failed its health check") << std::endl;
+    }
+    upstream.healthy = healthy;
+    close_upstream(upstream_connection);
+}
+
+Response Server::run_handler(const Node& node, Request& request)
+{
+    Response response = (*node.handler)(request);
+    // Everything below needs the body's bytes, otherwise JSON is written straight into the connection's output
+    if (node.options.compress || node.options.etag || node.options.cache_ttl > 0) { response.render(); }
+    if (node.options.compress) { Compression::apply(request, response, node.options.compress_min_size); }
+
+    // Hashed after compression, every content coding is its own representation
+    if (node.options.etag && response.status_code() == 200 && !response.is_stream() && !response.has_file_body() &&
+        response.header("ETag").empty())
+    {
+        char etag[20] = "\"";
+        char* end = std::to_chars(etag + 1, etag + sizeof(etag) - 1, xxh64(response.content()), 16).ptr;
+        *end++ = '"';
+        response.header("ETag", std::string_view(etag, end - etag));
+    }
+
+    return response;
+}
+
+void Server::handle_tick()
+{
+    uint64_t expirations = 0;
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) { return; }
+
+    ticks += expirations;
+    HttpDate::refresh();
+
+    if (draining && ticks >= drain_deadline)
+    {
+        std::cerr << "Drain timed out with " << open_connections << " connections open" << std::endl;
+        stopping = true;
+        return;
+    }
+
+    for (auto& slot : connections)
+    {
+        if (!slot || slot->handle == -1) { continue; }
+        Connection& connection = *slot;
+
+        // WebSockets stay open as long as they answer pings
+        if (connection.ws)
+        {
+            if (!connection.ws->tick(ticks)) { close_connection(connection); }
+            continue;
+        }
+
+        if (connection.sse)
+        {
+            if (!connection.sse->tick(ticks)) { close_connection(connection); }
+            continue;
+        }
+
+        // Waiting on an upstream, the exchange has its own timeout
+        if (connection.upstream != -1) { continue; }
+
+        if (ticks - connection.last_active >= keep_alive_timeout)
+        {
+            close_connection(connection);
+            continue;
+        }
+
+        // Idle sockets shouldn't hold on to buffers sized for their busiest moment
+        if (ticks - connection.last_active >= 1 && connection.output.empty()) { connection.trim(); }
+    }
+
+    check_upstreams();
+    flush_woken();
+}
+
+void Server::wake(int fd)
+{
+    Connection& connection = *connections[fd];
+    if (connection.woken) { return; }
+    connection.woken = true;
+    woken_connections.push_back(fd);
+}
+
+void Server::flush_woken()
+{
+    // Flushing can run handlers that wake more connections, so the list may grow while we walk it
+    for (size_t i = 0; i < woken_connections.size(); i++)
+    {
+        Connection& connection = *connections[woken_connections[i]];
+        connection.woken = false;
+        if (connection.handle == -1) { continue; }
+
+        // Subscriber that fell too far behind under SlowSubscriberPolicy::DISCONNECT
+        if (connection.sse && connection.sse->overrun) { close_connection(connection); }
+        else { flush_connection(connection); }
+    }
+    woken_connections.clear();
+}
+
+void Server::flush_connection(Connection& connection)
+{
+    bool stream_finished = false;
+
+    while (true)
+    {
+        auto result = connection.tls && !connection.tls->kernel_send() ? connection.tls->flush(connection.output)
+                                                                       : connection.output.flush(connection.handle);
+
+        if (result == OutputQueue::FlushResult::ERROR)
+        {
+            close_connection(connection);
+            return;
+        }
+
+        // Backpressure, EPOLLOUT brings us back here
+        if (result == OutputQueue::FlushResult::BLOCKED) { return; }
+
+        if (connection.h2)
+        {
+            if (connection.h2->pump(stream_high_water)) { continue; }
+            if (connection.h2->finished()) { connection.close_after_flush = true; }
+            break;
+        }
+
+        if (connection.upstream != -1)
+        {
+            bool produced = pump_upstream(connection);
+            if (connection.upstream == -1) { stream_finished = true; }
+            else if (!produced) { break; }
+            continue;
+        }
+
+        if (!connection.stream) { break; }
+
+        bool produced = pump_stream(connection);
+        if (!connection.stream) { stream_finished = true; }
+        else if (!produced) { break; }
+    }
+
+    if (connection.sending.sampled && connection.output.empty() && !connection.stream && connection.upstream == -1)
+    {
+        trace_sent(connection);
+    }
+
+    if (connection.close_after_flush && !connection.stream && connection.upstream == -1)
+    {
+        close_connection(connection);
+        return;
+    }
+
+    // Requests pipelined behind the stream or proxied response were held back until now
+    if (stream_finished)
+    {
+        if (overload) { connection.readable_at = monotonic_microseconds(); }
+        process_requests(connection);
+    }
+    else if (connection.input_pending || connection.requests_pending) { mark_ready(connection); }
+}
+
+bool Server::can_read(const Connection& connection) const
+{
+    return !connection.stream && connection.upstream == -1 && connection.output.pending_bytes() < stream_high_water;
+}
+
+void Server::mark_ready(Connection& connection)
+{
+    // Not while the connection's output is backed up or a response is still in progress, the stream
+    // finishing or the socket draining calls back into flush_connection and we get here again
+    if (connection.ready || connection.close_after_flush || !can_read(connection)) { return; }
+    connection.ready = true;
+    ready_connections.push_back(connection.handle);
+}
+
+void Server::run_ready()
+{
+    // One turn each. Whoever still has input afterwards queues up again behind the connections
+    // that become readable in the meantime.
+    ready_turn.swap(ready_connections);
+    for (int fd : ready_turn)
+    {
+        Connection& connection = *connections[fd];
+        if (!connection.ready) { continue; }
+        connection.ready = false;
+        if (connection.handle == -1 || !(connection.input_pending || connection.requests_pending)) { continue; }
+        serve_input(connection);
+    }
+    ready_turn.clear();
+}
+
+bool Server::pump_stream(Connection& connection)
+{
+    connection.last_active = ticks;
+
+    ChunkWriter writer(connection.output, connection.stream_chunked);
+    while (connection.stream && connection.output.pending_bytes() < stream_high_water)
+    {
+        size_t before = writer.written();
+        if (!(*connection.stream)(writer))
+        {
+            writer.finish();
+            connection.stream.reset();
+            break;
+        }
+
+        // The producer broke its contract, don't spin on it
+        if (writer.written() == before) { break; }
+    }
+
+    return writer.written() > 0 || !connection.stream;
+}
+
+void Server::close_connection(Connection& connection)
+{
+    if (connection.handle == -1) { return; }
+
+    // Mid-response, the upstream socket can't be reused
+    if (connection.upstream != -1) { close_upstream(*upstream_connections[connection.upstream]); }
+
+    // Cut off or never answered, still worth seeing where they got stuck
+    if (connection.sending.sampled) { tracer->commit(connection.sending, connection.handle); }
+    if (connection.trace.sampled) { tracer->commit(connection.trace, connection.handle); }
+    connection.sending.sampled = false;
+    connection.trace.sampled = false;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.handle, NULL);
+    if (connection.tls)
+    {
+        connection.tls->shutdown();
+        connection.tls.reset();
+    }
+    close(connection.handle);
+    connection.handle = -1;
+    connection.output.clear();
+    connection.stream.reset();
+    open_connections--;
+    if (stats_slot) { stats_slot->open_connections.store(open_connections, std::memory_order_relaxed); }
+    if (!accepting && !draining && open_connections <= accept_resume_connections) { resume_accepting(); }
+    connection.sse.reset();
+
+    // Cut off mid-body
+    if (connection.upload)
+    {
+        auto upload = std::move(connection.upload);
+        upload->abort();
+    }
+
+    // Abnormal closure unless the closing handshake already told the handler
+    if (connection.ws)
+    {
+        auto ws = std::move(connection.ws);
+        ws->closed(1006);
+    }
 }
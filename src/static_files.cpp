@@ -0,0 +1,465 @@
+#include "static_files.hpp"
+#include "common.hpp"
+#include "path.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+OpenFile::~OpenFile()
+{
+    if (fd != -1) { close(fd); }
+}
+
+static std::string_view mime_type(std::string_view path)
+{
+    size_t dot = path.rfind('.');
+    if (dot == std::string_view::npos) { return "application/octet-stream"; }
+    auto extension = path.substr(dot + 1);
+
+    if (extension == "html" || extension == "htm") { return "text/html; charset=utf-8"; }
+    if (extension == "css") { return "text/css"; }
+    if (extension == "js" || extension == "mjs") { return "text/javascript"; }
+    if (extension == "json" || extension == "map") { return "application/json"; }
+    if (extension == "txt") { return "text/plain; charset=utf-8"; }
+    if (extension == "xml") { return "application/xml"; }
+    if (extension == "svg") { return "image/svg+xml"; }
+    if (extension == "png") { return "image/png"; }
+    if (extension == "jpg" || extension == "jpeg") { return "image/jpeg"; }
+    if (extension == "gif") { return "image/gif"; }
+    if (extension == "webp") { return "image/webp"; }
+    if (extension == "avif") { return "image/avif"; }
+    if (extension == "ico") { return "image/x-icon"; }
+    if (extension == "woff") { return "font/woff"; }
+    if (extension == "woff2") { return "font/woff2"; }
+    if (extension == "wasm") { return "application/wasm"; }
+    if (extension == "pdf") { return "application/pdf"; }
+    if (extension == "mp4") { return "video/mp4"; }
+    return "application/octet-stream";
+}
+
+// True when the Accept-Encoding value lists coding (or *) without q=0
+static bool accepts_encoding(std::string_view accept, std::string_view coding)
+{
+    while (!accept.empty())
+    {
+        size_t comma = accept.find(',');
+        auto item = accept.substr(0, comma);
+        accept = comma == std::string_view::npos ? std::string_view() : accept.substr(comma + 1);
+
+        size_t semicolon = item.find(';');
+        auto name = item.substr(0, semicolon);
+        while (!name.empty() && name.front() == ' ') name.remove_prefix(1);
+        while (!name.empty() && name.back() == ' ') name.remove_suffix(1);
+
+        if (!iequals(name, coding) && name != "*") { continue; }
+
+        if (semicolon != std::string_view::npos)
+        {
+            auto params = item.substr(semicolon + 1);
+            size_t q = params.find("q=");
+            if (q != std::string_view::npos)
+            {
+                auto value = params.substr(q + 2);
+                if (value.starts_with("0") && value.find_first_of("123456789") == std::string_view::npos) { continue; }
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+// Parses a single "bytes=first-last" range, returns false when the header should be ignored
+static bool parse_range(std::string_view header, size_t size, size_t& first, size_t& last, bool& satisfiable)
+{
+    if (!header.starts_with("bytes=")) { return false; }
+    auto spec = header.substr(6);
+
+    // Multiple ranges aren't worth a multipart response, send the whole file instead
+    if (spec.find(',') != std::string_view::npos) { return false; }
+
+    size_t dash = spec.find('-');
+    if (dash == std::string_view::npos) { return false; }
+
+    auto first_str = spec.substr(0, dash);
+    auto last_str = spec.substr(dash + 1);
+    satisfiable = true;
+
+    if (first_str.empty())
+    {
+        // Suffix range, the last N bytes
+        size_t suffix = 0;
+        auto [ptr, ec] = std::from_chars(last_str.data(), last_str.data() + last_str.size(), suffix);
+        if (ec != std::errc() || ptr != last_str.data() + last_str.size()) { return false; }
+        if (suffix == 0 || size == 0)
+        {
+            satisfiable = false;
+            return true;
+        }
+        first = suffix >= size ? 0 : size - suffix;
+        last = size - 1;
+        return true;
+    }
+
+    auto [ptr, ec] = std::from_chars(first_str.data(), first_str.data() + first_str.size(), first);
+    if (ec != std::errc() || ptr != first_str.data() + first_str.size()) { return false; }
+
+    if (last_str.empty()) { last = size - 1; }
+    else
+    {
+        auto [last_ptr, last_ec] = std::from_chars(last_str.data(), last_str.data() + last_str.size(), last);
+        if (last_ec != std::errc() || last_ptr != last_str.data() + last_str.size() || last < first) { return false; }
+        if (last >= size) { last = size - 1; }
+    }
+
+    if (first >= size) { satisfiable = false; }
+    return true;
+}
+
+StaticFiles::StaticFiles(std::string root, size_t max_open_files)
+    : root(std::move(root)), max_open_files(std::max<size_t>(max_open_files, 4))
+{
+    while (this->root.size() > 1 && this->root.back() == '/') { this->root.pop_back(); }
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1)
+    {
+        std::cerr << "Error creating inotify instance: " << strerror(errno) << std::endl;
+    }
+}
+
+StaticFiles::~StaticFiles()
+{
+    if (inotify_fd != -1) { close(inotify_fd); }
+}
+
+void StaticFiles::reopen()
+{
+    if (inotify_fd == -1) { return; }
+
+    int fresh = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fresh == -1 || dup3(fresh, inotify_fd, O_CLOEXEC) == -1)
+    {
+        std::cerr << "Error reopening inotify instance: " << strerror(errno) << std::endl;
+    }
+    if (fresh != -1) { close(fresh); }
+
+    // Nothing is watched on the new instance, entries get loaded and watched again on first use
+    std::lock_guard lock(mutex);
+    entries.clear();
+    lru.clear();
+    watched_directories.clear();
+    directory_watches.clear();
+}
+
+bool StaticFiles::watch_directory(const std::string& directory)
+{
+    if (inotify_fd == -1) { return false; }
+
+    auto watch = directory_watches.find(directory);
+    if (watch != directory_watches.end())
+    {
+        watch->second.entries++;
+        return true;
+    }
+
+    int wd = inotify_add_watch(inotify_fd, directory.c_str(),
+                               IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                   IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd == -1)
+    {
+        std::cerr << "Error watching " << directory << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    directory_watches[directory] = {wd, 1};
+    watched_directories[wd] = directory;
+    return true;
+}
+
+void StaticFiles::unwatch_directory(const std::string& directory)
+{
+    auto watch = directory_watches.find(directory);
+    if (watch == directory_watches.end() || --watch->second.entries > 0) { return; }
+
+    // Already gone when the directory itself was deleted, the kernel then says EINVAL
+    inotify_rm_watch(inotify_fd, watch->second.wd);
+    watched_directories.erase(watch->second.wd);
+    directory_watches.erase(watch);
+}
+
+StaticFiles::LruList::iterator StaticFiles::remove(LruList::iterator entry)
+{
+    if (entry->watched) { unwatch_directory(entry->path.substr(0, entry->path.rfind('/'))); }
+    entries.erase(entry->path);
+    return lru.erase(entry);
+}
+
+bool StaticFiles::load(const std::string& path, Entry& entry)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd == -1) { return false; }
+
+    struct stat info = {};
+    if (fstat(fd, &info) == -1 || (!S_ISREG(info.st_mode) && !S_ISDIR(info.st_mode)))
+    {
+        close(fd);
+        return false;
+    }
+
+    entry.path = path;
+    entry.is_directory = S_ISDIR(info.st_mode);
+    if (entry.is_directory)
+    {
+        // Only the fact that it's a directory is worth caching
+        close(fd);
+        return true;
+    }
+
+    entry.file = std::make_shared<OpenFile>(fd);
+    entry.size = info.st_size;
+    entry.mtime = info.st_mtim.tv_sec;
+
+    // Strong validator from size and nanosecond mtime
+    char etag[64];
+    char* out = etag;
+    *out++ = '"';
+    out = std::to_chars(out, etag + sizeof(etag), static_cast<unsigned long long>(info.st_size), 16).ptr;
+    *out++ = '-';
+    out = std::to_chars(out, etag + sizeof(etag),
+                        static_cast<unsigned long long>(info.st_mtim.tv_sec) * 1000000000ull + info.st_mtim.tv_nsec, 16)
+              .ptr;
+    *out++ = '"';
+    entry.etag.assign(etag, out);
+
+    HttpDate::format(entry.mtime, entry.last_modified);
+
+    // Remember which precompressed siblings exist so misses don't cost a syscall per request
+    struct stat sibling = {};
+    entry.has_brotli = stat((path + ".br").c_str(), &sibling) == 0 && S_ISREG(sibling.st_mode);
+    entry.has_gzip = stat((path + ".gz").c_str(), &sibling) == 0 && S_ISREG(sibling.st_mode);
+
+    return true;
+}
+
+StaticFiles::Entry* StaticFiles::lookup(const std::string& path)
+{
+    auto it = entries.find(path);
+    if (it != entries.end())
+    {
+        lru.splice(lru.begin(), lru, it->second);
+        return &*it->second;
+    }
+
+    Entry entry;
+    if (!load(path, entry)) { return nullptr; }
+
+    entry.watched = watch_directory(path.substr(0, path.rfind('/')));
+
+    lru.push_front(std::move(entry));
+    entries[path] = lru.begin();
+
+    while (entries.size() > max_open_files) { remove(std::prev(lru.end())); }
+
+    return &lru.front();
+}
+
+void StaticFiles::invalidate(const std::string& path)
+{
+    auto it = entries.find(path);
+    if (it == entries.end()) { return; }
+
+    remove(it->second);
+}
+
+void StaticFiles::handle_changes()
+{
+    alignas(inotify_event) char buffer[4096];
+
+    while (true)
+    {
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0) { break; }
+
+        std::lock_guard lock(mutex);
+
+        for (char* ptr = buffer; ptr < buffer + length;)
+        {
+            auto event = reinterpret_cast<inotify_event*>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // We lost track of what changed, start over
+                for (auto it = lru.begin(); it != lru.end();) { it = remove(it); }
+                continue;
+            }
+
+            auto directory = watched_directories.find(event->wd);
+            if (directory == watched_directories.end()) { continue; }
+            // Removing entries can drop the watch and the iterator with it
+            const std::string directory_path = directory->second;
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+                const std::string prefix = directory_path + "/";
+                for (auto it = lru.begin(); it != lru.end();)
+                {
+                    if (it->path.starts_with(prefix) || it->path == directory_path) { it = remove(it); }
+                    else { ++it; }
+                }
+
+                auto watch = directory_watches.find(directory_path);
+                if (event->mask & IN_IGNORED && watch != directory_watches.end())
+                {
+                    watched_directories.erase(watch->second.wd);
+                    directory_watches.erase(watch);
+                }
+                continue;
+            }
+
+            if (event->len == 0) { continue; }
+
+            std::string path = directory_path + "/" + event->name;
+            invalidate(path);
+
+            // A sibling appearing or disappearing changes what the base file can offer
+            if (path.ends_with(".br") || path.ends_with(".gz")) { invalidate(path.substr(0, path.size() - 3)); }
+        }
+    }
+}
+
+Response StaticFiles::serve(Request& request)
+{
+    auto rest = request.params().find("*");
+    if (rest == request.params().end()) { return Response::with_status(404, "Not Found"); }
+
+    std::string relative = Path::decode_percent(rest->second);
+
+    // Never leave root
+    if (relative.empty() || relative.find('\0') != std::string::npos || relative == ".." ||
+        relative.starts_with("../") || relative.ends_with("/..") || relative.find("/../") != std::string::npos)
+    {
+        return Response::with_status(404, "Not Found");
+    }
+
+    std::string path = root + "/" + relative;
+
+    std::shared_ptr<OpenFile> file;
+    size_t size = 0;
+    time_t mtime = 0;
+    std::string etag;
+    char last_modified[http_date_length];
+    std::string_view encoding;
+    bool has_variants = false;
+
+    {
+        std::lock_guard lock(mutex);
+
+        Entry* entry = lookup(path);
+        if (entry && entry->is_directory)
+        {
+            path += "/index.html";
+            entry = lookup(path);
+        }
+        if (!entry || entry->is_directory) { return Response::with_status(404, "Not Found"); }
+
+        has_variants = entry->has_brotli || entry->has_gzip;
+
+        Entry* selected = entry;
+        auto accept = request.header("Accept-Encoding");
+        if (!accept.empty())
+        {
+            Entry* variant = nullptr;
+            if (entry->has_brotli && accepts_encoding(accept, "br") && (variant = lookup(path + ".br")))
+            {
+                encoding = "br";
+            }
+            else if (entry->has_gzip && accepts_encoding(accept, "gzip") && (variant = lookup(path + ".gz")))
+            {
+                encoding = "gzip";
+            }
+            if (variant && !variant->is_directory) { selected = variant; }
+            else { encoding = {}; }
+        }
+
+        file = selected->file;
+        size = selected->size;
+        mtime = selected->mtime;
+        etag = selected->etag;
+        memcpy(last_modified, selected->last_modified, http_date_length);
+
+        // Each encoding is a different representation and needs its own validator
+        if (!encoding.empty()) { etag.insert(etag.size() - 1, encoding == "br" ? "-br" : "-gz"); }
+    }
+
+    std::string_view last_modified_str(last_modified, http_date_length);
+
+    Response response;
+    response.content_type(mime_type(path)).header("ETag", etag).header("Last-Modified", last_modified_str);
+    if (has_variants) { response.header("Vary", "Accept-Encoding"); }
+
+    // Conditional GET, If-None-Match takes precedence over If-Modified-Since
+    auto if_none_match = request.header("If-None-Match");
+    bool not_modified = false;
+    if (!if_none_match.empty()) { not_modified = etag_matches(if_none_match, etag); }
+    else
+    {
+        time_t since = 0;
+        auto if_modified_since = request.header("If-Modified-Since");
+        if (!if_modified_since.empty() && HttpDate::parse(if_modified_since, since)) { not_modified = mtime <= since; }
+    }
+
+    if (not_modified)
+    {
+        response.status(304);
+        return response;
+    }
+
+    if (!encoding.empty()) { response.header("Content-Encoding", encoding); }
+    response.header("Accept-Ranges", "bytes");
+
+    auto range = request.header("Range");
+    auto if_range = request.header("If-Range");
+    bool range_allowed = if_range.empty() || if_range == etag || if_range == last_modified_str;
+
+    size_t first = 0, last = 0;
+    bool satisfiable = false;
+    if (!range.empty() && range_allowed && parse_range(range, size, first, last, satisfiable))
+    {
+        char content_range[80] = "bytes ";
+        char* out = content_range + 6;
+
+        if (!satisfiable)
+        {
+            *out++ = '*';
+            *out++ = '/';
+            out = std::to_chars(out, content_range + sizeof(content_range), size).ptr;
+            response.status(416).header("Content-Range", std::string_view(content_range, out - content_range));
+            response.body(std::string_view());
+            return response;
+        }
+
+        out = std::to_chars(out, content_range + sizeof(content_range), first).ptr;
+        *out++ = '-';
+        out = std::to_chars(out, content_range + sizeof(content_range), last).ptr;
+        *out++ = '/';
+        out = std::to_chars(out, content_range + sizeof(content_range), size).ptr;
+
+        int fd = file->fd;
+        response.status(206).header("Content-Range", std::string_view(content_range, out - content_range));
+        response.file(fd, first, last - first + 1, std::move(file));
+        return response;
+    }
+
+    int fd = file->fd;
+    if (size == 0) { response.body(std::string_view()); }
+    else { response.file(fd, 0, size, std::move(file)); }
+    return response;
+}
@@ -0,0 +1,203 @@
+#include "tls.hpp"
+
+#include <cerrno>
+#include <iostream>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+// Largest TLS record payload, writes are staged in pieces of this size
+constexpr size_t tls_record_size = 16 * 1024;
+
+static void print_errors(const char* what)
+{
+    std::cerr << "Error " << what << ": ";
+    unsigned long error = ERR_get_error();
+    if (error == 0) { std::cerr << "unknown"; }
+    while (error != 0)
+    {
+        char message[256];
+        ERR_error_string_n(error, message, sizeof(message));
+        std::cerr << message;
+        error = ERR_get_error();
+        if (error != 0) { std::cerr << "; "; }
+    }
+    std::cerr << std::endl;
+}
+
+// Wire format ALPN lists, in server preference order
+static constexpr unsigned char alpn_h2[] = "\x02h2\x08http/1.1";
+static constexpr unsigned char alpn_http11[] = "\x08http/1.1";
+
+static int select_alpn(SSL*, const unsigned char** out, unsigned char* out_length, const unsigned char* in,
+                       unsigned int in_length, void* arg)
+{
+    bool http2 = arg != nullptr;
+    const unsigned char* server = http2 ? alpn_h2 : alpn_http11;
+    unsigned int server_length = http2 ? sizeof(alpn_h2) - 1 : sizeof(alpn_http11) - 1;
+
+    unsigned char* selected = nullptr;
+    if (SSL_select_next_proto(&selected, out_length, server, server_length, in, in_length) != OPENSSL_NPN_NEGOTIATED)
+    {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+TlsContext::TlsContext(const TlsOptions& options)
+{
+    SSL_CTX* context = SSL_CTX_new(TLS_server_method());
+    if (!context)
+    {
+        print_errors("creating TLS context");
+        return;
+    }
+
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+
+    // Idle connections give their record buffers back, partial writes let flush() track progress per record
+    SSL_CTX_set_mode(context, SSL_MODE_RELEASE_BUFFERS | SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                  SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    long flags = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+    if (options.ktls) { flags |= SSL_OP_ENABLE_KTLS; }
+    SSL_CTX_set_options(context, flags);
+
+    // Resumption: stateless tickets (on by default) plus a server side cache for TLS 1.2 session IDs
+    static constexpr unsigned char session_context[] = "au_web";
+    SSL_CTX_set_session_id_context(context, session_context, sizeof(session_context) - 1);
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(context, static_cast<long>(options.session_cache_size));
+
+    SSL_CTX_set_alpn_select_cb(context, select_alpn, options.http2 ? context : nullptr);
+
+    if (SSL_CTX_use_certificate_chain_file(context, options.certificate_file.c_str()) != 1)
+    {
+        print_errors(("loading certificate " + options.certificate_file).c_str());
+        SSL_CTX_free(context);
+        return;
+    }
+
+    if (SSL_CTX_use_PrivateKey_file(context, options.private_key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(context) != 1)
+    {
+        print_errors(("loading private key " + options.private_key_file).c_str());
+        SSL_CTX_free(context);
+        return;
+    }
+
+    ctx = context;
+}
+
+TlsContext::~TlsContext()
+{
+    if (ctx) { SSL_CTX_free(ctx); }
+}
+
+std::unique_ptr<TlsSession> TlsContext::accept(int fd)
+{
+    SSL* ssl = SSL_new(ctx);
+    if (!ssl || SSL_set_fd(ssl, fd) != 1)
+    {
+        print_errors("creating TLS session");
+        if (ssl) { SSL_free(ssl); }
+        return nullptr;
+    }
+
+    SSL_set_accept_state(ssl);
+    return std::make_unique<TlsSession>(ssl);
+}
+
+TlsSession::TlsSession(SSL* ssl) : ssl(ssl)
+{
+}
+
+TlsSession::~TlsSession()
+{
+    SSL_free(ssl);
+}
+
+ssize_t TlsSession::read(char* buffer, size_t length)
+{
+    _read_wants_write = false;
+
+    ERR_clear_error();
+    errno = 0;
+    int result = SSL_read(ssl, buffer, static_cast<int>(length));
+
+    if (!_established && SSL_is_init_finished(ssl))
+    {
+        _established = true;
+        _kernel_send = BIO_get_ktls_send(SSL_get_wbio(ssl)) != 0;
+    }
+
+    if (result > 0) { return result; }
+
+    switch (SSL_get_error(ssl, result))
+    {
+        case SSL_ERROR_WANT_READ: errno = EAGAIN; return -1;
+        case SSL_ERROR_WANT_WRITE:
+            _read_wants_write = true;
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN: return 0;
+        case SSL_ERROR_SYSCALL:
+            // Peer went away without close_notify, same as a plain EOF
+            if (ERR_peek_error() == 0 && errno == 0) { return 0; }
+            if (ERR_peek_error() == 0) { return -1; }
+            [[fallthrough]];
+        default:
+            // Handshake failures are the client's problem (plain HTTP on the TLS port, unknown CA), not worth a log line
+            ERR_clear_error();
+            return 0;
+    }
+}
+
+OutputQueue::FlushResult TlsSession::flush(OutputQueue& out)
+{
+    static thread_local char staging[tls_record_size];
+
+    while (!out.empty())
+    {
+        // A retried write has to see the same bytes again, and it does since nothing was consumed
+        size_t length = out.peek(staging, sizeof(staging));
+        if (length == 0) { return OutputQueue::FlushResult::ERROR; }
+
+        ERR_clear_error();
+        errno = 0;
+        int written = SSL_write(ssl, staging, static_cast<int>(length));
+        if (written > 0)
+        {
+            out.consume(static_cast<size_t>(written));
+            continue;
+        }
+
+        switch (SSL_get_error(ssl, written))
+        {
+            case SSL_ERROR_WANT_WRITE:
+            case SSL_ERROR_WANT_READ: return OutputQueue::FlushResult::BLOCKED;
+            case SSL_ERROR_SYSCALL:
+                if (ERR_peek_error() == 0 && (errno == EPIPE || errno == ECONNRESET)) { return OutputQueue::FlushResult::ERROR; }
+                [[fallthrough]];
+            default: print_errors("writing TLS record"); return OutputQueue::FlushResult::ERROR;
+        }
+    }
+
+    return OutputQueue::FlushResult::DONE;
+}
+
+void TlsSession::shutdown()
+{
+    if (!_established) { return; }
+    ERR_clear_error();
+    SSL_shutdown(ssl);
+    ERR_clear_error();
+}
+
+std::string_view TlsSession::alpn() const
+{
+    const unsigned char* protocol = nullptr;
+    unsigned int length = 0;
+    SSL_get0_alpn_selected(ssl, &protocol, &length);
+    return std::string_view(reinterpret_cast<const char*>(protocol), protocol ? length : 0);
+}
@@ -0,0 +1,114 @@
+#include "trace.hpp"
+#include "json.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+
+static uint64_t monotonic_nanoseconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + static_cast<uint64_t>(now.tv_nsec);
+}
+
+static std::string_view method_name(Method method)
+{
+    switch (method)
+    {
+        case Method::OPTIONS: return "OPTIONS";
+        case Method::GET: return "GET";
+        case Method::HEAD: return "HEAD";
+        case Method::POST: return "POST";
+        case Method::PUT: return "PUT";
+        case Method::PATCH: return "PATCH";
+        case Method::DELETE: return "DELETE";
+        case Method::TRACE: return "TRACE";
+        case Method::CONNECT: return "CONNECT";
+        case Method::UNKNOWN: break;
+    }
+    return "UNKNOWN";
+}
+
+void PhaseTrace::set_name(Method method, std::string_view path)
+{
+    std::string_view verb = method_name(method);
+    size_t length = std::min(verb.size(), sizeof(name) - 1);
+    memcpy(name, verb.data(), length);
+    if (length < sizeof(name) - 1) { name[length++] = ' '; }
+
+    size_t path_length = std::min(path.size(), sizeof(name) - 1 - length);
+    memcpy(name + length, path.data(), path_length);
+    name[length + path_length] = '\0';
+}
+
+RequestTracer::RequestTracer(const TraceOptions& options)
+    : options(options), ring(std::max<size_t>(options.capacity, 1)), start_ticks(trace_ticks()),
+      start_nanoseconds(monotonic_nanoseconds())
+{
+    this->options.sample_every = std::max<uint32_t>(options.sample_every, 1);
+}
+
+void RequestTracer::commit(const PhaseTrace& trace, int connection)
+{
+    ring[next] = {trace, connection};
+    next = (next + 1) % ring.size();
+    count = std::min(count + 1, ring.size());
+}
+
+void RequestTracer::write(JsonWriter& json) const
+{
+    // Spans are named after the phase they start at, the last phase only ends one
+    static constexpr std::string_view span_names[trace_phases - 1] = {
+        "waiting for first byte", "receiving headers", "receiving body and parsing", "routing",
+        "before handler",         "handler",           "serializing",                "sending"};
+
+    // Calibrated over everything since startup, far longer than any drift that would matter here
+    uint64_t elapsed_ticks = trace_ticks() - start_ticks;
+    uint64_t elapsed_nanoseconds = monotonic_nanoseconds() - start_nanoseconds;
+    double ticks_per_microsecond =
+        elapsed_nanoseconds == 0 ? 1.0 : static_cast<double>(elapsed_ticks) * 1000.0 / static_cast<double>(elapsed_nanoseconds);
+    if (ticks_per_microsecond <= 0) { ticks_per_microsecond = 1.0; }
+    auto microseconds = [&](uint64_t ticks) { return static_cast<double>(ticks - start_ticks) / ticks_per_microsecond; };
+
+    pid_t pid = getpid();
+
+    json.begin_object().key("traceEvents").begin_array();
+    json.begin_object().field("name", "process_name").field("ph", "M").field("pid", pid);
+    json.key("args").begin_object().field("name", "au_web").end_object().end_object();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const Record& record = ring[(next + ring.size() - count + i) % ring.size()];
+        const PhaseTrace& trace = record.trace;
+
+        size_t first = 0;
+        while (first < trace_phases && trace.at[first] == 0) { first++; }
+        size_t last = trace_phases;
+        while (last > first && trace.at[last - 1] == 0) { last--; }
+        if (last - first < 2) { continue; }
+        last--;
+
+        json.begin_object().field("name", trace.name[0] ? trace.name : "request").field("cat", "request");
+        json.field("ph", "X").field("pid", pid).field("tid", record.connection);
+        json.field("ts", microseconds(trace.at[first]));
+        json.field("dur", static_cast<double>(trace.at[last] - trace.at[first]) / ticks_per_microsecond);
+        json.key("args").begin_object().field("status", trace.status).field("complete", trace.at[trace_phases - 1] != 0);
+        json.end_object().end_object();
+
+        // Skipped phases fold into the span before them
+        for (size_t phase = first; phase < last;)
+        {
+            size_t end = phase + 1;
+            while (end < last && trace.at[end] == 0) { end++; }
+
+            json.begin_object().field("name", span_names[phase]).field("cat", "phase").field("ph", "X");
+            json.field("pid", pid).field("tid", record.connection).field("ts", microseconds(trace.at[phase]));
+            json.field("dur", static_cast<double>(trace.at[end] - trace.at[phase]) / ticks_per_microsecond);
+            json.end_object();
+            phase = end;
+        }
+    }
+
+    json.end_array().field("displayTimeUnit", "ns").end_object();
+}
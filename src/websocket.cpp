@@ -0,0 +1,424 @@
+#include "websocket.hpp"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum Opcode : uint8_t
+{
+    OPCODE_CONTINUATION = 0x0,
+    OPCODE_TEXT = 0x1,
+    OPCODE_BINARY = 0x2,
+    OPCODE_CLOSE = 0x8,
+    OPCODE_PING = 0x9,
+    OPCODE_PONG = 0xa
+};
+
+enum CloseCode : uint16_t
+{
+    CLOSE_NORMAL = 1000,
+    CLOSE_PROTOCOL_ERROR = 1002,
+    CLOSE_NO_STATUS = 1005,
+    CLOSE_ABNORMAL = 1006,
+    CLOSE_INVALID_PAYLOAD = 1007,
+    CLOSE_TOO_BIG = 1009
+};
+
+// Codes a peer may send (RFC 6455 section 7.4): 1004-1006 and 1015 are reserved or never go on the wire,
+// the rest below 3000 aren't registered, 5000 and up don't exist
+static bool is_valid_close_code(uint16_t code)
+{
+    if (code >= 1000 && code <= 1003) { return true; }
+    if (code >= 1007 && code <= 1014) { return true; }
+    return code >= 3000 && code <= 4999;
+}
+
+// Shared payloads smaller than this are cheaper to copy than to reference
+constexpr size_t min_shared_send_size = 1024;
+
+static uint32_t rotl32(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// SHA-1, only used for the handshake where the protocol mandates it
+static void sha1(std::string_view input, uint8_t digest[20])
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+    std::string message(input);
+    uint64_t bit_length = static_cast<uint64_t>(input.size()) * 8;
+    message.push_back(static_cast<char>(0x80));
+    while (message.size() % 64 != 56) message.push_back(0);
+    for (int i = 7; i >= 0; i--) message.push_back(static_cast<char>(bit_length >> (i * 8)));
+
+    for (size_t chunk = 0; chunk < message.size(); chunk += 64)
+    {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+        {
+            const auto* bytes = reinterpret_cast<const uint8_t*>(message.data() + chunk + i * 4);
+            w[i] = (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | bytes[3];
+        }
+        for (int i = 16; i < 80; i++) w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f, k;
+            if (i < 20) { f = (b & c) | (~b & d), k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d, k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC; }
+            else { f = b ^ c ^ d, k = 0xCA62C1D6; }
+
+            uint32_t temp = rotl32(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl32(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    for (int i = 0; i < 5; i++)
+    {
+        digest[i * 4] = static_cast<uint8_t>(h[i] >> 24);
+        digest[i * 4 + 1] = static_cast<uint8_t>(h[i] >> 16);
+        digest[i * 4 + 2] = static_cast<uint8_t>(h[i] >> 8);
+        digest[i * 4 + 3] = static_cast<uint8_t>(h[i]);
+    }
+}
+
+static std::string base64_encode(const uint8_t* data, size_t length)
+{
+    static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string result;
+    for (size_t i = 0; i < length; i += 3)
+    {
+        uint32_t group = uint32_t(data[i]) << 16;
+        if (i + 1 < length) group |= uint32_t(data[i + 1]) << 8;
+        if (i + 2 < length) group |= data[i + 2];
+
+        result.push_back(alphabet[(group >> 18) & 63]);
+        result.push_back(alphabet[(group >> 12) & 63]);
+        result.push_back(i + 1 < length ? alphabet[(group >> 6) & 63] : '=');
+        result.push_back(i + 2 < length ? alphabet[group & 63] : '=');
+    }
+    return result;
+}
+
+std::string websocket_accept_key(std::string_view key)
+{
+    std::string input(key);
+    input += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    uint8_t digest[20];
+    sha1(input, digest);
+    return base64_encode(digest, sizeof(digest));
+}
+
+void websocket_unmask(char* data, size_t length, const uint8_t mask[4], size_t offset)
+{
+    // Rotate the key so it lines up with data[0], then every 4/8/16 byte block uses it unchanged
+    uint8_t key[4];
+    for (int i = 0; i < 4; i++) key[i] = mask[(offset + i) & 3];
+
+    uint32_t key32;
+    memcpy(&key32, key, sizeof(key32));
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i key128 = _mm_set1_epi32(static_cast<int>(key32));
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(block, key128));
+    }
+#endif
+
+    uint64_t key64 = (static_cast<uint64_t>(key32) << 32) | key32;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t block;
+        memcpy(&block, data + i, sizeof(block));
+        block ^= key64;
+        memcpy(data + i, &block, sizeof(block));
+    }
+
+    for (; i < length; i++) data[i] ^= key[i & 3];
+}
+
+// Text messages have to be well-formed UTF-8, no overlongs, surrogates or code points past U+10FFFF
+static bool is_valid_utf8(std::string_view text)
+{
+    const auto* bytes = reinterpret_cast<const uint8_t*>(text.data());
+    size_t length = text.size();
+    size_t i = 0;
+
+    while (i < length)
+    {
+        // ASCII fast path, 8 bytes at a time
+        if (i + 8 <= length)
+        {
+            uint64_t block;
+            memcpy(&block, bytes + i, sizeof(block));
+            if ((block & 0x8080808080808080ull) == 0)
+            {
+                i += 8;
+                continue;
+            }
+        }
+
+        uint8_t lead = bytes[i];
+        if (lead < 0x80)
+        {
+            i++;
+            continue;
+        }
+
+        size_t count;
+        uint32_t min;
+        uint32_t code_point;
+        if ((lead & 0xe0) == 0xc0) { count = 1, min = 0x80, code_point = lead & 0x1f; }
+        else if ((lead & 0xf0) == 0xe0) { count = 2, min = 0x800, code_point = lead & 0x0f; }
+        else if ((lead & 0xf8) == 0xf0) { count = 3, min = 0x10000, code_point = lead & 0x07; }
+        else { return false; }
+
+        if (i + count >= length) { return false; }
+        for (size_t j = 1; j <= count; j++)
+        {
+            if ((bytes[i + j] & 0xc0) != 0x80) { return false; }
+            code_point = (code_point << 6) | (bytes[i + j] & 0x3f);
+        }
+
+        if (code_point < min || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff)) { return false; }
+        i += count + 1;
+    }
+    return true;
+}
+
+WebSocket::WebSocket(OutputQueue& out, std::shared_ptr<const WebSocketHandler> handler, RouteParams params, Wake wake)
+    : out(out), handler(std::move(handler)), _params(std::move(params)), wake(std::move(wake))
+{
+}
+
+bool WebSocket::send_text(std::string_view message)
+{
+    return send_message(OPCODE_TEXT, message, nullptr);
+}
+
+bool WebSocket::send_binary(std::string_view message)
+{
+    return send_message(OPCODE_BINARY, message, nullptr);
+}
+
+bool WebSocket::send(std::shared_ptr<const std::string> message, bool binary)
+{
+    std::string_view payload = *message;
+    return send_message(binary ? OPCODE_BINARY : OPCODE_TEXT, payload, std::move(message));
+}
+
+bool WebSocket::send_message(uint8_t opcode, std::string_view payload, std::shared_ptr<const std::string> owner)
+{
+    if (close_sent || out.pending_bytes() > websocket_max_queued_bytes) { return false; }
+
+    write_header(opcode, payload.size());
+    if (owner && payload.size() >= min_shared_send_size) { out.append_view(payload, std::move(owner)); }
+    else { out.append(payload); }
+    wake();
+    return true;
+}
+
+void WebSocket::close(uint16_t code, std::string_view reason)
+{
+    if (close_sent) { return; }
+
+    char payload[125];
+    payload[0] = static_cast<char>(code >> 8);
+    payload[1] = static_cast<char>(code);
+    size_t length = std::min<size_t>(reason.size(), sizeof(payload) - 2);
+    if (length > 0) { memcpy(payload + 2, reason.data(), length); }
+
+    write_frame(OPCODE_CLOSE, std::string_view(payload, length + 2));
+    close_sent = true;
+}
+
+void WebSocket::write_header(uint8_t opcode, size_t length)
+{
+    // Server frames are never masked and we never fragment
+    char header[10];
+    size_t header_size = 2;
+    header[0] = static_cast<char>(0x80 | opcode);
+
+    if (length < 126) { header[1] = static_cast<char>(length); }
+    else if (length <= 0xffff)
+    {
+        header[1] = 126;
+        header[2] = static_cast<char>(length >> 8);
+        header[3] = static_cast<char>(length);
+        header_size = 4;
+    }
+    else
+    {
+        header[1] = 127;
+        for (int i = 0; i < 8; i++) header[2 + i] = static_cast<char>(static_cast<uint64_t>(length) >> ((7 - i) * 8));
+        header_size = 10;
+    }
+
+    out.append(std::string_view(header, header_size));
+}
+
+void WebSocket::write_frame(uint8_t opcode, std::string_view payload)
+{
+    write_header(opcode, payload.size());
+    out.append(payload);
+    wake();
+}
+
+bool WebSocket::fail(uint16_t code)
+{
+    close(code);
+    closed(code);
+    return false;
+}
+
+void WebSocket::closed(uint16_t code)
+{
+    if (close_notified) { return; }
+    close_notified = true;
+    if (handler->on_close) { handler->on_close(*this, code); }
+}
+
+bool WebSocket::receive(std::vector<char>& data, uint64_t now)
+{
+    last_received = now;
+    ping_outstanding = false;
+
+    size_t position = 0;
+    bool keep_open = true;
+
+    while (keep_open)
+    {
+        size_t available = data.size() - position;
+        if (available < 2) { break; }
+
+        auto* frame = reinterpret_cast<uint8_t*>(data.data() + position);
+        bool fin = frame[0] & 0x80;
+        uint8_t opcode = frame[0] & 0x0f;
+        bool masked = frame[1] & 0x80;
+        uint64_t length = frame[1] & 0x7f;
+
+        size_t header_size = 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) + (masked ? 4 : 0);
+        if (available < header_size) { break; }
+
+        // No extensions are negotiated, so the reserved bits must be clear, and clients always mask
+        if ((frame[0] & 0x70) || !masked) { return fail(CLOSE_PROTOCOL_ERROR); }
+
+        if (length == 126) { length = (uint64_t(frame[2]) << 8) | frame[3]; }
+        else if (length == 127)
+        {
+            // RFC 6455 section 5.2: the most significant bit of a 64-bit length must be 0
+            if (frame[2] & 0x80) { return fail(CLOSE_PROTOCOL_ERROR); }
+            length = 0;
+            for (int i = 0; i < 8; i++) length = (length << 8) | frame[2 + i];
+        }
+
+        bool control = opcode & 0x8;
+        if (control && (length > 125 || !fin)) { return fail(CLOSE_PROTOCOL_ERROR); }
+        // Subtracted, a length near 2^64 would wrap the sum
+        if (!control && (message.size() > websocket_max_message_size || length > websocket_max_message_size - message.size()))
+        {
+            return fail(CLOSE_TOO_BIG);
+        }
+        if (available - header_size < length) { break; }
+
+        char* payload = data.data() + position + header_size;
+        websocket_unmask(payload, length, frame + header_size - 4);
+        std::string_view body(payload, length);
+        position += header_size + length;
+
+        switch (opcode)
+        {
+            case OPCODE_TEXT:
+            case OPCODE_BINARY:
+            case OPCODE_CONTINUATION:
+            {
+                if ((opcode == OPCODE_CONTINUATION) != (message_opcode != 0)) { return fail(CLOSE_PROTOCOL_ERROR); }
+
+                // Unfragmented messages are handed over straight from the receive buffer
+                std::string_view complete = body;
+                if (!fin || message_opcode != 0)
+                {
+                    if (message_opcode == 0) { message_opcode = opcode; }
+                    message.append(body);
+                    if (!fin) { break; }
+                    complete = message;
+                    opcode = message_opcode;
+                }
+
+                if (opcode == OPCODE_TEXT && !is_valid_utf8(complete)) { return fail(CLOSE_INVALID_PAYLOAD); }
+
+                // After our close frame the peer may still be sending, those messages are dropped
+                if (!close_sent && handler->on_message) { handler->on_message(*this, complete, opcode == OPCODE_BINARY); }
+
+                message.clear();
+                message_opcode = 0;
+                break;
+            }
+
+            case OPCODE_CLOSE:
+            {
+                if (length == 1) { return fail(CLOSE_PROTOCOL_ERROR); }
+
+                uint16_t code = CLOSE_NO_STATUS;
+                if (length >= 2)
+                {
+                    code = (uint16_t(static_cast<uint8_t>(payload[0])) << 8) | static_cast<uint8_t>(payload[1]);
+                    if (!is_valid_close_code(code)) { return fail(CLOSE_PROTOCOL_ERROR); }
+                    if (!is_valid_utf8(body.substr(2))) { return fail(CLOSE_INVALID_PAYLOAD); }
+                }
+
+                // Echo the code, or an empty close when there was none
+                if (!close_sent)
+                {
+                    write_frame(OPCODE_CLOSE, body.substr(0, length >= 2 ? 2 : 0));
+                    close_sent = true;
+                }
+                closed(code);
+                keep_open = false;
+                break;
+            }
+
+            case OPCODE_PING: write_frame(OPCODE_PONG, body); break;
+            case OPCODE_PONG: break;
+            default: return fail(CLOSE_PROTOCOL_ERROR);
+        }
+    }
+
+    data.erase(data.begin(), data.begin() + position);
+    return keep_open;
+}
+
+bool WebSocket::tick(uint64_t now)
+{
+    // Closing handshake or ping that never got an answer
+    if (close_sent) { return ++closing_ticks < websocket_pong_timeout; }
+    if (ping_outstanding) { return now - ping_sent < websocket_pong_timeout; }
+
+    if (now - last_received >= websocket_ping_interval)
+    {
+        write_frame(OPCODE_PING, {});
+        ping_outstanding = true;
+        ping_sent = now;
+    }
+    return true;
+}
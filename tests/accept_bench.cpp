@@ -0,0 +1,92 @@
+// Per-connection cost of taking a socket off the listener: the old accept() + fcntl() pair to make it
+// non-blocking against accept4(SOCK_NONBLOCK | SOCK_CLOEXEC).
+//
+//   g++ -std=c++23 -O2 tests/accept_bench.cpp -o accept_bench && ./accept_bench
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+constexpr int batch = 256;
+constexpr int connections = batch * 80;
+
+struct Result
+{
+    double nanoseconds = 0;
+    int syscalls = 0;
+};
+
+// Connects a batch of clients, then times only the server side taking them
+template <typename Accept> Result run(int listener, const sockaddr_in& address, Accept accept_one)
+{
+    Result result;
+    std::vector<int> clients;
+    std::vector<int> accepted;
+
+    for (int done = 0; done < connections; done += batch)
+    {
+        for (int i = 0; i < batch; i++)
+        {
+            int client = socket(AF_INET, SOCK_STREAM, 0);
+            connect(client, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+            clients.push_back(client);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < batch; i++) { accepted.push_back(accept_one(listener, result.syscalls)); }
+        result.nanoseconds += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        for (int fd : clients) { close(fd); }
+        for (int fd : accepted) { close(fd); }
+        clients.clear();
+        accepted.clear();
+    }
+
+    return result;
+}
+
+int main()
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+    socklen_t length = sizeof(address);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+    listen(listener, batch * 2);
+
+    auto old_path = run(listener, address, [](int fd, int& syscalls) {
+        sockaddr_in peer;
+        socklen_t peer_length = sizeof(peer);
+        int client = accept(fd, reinterpret_cast<sockaddr*>(&peer), &peer_length);
+        int flags = fcntl(client, F_GETFL, 0);
+        fcntl(client, F_SETFL, flags | O_NONBLOCK);
+        syscalls += 3;
+        return client;
+    });
+
+    auto new_path = run(listener, address, [](int fd, int& syscalls) {
+        sockaddr_storage peer;
+        socklen_t peer_length = sizeof(peer);
+        int client = accept4(fd, reinterpret_cast<sockaddr*>(&peer), &peer_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        syscalls += 1;
+        return client;
+    });
+
+    std::printf("accept + fcntl x2 : %.2f syscalls, %.0f ns per connection\n",
+                static_cast<double>(old_path.syscalls) / connections, old_path.nanoseconds / connections);
+    std::printf("accept4           : %.2f syscalls, %.0f ns per connection\n",
+                static_cast<double>(new_path.syscalls) / connections, new_path.nanoseconds / connections);
+
+    close(listener);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "form.hpp"
+
+// Every part as "name|filename|content-type=body", the way the parser reported it
+struct Collected
+{
+    std::vector<std::string> parts;
+
+    FormEvents events()
+    {
+        return {.on_part = [this](const FormPart& part) {
+                    parts.push_back(part.name + "|" + part.filename + "|" + part.content_type + "=");
+                    return true;
+                },
+                .on_data = [this](std::string_view data) {
+                    assert(!parts.empty());
+                    parts.back() += data;
+                    return true;
+                }};
+    }
+};
+
+// Feeds body in pieces of chunk_size bytes
+std::vector<std::string> parse_multipart(std::string_view body, std::string_view boundary, size_t chunk_size, bool& complete)
+{
+    Collected collected;
+    auto events = collected.events();
+    MultipartParser parser(boundary);
+    for (size_t i = 0; i < body.size(); i += chunk_size)
+    {
+        if (!parser.feed(body.substr(i, chunk_size), events)) { break; }
+    }
+    complete = parser.complete();
+    return collected.parts;
+}
+
+std::vector<std::string> parse_urlencoded(std::string_view body, size_t chunk_size, bool& valid)
+{
+    Collected collected;
+    auto events = collected.events();
+    UrlencodedParser parser;
+    valid = true;
+    for (size_t i = 0; i < body.size() && valid; i += chunk_size) { valid = parser.feed(body.substr(i, chunk_size), events); }
+    valid = valid && parser.finish(events);
+    return collected.parts;
+}
+
+void run_tests()
+{
+    std::cout << "Running form parser tests...\n";
+
+    {
+        std::cout << "Test 1: multipart/form-data split at every chunk size\n";
+        std::string body = "preamble\r\n"
+                           "--XyZ\r\n"
+                           "Content-Disposition: form-data; name=\"title\"\r\n"
+                           "\r\n"
+                           "hello world\r\n"
+                           "--XyZ\r\n"
+                           "Content-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "\r\n"
+                           "line one\r\n--Xy not a delimiter\r\n-\r\n"
+                           "--XyZ\r\n"
+                           "\r\n"
+                           "\r\n"
+                           "--XyZ--\r\n"
+                           "epilogue";
+        std::vector<std::string> expected = {"title||=hello world", "file|a.txt|text/plain=line one\r\n--Xy not a delimiter\r\n-",
+                                             "||="};
+
+        for (size_t chunk_size = 1; chunk_size <= body.size(); chunk_size++)
+        {
+            bool complete = false;
+            assert(parse_multipart(body, "XyZ", chunk_size, complete) == expected);
+            assert(complete);
+        }
+    }
+
+    {
+        std::cout << "Test 2: multipart body starting with the delimiter, transport padding\n";
+        std::string body = "--b  \r\nContent-Disposition: form-data; name=x\r\n\r\n1\r\n--b--";
+        bool complete = false;
+        assert(parse_multipart(body, "b", 7, complete) == std::vector<std::string>{"x||=1"});
+        assert(complete);
+    }
+
+    {
+        std::cout << "Test 3: malformed and truncated multipart bodies\n";
+        bool complete = true;
+        parse_multipart("--b\r\nno colon here\r\n\r\n1\r\n--b--", "b", 4, complete);
+        assert(!complete);
+        parse_multipart("--b\r\n\r\n1\r\n--b", "b", 4, complete);
+        assert(!complete);
+        parse_multipart("--bX\r\n", "b", 4, complete);
+        assert(!complete);
+    }
+
+    {
+        std::cout << "Test 4: application/x-www-form-urlencoded split at every chunk size\n";
+        std::string body = "name=J%C3%BCrgen+M&empty=&flag&&amp=%26%3D&last=x";
+        std::vector<std::string> expected = {"name||=J\xC3\xBCrgen M", "empty||=", "flag||=", "amp||=&=", "last||=x"};
+
+        for (size_t chunk_size = 1; chunk_size <= body.size(); chunk_size++)
+        {
+            bool valid = false;
+            assert(parse_urlencoded(body, chunk_size, valid) == expected);
+            assert(valid);
+        }
+    }
+
+    {
+        std::cout << "Test 5: bad percent escapes\n";
+        bool valid = true;
+        parse_urlencoded("a=%zz", 2, valid);
+        assert(!valid);
+        parse_urlencoded("a=%4", 2, valid);
+        assert(!valid);
+    }
+
+    {
+        std::cout << "Test 6: header parameters\n";
+        assert(header_parameter("multipart/form-data; boundary=\"abc def\"", "boundary") == "abc def");
+        assert(header_parameter("multipart/form-data;charset=utf-8; BOUNDARY=x", "boundary") == "x");
+        assert(header_parameter("form-data; filename=\"a.txt\"; name=\"f\"", "name") == "f");
+        assert(header_parameter("text/plain", "boundary").empty());
+    }
+
+    {
+        std::cout << "Test 7: pattern search\n";
+        PatternSearch search("\r\n--abc");
+        assert(search.find("xx\r\n--ab\r\n--abc") == 8);
+        assert(search.find("\r\n--ab") == std::string_view::npos);
+        assert(search.find("\r\n--abc") == 0);
+    }
+
+    std::cout << "All form parser tests passed!\n";
+}
+
+int main()
+{
+    run_tests();
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "framing.hpp"
+#include "request_limits.hpp"
+
+constexpr std::string_view next_request = "GET /next HTTP/1.1\r\nHost: x\r\n\r\n";
+
+size_t head_size(std::string_view raw)
+{
+    return raw.find("\r\n\r\n") + 4;
+}
+
+// Refusal for the head of raw, empty when its framing is accepted
+std::string_view rejection(std::string_view raw)
+{
+    return request_framing(raw.substr(0, head_size(raw))).rejection;
+}
+
+// Decodes the chunked request at the front of raw fed in pieces of chunk_size bytes, returns its body and
+// leaves what followed it in rest
+ChunkedDecoder::Result decode(std::string_view raw, size_t chunk_size, size_t limit, std::string& body, std::string& rest)
+{
+    size_t head = head_size(raw);
+    std::vector<char> buffer(raw.begin(), raw.begin() + head);
+    ChunkedDecoder decoder;
+    auto result = ChunkedDecoder::Result::INCOMPLETE;
+    for (size_t i = head; i < raw.size() && result == ChunkedDecoder::Result::INCOMPLETE; i += chunk_size)
+    {
+        auto piece = raw.substr(i, chunk_size);
+        buffer.insert(buffer.end(), piece.begin(), piece.end());
+        result = decoder.decode(buffer, head, limit);
+    }
+
+    body.assign(buffer.data() + head, decoder.decoded());
+    rest.assign(buffer.begin() + decoder.input_end(), buffer.end());
+    return result;
+}
+
+void run_tests()
+{
+    std::cout << "Running framing tests...\n";
+
+    {
+        std::cout << "Test 1: Content-Length body with a pipelined request behind it\n";
+        std::string raw = "POST /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc" + std::string(next_request);
+        auto framing = request_framing(std::string_view(raw).substr(0, head_size(raw)));
+        assert(framing.rejection.empty() && !framing.chunked && framing.content_length == 3);
+        assert(raw.substr(head_size(raw) + framing.content_length) == next_request);
+    }
+
+    {
+        std::cout << "Test 2: chunked body hiding a request, split at every chunk size\n";
+        std::string hidden = "GET /admin/x HTTP/1.1\r\nHost: x\r\n\r\n";
+        std::string raw = "POST /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" + std::string("22;ext=1\r\n") + hidden +
+                          "\r\n1\r\nZ\r\n0\r\nTrailer-Field: 1\r\n\r\n" + std::string(next_request);
+        auto framing = request_framing(std::string_view(raw).substr(0, head_size(raw)));
+        assert(framing.rejection.empty() && framing.chunked);
+
+        for (size_t chunk_size = 1; chunk_size <= raw.size(); chunk_size++)
+        {
+            std::string body, rest;
+            assert(decode(raw, chunk_size, 1024, body, rest) == ChunkedDecoder::Result::DONE);
+            assert(body == hidden + "Z");
+            // Only the bytes of the next request are left over, whatever arrived with this one
+            assert(std::string_view(next_request).starts_with(rest));
+        }
+    }
+
+    {
+        std::cout << "Test 3: Transfer-Encoding together with Content-Length\n";
+        assert(rejection("POST /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n0\r\n\r\n") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n") == bad_request_response);
+    }
+
+    {
+        std::cout << "Test 4: duplicate, conflicting and invalid Content-Length\n";
+        assert(rejection("POST /a HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\n\r\nabc") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\nabcd") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nContent-Length: 3, 3\r\n\r\nabc") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nContent-Length: abc\r\n\r\n") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nContent-Length: -1\r\n\r\n") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nContent-Length: +3\r\n\r\nabc") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nContent-Length:\r\n\r\n") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n") == content_too_large_response);
+    }
+
+    {
+        std::cout << "Test 5: transfer codings\n";
+        assert(rejection("POST /a HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n") == not_implemented_response);
+        assert(rejection("POST /a HTTP/1.1\r\nTransfer-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n") ==
+               not_implemented_response);
+        assert(rejection("POST /a HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nTransfer-Encoding: chunked, chunked\r\n\r\n") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.0\r\nTransfer-Encoding: chunked\r\n\r\n") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nTransfer-Encoding: Chunked\r\n\r\n").empty());
+    }
+
+    {
+        std::cout << "Test 6: field names another parser could read differently\n";
+        assert(rejection("POST /a HTTP/1.1\r\nTransfer-Encoding : chunked\r\n\r\n") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nX: a\r\n Transfer-Encoding: chunked\r\n\r\n") == bad_request_response);
+        assert(rejection("POST /a HTTP/1.1\r\nno colon\r\n\r\n") == bad_request_response);
+        assert(rejection("GET / HTTP/1.1\r\nHost: x\r\nAccept: */*\r\n\r\n").empty());
+    }
+
+    {
+        std::cout << "Test 7: malformed chunks\n";
+        std::string body, rest;
+        assert(decode("POST /a HTTP/1.1\r\n\r\nzz\r\n", 4, 1024, body, rest) == ChunkedDecoder::Result::INVALID);
+        assert(decode("POST /a HTTP/1.1\r\n\r\n3 x\r\nabc\r\n", 4, 1024, body, rest) == ChunkedDecoder::Result::INVALID);
+        assert(decode("POST /a HTTP/1.1\r\n\r\n3\r\nabcX\r\n", 4, 1024, body, rest) == ChunkedDecoder::Result::INVALID);
+        assert(decode("POST /a HTTP/1.1\r\n\r\n-3\r\nabc\r\n", 4, 1024, body, rest) == ChunkedDecoder::Result::INVALID);
+        assert(decode("POST /a HTTP/1.1\r\n\r\n3\r\nab", 4, 1024, body, rest) == ChunkedDecoder::Result::INCOMPLETE);
+        assert(decode("POST /a HTTP/1.1\r\n\r\nffffffffffffffffff\r\n", 4, 1024, body, rest) == ChunkedDecoder::Result::TOO_LARGE);
+    }
+
+    {
+        std::cout << "Test 8: chunked upload over the limit\n";
+        std::string raw = "POST /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+        for (int i = 0; i < 8; i++) { raw += "10\r\n" + std::string(16, 'x') + "\r\n"; }
+        raw += "0\r\n\r\n";
+
+        for (size_t chunk_size = 1; chunk_size <= raw.size(); chunk_size++)
+        {
+            std::string body, rest;
+            assert(decode(raw, chunk_size, 127, body, rest) == ChunkedDecoder::Result::TOO_LARGE);
+            // Refused on the size line of the chunk that would cross it, none of that chunk is kept
+            assert(body.size() == 112);
+            assert(decode(raw, chunk_size, 128, body, rest) == ChunkedDecoder::Result::DONE);
+        }
+    }
+
+    std::cout << "All framing tests passed!\n";
+}
+
+int main()
+{
+    run_tests();
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hpack.hpp"
+
+// "8286 84be" style hex from RFC 7541 Appendix C, spaces ignored
+std::string from_hex(std::string_view hex)
+{
+    std::string out;
+    int high = -1;
+    for (char c : hex)
+    {
+        if (c == ' ') { continue; }
+        int nibble = c <= '9' ? c - '0' : c - 'a' + 10;
+        if (high == -1) { high = nibble; }
+        else
+        {
+            out.push_back(static_cast<char>((high << 4) | nibble));
+            high = -1;
+        }
+    }
+    return out;
+}
+
+bool equals(const HeaderList& headers, const std::vector<std::pair<std::string_view, std::string_view>>& expected)
+{
+    if (headers.size() != expected.size()) { return false; }
+    for (size_t i = 0; i < headers.size(); i++)
+    {
+        if (headers[i].name != expected[i].first || headers[i].value != expected[i].second) { return false; }
+    }
+    return true;
+}
+
+HpackDecoder::Result decode(HpackDecoder& decoder, std::string_view hex, HeaderList& headers)
+{
+    headers.clear();
+    return decoder.decode(from_hex(hex), headers);
+}
+
+// The three requests of C.3 and C.4 decode to the same fields, only the string encoding differs
+void check_requests(const char* const blocks[3])
+{
+    HpackDecoder decoder;
+    HeaderList headers;
+
+    assert(decode(decoder, blocks[0], headers) == HpackDecoder::Result::OK);
+    assert(equals(headers,
+                  {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}}));
+
+    assert(decode(decoder, blocks[1], headers) == HpackDecoder::Result::OK);
+    assert(equals(headers, {{":method", "GET"},
+                            {":scheme", "http"},
+                            {":path", "/"},
+                            {":authority", "www.example.com"},
+                            {"cache-control", "no-cache"}}));
+
+    assert(decode(decoder, blocks[2], headers) == HpackDecoder::Result::OK);
+    assert(equals(headers, {{":method", "GET"},
+                            {":scheme", "https"},
+                            {":path", "/index.html"},
+                            {":authority", "www.example.com"},
+                            {"custom-key", "custom-value"}}));
+}
+
+void run_tests()
+{
+    std::cout << "Running HPACK tests...\n";
+
+    {
+        std::cout << "Test 1: RFC 7541 C.3 requests without Huffman coding\n";
+        const char* const blocks[3] = {
+            "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+            "8286 84be 5808 6e6f 2d63 6163 6865",
+            "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+        };
+        check_requests(blocks);
+    }
+
+    {
+        std::cout << "Test 2: RFC 7541 C.4 requests with Huffman coding\n";
+        const char* const blocks[3] = {
+            "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+            "8286 84be 5886 a8eb 1064 9cbf",
+            "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+        };
+        check_requests(blocks);
+    }
+
+    {
+        std::cout << "Test 3: Huffman coding round trip\n";
+        std::string all;
+        for (int c = 0; c < 256; c++) { all.push_back(static_cast<char>(c)); }
+
+        for (std::string_view input : {std::string_view("www.example.com"), std::string_view(all)})
+        {
+            std::string encoded, decoded;
+            huffman::encode(input, encoded);
+            assert(encoded.size() == huffman::encoded_length(input));
+            assert(huffman::decode(encoded, decoded) && decoded == input);
+        }
+
+        std::string encoded;
+        huffman::encode("www.example.com", encoded);
+        assert(encoded == from_hex("f1e3 c2e5 f23a 6ba0 ab90 f4ff"));
+    }
+
+    {
+        std::cout << "Test 4: invalid Huffman padding and EOS\n";
+        std::string out;
+        // "a" is 00011, padded with ones
+        assert(huffman::decode(from_hex("1f"), out) && out == "a");
+        // Padding of zeros instead of the EOS prefix
+        out.clear();
+        assert(!huffman::decode(from_hex("18"), out));
+        // Padding longer than 7 bits
+        out.clear();
+        assert(!huffman::decode(from_hex("1fff"), out));
+        // The 30-bit EOS symbol itself
+        out.clear();
+        assert(!huffman::decode(from_hex("ffff ffff"), out));
+
+        // Inside a header block it's a decoding error
+        HpackDecoder decoder;
+        HeaderList headers;
+        assert(decode(decoder, "0081 1f81 18", headers) == HpackDecoder::Result::INVALID);
+    }
+
+    {
+        std::cout << "Test 5: integer decoding overflow and truncation\n";
+        HpackDecoder decoder;
+        HeaderList headers;
+        // Indexed field with ten continuation bytes, more than fits in 64 bits
+        assert(decode(decoder, "ff ffff ffff ffff ffff ff01", headers) == HpackDecoder::Result::INVALID);
+        // Huge but well-formed index, beyond both tables
+        assert(decode(decoder, "ff ffff ffff 0f", headers) == HpackDecoder::Result::INVALID);
+        // String length running past the end of the block, and a continuation that never ends
+        assert(decode(decoder, "0005 6162 63", headers) == HpackDecoder::Result::INVALID);
+        assert(decode(decoder, "007f ff", headers) == HpackDecoder::Result::INVALID);
+    }
+
+    {
+        std::cout << "Test 6: dynamic table eviction (RFC 7541 C.5, 256 byte table)\n";
+        HpackDecoder decoder;
+        HeaderList headers;
+
+        // Size update to 256, then C.5.1
+        assert(decode(decoder,
+                      "3fe1 01"
+                      "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 "
+                      "3a32 3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+                      headers) == HpackDecoder::Result::OK);
+        assert(equals(headers, {{":status", "302"},
+                                {"cache-control", "private"},
+                                {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+                                {"location", "https://www.example.com"}}));
+
+        // :status 307 pushes :status 302 out, the other three move down one index
+        assert(decode(decoder, "4803 3330 37c1 c0bf", headers) == HpackDecoder::Result::OK);
+        assert(equals(headers, {{":status", "307"},
+                                {"cache-control", "private"},
+                                {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+                                {"location", "https://www.example.com"}}));
+        // Four entries are left, 62 to 65
+        assert(decode(decoder, "c1", headers) == HpackDecoder::Result::OK);
+        assert(decode(decoder, "c2", headers) == HpackDecoder::Result::INVALID);
+    }
+
+    {
+        std::cout << "Test 7: table size updates\n";
+        HpackTable table;
+        table.add("a", std::string(100, 'x'));
+        table.add("b", std::string(100, 'y'));
+        assert(table.get(62)->name == "b" && table.get(63)->name == "a");
+        table.set_max_size(140);
+        assert(table.get(62)->name == "b" && !table.get(63));
+        // An entry bigger than the table empties it
+        table.add("c", std::string(200, 'z'));
+        assert(!table.get(62));
+
+        HpackDecoder decoder;
+        HeaderList headers;
+        decoder.set_max_allowed_size(4096);
+        // 4096 is allowed, 4097 isn't
+        assert(decode(decoder, "3fe1 1f", headers) == HpackDecoder::Result::OK);
+        assert(decode(decoder, "3fe2 1f", headers) == HpackDecoder::Result::INVALID);
+        // Only at the start of a block
+        assert(decode(decoder, "82 20", headers) == HpackDecoder::Result::INVALID);
+        // Shrinking to zero evicts everything
+        assert(decode(decoder, "4001 6101 62", headers) == HpackDecoder::Result::OK);
+        assert(decode(decoder, "be", headers) == HpackDecoder::Result::OK);
+        assert(decode(decoder, "20be", headers) == HpackDecoder::Result::INVALID);
+    }
+
+    {
+        std::cout << "Test 8: header list size limit\n";
+        HpackDecoder decoder;
+        HeaderList headers;
+        decoder.set_max_header_list_size(4 * (1 + 64 + 32));
+
+        // "a" with a 64 byte value is added to the table, then referenced by single bytes
+        std::string literal = "4001 6140" + std::string(128, '6');
+        assert(decode(decoder, literal, headers) == HpackDecoder::Result::OK);
+        assert(decode(decoder, "bebe bebe", headers) == HpackDecoder::Result::OK && headers.size() == 4);
+        assert(decode(decoder, "bebe bebe be", headers) == HpackDecoder::Result::TOO_LARGE);
+
+        // Stops before copying the field that doesn't fit
+        assert(decode(decoder, literal + "bebe bebe", headers) == HpackDecoder::Result::TOO_LARGE);
+        assert(headers.size() == 4);
+    }
+
+    std::cout << "All HPACK tests passed!\n";
+}
+
+int main()
+{
+    run_tests();
+    return 0;
+}
@@ -0,0 +1,258 @@
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http2.hpp"
+#include "output.hpp"
+
+struct Frame
+{
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+    std::string payload;
+};
+
+std::string frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    std::string out;
+    out.push_back(static_cast<char>(payload.size() >> 16));
+    out.push_back(static_cast<char>(payload.size() >> 8));
+    out.push_back(static_cast<char>(payload.size()));
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(flags));
+    for (int shift = 24; shift >= 0; shift -= 8) { out.push_back(static_cast<char>(stream_id >> shift)); }
+    out.append(payload);
+    return out;
+}
+
+uint32_t read_u32(std::string_view bytes)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) { value = (value << 8) | static_cast<unsigned char>(bytes[i]); }
+    return value;
+}
+
+std::vector<Frame> frames(OutputQueue& out)
+{
+    std::string bytes;
+    out.drain_into(bytes);
+
+    std::vector<Frame> result;
+    size_t position = 0;
+    while (bytes.size() - position >= 9)
+    {
+        size_t length = (static_cast<size_t>(static_cast<unsigned char>(bytes[position])) << 16) |
+                        (static_cast<size_t>(static_cast<unsigned char>(bytes[position + 1])) << 8) |
+                        static_cast<unsigned char>(bytes[position + 2]);
+        result.push_back({static_cast<uint8_t>(bytes[position + 3]), static_cast<uint8_t>(bytes[position + 4]),
+                          read_u32(bytes.substr(position + 5)) & 0x7fffffff, bytes.substr(position + 9, length)});
+        position += 9 + length;
+    }
+    return result;
+}
+
+// Error code of the GOAWAY or RST_STREAM for stream_id, -1 when there is none
+int64_t error_code(const std::vector<Frame>& sent, uint8_t type, uint32_t stream_id = 0)
+{
+    for (const auto& frame : sent)
+    {
+        if (frame.type != type || frame.stream_id != stream_id) { continue; }
+        return read_u32(std::string_view(frame.payload).substr(type == 0x7 ? 4 : 0));
+    }
+    return -1;
+}
+
+constexpr uint8_t HEADERS = 0x1, RST_STREAM = 0x3, SETTINGS = 0x4, PING = 0x6, GOAWAY = 0x7, CONTINUATION = 0x9;
+constexpr uint8_t END_STREAM = 0x1, END_HEADERS = 0x4;
+constexpr uint32_t PROTOCOL_ERROR = 0x1, ENHANCE_YOUR_CALM = 0xb;
+
+// GET / on http with :authority x, all from the static table but the authority value
+const std::string get_block = std::string("\x82\x86\x84\x41\x01x", 6);
+
+// A session that answered the preface, dispatched counts the requests that reached the handler
+struct Session
+{
+    OutputQueue out;
+    int dispatched = 0;
+    Http2Session session{out, [this](Request&, Response& response) {
+                             dispatched++;
+                             response = Response::ok("ok");
+                             return std::shared_ptr<const Response>();
+                         }};
+
+    Session()
+    {
+        session.start();
+        assert(receive(std::string(http2_preface) + frame(SETTINGS, 0, 0, "")));
+        frames(out);
+    }
+
+    bool receive(std::string_view bytes, size_t budget = SIZE_MAX)
+    {
+        data.insert(data.end(), bytes.begin(), bytes.end());
+        return session.receive(data, budget);
+    }
+
+    std::vector<char> data;
+};
+
+void run_tests()
+{
+    std::cout << "Running HTTP/2 tests...\n";
+
+    {
+        std::cout << "Test 1: our SETTINGS advertise the header list limit\n";
+        OutputQueue out;
+        Http2Session session(out, [](Request&, Response&) { return std::shared_ptr<const Response>(); });
+        session.start();
+
+        auto sent = frames(out);
+        assert(sent.size() == 1 && sent[0].type == SETTINGS && sent[0].payload.size() % 6 == 0);
+        bool advertised = false;
+        for (size_t i = 0; i < sent[0].payload.size(); i += 6)
+        {
+            auto setting = std::string_view(sent[0].payload).substr(i, 6);
+            if (setting[0] != 0 || setting[1] != 0x6) { continue; }
+            advertised = read_u32(setting.substr(2)) == http2_max_header_list_size;
+        }
+        assert(advertised);
+    }
+
+    {
+        std::cout << "Test 2: a header block split over CONTINUATION frames\n";
+        Session client;
+        assert(client.receive(frame(HEADERS, END_STREAM, 1, get_block.substr(0, 2))));
+        assert(client.receive(frame(CONTINUATION, 0, 1, get_block.substr(2, 2))));
+        assert(client.dispatched == 0);
+        assert(client.receive(frame(CONTINUATION, END_HEADERS, 1, get_block.substr(4))));
+        assert(client.dispatched == 1);
+    }
+
+    {
+        std::cout << "Test 3: other frames interleaved with CONTINUATION\n";
+        std::string headers = frame(HEADERS, END_STREAM, 1, get_block.substr(0, 2));
+        for (const auto& interleaved : {frame(PING, 0, 0, std::string(8, '\0')),
+                                        frame(HEADERS, END_STREAM | END_HEADERS, 3, get_block),
+                                        frame(CONTINUATION, END_HEADERS, 3, get_block.substr(2))})
+        {
+            Session client;
+            assert(!client.receive(headers + interleaved));
+            assert(error_code(frames(client.out), GOAWAY) == PROTOCOL_ERROR);
+            assert(client.dispatched == 0);
+        }
+
+        // CONTINUATION without a header block open
+        Session client;
+        assert(!client.receive(frame(CONTINUATION, END_HEADERS, 1, get_block)));
+        assert(error_code(frames(client.out), GOAWAY) == PROTOCOL_ERROR);
+    }
+
+    {
+        std::cout << "Test 4: header block past its size limit\n";
+        Session client;
+        std::string piece(16 * 1024, '\0');
+        assert(client.receive(frame(HEADERS, END_STREAM, 1, piece)));
+        for (size_t sent = piece.size(); sent + piece.size() <= http2_max_header_block_size; sent += piece.size())
+        {
+            assert(client.receive(frame(CONTINUATION, 0, 1, piece)));
+        }
+        assert(!client.receive(frame(CONTINUATION, END_HEADERS, 1, piece)));
+        assert(error_code(frames(client.out), GOAWAY) == ENHANCE_YOUR_CALM);
+    }
+
+    {
+        std::cout << "Test 5: small header block decoding past MAX_HEADER_LIST_SIZE\n";
+        // One 2KB field added to the dynamic table, then referenced by one byte each
+        std::string field = std::string("\x40\x01" "a" "\x7f\x81\x0f", 6) + std::string(2048, 'v');
+        size_t field_size = 1 + 2048 + 32;
+
+        std::string fits = get_block + field;
+        for (size_t size = field_size * 2; size <= http2_max_header_list_size - 200; size += field_size)
+        {
+            fits += '\xbe';
+        }
+        Session client;
+        assert(client.receive(frame(HEADERS, END_STREAM | END_HEADERS, 1, fits)));
+        assert(client.dispatched == 1);
+
+        Session bomb;
+        std::string block = get_block + field + std::string(http2_max_header_list_size / field_size, '\xbe');
+        assert(block.size() < 16 * 1024);
+        assert(!bomb.receive(frame(HEADERS, END_STREAM | END_HEADERS, 1, block)));
+        assert(error_code(frames(bomb.out), GOAWAY) == ENHANCE_YOUR_CALM);
+        assert(bomb.dispatched == 0);
+    }
+
+    {
+        std::cout << "Test 6: malformed requests are reset, not translated\n";
+        // Literal field without indexing, new name
+        auto literal = [](std::string_view name, std::string_view value) {
+            std::string out = {'\0', static_cast<char>(name.size())};
+            out.append(name);
+            out.push_back(static_cast<char>(value.size()));
+            out.append(value);
+            return out;
+        };
+        std::string method = "\x82", scheme = "\x86", path = "\x84", authority = literal(":authority", "x");
+
+        const std::string malformed[] = {
+            method + scheme + path + authority + literal("x-a", "1\r\nx-injected: 1"),
+            method + scheme + literal(":path", "/ HTTP/1.1\r\nX-Injected: 1\r\n\r\n") + authority,
+            method + scheme + literal(":path", "/a b") + authority,
+            method + scheme + literal(":path", "a") + authority,
+            method + scheme + path + authority + literal("X-A", "1"),
+            method + scheme + path + authority + literal("x a", "1"),
+            method + scheme + path + authority + literal("x-a", std::string_view("a\0b", 3)),
+            method + method + scheme + path + authority,
+            method + scheme + authority + literal("x-a", "1") + path,
+            method + path + authority,
+            method + scheme + path + authority + literal(":foo", "1"),
+        };
+
+        Session client;
+        uint32_t stream_id = 1;
+        for (const auto& block : malformed)
+        {
+            assert(client.receive(frame(HEADERS, END_STREAM | END_HEADERS, stream_id, block)));
+            assert(error_code(frames(client.out), RST_STREAM, stream_id) == PROTOCOL_ERROR);
+            stream_id += 2;
+        }
+        assert(client.dispatched == 0);
+
+        std::string options = literal(":method", "OPTIONS") + scheme + literal(":path", "*") + authority;
+        assert(client.receive(frame(HEADERS, END_STREAM | END_HEADERS, stream_id, options)));
+        assert(client.dispatched == 1);
+    }
+
+    {
+        std::cout << "Test 7: requests past the budget wait in the buffer\n";
+        Session client;
+        std::string requests;
+        for (uint32_t stream_id = 1; stream_id < 40; stream_id += 2)
+        {
+            requests += frame(HEADERS, END_STREAM | END_HEADERS, stream_id, get_block);
+        }
+
+        size_t budget = 16;
+        assert(client.session.receive(client.data, budget) && client.data.empty());
+        client.data.assign(requests.begin(), requests.end());
+        assert(client.session.receive(client.data, budget));
+        assert(client.dispatched == 16 && budget == 0 && !client.data.empty());
+
+        budget = 16;
+        assert(client.session.receive(client.data, budget));
+        assert(client.dispatched == 20 && budget == 12 && client.data.empty());
+    }
+
+    std::cout << "All HTTP/2 tests passed!\n";
+}
+
+int main()
+{
+    run_tests();
+    return 0;
+}
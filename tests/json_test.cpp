@@ -0,0 +1,98 @@
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+template <typename Write> std::string serialize(Write write)
+{
+    std::vector<char> out;
+    {
+        JsonWriter writer(out);
+        write(writer);
+    }
+    return std::string(out.data(), out.size());
+}
+
+// Reference escaping, one byte at a time
+std::string escaped(std::string_view text)
+{
+    std::string result = "\"";
+    for (char c : text)
+    {
+        if (c == '"') { result += "\\\""; }
+        else if (c == '\\') { result += "\\\\"; }
+        else if (c == '\n') { result += "\\n"; }
+        else if (c == '\t') { result += "\\t"; }
+        else if (c == '\x01') { result += "\\u0001"; }
+        else { result += c; }
+    }
+    return result + "\"";
+}
+
+void run_tests()
+{
+    std::cout << "Running JSON writer tests...\n";
+
+    {
+        std::cout << "Test 1: nested containers get their commas\n";
+        auto json = serialize([](JsonWriter& w) {
+            w.begin_object().field("a", 1).key("b").begin_array().value(1).begin_object().end_object().begin_array().end_array();
+            w.value(nullptr).end_array().field("c", false).key("d").begin_object().field("e", "f").end_object().end_object();
+        });
+        assert(json == R"({"a":1,"b":[1,{},[],null],"c":false,"d":{"e":"f"}})");
+    }
+
+    {
+        std::cout << "Test 2: numbers\n";
+        auto json = serialize([](JsonWriter& w) {
+            w.begin_array().value(-42).value(uint64_t(18446744073709551615ull)).value(0.1).value(1e300);
+            w.value(NAN).value(INFINITY).value(int8_t(-128)).end_array();
+        });
+        assert(json == "[-42,18446744073709551615,0.1,1e+300,null,null,-128]");
+    }
+
+    {
+        std::cout << "Test 3: escapes at every offset around the 16 byte blocks\n";
+        for (char special : {'"', '\\', '\n', '\t', '\x01'})
+        {
+            for (size_t length = 0; length < 40; length++)
+            {
+                for (size_t at = 0; at < length; at++)
+                {
+                    std::string text(length, 'x');
+                    text[at] = special;
+                    text[length - 1 - at] = special;
+                    assert(serialize([&](JsonWriter& w) { w.value(text); }) == escaped(text));
+                }
+            }
+        }
+    }
+
+    {
+        std::cout << "Test 4: UTF-8 and DEL pass through\n";
+        assert(serialize([](JsonWriter& w) { w.value("\xC3\xBC\x7f/"); }) == "\"\xC3\xBC\x7f/\"");
+    }
+
+    {
+        std::cout << "Test 5: raw JSON and writing behind existing bytes\n";
+        std::vector<char> out = {'x', ':'};
+        {
+            JsonWriter writer(out);
+            writer.begin_array().raw(R"({"k":[1]})").value("v").end_array();
+            assert(writer.size() == 15);
+        }
+        assert(std::string(out.data(), out.size()) == R"(x:[{"k":[1]},"v"])");
+    }
+
+    std::cout << "All JSON writer tests passed!\n";
+}
+
+int main()
+{
+    run_tests();
+    return 0;
+}
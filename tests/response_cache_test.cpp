@@ -0,0 +1,107 @@
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "response.hpp"
+#include "response_cache.hpp"
+
+void run_tests()
+{
+    std::cout << "Running ResponseCache tests...\n";
+
+    {
+        std::cout << "Test 1: a miss runs the handler once, hits don't\n";
+        ResponseCache cache;
+        int calls = 0;
+        Response uncached;
+        auto produce = [&]() {
+            calls++;
+            return Response::ok("hello");
+        };
+
+        auto first = cache.fetch("k", 60, produce, uncached);
+        auto second = cache.fetch("k", 60, produce, uncached);
+        assert(first && first == second);
+        assert(calls == 1);
+    }
+
+    {
+        std::cout << "Test 2: uncacheable responses come back in uncached\n";
+        ResponseCache cache;
+        int calls = 0;
+        Response uncached;
+        auto produce = [&]() {
+            calls++;
+            return Response::with_status(500, "Internal Server Error");
+        };
+
+        assert(!cache.fetch("k", 60, produce, uncached));
+        assert(uncached.status_code() == 500);
+        assert(!cache.fetch("k", 60, produce, uncached));
+        assert(calls == 2);
+    }
+
+    {
+        std::cout << "Test 3: a throwing handler leaves the key usable\n";
+        ResponseCache cache;
+        Response uncached;
+        bool threw = false;
+        try
+        {
+            cache.fetch("k", 60, []() -> Response { throw std::runtime_error("handler failed"); }, uncached);
+        }
+        catch (const std::runtime_error&)
+        {
+            threw = true;
+        }
+        assert(threw);
+
+        auto response = cache.fetch("k", 60, []() { return Response::ok("recovered"); }, uncached);
+        assert(response && response->content() == "recovered");
+    }
+
+    {
+        std::cout << "Test 4: per-user and no-store responses aren't cached, whatever the header case\n";
+        ResponseCache cache;
+        Response uncached;
+        assert(!cache.fetch("a", 60, []() { return std::move(Response::ok("x").header("set-cookie", "id=1")); }, uncached));
+        assert(!cache.fetch("b", 60, []() { return std::move(Response::ok("x").header("Cache-Control", "private")); },
+                            uncached));
+        assert(!cache.fetch("c", 60,
+                            []() { return std::move(Response::ok("x").header("cache-control", "max-age=0, No-Store")); },
+                            uncached));
+        assert(cache.fetch("d", 60, []() { return std::move(Response::ok("x").header("Cache-Control", "public")); },
+                           uncached));
+    }
+
+    {
+        std::cout << "Test 5: a handler filling its own key is replaced, not duplicated\n";
+        ResponseCache cache(4096);
+        Response uncached;
+        auto inner = [&]() { return Response::ok("inner"); };
+        auto outer = [&]() {
+            cache.fetch("k", 60, inner, uncached);
+            return Response::ok("outer");
+        };
+
+        auto response = cache.fetch("k", 60, outer, uncached);
+        assert(response && response->content() == "outer");
+        assert(cache.fetch("k", 60, inner, uncached) == response);
+
+        // Pushes "k" out again, a stale second LRU node would point eviction at a key that's gone
+        for (int i = 0; i < 200; i++)
+        {
+            assert(cache.fetch("key" + std::to_string(i), 60, inner, uncached));
+        }
+        assert(cache.fetch("k", 60, inner, uncached)->content() == "inner");
+    }
+
+    std::cout << "All ResponseCache tests passed!\n";
+}
+
+int main()
+{
+    run_tests();
+    return 0;
+}
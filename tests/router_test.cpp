@@ -0,0 +1,113 @@
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "request.hpp"
+#include "response.hpp"
+#include "router.hpp"
+
+Response handle(Request& req)
+{
+    (void)req;
+    return Response::ok("ok");
+}
+
+void run_tests()
+{
+    std::cout << "Running Router tests...\n";
+
+    {
+        std::cout << "Test 1: Add and find a static route\n";
+        Router router;
+        router.add_route(Method::GET, "/users", handle);
+        RouteParams params;
+        auto node = router.find_route(Method::GET, "/users", params);
+        assert(node && node->handler);
+        assert(router.find_route(Method::POST, "/users", params) == nullptr);
+    }
+
+    {
+        std::cout << "Test 2: Intermediate nodes don't get a handler\n";
+        Router router;
+        router.add_route(Method::GET, "/users/:id/profile", handle);
+        RouteParams params;
+        assert(router.find_route(Method::GET, "/users/42", params) == nullptr);
+        auto node = router.find_route(Method::GET, "/users/42/profile", params);
+        assert(node && node->handler);
+        assert(params["id"] == "42");
+    }
+
+    {
+        std::cout << "Test 3: Remove a route\n";
+        Router router;
+        router.add_route(Method::GET, "/a", handle);
+        router.add_route(Method::GET, "/b", handle);
+        assert(router.remove_route(Method::GET, "/a"));
+        assert(!router.remove_route(Method::GET, "/a"));
+        RouteParams params;
+        assert(router.find_route(Method::GET, "/a", params) == nullptr);
+        assert(router.find_route(Method::GET, "/b", params) != nullptr);
+    }
+
+    {
+        std::cout << "Test 4: A batch is published once, when it ends\n";
+        Router router;
+        router.add_route(Method::GET, "/old", handle);
+        router.begin_batch();
+        router.add_route(Method::GET, "/a", handle);
+        router.begin_batch();
+        router.add_route(Method::GET, "/b", handle);
+        router.end_batch();
+        assert(router.remove_route(Method::GET, "/old"));
+        RouteParams params;
+        assert(router.find_route(Method::GET, "/a", params) == nullptr);
+        assert(router.find_route(Method::GET, "/old", params) != nullptr);
+        router.end_batch();
+        assert(router.find_route(Method::GET, "/a", params) != nullptr);
+        assert(router.find_route(Method::GET, "/b", params) != nullptr);
+        assert(router.find_route(Method::GET, "/old", params) == nullptr);
+    }
+
+    {
+        std::cout << "Test 5: Updates while readers are looking up routes\n";
+        Router router;
+        router.add_route(Method::GET, "/stable", handle);
+
+        std::atomic<bool> done = false;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 4; i++)
+        {
+            readers.emplace_back([&]() {
+                auto reader = router.register_reader();
+                while (!done.load())
+                {
+                    router.quiescent(reader);
+                    RouteParams params;
+                    auto node = router.find_route(Method::GET, "/stable", params);
+                    assert(node && node->handler);
+                    router.find_route(Method::GET, "/canary", params);
+                }
+                router.unregister_reader(reader);
+            });
+        }
+
+        for (int i = 0; i < 2000; i++)
+        {
+            router.add_route(Method::GET, "/canary", handle);
+            router.remove_route(Method::GET, "/canary");
+        }
+
+        done.store(true);
+        for (auto& reader : readers) { reader.join(); }
+    }
+
+    std::cout << "All tests passed!\n";
+}
+
+int main()
+{
+    run_tests();
+    return 0;
+}